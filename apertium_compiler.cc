@@ -23,16 +23,26 @@
 #include <locale>
 
 #include <compiler.h>
+#include <option_utils.h>
 
 using namespace std;
 
 void showHelp(char *progName) {
   cerr << "USAGE: " << basename(progName)
-       << " [-d debug_file] [-i input_file] [-o output_file] [-h]" << endl;
+       << " [-d debug_file] [-i input_file] [-o output_file] [-s] [-y]"
+       << " [-j threads] [-c cache_file] [-h]" << endl;
   cerr << "Options:" << endl;
   cerr << "-d, --debug:\t\t show debug messages" << endl;
   cerr << "-i, --inputfile:\t input file (stdin by default)" << endl;
   cerr << "-o, --outputfile:\t output file (stdout by default)" << endl;
+  cerr << "-s, --switch:\t\t compile the chooses testing a clip against "
+       << "literals to switch instructions" << endl;
+  cerr << "-y, --symbols:\t\t define the attributes, lists and variables in a "
+       << "symbol section, referenced by index" << endl;
+  cerr << "-j, --jobs:\t\t generate the code of the rules using some threads "
+       << "(0 for one per core)" << endl;
+  cerr << "-c, --cache:\t\t keep the code of the rules and macros in a cache "
+       << "file, to only generate again the ones which changed" << endl;
   cerr << "-h, --help:\t\t show this help" << endl;
 }
 
@@ -62,6 +72,10 @@ int main(int argc, char *argv[]) {
       {"debug", required_argument, 0, 'd' },
       {"inputfile", required_argument, 0, 'i' },
       {"outputfile", required_argument, 0, 'o' },
+      {"switch", no_argument, 0, 's' },
+      {"symbols", no_argument, 0, 'y' },
+      {"jobs", required_argument, 0, 'j' },
+      {"cache", required_argument, 0, 'c' },
       { "help", no_argument, 0, 'h' },
       { 0, 0, 0, 0 }
     };
@@ -76,7 +90,7 @@ int main(int argc, char *argv[]) {
   while (true) {
     int option_index = 0;
 
-    int c = getopt_long(argc, argv, "d:i:o:h", long_options, &option_index);
+    int c = getopt_long(argc, argv, "d:i:o:syj:c:h", long_options, &option_index);
 
     // Detect the end of the options.
     if (c == -1)
@@ -117,6 +131,25 @@ int main(int argc, char *argv[]) {
       }
       break;
     }
+    case 's':
+      compiler.setSwitch(true);
+      break;
+    case 'y':
+      compiler.setSymbols(true);
+      break;
+    case 'j': {
+      unsigned int jobs;
+      if (!OptionUtils::parseNumber(optarg, jobs)) {
+        cerr << "Error: The value of -j must be a non-negative number, not '"
+             << optarg << "'" << endl;
+        return EXIT_FAILURE;
+      }
+      compiler.setJobs(jobs);
+      break;
+    }
+    case 'c':
+      compiler.setCacheFile(optarg);
+      break;
     }
   }
 
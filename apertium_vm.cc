@@ -24,17 +24,50 @@
 
 #include <vm.h>
 #include <vm_exceptions.h>
+#include <option_utils.h>
 
 using namespace std;
 
 void showHelp(char *progName) {
   cerr << "USAGE: " << basename(progName)
-       << " -c code_file [-i input_file] [-o output_file] [-g] [-h]" << endl;
+       << " -c code_file|-l snapshot_file [-i input_file] [-o output_file]"
+       << " [-b binary_file] [-s snapshot_file] [-n shared_object]"
+       << " [-e threads] [-O] [--optimizer-stats] [-I max_size] [-V]"
+       << " [-m size] [--memoize-stats] [--profile json_file]"
+       << " [--opcode-stats json_file] [-g] [-h]" << endl;
   cerr << "Options:" << endl;
   cerr << "  -c, --codefile:\t a [chunker|interchunk|postchunk] compiled "
        << "rules file" << endl;
+  cerr << "  -l, --load-snapshot:\t a snapshot file, used instead of the code "
+       << "file" << endl;
   cerr << "  -i, --inputfile:\t input file (stdin by default)" << endl;
   cerr << "  -o, --outputfile:\t output file (stdout by default)" << endl;
+  cerr << "  -b, --emit-binary:\t write the code file as a binary code file, "
+       << "faster to load, and exit" << endl;
+  cerr << "  -s, --save-snapshot:\t write a snapshot of the vm initialized with "
+       << "the code file, faster to start, and exit" << endl;
+  cerr << "  -n, --emit-native:\t compile the code file to native code in a "
+       << "shared object, used as code file, and exit" << endl;
+  cerr << "  -e, --eager-load:\t load all the rules and macros at startup, "
+       << "using some threads (0 for one per core)" << endl;
+  cerr << "  -O, --optimize:\t optimize the rules and macros of an assembly "
+       << "code file when loading them" << endl;
+  cerr << "  --optimizer-stats:\t optimize and show the instructions removed "
+       << "from the code file" << endl;
+  cerr << "  -I, --inline:\t\t inline the macros with up to max_size "
+       << "instructions into the rules calling them" << endl;
+  cerr << "  -V, --verify:\t\t verify the code when loading it and run it "
+       << "without checking every instruction" << endl;
+  cerr << "  -m, --memoize:\t\t cache up to size outputs of the rules which "
+       << "only depend on their words" << endl;
+  cerr << "  --memoize-stats:\t cache the outputs of the rules and show how "
+       << "many were found in the cache" << endl;
+  cerr << "  --profile:\t\t show the calls, instructions, time and bytes "
+       << "output of every rule and macro, and write them as json to a file"
+       << endl;
+  cerr << "  --opcode-stats:\t write the executions and cycles of every opcode "
+       << "and pair of opcodes as json to a file, if built with OPCODE_STATS=1"
+       << endl;
   cerr << "  -g, --debug:\t\t debug interactively the program code" << endl;
   cerr << "  -h, --help:\t\t show this help" << endl;
 }
@@ -61,11 +94,27 @@ bool testFile(const char *fileName, ios_base::openmode mode) {
  */
 int main(int argc, char *argv[] ) {
   bool codeFileSupplied = false;
+  char *binaryFile = NULL;
+  char *snapshotFile = NULL;
+  char *nativeFile = NULL;
 	static struct option long_options[] =
 		{
 		  {"codefile", required_argument, 0, 'c' },
+		  {"load-snapshot", required_argument, 0, 'l' },
 		  {"inputfile", required_argument, 0, 'i' },
 		  {"outputfile", required_argument, 0, 'o' },
+		  {"emit-binary", required_argument, 0, 'b' },
+		  {"save-snapshot", required_argument, 0, 's' },
+		  {"emit-native", required_argument, 0, 'n' },
+		  {"eager-load", required_argument, 0, 'e' },
+		  {"optimize", no_argument, 0, 'O' },
+		  {"optimizer-stats", no_argument, 0, 'S' },
+		  {"inline", required_argument, 0, 'I' },
+		  {"verify", no_argument, 0, 'V' },
+		  {"memoize", required_argument, 0, 'm' },
+		  {"memoize-stats", no_argument, 0, 'M' },
+		  {"profile", required_argument, 0, 'P' },
+		  {"opcode-stats", required_argument, 0, 'T' },
 		  {"debug", no_argument, 0, 'g' },
 		  {"help", no_argument, 0, 'h' },
 		  { 0, 0, 0, 0 }
@@ -81,7 +130,7 @@ int main(int argc, char *argv[] ) {
   while (true) {
     int option_index = 0;
 
-    int c = getopt_long(argc, argv, "c:i:o:gh", long_options, &option_index);
+    int c = getopt_long(argc, argv, "c:l:i:o:b:s:n:e:OI:Vm:gh", long_options, &option_index);
 
     // Detect the end of the options.
     if (c == -1)
@@ -92,7 +141,8 @@ int main(int argc, char *argv[] ) {
       showHelp(argv[0]);
       return EXIT_FAILURE;
       break;
-    case 'c': {
+    case 'c':
+    case 'l': {
       char *codeFile = optarg;
       if (!testFile(codeFile, ios::in)) {
         cerr << "Error: Can't open code file '" << codeFile << "'" << endl;
@@ -128,6 +178,67 @@ int main(int argc, char *argv[] ) {
       }
       break;
     }
+    case 'b':
+      binaryFile = optarg;
+      break;
+    case 's':
+      snapshotFile = optarg;
+      break;
+    case 'n':
+      nativeFile = optarg;
+      break;
+    case 'e': {
+      unsigned int threads;
+      if (!OptionUtils::parseNumber(optarg, threads)) {
+        cerr << "Error: The value of -e must be a non-negative number, not '"
+             << optarg << "'" << endl;
+        return EXIT_FAILURE;
+      }
+      vm.setEagerLoad(threads);
+      break;
+    }
+    case 'O':
+      vm.setOptimize(false);
+      break;
+    case 'S':
+      vm.setOptimize(true);
+      break;
+    case 'I': {
+      unsigned int maxSize;
+      if (!OptionUtils::parseNumber(optarg, maxSize)) {
+        cerr << "Error: The value of -I must be a non-negative number, not '"
+             << optarg << "'" << endl;
+        return EXIT_FAILURE;
+      }
+      vm.setInline(maxSize);
+      break;
+    }
+    case 'V':
+      vm.setVerify();
+      break;
+    case 'm': {
+      unsigned int size;
+      if (!OptionUtils::parseNumber(optarg, size) || size == 0) {
+        cerr << "Error: The value of -m must be a positive number, not '"
+             << optarg << "'" << endl;
+        return EXIT_FAILURE;
+      }
+      vm.setRuleCache(size, false);
+      break;
+    }
+    case 'M':
+      vm.setRuleCache(0, true);
+      break;
+    case 'P':
+      vm.setProfile(optarg);
+      break;
+    case 'T':
+      if (!vm.setOpcodeStats(optarg)) {
+        cerr << "Error: The vm must be built with OPCODE_STATS=1 to gather "
+             << "opcode statistics" << endl;
+        return EXIT_FAILURE;
+      }
+      break;
     case 'g':
       vm.setDebugMode();
       break;
@@ -140,7 +251,16 @@ int main(int argc, char *argv[] ) {
     return EXIT_FAILURE;
   }
 
-  bool error = !vm.run();
+  bool error;
+  if (binaryFile != NULL) {
+    error = !vm.emitBinary(binaryFile);
+  } else if (snapshotFile != NULL) {
+    error = !vm.saveSnapshot(snapshotFile);
+  } else if (nativeFile != NULL) {
+    error = !vm.emitNative(nativeFile);
+  } else {
+    error = !vm.run();
+  }
   loc.~locale();
 
   if (error) {
@@ -0,0 +1,678 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <filesystem>
+#include <new>
+#include <getopt.h>
+#include <libgen.h>
+#include <locale>
+
+#include <vm.h>
+#include <assembly_loader.h>
+#include <vm_exceptions.h>
+
+using namespace std;
+
+/// Number of memory allocations since the program started.
+static unsigned long numAllocations = 0;
+
+void* operator new(size_t size) {
+  numAllocations++;
+  void *p = malloc(size > 0 ? size : 1);
+  if (p == NULL) {
+    throw bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+  free(p);
+}
+
+/// Minimum time spent running a benchmark before measuring it.
+const double WARMUP_SECONDS = 0.1;
+
+/// Minimum time of a sample, running the benchmark as many times as needed.
+const double MIN_SAMPLE_SECONDS = 0.02;
+
+/// The measure of a benchmark, per operation.
+struct BenchmarkResult {
+  string name;
+  unsigned long opsPerRun;
+  double medianNs;
+  double minNs;
+  double maxNs;
+  double allocations;
+};
+
+/// The input and code of a stage of a language pair.
+struct StageData {
+  string name;
+  TRANSFER_STAGE stage;
+  wstring input;
+  CodeUnit preprocessCode;
+};
+
+/// Sink for the results of the benchmarks, so they aren't optimized away.
+static volatile size_t sink = 0;
+
+void showHelp(char *progName) {
+  cerr << "USAGE: " << basename(progName)
+       << " [-d testfiles_dir] [-t test_name] [-s samples] [-f filter]"
+       << " [-o output_file] [-h]" << endl;
+  cerr << "Options:" << endl;
+  cerr << "  -d, --testfiles:\t the directory of the language pairs "
+       << "(new_test/_testfiles by default)" << endl;
+  cerr << "  -t, --test:\t\t the suffix of the tests used as input "
+       << "(_1000 by default)" << endl;
+  cerr << "  -s, --samples:\t number of samples of every benchmark "
+       << "(15 by default)" << endl;
+  cerr << "  -f, --filter:\t\t only run the benchmarks whose name contains "
+       << "filter" << endl;
+  cerr << "  -o, --outputfile:\t write the results as json to a file" << endl;
+  cerr << "  -h, --help:\t\t show this help" << endl;
+}
+
+/**
+ * Get the time elapsed since a time point.
+ *
+ * @param start the time point
+ *
+ * @return the seconds elapsed
+ */
+double getSeconds(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Measure a benchmark. It's run for a while first, which also tells how many
+ * runs a sample needs to last long enough to be measured, and then the time
+ * of each sample is taken. The median of the samples is the result, as it
+ * isn't affected by the occasional slow sample.
+ *
+ * @param name the name of the benchmark
+ * @param opsPerRun the number of operations done by a run
+ * @param numSamples the number of samples
+ * @param run a run of the benchmark
+ *
+ * @return the result of the benchmark
+ */
+BenchmarkResult measure(const string &name, unsigned long opsPerRun,
+    unsigned int numSamples, const function<void()> &run) {
+  unsigned long numRuns = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  do {
+    run();
+    numRuns++;
+  } while (getSeconds(start) < WARMUP_SECONDS);
+
+  double runSeconds = getSeconds(start) / numRuns;
+  unsigned long runsPerSample = max(1.0, MIN_SAMPLE_SECONDS / runSeconds);
+
+  vector<double> samples;
+  unsigned long allocations = 0;
+  for (unsigned int i = 0; i < numSamples; i++) {
+    unsigned long firstAllocation = numAllocations;
+    start = chrono::steady_clock::now();
+    for (unsigned long j = 0; j < runsPerSample; j++) {
+      run();
+    }
+    double seconds = getSeconds(start);
+    allocations += numAllocations - firstAllocation;
+    samples.push_back(1e9 * seconds / (runsPerSample * opsPerRun));
+  }
+  sort(samples.begin(), samples.end());
+
+  BenchmarkResult result;
+  result.name = name;
+  result.opsPerRun = opsPerRun;
+  result.medianNs = (numSamples % 2 ? samples[numSamples / 2]
+      : (samples[numSamples / 2 - 1] + samples[numSamples / 2]) / 2);
+  result.minNs = samples.front();
+  result.maxNs = samples.back();
+  result.allocations = (double) allocations
+      / ((double) numSamples * runsPerSample * opsPerRun);
+
+  return result;
+}
+
+/**
+ * Read a whole text file.
+ *
+ * @param fileName the name of the file
+ *
+ * @return the content of the file
+ */
+wstring readFile(const string &fileName) {
+  wifstream file(fileName.c_str());
+  wstringstream ws;
+  ws << file.rdbuf();
+
+  return ws.str();
+}
+
+/**
+ * Get the transfer stage of a code file from its header.
+ *
+ * @param fileName the name of the code file
+ *
+ * @return the transfer stage
+ */
+TRANSFER_STAGE getTransferStage(const string &fileName) {
+  wifstream file(fileName.c_str());
+  wstring header;
+  getline(file, header);
+  getline(file, header);
+
+  if (header.find(L"#<interchunk") == 0) {
+    return INTERCHUNK;
+  } else if (header.find(L"#<postchunk") == 0) {
+    return POSTCHUNK;
+  }
+  return TRANSFER;
+}
+
+/**
+ * Divide an input in words, depending on the transfer stage.
+ *
+ * @param stage the transfer stage
+ * @param input the input
+ * @param words the words to fill
+ * @param blanks the blanks to fill
+ */
+void tokenize(TRANSFER_STAGE stage, const wstring &input,
+    vector<TransferWord *> &words, vector<wstring> &blanks) {
+  wistringstream stream(input);
+
+  if (stage == TRANSFER) {
+    BilingualWord::tokenizeInput(stream, words, blanks);
+  } else {
+    ChunkWord::tokenizeInput(stream, words, blanks, stage == POSTCHUNK,
+        stage == POSTCHUNK);
+  }
+}
+
+/**
+ * Delete the words created by tokenize.
+ *
+ * @param words the words to delete
+ */
+void deleteWords(vector<TransferWord *> &words) {
+  for (unsigned int i = 0; i < words.size(); i++) {
+    delete words[i];
+  }
+  words.clear();
+}
+
+/**
+ * Get the patterns added to the trie by the preprocess code of a code file,
+ * as their items, with the rule of each one.
+ *
+ * @param preprocessCode the preprocess code
+ * @param patterns the items of every pattern to fill
+ * @param rules the rule of every pattern to fill
+ */
+void getPatterns(const CodeUnit &preprocessCode,
+    vector<vector<wstring> > &patterns, vector<int> &rules) {
+  const vector<Instruction> &code = preprocessCode.code;
+
+  for (unsigned int i = 1; i < code.size(); i++) {
+    if (code[i].opCode != ADDTRIE || code[i - 1].opCode != PUSH) {
+      continue;
+    }
+
+    unsigned int numItems = VMWstringUtils::stringTo<unsigned int>(
+        code[i - 1].op1);
+    if (numItems > i - 1) {
+      continue;
+    }
+
+    vector<wstring> pattern;
+    for (unsigned int j = i - 1 - numItems; j < i - 1; j++) {
+      wstring item = code[j].op1;
+      pattern.push_back(VMWstringUtils::replace(item, L"\"", L""));
+    }
+
+    patterns.push_back(pattern);
+    rules.push_back(VMWstringUtils::stringTo<int>(code[i].op1));
+  }
+}
+
+/**
+ * Get the text of the words matched against the patterns, like the vm does:
+ * the whole source lexical unit in the transfer, the lemma and tags of the
+ * chunk in the interchunk and its lemma in the postchunk, lowering the lemma.
+ *
+ * @param stage the transfer stage
+ * @param words the words of the input
+ *
+ * @return the text of every word
+ */
+vector<wstring> getInputPatterns(TRANSFER_STAGE stage,
+    vector<TransferWord *> &words) {
+  vector<wstring> patterns;
+
+  for (unsigned int i = 0; i < words.size(); i++) {
+    wstring pattern;
+    if (stage == TRANSFER) {
+      pattern = ((BilingualWord *) words[i])->getSource()->getWhole();
+    } else {
+      ChunkLexicalUnit *chunk = ((ChunkWord *) words[i])->getChunk();
+      pattern = wstring(chunk->getPart(LEM));
+      if (stage == INTERCHUNK) {
+        pattern += chunk->getPart(TAGS);
+      }
+    }
+    patterns.push_back(VMWstringUtils::lemmaToLower(pattern));
+  }
+
+  return patterns;
+}
+
+/**
+ * Run the benchmarks of the trie and the tokenizer of a stage.
+ *
+ * @param data the stage
+ * @param numSamples the number of samples of every benchmark
+ * @param filter only the benchmarks whose name contains it are run
+ * @param results the results to fill
+ */
+void benchStage(const StageData &data, unsigned int numSamples,
+    const string &filter, vector<BenchmarkResult> &results) {
+  vector<vector<wstring> > patterns;
+  vector<int> rules;
+  getPatterns(data.preprocessCode, patterns, rules);
+
+  vector<TransferWord *> words;
+  vector<wstring> blanks;
+  tokenize(data.stage, data.input, words, blanks);
+  vector<wstring> inputPatterns = getInputPatterns(data.stage, words);
+  unsigned long numWords = words.size();
+  deleteWords(words);
+
+  // The trie warns about the rules blocked by others every time it's built.
+  wstreambuf *errorBuffer = wcerr.rdbuf(NULL);
+
+  SystemTrie trie;
+  for (unsigned int i = 0; i < patterns.size(); i++) {
+    trie.addPattern(patterns[i], rules[i]);
+  }
+
+  vector<pair<string, function<void()> > > benchmarks;
+  vector<unsigned long> ops;
+
+  // A run builds a whole trie, so it also measures its destruction.
+  benchmarks.push_back(make_pair("trie/addPattern", [&]() {
+    SystemTrie newTrie;
+    for (unsigned int i = 0; i < patterns.size(); i++) {
+      newTrie.addPattern(patterns[i], rules[i]);
+    }
+  }));
+  ops.push_back(patterns.size());
+
+  benchmarks.push_back(make_pair("trie/getPatternNodes", [&]() {
+    for (unsigned int i = 0; i < inputPatterns.size(); i++) {
+      sink += trie.getPatternNodes(inputPatterns[i]).size();
+    }
+  }));
+  ops.push_back(inputPatterns.size());
+
+  benchmarks.push_back(make_pair("trie/getRuleNumber", [&]() {
+    for (unsigned int i = 0; i < inputPatterns.size(); i++) {
+      sink += trie.getRuleNumber(inputPatterns[i]);
+    }
+  }));
+  ops.push_back(inputPatterns.size());
+
+  string tokenizer = (data.stage == TRANSFER ? "BilingualWord::tokenizeInput"
+      : "ChunkWord::tokenizeInput");
+  benchmarks.push_back(make_pair(tokenizer, [&]() {
+    vector<TransferWord *> runWords;
+    vector<wstring> runBlanks;
+    tokenize(data.stage, data.input, runWords, runBlanks);
+    sink += runWords.size();
+    deleteWords(runWords);
+  }));
+  ops.push_back(numWords);
+
+  for (unsigned int i = 0; i < benchmarks.size(); i++) {
+    string name = benchmarks[i].first + " " + data.name;
+    if (name.find(filter) != string::npos && ops[i] > 0) {
+      results.push_back(measure(name, ops[i], numSamples,
+          benchmarks[i].second));
+    }
+  }
+
+  wcerr.rdbuf(errorBuffer);
+  wcerr.clear();
+}
+
+/**
+ * Run the benchmarks of the lexical units and the case functions, with the
+ * lexical units of the input of a transfer stage.
+ *
+ * @param data the stage, a transfer one
+ * @param numSamples the number of samples of every benchmark
+ * @param filter only the benchmarks whose name contains it are run
+ * @param results the results to fill
+ */
+void benchLexicalUnits(const StageData &data, unsigned int numSamples,
+    const string &filter, vector<BenchmarkResult> &results) {
+  vector<TransferWord *> words;
+  vector<wstring> blanks;
+  tokenize(data.stage, data.input, words, blanks);
+
+  vector<wstring> wholes, lemmas;
+  for (unsigned int i = 0; i < words.size(); i++) {
+    BilingualLexicalUnit *lu = ((BilingualWord *) words[i])->getSource();
+    wholes.push_back(lu->getWhole());
+    lemmas.push_back(wstring(lu->getPart(LEM)));
+  }
+  deleteWords(words);
+
+  vector<BilingualLexicalUnit> lus;
+  for (unsigned int i = 0; i < wholes.size(); i++) {
+    lus.push_back(BilingualLexicalUnit(wholes[i]));
+    lus.back().parse();
+  }
+
+  const LU_PART parts[] = { LEM, LEMH, LEMQ, TAGS };
+  const unsigned int numParts = 4;
+
+  vector<pair<string, function<void()> > > benchmarks;
+  vector<unsigned long> ops;
+
+  // A lexical unit is only parsed once, so a run also creates them.
+  benchmarks.push_back(make_pair("BilingualLexicalUnit::parse", [&]() {
+    for (unsigned int i = 0; i < wholes.size(); i++) {
+      BilingualLexicalUnit lu(wholes[i]);
+      lu.parse();
+      sink += lu.getPart(TAGS).size();
+    }
+  }));
+  ops.push_back(wholes.size());
+
+  benchmarks.push_back(make_pair("BilingualLexicalUnit::getPart", [&]() {
+    for (unsigned int i = 0; i < lus.size(); i++) {
+      for (unsigned int j = 0; j < numParts; j++) {
+        sink += lus[i].getPart(parts[j]).size();
+      }
+    }
+  }));
+  ops.push_back(lus.size() * numParts);
+
+  benchmarks.push_back(make_pair("VMWstringUtils::getCase", [&]() {
+    for (unsigned int i = 0; i < lemmas.size(); i++) {
+      sink += VMWstringUtils::getCase(lemmas[i]);
+    }
+  }));
+  ops.push_back(lemmas.size());
+
+  benchmarks.push_back(make_pair("VMWstringUtils::wtolower", [&]() {
+    for (unsigned int i = 0; i < lemmas.size(); i++) {
+      sink += VMWstringUtils::wtolower(lemmas[i]).size();
+    }
+  }));
+  ops.push_back(lemmas.size());
+
+  benchmarks.push_back(make_pair("VMWstringUtils::wtoupper", [&]() {
+    for (unsigned int i = 0; i < lemmas.size(); i++) {
+      sink += VMWstringUtils::wtoupper(lemmas[i]).size();
+    }
+  }));
+  ops.push_back(lemmas.size());
+
+  benchmarks.push_back(make_pair("VMWstringUtils::changeCase", [&]() {
+    for (unsigned int i = 0; i < lemmas.size(); i++) {
+      sink += VMWstringUtils::changeCase(lemmas[i], Aa).size();
+    }
+  }));
+  ops.push_back(lemmas.size());
+
+  benchmarks.push_back(make_pair("VMWstringUtils::lemmaToLower", [&]() {
+    for (unsigned int i = 0; i < wholes.size(); i++) {
+      sink += VMWstringUtils::lemmaToLower(wholes[i]).size();
+    }
+  }));
+  ops.push_back(wholes.size());
+
+  for (unsigned int i = 0; i < benchmarks.size(); i++) {
+    string name = benchmarks[i].first + " " + data.name;
+    if (name.find(filter) != string::npos && ops[i] > 0) {
+      results.push_back(measure(name, ops[i], numSamples,
+          benchmarks[i].second));
+    }
+  }
+}
+
+/**
+ * Load the stages of every language pair with a test of the given name.
+ *
+ * @param testfilesDir the directory of the language pairs
+ * @param testSuffix the suffix of the name of the test used as input
+ *
+ * @return the stages found
+ */
+vector<StageData> loadStages(const string &testfilesDir,
+    const string &testSuffix) {
+  vector<string> pairDirs;
+  for (const filesystem::directory_entry &entry :
+      filesystem::directory_iterator(testfilesDir)) {
+    if (entry.is_directory()) {
+      pairDirs.push_back(entry.path().string());
+    }
+  }
+  sort(pairDirs.begin(), pairDirs.end());
+
+  vector<StageData> stages;
+  for (unsigned int i = 0; i < pairDirs.size(); i++) {
+    string testsDir = pairDirs[i] + "/tests";
+    string testDir;
+    if (filesystem::is_directory(testsDir)) {
+      for (const filesystem::directory_entry &entry :
+          filesystem::directory_iterator(testsDir)) {
+        string name = entry.path().filename().string();
+        if (name.size() >= testSuffix.size() && name.compare(
+            name.size() - testSuffix.size(), testSuffix.size(), testSuffix) == 0) {
+          testDir = entry.path().string();
+        }
+      }
+    }
+    if (testDir.empty()) {
+      cerr << "No test " << testSuffix << " in " << pairDirs[i] << endl;
+      continue;
+    }
+
+    for (unsigned int stage = 1; stage <= 3; stage++) {
+      string stageName = "stage" + to_string(stage);
+      string codeFile = pairDirs[i] + "/code/" + stageName + "/rules.vm";
+      string inputFile = testDir + "/" + stageName + "/pretransfer";
+      if (!filesystem::exists(codeFile) || !filesystem::exists(inputFile)) {
+        continue;
+      }
+
+      StageData data;
+      data.name = filesystem::path(pairDirs[i]).filename().string() + "/"
+          + stageName;
+      data.stage = getTransferStage(codeFile);
+      data.input = readFile(inputFile);
+
+      CodeUnit code;
+      CodeSection rulesCode, macrosCode;
+      unsigned int endAddress;
+      AssemblyLoader loader(&codeFile[0]);
+      loader.load(data.preprocessCode, code, rulesCode, macrosCode,
+          endAddress);
+
+      stages.push_back(data);
+    }
+  }
+
+  return stages;
+}
+
+/**
+ * Write the results of the benchmarks to a JSON file.
+ *
+ * @param fileName the name of the file
+ * @param results the results
+ *
+ * @return true if the file was written, false otherwise
+ */
+bool writeResults(const char *fileName,
+    const vector<BenchmarkResult> &results) {
+  ofstream file(fileName);
+  if (!file.good()) {
+    return false;
+  }
+
+  file << fixed << setprecision(3);
+  file << "{" << endl << "  \"results\": [";
+  for (unsigned int i = 0; i < results.size(); i++) {
+    const BenchmarkResult &result = results[i];
+    file << (i > 0 ? "," : "") << endl << "    {\"name\": \"" << result.name
+         << "\", \"ops_per_run\": " << result.opsPerRun
+         << ", \"median_ns_per_op\": " << result.medianNs
+         << ", \"min_ns_per_op\": " << result.minNs
+         << ", \"max_ns_per_op\": " << result.maxNs
+         << ", \"allocations_per_op\": " << result.allocations << "}";
+  }
+  file << endl << "  ]" << endl << "}" << endl;
+  file.close();
+
+  return !file.fail();
+}
+
+/**
+ * The main program which runs the micro-benchmarks of the vm components.
+ */
+int main(int argc, char *argv[]) {
+  string testfilesDir = "new_test/_testfiles";
+  string testSuffix = "_1000";
+  unsigned int numSamples = 15;
+  string filter = "";
+  char *outputFile = NULL;
+  static struct option long_options[] =
+    {
+      {"testfiles", required_argument, 0, 'd' },
+      {"test", required_argument, 0, 't' },
+      {"samples", required_argument, 0, 's' },
+      {"filter", required_argument, 0, 'f' },
+      {"outputfile", required_argument, 0, 'o' },
+      {"help", no_argument, 0, 'h' },
+      { 0, 0, 0, 0 }
+    };
+
+  // Set the C++ global locale as the one in current use by the user.
+  locale loc = locale("");
+  locale::global(loc);
+
+  while (true) {
+    int option_index = 0;
+
+    int c = getopt_long(argc, argv, "d:t:s:f:o:h", long_options, &option_index);
+
+    // Detect the end of the options.
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'd':
+      testfilesDir = optarg;
+      break;
+    case 't':
+      testSuffix = optarg;
+      break;
+    case 's':
+      numSamples = max(1, atoi(optarg));
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    case 'o':
+      outputFile = optarg;
+      break;
+    case 'h':
+    default:
+      showHelp(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  vector<StageData> stages;
+  try {
+    stages = loadStages(testfilesDir, testSuffix);
+  } catch (filesystem::filesystem_error &e) {
+    cerr << "Error: " << e.what() << endl;
+    return EXIT_FAILURE;
+  } catch (VmException &e) {
+    wcerr << L"Error: " << e.getMessage() << endl;
+    return EXIT_FAILURE;
+  }
+
+  cout << left << setw(48) << "benchmark" << right << setw(14) << "median ns/op"
+       << setw(12) << "min ns/op" << setw(12) << "max ns/op"
+       << setw(12) << "allocs/op" << endl;
+
+  vector<BenchmarkResult> results;
+  for (unsigned int i = 0; i < stages.size(); i++) {
+    unsigned int first = results.size();
+    benchStage(stages[i], numSamples, filter, results);
+    if (stages[i].stage == TRANSFER) {
+      benchLexicalUnits(stages[i], numSamples, filter, results);
+    }
+
+    for (unsigned int j = first; j < results.size(); j++) {
+      cout << left << setw(48) << results[j].name << right << fixed
+           << setprecision(1) << setw(14) << results[j].medianNs
+           << setw(12) << results[j].minNs << setw(12) << results[j].maxNs
+           << setprecision(3) << setw(12) << results[j].allocations << endl;
+    }
+  }
+
+  if (outputFile != NULL && !writeResults(outputFile, results)) {
+    cerr << "Error: Can't write the results to '" << outputFile << "'"
+         << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -21,8 +21,57 @@ for arg in `ls $output` ; do
     echo "-" $arg "-- Error"
     #cat test_results.log
     fi
+
+  # The rules generated in parallel must give exactly the same code.
+  ./apertium-compile-transfer -j 4 -i $inputarg -d compiler.log > compiler.out
+  if diff compiler.out $output$arg > test_results.log ; then
+    echo "+ jobs-"$arg "-- OK"
+  else
+    echo "- jobs-"$arg "-- Error"
+  fi
+
+  # The code of the rules reused from the cache must be the same too.
+  rm -f compiler.cache
+  ./apertium-compile-transfer -c compiler.cache -i $inputarg -d compiler.log \
+    > /dev/null 2> /dev/null
+  ./apertium-compile-transfer -c compiler.cache -i $inputarg -d compiler.log \
+    > compiler.out 2> /dev/null
+  if diff compiler.out $output$arg > test_results.log ; then
+    echo "+ cache-"$arg "-- OK"
+  else
+    echo "- cache-"$arg "-- Error"
+  fi
+
+  # A unit stored with another key, e.g. one sharing its hash, isn't reused.
+  sed -i 's/<def-macro /<def-macrO /; s/<rule /<rulE /' compiler.cache
+  ./apertium-compile-transfer -c compiler.cache -i $inputarg -d compiler.log \
+    > compiler.out 2> /dev/null
+  if diff compiler.out $output$arg > test_results.log ; then
+    echo "+ cache-key-"$arg "-- OK"
+  else
+    echo "- cache-key-"$arg "-- Error"
+  fi
+done
+
+# A failed compilation, by a syntax error or an undefined macro, must leave
+# the output empty.
+result=OK
+head -c 3000 ${input}apertium-en-ca.en-ca.t1x > compiler.t1x
+sed '0,/call-macro n="/s/call-macro n="/call-macro n="undefined_/' \
+  ${input}apertium-en-ca.en-ca.t1x > compiler-macro.t1x
+for file in compiler.t1x compiler-macro.t1x; do
+  ./apertium-compile-transfer -i $file > compiler.out 2> /dev/null
+  if [ $? -ne 1 ] || [ -s compiler.out ] ; then
+    result=Error
+  fi
 done
+if [ $result = OK ] ; then
+  echo "+ failed-compilation -- OK"
+else
+  echo "- failed-compilation -- Error"
+fi
 
 echo "============================================"
 
-rm -f compiler.log compiler.out test_results.log
+rm -f compiler.log compiler.out compiler.cache test_results.log compiler.t1x \
+  compiler-macro.t1x
@@ -45,7 +45,228 @@ name=escape-sme-nob
     #cat test_results.log
     fi
 
+#Test the case of the chunk pseudolemma applied to multiwords in the content.
+name=multiword-case-en-ca
+./apertium-xfervm -c $code/apertium-en-ca.en-ca.v3x -i test/input/postchunk/$name 2> test_warnings.log > vm.out
+  if diff vm.out $indoutput/$name > test_results.log ; then
+    echo "+" $name "-- OK"
+  else
+    echo "-" $name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test a rule and a macro call with more words than the ones stored inline.
+name=long_rule
+./apertium-xfervm -c $code/test_rules_long.v1x -i test/input/chunker/$name 2> test_warnings.log > vm.out
+  if diff vm.out $indoutput/$name > test_results.log ; then
+    echo "+" $name "-- OK"
+  else
+    echo "-" $name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test the optimizer with a cycle of jumps, which must end and keep the output.
+name=jump_cycle
+timeout 60 ./apertium-xfervm -O -c test/input/optimizer/$name.v1x \
+  -i test/input/optimizer/$name 2> test_warnings.log > vm.out
+  if diff vm.out $indoutput/$name > test_results.log ; then
+    echo "+" $name "-- OK"
+  else
+    echo "-" $name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test a postchunk rule clipping a position of the chunk, which must fail with
+#an error if the chunk doesn't have a lexical unit there, even verified.
+name=postchunk_position
+./apertium-xfervm -c $code/test_$name.v3x -i test/input/postchunk/$name 2> test_warnings.log > vm.out
+result=OK
+diff vm.out $indoutput/$name > test_results.log || result=Error
+for option in "" "-V"; do
+  echo '^nom<SN><m><sg>{^casa<n><f><sg>$ ^gran<adj>$}$' |\
+    ./apertium-xfervm $option -c $code/test_$name.v3x > vm.out 2> test_warnings.log
+  if [ $? -ne 1 ] || ! grep -q "lexical units of the chunk" test_warnings.log ; then
+    result=Error
+  fi
+done
+  if [ $result = OK ] ; then
+    echo "+" $name "-- OK"
+  else
+    echo "-" $name "-- Error"
+    fi
+
+#Test the binary code files, which should give the same output as the assembly.
+name=bbc_spain_profile
+for stage in 1 2 3; do
+  ./apertium-xfervm -c $code/apertium-en-ca.en-ca.v${stage}x -b code.v${stage}b 2> test_warnings.log
+done
+cat $input$name.txt |\
+  ./apertium-xfervm -c code.v1b 2> test_warnings.log |\
+  ./apertium-xfervm -c code.v2b 2> test_warnings.log |\
+  ./apertium-xfervm -c code.v3b > vm.out 2> test_warnings.log
+  if diff vm.out $output$name > test_results.log ; then
+    echo "+" binary-$name "-- OK"
+  else
+    echo "-" binary-$name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test the snapshots of the initialized vm, which should give the same output.
+for stage in 1 2 3; do
+  ./apertium-xfervm -c $code/apertium-en-ca.en-ca.v${stage}x -s code.v${stage}s 2> test_warnings.log
+done
+cat $input$name.txt |\
+  ./apertium-xfervm -l code.v1s 2> test_warnings.log |\
+  ./apertium-xfervm -l code.v2s 2> test_warnings.log |\
+  ./apertium-xfervm -l code.v3s > vm.out 2> test_warnings.log
+  if diff vm.out $output$name > test_results.log ; then
+    echo "+" snapshot-$name "-- OK"
+  else
+    echo "-" snapshot-$name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test truncated binary files and snapshots, which should fail with an error.
+result=OK
+for size in 200 2000 60000; do
+  for file in code.v1b code.v1s; do
+    head -c $size $file > code.vt
+    ./apertium-xfervm -c code.vt < /dev/null > vm.out 2> test_warnings.log
+    if [ $? -ne 1 ] || ! grep -q "Loader error" test_warnings.log ; then
+      result=Error
+    fi
+  done
+done
+  if [ $result = OK ] ; then
+    echo "+" truncated-$name "-- OK"
+  else
+    echo "-" truncated-$name "-- Error"
+    fi
+
+#Test the numeric options with invalid values, which should fail with an error.
+result=OK
+for option in "-e -1" "-I x" "-m 10k" "-m 0" "-e 99999999999"; do
+  ./apertium-xfervm $option -c $code/apertium-en-ca.en-ca.v1x < /dev/null \
+    > vm.out 2> test_warnings.log
+  if [ $? -ne 1 ] || ! grep -q "Error: The value of" test_warnings.log ; then
+    result=Error
+  fi
+done
+  if [ $result = OK ] ; then
+    echo "+" invalid-options-$name "-- OK"
+  else
+    echo "-" invalid-options-$name "-- Error"
+    fi
+
+#Test the optimized code, which should give the same output.
+cat $input$name.txt |\
+  ./apertium-xfervm -O -c $code/apertium-en-ca.en-ca.v1x 2> test_warnings.log |\
+  ./apertium-xfervm -O -c $code/apertium-en-ca.en-ca.v2x 2> test_warnings.log |\
+  ./apertium-xfervm -O -c $code/apertium-en-ca.en-ca.v3x > vm.out 2> test_warnings.log
+  if diff vm.out $output$name > test_results.log ; then
+    echo "+" optimized-$name "-- OK"
+  else
+    echo "-" optimized-$name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test the code with its small macros inlined, which should give the same output.
+cat $input$name.txt |\
+  ./apertium-xfervm -I 50 -c $code/apertium-en-ca.en-ca.v1x 2> test_warnings.log |\
+  ./apertium-xfervm -I 50 -c $code/apertium-en-ca.en-ca.v2x 2> test_warnings.log |\
+  ./apertium-xfervm -I 50 -c $code/apertium-en-ca.en-ca.v3x > vm.out 2> test_warnings.log
+  if diff vm.out $output$name > test_results.log ; then
+    echo "+" inlined-$name "-- OK"
+  else
+    echo "-" inlined-$name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test the verified code, which should give the same output.
+cat $input$name.txt |\
+  ./apertium-xfervm -V -c $code/apertium-en-ca.en-ca.v1x 2> test_warnings.log |\
+  ./apertium-xfervm -V -c $code/apertium-en-ca.en-ca.v2x 2> test_warnings.log |\
+  ./apertium-xfervm -V -c $code/apertium-en-ca.en-ca.v3x > vm.out 2> test_warnings.log
+  if diff vm.out $output$name > test_results.log ; then
+    echo "+" verified-$name "-- OK"
+  else
+    echo "-" verified-$name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test the code caching the output of the rules, which should give the same output.
+cat $input$name.txt |\
+  ./apertium-xfervm -m 1000 -c $code/apertium-en-ca.en-ca.v1x 2> test_warnings.log |\
+  ./apertium-xfervm -m 1000 -c $code/apertium-en-ca.en-ca.v2x 2> test_warnings.log |\
+  ./apertium-xfervm -m 1000 -c $code/apertium-en-ca.en-ca.v3x > vm.out 2> test_warnings.log
+  if diff vm.out $output$name > test_results.log ; then
+    echo "+" memoized-$name "-- OK"
+  else
+    echo "-" memoized-$name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test the profiled code, which should give the same output and profile every rule.
+cat $input$name.txt |\
+  ./apertium-xfervm --profile profile.v1 -c $code/apertium-en-ca.en-ca.v1x 2> test_warnings.log |\
+  ./apertium-xfervm --profile profile.v2 -c $code/apertium-en-ca.en-ca.v2x 2> test_warnings.log |\
+  ./apertium-xfervm --profile profile.v3 -c $code/apertium-en-ca.en-ca.v3x > vm.out 2> test_warnings.log
+  if diff vm.out $output$name > test_results.log && grep -q '"type": "rule"' profile.v3 ; then
+    echo "+" profiled-$name "-- OK"
+  else
+    echo "-" profiled-$name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test the code compiled with switch instructions, which should give the same output.
+for stage in 1 2 3; do
+  ./apertium-compile-transfer -s -i test/data/apertium-en-ca.en-ca.t${stage}x > code.v${stage}w 2> test_warnings.log
+done
+cat $input$name.txt |\
+  ./apertium-xfervm -c ./code.v1w 2> test_warnings.log |\
+  ./apertium-xfervm -c ./code.v2w 2> test_warnings.log |\
+  ./apertium-xfervm -c ./code.v3w > vm.out 2> test_warnings.log
+  if diff vm.out $output$name > test_results.log ; then
+    echo "+" switch-$name "-- OK"
+  else
+    echo "-" switch-$name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test the code compiled with a symbol section, which should give the same output.
+for stage in 1 2 3; do
+  ./apertium-compile-transfer -y -i test/data/apertium-en-ca.en-ca.t${stage}x > code.v${stage}y 2> test_warnings.log
+done
+cat $input$name.txt |\
+  ./apertium-xfervm -c ./code.v1y 2> test_warnings.log |\
+  ./apertium-xfervm -c ./code.v2y 2> test_warnings.log |\
+  ./apertium-xfervm -c ./code.v3y > vm.out 2> test_warnings.log
+  if diff vm.out $output$name > test_results.log ; then
+    echo "+" symbols-$name "-- OK"
+  else
+    echo "-" symbols-$name "-- Error"
+    #cat test_results.log
+    fi
+
+#Test the code compiled to native code, which should give the same output.
+for stage in 1 2 3; do
+  ./apertium-xfervm -c $code/apertium-en-ca.en-ca.v${stage}x -n ./code.v${stage}n.so 2> test_warnings.log
+done
+cat $input$name.txt |\
+  ./apertium-xfervm -c ./code.v1n.so 2> test_warnings.log |\
+  ./apertium-xfervm -c ./code.v2n.so 2> test_warnings.log |\
+  ./apertium-xfervm -c ./code.v3n.so > vm.out 2> test_warnings.log
+  if diff vm.out $output$name > test_results.log ; then
+    echo "+" native-$name "-- OK"
+  else
+    echo "-" native-$name "-- Error"
+    #cat test_results.log
+    fi
+
 echo "============================================"
 echo ""
 
+rm -f code.v1b code.v2b code.v3b code.v1s code.v2s code.v3s code.vt
+rm -f code.v1n.so code.v2n.so code.v3n.so code.v1w code.v2w code.v3w
+rm -f code.v1y code.v2y code.v3y profile.v1 profile.v2 profile.v3
 rm -f vm.out test_results.log test_warnings.log
@@ -0,0 +1,49 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "option_utils.h"
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+
+/**
+ * Parse the value of an option as a non-negative number, rejecting the values
+ * strtoul would accept with a sign or followed by other characters.
+ *
+ * @param text the value of the option
+ * @param number the number parsed, if it's valid
+ *
+ * @return true if the value is a number which fits an unsigned int, false in
+ * other case
+ */
+bool OptionUtils::parseNumber(const char *text, unsigned int &number) {
+  if (!isdigit((unsigned char) text[0])) {
+    return false;
+  }
+
+  char *end;
+  errno = 0;
+  unsigned long value = strtoul(text, &end, 10);
+  if (errno != 0 || *end != '\0' || value > UINT_MAX) {
+    return false;
+  }
+
+  number = value;
+  return true;
+}
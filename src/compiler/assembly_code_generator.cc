@@ -18,16 +18,32 @@
 #include <assembly_code_generator.h>
 
 #include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cwctype>
 
 #include <compiler_exception.h>
 #include <wstring_utils.h>
 
 AssemblyCodeGenerator::AssemblyCodeGenerator() {
+  headFile = NULL;
+  rulesFile = NULL;
+  inRulesSection = false;
+  forked = false;
+  openChooses = 0;
   nextAddress = 0;
   nextLabel[RULE] = 0;
   nextLabel[WHEN] = 0;
   nextLabel[CHOOSE] = 0;
+  firstLabel[RULE] = 0;
+  firstLabel[WHEN] = 0;
+  firstLabel[CHOOSE] = 0;
   jumpToRulesSection = false;
+  useSwitch = false;
+  useSymbols = false;
+  numSymbols[ATTR_SYMBOL] = 0;
+  numSymbols[LIST_SYMBOL] = 0;
+  numSymbols[VAR_SYMBOL] = 0;
 }
 
 AssemblyCodeGenerator::AssemblyCodeGenerator(const AssemblyCodeGenerator &c) {
@@ -35,7 +51,15 @@ AssemblyCodeGenerator::AssemblyCodeGenerator(const AssemblyCodeGenerator &c) {
 }
 
 AssemblyCodeGenerator::~AssemblyCodeGenerator() {
+  if (headFile != NULL) {
+    fclose(headFile);
+    headFile = NULL;
+  }
 
+  if (rulesFile != NULL) {
+    fclose(rulesFile);
+    rulesFile = NULL;
+  }
 }
 
 AssemblyCodeGenerator&
@@ -48,12 +72,28 @@ AssemblyCodeGenerator::operator=(const AssemblyCodeGenerator &c) {
 }
 
 void AssemblyCodeGenerator::copy(const AssemblyCodeGenerator &c) {
+  // The code written so far belongs to the original generator.
+  this->headFile = NULL;
+  this->rulesFile = NULL;
+  this->inRulesSection = c.inRulesSection;
+  this->forked = c.forked;
+  this->openChooses = c.openChooses;
   this->nextAddress = c.nextAddress;
+  for (unsigned int i = RULE; i <= CHOOSE; i++) {
+    this->nextLabel[i] = c.nextLabel[i];
+    this->firstLabel[i] = c.firstLabel[i];
+  }
   this->code = c.code;
   this->patternsCode = c.patternsCode;
-  this->patternSection = c.patternSection;
   this->debug = c.debug;
   this->jumpToRulesSection = c.jumpToRulesSection;
+  this->useSwitch = c.useSwitch;
+  this->useSymbols = c.useSymbols;
+  this->symbols = c.symbols;
+  for (unsigned int i = ATTR_SYMBOL; i <= VAR_SYMBOL; i++) {
+    this->numSymbols[i] = c.numSymbols[i];
+  }
+  this->symbolRefs = c.symbolRefs;
 }
 
 /**
@@ -66,13 +106,42 @@ void AssemblyCodeGenerator::setDebug(bool mode) {
 }
 
 /**
- * Add the generated assembly code, modifying the next available address.
+ * Set the compilation of the chooses which test a clip against literals to
+ * switch instructions on or off.
+ *
+ * @param mode true to use switch instructions, false in other case.
+ */
+void AssemblyCodeGenerator::setSwitch(bool mode) {
+  useSwitch = mode;
+}
+
+/**
+ * Set the symbol section on or off. With it, the attributes, lists and
+ * variables are defined once at the start of the code and the instructions
+ * reference them by their index, e.g. "push @attr_3" instead of repeating all
+ * the tags of the attribute.
+ *
+ * @param mode true to generate the symbol section, false in other case.
+ */
+void AssemblyCodeGenerator::setSymbols(bool mode) {
+  useSymbols = mode;
+}
+
+/**
+ * Add the generated assembly code, modifying the next available address. The
+ * code is written right away, except the code of the chooses which could
+ * become switches, kept until the outermost choose ends, and the code of a
+ * forked generator, kept until it's joined.
  *
  * @param code the assembly code to add
  */
 void AssemblyCodeGenerator::addCode(const wstring &code) {
   this->code.push_back(code);
   nextAddress++;
+
+  if (openChooses == 0 && !forked) {
+    writeCode();
+  }
 }
 
 /**
@@ -92,26 +161,397 @@ void AssemblyCodeGenerator::addPatternsCode(const wstring &code) {
 }
 
 /**
- * Returns a writable representation of the assembly code.
+ * Add the header and footer of the patterns section, the first time only.
+ */
+void AssemblyCodeGenerator::addPatternsSection() {
+  if (patternsCode.size() == 0) {
+    patternsCode.push_back(L"patterns_start:");
+    patternsCode.push_back(L"patterns_end:");
+  }
+}
+
+/**
+ * Write the code added and not written yet to a temporary file. The patterns
+ * section goes before the rules but is only complete after the last rule, so
+ * the code before the rules section and the code of the rules section are kept
+ * apart until then. Nothing reaches the output before the compilation ends, so
+ * a failed one doesn't leave part of the code in it.
+ */
+void AssemblyCodeGenerator::writeCode() {
+  if (!inRulesSection && headFile == NULL && code.size() > 0) {
+    headFile = tmpfile();
+    if (headFile == NULL) {
+      throw CompilerException(L"Can't create a temporary file for the code.");
+    }
+  }
+
+  // The temporary files keep the characters as they are, with no encoding.
+  const wchar_t newLine = L'\n';
+  FILE *file = (inRulesSection ? rulesFile : headFile);
+
+  for (unsigned int i = 0; i < code.size(); i++) {
+    wstring line = getSymbolicCode(code[i]);
+    fwrite(line.data(), sizeof(wchar_t), line.size(), file);
+    fwrite(&newLine, sizeof(wchar_t), 1, file);
+  }
+
+  code.clear();
+}
+
+/**
+ * Add a definition to the symbol section, unless the same attribute or list
+ * was already added, and the references which will replace its values.
  *
- * @return the writable representation as a wide string.
+ * @param type the type of the symbol, e.g. ATTR_SYMBOL
+ * @param value the items of the attribute or list, or the name of the variable
+ * @param defaultValue the default value of a variable
  */
-wstring AssemblyCodeGenerator::getWritableCode() const {
-  wstring writableCode = L"";
+void AssemblyCodeGenerator::addSymbol(unsigned int type, const wstring &value,
+    const wstring &defaultValue) {
+  static const wstring names[3] = { L"attr", L"list", L"var" };
+  wstring quotedValue = L"\"" + value + L"\"";
+
+  if (type != VAR_SYMBOL
+      && (value.empty() || symbolRefs.find(quotedValue) != symbolRefs.end())) {
+    return;
+  }
+
+  wstringstream index;
+  index << numSymbols[type]++;
+
+  wstring symbol = L"." + names[type] + INSTR_SEP + index.str() + INSTR_SEP
+      + quotedValue;
+  if (type == VAR_SYMBOL) {
+    symbol += INSTR_SEP + L"\"" + defaultValue + L"\"";
+    addSymbolRef(quotedValue, L"&var_" + index.str());
+    // Numbers are positions, so a variable named like one can't be replaced.
+    if (value.find_first_not_of(L"0123456789") != wstring::npos) {
+      addSymbolRef(value, L"@var_" + index.str());
+    }
+  } else {
+    addSymbolRef(quotedValue, L"@" + names[type] + L"_" + index.str());
+  }
+  symbols.push_back(symbol);
+}
 
-  for (unsigned int i = 0; i < patternSection; i++) {
-    writableCode += code[i] + L"\n";
+/**
+ * Set the reference which replaces an operand of the push instructions, if
+ * there isn't already one. As every reference is loaded as the operand it
+ * replaces, any push of the same value can use it.
+ *
+ * @param operand the operand of the push instruction, e.g. "<sg>|<pl>"
+ * @param ref the reference to the symbol, e.g. @attr_2
+ */
+void AssemblyCodeGenerator::addSymbolRef(const wstring &operand,
+    const wstring &ref) {
+  if (symbolRefs.find(operand) == symbolRefs.end()) {
+    symbolRefs[operand] = ref;
   }
+}
+
+/**
+ * Get a line of code with its operand replaced by a reference to the symbol
+ * section, if there is one for it.
+ *
+ * @param line the line of code
+ *
+ * @return the line which references the symbol or the same line
+ */
+wstring AssemblyCodeGenerator::getSymbolicCode(const wstring &line) const {
+  if (!useSymbols || !WstringUtils::startsWith(line, PUSH_OP + INSTR_SEP)) {
+    return line;
+  }
+
+  map<wstring, wstring>::const_iterator it =
+      symbolRefs.find(line.substr(PUSH_OP.size() + INSTR_SEP.size()));
+  if (it == symbolRefs.end()) {
+    return line;
+  }
+
+  return PUSH_OP + INSTR_SEP + it->second;
+}
+
+/**
+ * End the assembly code, writing the code added and not written yet to its
+ * temporary file.
+ */
+void AssemblyCodeGenerator::endOutput() {
+  writeCode();
+}
+
+/**
+ * Write the assembly code of a compilation which ended: the code before the
+ * rules section, the patterns section and the rules section, copied from their
+ * temporary files.
+ *
+ * @param output the stream to write the code to
+ */
+void AssemblyCodeGenerator::writeOutput(wostream &output) {
+  copyFile(headFile, output);
 
   for (unsigned int i = 0; i < patternsCode.size(); i++) {
-    writableCode += patternsCode[i] + L"\n";
+    output << patternsCode[i] << L'\n';
   }
 
-  for (unsigned int i = patternSection; i < code.size(); i++) {
-    writableCode += code[i] + L"\n";
+  copyFile(rulesFile, output);
+  output.flush();
+}
+
+/**
+ * Copy the code kept in a temporary file to the output with a fixed-size
+ * buffer.
+ *
+ * @param file the temporary file, or NULL if no code was kept in it
+ * @param output the stream to write the code to
+ */
+void AssemblyCodeGenerator::copyFile(FILE *file, wostream &output) const {
+  if (file == NULL) {
+    return;
   }
 
-  return writableCode;
+  wchar_t buffer[BUFFER_SIZE];
+  size_t size;
+
+  rewind(file);
+  while ((size = fread(buffer, sizeof(wchar_t), BUFFER_SIZE, file)) > 0) {
+    output.write(buffer, size);
+  }
+}
+
+/**
+ * Create a generator for the code of a unit, a rule or a macro, which can be
+ * used from another thread. It starts with the labels the unit would get from
+ * this generator, and this generator skips them, so the code is the same as if
+ * the unit was generated here.
+ *
+ * @param unit the event of the rule or macro, with all its children
+ *
+ * @return the new generator, to be joined with joinUnit
+ */
+CodeGenerator* AssemblyCodeGenerator::forkUnit(const Event &unit) {
+  AssemblyCodeGenerator *generator = new AssemblyCodeGenerator();
+  generator->forked = true;
+  generator->debug = debug;
+  generator->useSwitch = useSwitch;
+  for (unsigned int i = RULE; i <= CHOOSE; i++) {
+    generator->nextLabel[i] = nextLabel[i];
+    generator->firstLabel[i] = nextLabel[i];
+  }
+
+  skipLabels(unit);
+
+  return generator;
+}
+
+/**
+ * Create a generator for a unit whose code was already generated, as given by
+ * getUnitCode, so it only needs to be joined.
+ *
+ * @param unit the event of the rule or macro, with all its children
+ * @param unitCode the code of the unit, with its labels starting at 0
+ *
+ * @return the new generator, to be joined with joinUnit, or NULL if the code
+ * isn't valid, in which case no labels are skipped
+ */
+CodeGenerator* AssemblyCodeGenerator::forkUnit(const Event &unit,
+    const vector<wstring> &unitCode) {
+  unsigned int numCodeLines;
+  wstringstream ws(unitCode.empty() ? L"" : unitCode[0]);
+
+  if (!(ws >> numCodeLines) || numCodeLines >= unitCode.size()) {
+    return NULL;
+  }
+
+  AssemblyCodeGenerator *generator =
+      (AssemblyCodeGenerator *) forkUnit(unit);
+  const unsigned int zero[3] = { 0, 0, 0 };
+
+  for (unsigned int i = 1; i < unitCode.size(); i++) {
+    wstring line = relabel(unitCode[i], zero, generator->firstLabel);
+    if (i <= numCodeLines) {
+      generator->code.push_back(line);
+    } else {
+      generator->addPatternsSection();
+      generator->patternsCode.insert(generator->patternsCode.end() - 1, line);
+    }
+  }
+
+  return generator;
+}
+
+/**
+ * Get the code generated by a forked generator, with its labels starting at
+ * 0 so it can be given to forkUnit for a unit which gets other labels.
+ *
+ * @param generator the generator returned by forkUnit
+ *
+ * @return the number of lines of code, the code and the code of the patterns
+ */
+vector<wstring> AssemblyCodeGenerator::getUnitCode(
+    const CodeGenerator *generator) const {
+  const AssemblyCodeGenerator *unit = (const AssemblyCodeGenerator *) generator;
+  const unsigned int zero[3] = { 0, 0, 0 };
+  vector<wstring> unitCode;
+
+  wstringstream ws;
+  ws << unit->code.size();
+  unitCode.push_back(ws.str());
+
+  for (unsigned int i = 0; i < unit->code.size(); i++) {
+    unitCode.push_back(relabel(unit->code[i], unit->firstLabel, zero));
+  }
+
+  // The header and footer of the patterns section aren't part of the unit.
+  for (unsigned int i = 1; i + 1 < unit->patternsCode.size(); i++) {
+    unitCode.push_back(relabel(unit->patternsCode[i], unit->firstLabel, zero));
+  }
+
+  return unitCode;
+}
+
+/**
+ * Add the code of a unit generated by a forked generator, in the same place
+ * it would have been generated by this one, and delete the forked generator.
+ *
+ * @param generator the generator returned by forkUnit
+ */
+void AssemblyCodeGenerator::joinUnit(CodeGenerator *generator) {
+  AssemblyCodeGenerator *unit = (AssemblyCodeGenerator *) generator;
+
+  for (unsigned int i = 0; i < unit->code.size(); i++) {
+    addCode(unit->code[i]);
+  }
+
+  // The patterns of the rule go before the footer, without their own header.
+  if (unit->patternsCode.size() > 0) {
+    addPatternsSection();
+    for (unsigned int i = 1; i < unit->patternsCode.size() - 1; i++) {
+      addPatternsCode(unit->patternsCode[i]);
+    }
+  }
+
+  delete unit;
+}
+
+/**
+ * Skip the labels which would be used by an event and its children.
+ *
+ * @param event the event whose labels are skipped
+ */
+void AssemblyCodeGenerator::skipLabels(const Event &event) {
+  switch (event.getElement()) {
+  case RULE_ELEM:
+    nextLabel[RULE]++;
+    break;
+  case WHEN_ELEM:
+    nextLabel[WHEN]++;
+    break;
+  case CHOOSE_ELEM:
+    nextLabel[CHOOSE]++;
+    break;
+  default:
+    break;
+  }
+
+  for (const Event *child = event.getFirstChild(); child != NULL;
+      child = child->getNextSibling()) {
+    skipLabels(*child);
+  }
+}
+
+/**
+ * Move the numbered labels of a line of code from one start to another, e.g.
+ * "jz when_12_end" to "jz when_2_end" if the whens started at 10 and now at 0.
+ * Only the labels defined and the targets of the jumps are changed, so the
+ * literals and debug comments are kept as they are.
+ *
+ * @param line the line of code
+ * @param from the first label of each type the line uses
+ * @param to the new first label of each type
+ *
+ * @return the line with its labels moved
+ */
+wstring AssemblyCodeGenerator::relabel(const wstring &line,
+    const unsigned int from[3], const unsigned int to[3]) const {
+  if (line.empty() || line[0] == L'#') {
+    return line;
+  }
+
+  size_t opEnd = line.find(INSTR_SEP);
+  if (opEnd == wstring::npos) {
+    if (line[line.size() - 1] == L':') {
+      return relabelTarget(line.substr(0, line.size() - 1), from, to) + L":";
+    }
+    return line;
+  }
+
+  wstring op = line.substr(0, opEnd);
+  if (op != JMP_OP && op != JZ_OP && op != ADDTRIE_OP && op != SWITCH_OP) {
+    return line;
+  }
+
+  // The literals of the switch targets are quoted and have no quotes inside.
+  wstring result = op;
+  size_t pos = opEnd;
+  while (pos < line.size()) {
+    result += line[pos++];
+    if (pos >= line.size()) {
+      break;
+    }
+
+    size_t end;
+    if (line[pos] == L'"') {
+      end = line.find(L'"', pos + 1);
+      end = (end == wstring::npos) ? line.size() : end + 1;
+      result += line.substr(pos, end - pos);
+    } else {
+      end = line.find(INSTR_SEP, pos);
+      end = (end == wstring::npos) ? line.size() : end;
+      result += relabelTarget(line.substr(pos, end - pos), from, to);
+    }
+    pos = end;
+  }
+
+  return result;
+}
+
+/**
+ * Move a label from one start to another, if it's one of the numbered labels
+ * of the rules, whens and chooses.
+ *
+ * @param label the label, e.g. when_12_end
+ * @param from the first label of each type
+ * @param to the new first label of each type
+ *
+ * @return the label moved, or the same label if it isn't numbered
+ */
+wstring AssemblyCodeGenerator::relabelTarget(const wstring &label,
+    const unsigned int from[3], const unsigned int to[3]) const {
+  static const wstring prefixes[3] = { L"action_", L"when_", L"choose_" };
+
+  for (unsigned int type = RULE; type <= CHOOSE; type++) {
+    if (!WstringUtils::startsWith(label, prefixes[type])) {
+      continue;
+    }
+
+    size_t start = prefixes[type].size();
+    size_t end = label.find(L'_', start);
+    if (end == wstring::npos || end == start
+        || label.find_first_not_of(L"0123456789", start) != end) {
+      return label;
+    }
+
+    unsigned int number;
+    wstringstream ws(label.substr(start, end - start));
+    ws >> number;
+
+    wstringstream moved;
+    moved << prefixes[type] << (number - from[type] + to[type])
+        << label.substr(end);
+    return moved.str();
+  }
+
+  return label;
 }
 
 /*
@@ -138,15 +578,15 @@ wstring AssemblyCodeGenerator::getNextLabel(unsigned int element) {
  * @return the opcode of the store instruction to use
  */
 wstring AssemblyCodeGenerator::genStoreInstr(const Event &container) const {
-  wstring name = container.getName();
+  ELEMENT_NAME element = container.getElement();
 
-  if (name == L"var") {
+  if (element == VAR_ELEM) {
     return STOREV_OP;
-  } else if (name == L"clip") {
-    if (!container.hasAttribute(L"side")) {
+  } else if (element == CLIP_ELEM) {
+    if (!container.hasAttribute(SIDE_ATTR)) {
       return STORECL_OP;
     } else {
-      wstring side = container.getAttribute(L"side");
+      wstring side = container.getAttribute(SIDE_ATTR);
       if (side == L"sl") {
         return STORESL_OP;
       } else if (side == L"tl") {
@@ -156,7 +596,7 @@ wstring AssemblyCodeGenerator::genStoreInstr(const Event &container) const {
   }
 
   wstringstream msg(L"Can't find an appropriate store instruction for event: ");
-  msg << name;
+  msg << container.getName();
   throw CompilerException(msg.str());
 }
 
@@ -172,10 +612,10 @@ wstring AssemblyCodeGenerator::genStoreInstr(const Event &container) const {
 wstring AssemblyCodeGenerator::getIgnoreCaseInstr(const Event &event,
     const wstring &instrNotIgnoreCase, const wstring &instrIgnoreCase) {
 
-  if (!event.hasAttribute(L"caseless")) {
+  if (!event.hasAttribute(CASELESS_ATTR)) {
     return instrNotIgnoreCase;
   } else {
-    wstring caseless = event.getAttribute(L"caseless");
+    wstring caseless = event.getAttribute(CASELESS_ATTR);
     if (caseless == L"no")
       return instrNotIgnoreCase;
     else if (caseless == L"yes")
@@ -217,6 +657,10 @@ void AssemblyCodeGenerator::genHeader(const Event &event) {
  */
 void AssemblyCodeGenerator::addJumpToRulesSection() {
   if (!jumpToRulesSection) {
+    // Every symbol is defined before the macros and rules which use it.
+    for (unsigned int i = 0; i < symbols.size(); i++) {
+      addCode(symbols[i]);
+    }
     addCode(JMP_OP + INSTR_SEP + L"section_rules_start");
   }
 
@@ -235,28 +679,48 @@ void AssemblyCodeGenerator::genPostchunkStart(const Event &event) {
   genHeader(event);
 }
 
+void AssemblyCodeGenerator::genDefAttrEnd(const Event &event,
+    const vector<wstring> &items) {
+  if (useSymbols) {
+    addSymbol(ATTR_SYMBOL, WstringUtils::wjoin(items, L'|'), L"");
+  }
+}
+
 void AssemblyCodeGenerator::genDefVarStart(const Event &event,
     const wstring &defaultValue) {
   genDebugCode(event);
 
+  // The symbol section gives the variables their default value.
+  wstring varName = event.getAttribute(N_ATTR);
+  if (useSymbols) {
+    addSymbol(VAR_SYMBOL, varName, defaultValue);
+    return;
+  }
+
   // Push the default value and store it in var.
-  wstring varName = event.getAttribute(L"n");
   addCode(PUSH_OP + INSTR_SEP + L"\"" + varName + L"\"");
   addCode(PUSH_OP + INSTR_SEP + L"\"" + defaultValue + L"\"");
   addCode(STOREV_OP);
 }
 
+void AssemblyCodeGenerator::genDefListEnd(const Event &event,
+    const vector<wstring> &items) {
+  if (useSymbols) {
+    addSymbol(LIST_SYMBOL, WstringUtils::wjoin(items, L'|'), L"");
+  }
+}
+
 void AssemblyCodeGenerator::genSectionDefMacrosStart(const Event &event) {
   addJumpToRulesSection();
 }
 
 void AssemblyCodeGenerator::genDefMacroStart(const Event &event) {
   genDebugCode(event);
-  addCode(L"macro_" + event.getAttribute(L"n") + L"_start:");
+  addCode(L"macro_" + event.getAttribute(N_ATTR) + L"_start:");
 }
 
 void AssemblyCodeGenerator::genDefMacroEnd(const Event &event) {
-  wstring macroEndLabel = L"macro_" + event.getAttribute(L"n") + L"_end:";
+  wstring macroEndLabel = L"macro_" + event.getAttribute(N_ATTR) + L"_end:";
   addCode(macroEndLabel + INSTR_SEP + RET_OP);
 }
 
@@ -264,7 +728,13 @@ void AssemblyCodeGenerator::genSectionRulesStart(const Event & event) {
   genDebugCode(event);
   addJumpToRulesSection();
   addCode(L"section_rules_start:");
-  patternSection = nextAddress;
+
+  // The patterns section goes here, so the rules have to wait for it.
+  rulesFile = tmpfile();
+  if (rulesFile == NULL) {
+    throw CompilerException(L"Can't create a temporary file for the rules.");
+  }
+  inRulesSection = true;
 }
 
 void AssemblyCodeGenerator::genSectionRulesEnd(const Event & event) {
@@ -276,11 +746,7 @@ void AssemblyCodeGenerator::genRuleStart(Event & event) {
 }
 
 void AssemblyCodeGenerator::genPatternStart(const Event & event) {
-  // First time, add the header and footer of the patterns section.
-  if (patternsCode.size() == 0) {
-    patternsCode.push_back(L"patterns_start:");
-    patternsCode.push_back(L"patterns_end:");
-  }
+  addPatternsSection();
 }
 
 void AssemblyCodeGenerator::genPatternEnd(const Event & event) {
@@ -329,18 +795,35 @@ void AssemblyCodeGenerator::genCallMacroEnd(const Event & event) {
   wstringstream ws;
   ws << event.getNumChildren();
   addCode(PUSH_OP + INSTR_SEP + ws.str());
-  addCode(CALL_OP + INSTR_SEP + event.getAttribute(L"n"));
+  addCode(CALL_OP + INSTR_SEP + event.getAttribute(N_ATTR));
 }
 
 void AssemblyCodeGenerator::genWithParamStart(const Event & event) {
-  addCode(PUSH_OP + INSTR_SEP + event.getAttribute(L"pos"));
+  addCode(PUSH_OP + INSTR_SEP + event.getAttribute(POS_ATTR));
 }
 
 void AssemblyCodeGenerator::genChooseStart(Event & event) {
   event.setVariable(L"label", getNextLabel(CHOOSE));
+
+  // Keep the code of the choose, and where it starts, to turn it into a
+  // switch at its end.
+  if (useSwitch) {
+    wstringstream ws;
+    ws << code.size();
+    event.setVariable(L"start", ws.str());
+    openChooses++;
+  }
 }
 
 void AssemblyCodeGenerator::genChooseEnd(const Event & event) {
+  if (useSwitch) {
+    wstringstream ws(event.getVariable(L"start"));
+    unsigned int start;
+    ws >> start;
+    genSwitch(start);
+    openChooses--;
+  }
+
   addCode(L"choose_" + event.getVariable(L"label") + L"_end:");
 }
 
@@ -367,8 +850,8 @@ void AssemblyCodeGenerator::genTestEnd(const Event & event) {
 }
 
 void AssemblyCodeGenerator::genBStart(const Event & event) {
-  if (event.hasAttribute(L"pos")) {
-    addCode(PUSHSB_OP + INSTR_SEP + event.getAttribute(L"pos"));
+  if (event.hasAttribute(POS_ATTR)) {
+    addCode(PUSHSB_OP + INSTR_SEP + event.getAttribute(POS_ATTR));
   } else {
     addCode(PUSHBL_OP);
   }
@@ -377,7 +860,7 @@ void AssemblyCodeGenerator::genBStart(const Event & event) {
 void AssemblyCodeGenerator::genLitStart(const Event & event) {
   genDebugCode(event);
 
-  wstring value = event.getAttribute(L"v");
+  wstring value = event.getAttribute(V_ATTR);
   wstringstream ws(value);
   int numericValue;
 
@@ -392,7 +875,7 @@ void AssemblyCodeGenerator::genLitTagStart(const Event & event) {
   genDebugCode(event);
 
   // Convert <det.ind> to <det><ind> format.
-  wstring litTag = L"\"<" + event.getAttribute(L"v") + L">\"";
+  wstring litTag = L"\"<" + event.getAttribute(V_ATTR) + L">\"";
   litTag = WstringUtils::replace(litTag, L".", L"><");
   addCode(PUSH_OP + INSTR_SEP + litTag);
 }
@@ -428,10 +911,10 @@ void AssemblyCodeGenerator::genChunkStart(Event & event) {
   wstring chunkName = L""; // Name is optional.
 
   // If there is a fromname, we push the var name.
-  if (event.hasAttribute(L"namefrom")) {
-    chunkName = event.getAttribute(L"namefrom");
-  } else if (event.hasAttribute(L"name")) {
-    chunkName = L"\"" + event.getAttribute(L"name") + L"\"";
+  if (event.hasAttribute(NAMEFROM_ATTR)) {
+    chunkName = event.getAttribute(NAMEFROM_ATTR);
+  } else if (event.hasAttribute(NAME_ATTR)) {
+    chunkName = L"\"" + event.getAttribute(NAME_ATTR) + L"\"";
   }
 
   if (chunkName != L"") {
@@ -439,9 +922,9 @@ void AssemblyCodeGenerator::genChunkStart(Event & event) {
     event.setVariable(L"name", L"true");
   }
 
-  if (event.hasAttribute(L"case")) {
+  if (event.hasAttribute(CASE_ATTR)) {
     // Push the var name, get its case and modify the case of the name.
-    addCode(PUSH_OP + INSTR_SEP + event.getAttribute(L"case"));
+    addCode(PUSH_OP + INSTR_SEP + event.getAttribute(CASE_ATTR));
     addCode(CASE_OF_OP);
     addCode(MODIFY_CASE_OP);
   }
@@ -488,14 +971,14 @@ void AssemblyCodeGenerator::genOutEnd(const Event & event) {
 void AssemblyCodeGenerator::genVarStart(const Event & event, bool isContainer) {
   genDebugCode(event);
 
-  wstring varName = event.getAttribute(L"n");
+  wstring varName = event.getAttribute(N_ATTR);
 
   // If it's a container push its name as a quoted string.
   if (isContainer) {
-    addCode(PUSH_OP + INSTR_SEP + L"\"" + event.getAttribute(L"n") + L"\"");
+    addCode(PUSH_OP + INSTR_SEP + L"\"" + event.getAttribute(N_ATTR) + L"\"");
 
     // If it's a container of a modify-case, we also need its content.
-    if (event.getParent()->getName() == L"modify-case") {
+    if (event.getParent()->getElement() == MODIFY_CASE_ELEM) {
       addCode(PUSH_OP + INSTR_SEP + varName);
     }
   } else {
@@ -513,7 +996,7 @@ void AssemblyCodeGenerator::genClipCode(const Event &event,
     const vector<wstring> &partAttrs) {
 
   // Push the position to the stack.
-  wstring pos = event.getAttribute(L"pos");
+  wstring pos = event.getAttribute(POS_ATTR);
   addCode(PUSH_OP + INSTR_SEP + pos);
 
   // Push the contents of the part attribute.
@@ -533,14 +1016,14 @@ void AssemblyCodeGenerator::genClipCode(const Event &event,
 void AssemblyCodeGenerator::genClipInstr(const Event &event, bool linkTo) {
   wstring link = L"";
   if (linkTo) {
-    link = INSTR_SEP + L"\"<" + event.getAttribute(L"link-to") + L">\"";
+    link = INSTR_SEP + L"\"<" + event.getAttribute(LINK_TO_ATTR) + L">\"";
   }
 
   // Choose the appropriate instr depending on the side of the clip element.
-  if (!event.hasAttribute(L"side")) {
+  if (!event.hasAttribute(SIDE_ATTR)) {
     addCode(CLIP_OP + link);
   } else {
-    wstring side = event.getAttribute(L"side");
+    wstring side = event.getAttribute(SIDE_ATTR);
     if (side == L"sl") {
       addCode(CLIPSL_OP + link);
     } else if (side == L"tl") {
@@ -555,7 +1038,7 @@ void AssemblyCodeGenerator::genClipStart(const Event & event,
 
   genClipCode(event, partAttrs);
 
-  if (isContainer && event.getParent()->getName() == L"modify-case") {
+  if (isContainer && event.getParent()->getElement() == MODIFY_CASE_ELEM) {
     // If it's a container of a modify-case, we need to generate another
     //clip instruction to get the clip value needed by the modify-case.
     genClipCode(event, partAttrs);
@@ -600,7 +1083,7 @@ void AssemblyCodeGenerator::genConcatEnd(const Event & event) {
 void AssemblyCodeGenerator::genAppendStart(const Event & event) {
   genDebugCode(event);
 
-  wstring varName = L"\"" + event.getAttribute(L"n") + L"\"";
+  wstring varName = L"\"" + event.getAttribute(N_ATTR) + L"\"";
   addCode(PUSH_OP + INSTR_SEP + varName);
 }
 
@@ -615,7 +1098,7 @@ void AssemblyCodeGenerator::genGetCaseFromStart(const Event & event) {
 }
 
 void AssemblyCodeGenerator::genGetCaseFromEnd(const Event & event) {
-  wstring pos = event.getAttribute(L"pos");
+  wstring pos = event.getAttribute(POS_ATTR);
 
   addCode(PUSH_OP + INSTR_SEP + pos);
   addCode(GET_CASE_FROM_OP);
@@ -655,6 +1138,214 @@ void AssemblyCodeGenerator::genContainsSubstringEnd(const Event & event) {
   addCode(getIgnoreCaseInstr(event, CMP_SUBSTR_OP, CMPI_SUBSTR_OP));
 }
 
+/**
+ * Replace the first whens of a choose which test the same clip against
+ * literals with a single clip and a switch instruction, which jumps directly
+ * to the when whose literal is equal to the clip. The rest of the choose is
+ * left as it is and the switch jumps there if no literal is equal. A when
+ * can also test the clip against several literals joined by an or.
+ *
+ * @param start the position of the code where the choose starts
+ */
+void AssemblyCodeGenerator::genSwitch(unsigned int start) {
+  vector<wstring> clip;
+  vector<wstring> values;
+  vector<wstring> targets;
+  vector<unsigned int> bodyStarts;
+  vector<unsigned int> bodyEnds;
+  unsigned int pos = start;
+
+  while (pos < code.size()) {
+    vector<wstring> whenClip;
+    vector<wstring> whenValues;
+    wstring label;
+    unsigned int bodyStart = pos;
+
+    if (!parseSwitchTest(bodyStart, whenClip, whenValues, label)
+        || (!clip.empty() && whenClip != clip)) {
+      break;
+    }
+
+    // The when ends with a jump to the end of the choose and its end label.
+    wstring endLabel = L"when_" + label + L"_end:";
+    unsigned int bodyEnd = bodyStart;
+    while (bodyEnd < code.size() && code[bodyEnd] != endLabel) {
+      bodyEnd++;
+    }
+    if (bodyEnd == code.size() || !WstringUtils::startsWith(code[bodyEnd - 1],
+        JMP_OP + INSTR_SEP + L"choose_")) {
+      break;
+    }
+
+    // If a literal is repeated only the first when testing it can be chosen.
+    for (unsigned int i = 0; i < whenValues.size(); i++) {
+      if (find(values.begin(), values.end(), whenValues[i]) == values.end()) {
+        values.push_back(whenValues[i]);
+        targets.push_back(L"when_" + label + L"_case");
+      }
+    }
+
+    clip = whenClip;
+    bodyStarts.push_back(bodyStart);
+    bodyEnds.push_back(bodyEnd);
+    pos = bodyEnd + 1;
+  }
+
+  if (bodyStarts.size() < 2) {
+    return;
+  }
+
+  vector<wstring> switchCode(code.begin(), code.begin() + start);
+  switchCode.insert(switchCode.end(), clip.begin(), clip.end());
+
+  // The default target is the end of the last when replaced.
+  wstring lastEnd = code[bodyEnds.back()];
+  wstring switchInstr = SWITCH_OP + INSTR_SEP
+      + lastEnd.substr(0, lastEnd.size() - 1);
+  for (unsigned int i = 0; i < values.size(); i++) {
+    switchInstr += INSTR_SEP + L"\"" + values[i] + L"\"" + INSTR_SEP
+        + targets[i];
+  }
+  switchCode.push_back(switchInstr);
+
+  for (unsigned int i = 0; i < bodyStarts.size(); i++) {
+    wstring end = code[bodyEnds[i]];
+    switchCode.push_back(end.substr(0, end.size() - 4) + L"case:");
+    switchCode.insert(switchCode.end(), code.begin() + bodyStarts[i],
+        code.begin() + bodyEnds[i] + 1);
+  }
+  switchCode.insert(switchCode.end(), code.begin() + pos, code.end());
+
+  nextAddress += switchCode.size() - code.size();
+  code.swap(switchCode);
+}
+
+/**
+ * Parse the test of a when if it only compares a clip with literals, e.g.
+ * "push 1, push "<m>|<f>", cliptl, push "<m>", cmp, jz when_0_end", with the
+ * literal before or after the clip. Several comparisons of the same clip can
+ * be joined by an or. Debug messages are skipped.
+ *
+ * @param pos the position where the test starts, updated to where it ends
+ * @param clip the instructions of the clip compared
+ * @param values the literals compared with the clip
+ * @param label the label number of the when
+ *
+ * @return true if the test was parsed, false in other case
+ */
+bool AssemblyCodeGenerator::parseSwitchTest(unsigned int &pos,
+    vector<wstring> &clip, vector<wstring> &values, wstring &label) const {
+  vector<wstring> instrs;
+  unsigned int i = pos;
+
+  for (; i < code.size(); i++) {
+    const wstring &line = code[i];
+    if (line.empty() || line[line.size() - 1] == L':') {
+      return false;
+    } else if (line[0] != L'#') {
+      instrs.push_back(line);
+      if (WstringUtils::startsWith(line, JZ_OP + INSTR_SEP)) {
+        break;
+      }
+    }
+  }
+
+  if (i == code.size() || instrs.size() < 6) {
+    return false;
+  }
+
+  // The jz goes to the end of the when.
+  wstring jzTarget = instrs.back().substr(JZ_OP.size() + INSTR_SEP.size());
+  if (!WstringUtils::startsWith(jzTarget, L"when_")
+      || jzTarget.size() <= 9) {
+    return false;
+  }
+  label = jzTarget.substr(5, jzTarget.size() - 9);
+
+  // More than one comparison must be joined by an or.
+  unsigned int numCmps = 1;
+  unsigned int numInstrs = instrs.size() - 1;
+  if (numInstrs > 5) {
+    wstringstream ws;
+    ws << (numInstrs - 1) / 5;
+    if (instrs[numInstrs - 1] != OR_OP + INSTR_SEP + ws.str()
+        || (numInstrs - 1) % 5 != 0) {
+      return false;
+    }
+    numCmps = (numInstrs - 1) / 5;
+  } else if (numInstrs != 5) {
+    return false;
+  }
+
+  for (unsigned int j = 0; j < numCmps; j++) {
+    vector<wstring>::const_iterator cmp = instrs.begin() + j * 5;
+    if (cmp[4] != CMP_OP) {
+      return false;
+    }
+
+    // The clip can be the first or the second operand.
+    unsigned int clipStart = (cmp[2] == CLIP_OP || cmp[2] == CLIPSL_OP
+        || cmp[2] == CLIPTL_OP ? 0 : 1);
+    const wstring &clipInstr = cmp[clipStart + 2];
+    if (clipInstr != CLIP_OP && clipInstr != CLIPSL_OP
+        && clipInstr != CLIPTL_OP) {
+      return false;
+    }
+
+    vector<wstring> cmpClip(cmp + clipStart, cmp + clipStart + 3);
+    if (!WstringUtils::startsWith(cmpClip[0], PUSH_OP + INSTR_SEP)
+        || !WstringUtils::startsWith(cmpClip[1], PUSH_OP + INSTR_SEP)
+        || (!clip.empty() && cmpClip != clip)) {
+      return false;
+    }
+    clip = cmpClip;
+
+    wstring value;
+    if (!parseSwitchLiteral(cmp[clipStart == 0 ? 3 : 0], value)) {
+      return false;
+    }
+    values.push_back(value);
+  }
+
+  pos = i + 1;
+  return true;
+}
+
+/**
+ * Get the value pushed by a push of a literal. Literals with quotes aren't
+ * accepted, as they couldn't be written in a switch instruction.
+ *
+ * @param instr the push instruction
+ * @param value the value pushed
+ *
+ * @return true if it's the push of a literal, false in other case
+ */
+bool AssemblyCodeGenerator::parseSwitchLiteral(const wstring &instr,
+    wstring &value) const {
+  if (!WstringUtils::startsWith(instr, PUSH_OP + INSTR_SEP)) {
+    return false;
+  }
+
+  wstring operand = instr.substr(PUSH_OP.size() + INSTR_SEP.size());
+  if (operand.size() >= 2 && operand[0] == L'"'
+      && operand[operand.size() - 1] == L'"') {
+    value = operand.substr(1, operand.size() - 2);
+    return value.find(L'"') == wstring::npos;
+  }
+
+  // Numbers are pushed without quotes.
+  if (operand.empty()) {
+    return false;
+  }
+  for (unsigned int i = 0; i < operand.size(); i++) {
+    if (!iswdigit(operand[i])) {
+      return false;
+    }
+  }
+  value = operand;
+  return true;
+}
+
 /**
  * Generate a debug message for a given event.
  *
@@ -21,6 +21,8 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <map>
+#include <cstdio>
 
 #include <event.h>
 #include <code_generator.h>
@@ -68,11 +70,16 @@ static const wstring STORECL_OP = L"storecl";
 static const wstring STORESL_OP = L"storesl";
 static const wstring STORETL_OP = L"storetl";
 static const wstring STOREV_OP = L"storev";
+static const wstring SWITCH_OP = L"switch";
 
 static const unsigned int RULE = 0;
 static const unsigned int WHEN = 1;
 static const unsigned int CHOOSE = 2;
 
+static const unsigned int ATTR_SYMBOL = 0;
+static const unsigned int LIST_SYMBOL = 1;
+static const unsigned int VAR_SYMBOL = 2;
+
 /// This class generates code as a predefined pseudo-assembly.
 class AssemblyCodeGenerator: public CodeGenerator {
 
@@ -85,11 +92,20 @@ public:
   void copy(const AssemblyCodeGenerator&);
 
   void setDebug(bool);
+  void setSwitch(bool);
+  void setSymbols(bool);
+
+  void endOutput();
+  void writeOutput(wostream &);
+
+  CodeGenerator *forkUnit(const Event &);
+  CodeGenerator *forkUnit(const Event &, const vector<wstring> &);
+  vector<wstring> getUnitCode(const CodeGenerator *) const;
+  void joinUnit(CodeGenerator *);
 
   void addCode(const wstring &);
   void addPatternsCode(const wstring &);
   wstring getNextLabel(unsigned int);
-  wstring getWritableCode() const;
   wstring genStoreInstr(const Event &container) const;
   wstring getIgnoreCaseInstr(const Event&, const wstring&, const wstring&);
   void genHeader(const Event &);
@@ -101,7 +117,9 @@ public:
   void genTransferStart(const Event &);
   void genInterchunkStart(const Event &);
   void genPostchunkStart(const Event &);
+  void genDefAttrEnd(const Event &, const vector<wstring> &);
   void genDefVarStart(const Event &, const wstring &);
+  void genDefListEnd(const Event &, const vector<wstring> &);
   void genSectionDefMacrosStart(const Event &);
   void genDefMacroStart(const Event &);
   void genDefMacroEnd(const Event &);
@@ -154,26 +172,76 @@ public:
 
 
 private:
+  /// Number of characters copied at once from the temporary files.
+  static const unsigned int BUFFER_SIZE = 4096;
+
   /// Used to get the next address of an instruction if needed.
   int nextAddress;
 
-  /// The assembly code generated.
+  /// The assembly code generated and not written yet.
   vector<wstring> code;
 
   /// The assembly code generated for the patterns section.
   vector<wstring> patternsCode;
 
-  /// Indicates the start position of the pattern section.
-  unsigned int patternSection;
+  /// Temporary file with the code before the rules section, until it's
+  /// written.
+  FILE *headFile;
+
+  /// Temporary file with the code of the rules section, until it's written.
+  FILE *rulesFile;
+
+  /// If the code generated goes to the rules section, after the patterns.
+  bool inRulesSection;
+
+  /// If the code is kept until it's joined to the generator which forked it.
+  bool forked;
+
+  /// Number of chooses being generated which are kept to make switches.
+  unsigned int openChooses;
 
   /// Used to generate the next label, based on the element type.
   unsigned int nextLabel[3];
 
+  /// The first label of each type used by the unit of a forked generator.
+  unsigned int firstLabel[3];
+
   /// If debug is on, debug messages will be added to the code generated.
   bool debug;
 
   /// Flag to check if the jump to the rules section was already added.
   bool jumpToRulesSection;
+
+  /// If the chooses testing a clip against literals are compiled to switches.
+  bool useSwitch;
+
+  /// If the attributes, lists and variables are referenced by their index.
+  bool useSymbols;
+
+  /// The lines of the symbol section, with the definitions in order.
+  vector<wstring> symbols;
+
+  /// Number of symbols of each type: attributes, lists and variables.
+  unsigned int numSymbols[3];
+
+  /// The reference to a symbol which replaces each operand of a push.
+  map<wstring, wstring> symbolRefs;
+
+  void writeCode();
+  void copyFile(FILE *, wostream &) const;
+  void addSymbol(unsigned int, const wstring &, const wstring &);
+  void addSymbolRef(const wstring &, const wstring &);
+  wstring getSymbolicCode(const wstring &) const;
+  void addPatternsSection();
+  void skipLabels(const Event &);
+  wstring relabel(const wstring &, const unsigned int[3],
+      const unsigned int[3]) const;
+  wstring relabelTarget(const wstring &, const unsigned int[3],
+      const unsigned int[3]) const;
+  void genSwitch(unsigned int);
+  bool parseSwitchTest(unsigned int &, vector<wstring> &, vector<wstring> &,
+      wstring &) const;
+  bool parseSwitchLiteral(const wstring &, wstring &) const;
 };
 
 #endif /* ASSEMBLY_CODE_GENERATOR_H_ */
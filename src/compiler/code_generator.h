@@ -20,6 +20,7 @@
 
 #include <vector>
 #include <string>
+#include <ostream>
 
 #include <event.h>
 
@@ -31,13 +32,23 @@ public:
   virtual ~CodeGenerator() {}
 
   virtual void setDebug(bool) = 0;
+  virtual void setSwitch(bool) = 0;
+  virtual void setSymbols(bool) = 0;
 
-  virtual wstring getWritableCode() const = 0;
+  virtual void endOutput() = 0;
+  virtual void writeOutput(wostream &) = 0;
+
+  virtual CodeGenerator *forkUnit(const Event &) = 0;
+  virtual CodeGenerator *forkUnit(const Event &, const vector<wstring> &) = 0;
+  virtual vector<wstring> getUnitCode(const CodeGenerator *) const = 0;
+  virtual void joinUnit(CodeGenerator *) = 0;
 
   virtual void genTransferStart(const Event &) = 0;
   virtual void genInterchunkStart(const Event &) = 0;
   virtual void genPostchunkStart(const Event &) = 0;
+  virtual void genDefAttrEnd(const Event &, const vector<wstring> &) = 0;
   virtual void genDefVarStart(const Event &, const wstring &) = 0;
+  virtual void genDefListEnd(const Event &, const vector<wstring> &) = 0;
   virtual void genSectionDefMacrosStart(const Event &) = 0;
   virtual void genDefMacroStart(const Event &) = 0;
   virtual void genDefMacroEnd(const Event &) = 0;
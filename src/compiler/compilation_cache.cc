@@ -0,0 +1,248 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <compilation_cache.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+const wstring CompilationCache::HEADER = L"#<compilation-cache>";
+
+CompilationCache::CompilationCache() {
+  numUnits = 0;
+  numRebuilt = 0;
+}
+
+CompilationCache::CompilationCache(const CompilationCache &c) {
+  copy(c);
+}
+
+CompilationCache::~CompilationCache() {
+
+}
+
+CompilationCache& CompilationCache::operator=(const CompilationCache &c) {
+  if (this != &c) {
+    this->~CompilationCache();
+    this->copy(c);
+  }
+  return *this;
+}
+
+void CompilationCache::copy(const CompilationCache &c) {
+  fileName = c.fileName;
+  options = c.options;
+  loadedUnits = c.loadedUnits;
+  units = c.units;
+  numUnits = c.numUnits;
+  numRebuilt = c.numRebuilt;
+}
+
+/**
+ * Load the units of a cache file. A missing file, or one with another version
+ * or options, is treated as an empty cache and replaced when saved.
+ *
+ * @param fileName the name of the cache file
+ * @param options the options of the compilation, e.g. if debug is on
+ */
+void CompilationCache::load(const string &fileName, const wstring &options) {
+  this->fileName = fileName;
+  this->options = options;
+  loadedUnits.clear();
+  units.clear();
+  numUnits = 0;
+  numRebuilt = 0;
+
+  wifstream file(fileName.c_str());
+  wstring header, fileOptions;
+  wstringstream expectedHeader;
+  expectedHeader << HEADER << L" version " << VERSION;
+
+  if (!getline(file, header) || header != expectedHeader.str()
+      || !getline(file, fileOptions) || fileOptions != options) {
+    return;
+  }
+
+  wstring key;
+  vector<wstring> code;
+  while (readUnit(file, key, code)) {
+    loadedUnits[key] = code;
+  }
+}
+
+/**
+ * Read the next unit of a cache file.
+ *
+ * @param file the cache file
+ * @param key the key of the unit read
+ * @param code the code of the unit read
+ *
+ * @return true if a complete unit was read, false at the end of the file or
+ * if the rest of it isn't valid
+ */
+bool CompilationCache::readUnit(wistream &file, wstring &key,
+    vector<wstring> &code) const {
+  wstring word, unitHash;
+  unsigned int numLines;
+
+  if (!(file >> word >> unitHash >> numLines) || word != L"unit"
+      || file.get() != L'\n' || !readLine(file, key)
+      || hash(key) != unitHash) {
+    return false;
+  }
+
+  code.clear();
+  for (unsigned int i = 0; i < numLines; i++) {
+    wstring line;
+    if (!readLine(file, line)) {
+      return false;
+    }
+    code.push_back(line);
+  }
+
+  return true;
+}
+
+/**
+ * Read a line of a cache file, preceded by its length.
+ *
+ * @param file the cache file
+ * @param line the line read
+ *
+ * @return true if the line was read, false if it isn't valid
+ */
+bool CompilationCache::readLine(wistream &file, wstring &line) const {
+  size_t length;
+  if (!(file >> length) || file.get() != L' ') {
+    return false;
+  }
+
+  line.assign(length, L' ');
+  return file.read(&line[0], length) && file.get() == L'\n';
+}
+
+/**
+ * Save the units of this compilation to the cache file, dropping the ones
+ * which weren't used. The file is replaced at once, so an interrupted save
+ * leaves the previous cache.
+ *
+ * @return true if the file was saved, false in other case
+ */
+bool CompilationCache::save() const {
+  string tmpFileName = fileName + ".tmp";
+  wofstream file(tmpFileName.c_str());
+
+  file << HEADER << L" version " << VERSION << L'\n';
+  file << options << L'\n';
+
+  map<wstring, vector<wstring> >::const_iterator it;
+  for (it = units.begin(); it != units.end(); it++) {
+    file << L"unit " << hash(it->first) << L' ' << it->second.size() << L'\n';
+    file << it->first.size() << L' ' << it->first << L'\n';
+    for (unsigned int i = 0; i < it->second.size(); i++) {
+      file << it->second[i].size() << L' ' << it->second[i] << L'\n';
+    }
+  }
+
+  file.close();
+  if (file.fail() || rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+    remove(tmpFileName.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Find the code of a unit in the cache. If it's found, the unit is kept when
+ * the cache is saved, otherwise it counts as rebuilt.
+ *
+ * @param key the key of the unit
+ * @param code the code of the unit, if it's found
+ *
+ * @return true if the unit was found, false in other case
+ */
+bool CompilationCache::find(const wstring &key, vector<wstring> &code) {
+  map<wstring, vector<wstring> >::const_iterator it = loadedUnits.find(key);
+  numUnits++;
+
+  if (it == loadedUnits.end()) {
+    numRebuilt++;
+    return false;
+  }
+
+  code = it->second;
+  units[key] = code;
+  return true;
+}
+
+/**
+ * Add the code generated for a unit to the cache.
+ *
+ * @param key the key of the unit
+ * @param code the code of the unit
+ */
+void CompilationCache::add(const wstring &key, const vector<wstring> &code) {
+  units[key] = code;
+}
+
+/**
+ * Get the number of units of this compilation.
+ *
+ * @return the number of units looked for in the cache
+ */
+unsigned int CompilationCache::getNumUnits() const {
+  return numUnits;
+}
+
+/**
+ * Get the number of units of this compilation not found in the cache.
+ *
+ * @return the number of units rebuilt
+ */
+unsigned int CompilationCache::getNumRebuilt() const {
+  return numRebuilt;
+}
+
+/**
+ * Hash the key of a unit with two 64 bits FNV-1a hashes, with different
+ * offsets. The hash only checks that a unit of the file wasn't corrupted, the
+ * units are found by their whole key.
+ *
+ * @param key the key of the unit
+ *
+ * @return the hash as hexadecimal digits
+ */
+wstring CompilationCache::hash(const wstring &key) {
+  const unsigned long long prime = 1099511628211ULL;
+  unsigned long long first = 14695981039346656037ULL;
+  unsigned long long second = 0x6c62272e07bb0142ULL;
+
+  for (unsigned int i = 0; i < key.size(); i++) {
+    unsigned long long c = (unsigned int) key[i];
+    for (unsigned int byte = 0; byte < 4; byte++) {
+      first = (first ^ ((c >> (8 * byte)) & 0xFF)) * prime;
+      second = (second ^ ((c >> (8 * byte)) & 0xFF)) * prime;
+    }
+  }
+
+  wstringstream ws;
+  ws << hex << setfill(L'0') << setw(16) << first << setw(16) << second;
+  return ws.str();
+}
@@ -0,0 +1,93 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef COMPILATION_CACHE_H_
+#define COMPILATION_CACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Keeps the code of the rules and macros compiled in a file, so compiling the
+ * same rules again only needs to generate the code of the units which changed.
+ * Each unit is stored with its key, which is compared on every lookup, so two
+ * units sharing a hash can't reuse each other's code. The file has this format:
+ *
+ * \verbatim
+   #<compilation-cache> version <version>
+   <options>
+   unit <hash> <number of lines>
+   <length of the key> <key>
+   <length of the line> <line>
+   ...
+   \endverbatim
+ *
+ * A file with another version or options, e.g. with debug code, isn't used,
+ * and the units whose key doesn't match their hash are skipped.
+ */
+class CompilationCache {
+
+public:
+
+  /// First line of a cache file, before its version.
+  static const wstring HEADER;
+
+  /// Version of the file, changed with the format or the code generated.
+  static const unsigned int VERSION = 2;
+
+  CompilationCache();
+  CompilationCache(const CompilationCache&);
+  ~CompilationCache();
+  CompilationCache& operator=(const CompilationCache&);
+  void copy(const CompilationCache&);
+
+  void load(const string &, const wstring &);
+  bool save() const;
+  bool find(const wstring &, vector<wstring> &);
+  void add(const wstring &, const vector<wstring> &);
+  unsigned int getNumUnits() const;
+  unsigned int getNumRebuilt() const;
+
+  static wstring hash(const wstring &);
+
+private:
+  /// Name of the cache file.
+  string fileName;
+
+  /// The options of the compilation, which have to match the file's ones.
+  wstring options;
+
+  /// The code of the units read from the file, by key.
+  map<wstring, vector<wstring> > loadedUnits;
+
+  /// The code of the units of this compilation, the ones saved, by key.
+  map<wstring, vector<wstring> > units;
+
+  /// Number of units of this compilation looked for in the cache.
+  unsigned int numUnits;
+
+  /// Number of units not found in the cache, whose code was generated.
+  unsigned int numRebuilt;
+
+  bool readUnit(wistream &, wstring &, vector<wstring> &) const;
+  bool readLine(wistream &, wstring &) const;
+};
+
+#endif /* COMPILATION_CACHE_H_ */
@@ -17,6 +17,7 @@
 
 #include <compiler.h>
 #include <unistd.h>
+#include <sstream>
 
 #include <wstring_utils.h>
 #include <assembly_code_generator.h>
@@ -24,6 +25,10 @@
 Compiler::Compiler() {
   inputFileName = NULL;
   outputFileName = NULL;
+  useSwitch = false;
+  useSymbols = false;
+  jobs = 1;
+  cacheFileName = NULL;
 
   //For now, there is only one code generator.
   codeGenerator = new AssemblyCodeGenerator();
@@ -36,6 +41,7 @@ Compiler::Compiler(const Compiler &c) {
 Compiler::~Compiler() {
   inputFileName = NULL;
   outputFileName = NULL;
+  cacheFileName = NULL;
   delete codeGenerator;
   codeGenerator = NULL;
 }
@@ -51,6 +57,11 @@ Compiler& Compiler::operator=(const Compiler &c) {
 void Compiler::copy(const Compiler &c) {
   inputFileName = c.inputFileName;
   outputFileName = c.outputFileName;
+  useSwitch = c.useSwitch;
+  useSymbols = c.useSymbols;
+  jobs = c.jobs;
+  cacheFileName = c.cacheFileName;
+  cache = c.cache;
 }
 
 /**
@@ -62,6 +73,46 @@ void Compiler::setDebug(char *fileName) {
   debugFile.open(fileName);
 }
 
+/**
+ * Compile the chooses which test a clip against literals to switch
+ * instructions, which jump directly to the when chosen.
+ *
+ * @param mode true to use switch instructions, false in other case
+ */
+void Compiler::setSwitch(bool mode) {
+  useSwitch = mode;
+}
+
+/**
+ * Define the attributes, lists and variables in a symbol section at the start
+ * of the code, with the instructions referencing them by their index.
+ *
+ * @param mode true to generate the symbol section, false in other case
+ */
+void Compiler::setSymbols(bool mode) {
+  useSymbols = mode;
+}
+
+/**
+ * Generate the code of the rules using some threads. The code generated is the
+ * same as with a single thread.
+ *
+ * @param jobs the number of threads, 0 to use one per core
+ */
+void Compiler::setJobs(unsigned int jobs) {
+  this->jobs = jobs;
+}
+
+/**
+ * Keep the code of the rules and macros in a cache file, so only the ones
+ * which changed since the last compilation are generated again.
+ *
+ * @param fileName the name of the cache file, created if it doesn't exist
+ */
+void Compiler::setCacheFile(char *fileName) {
+  cacheFileName = fileName;
+}
+
 /**
  * Set the input file to read the transfer rules.
  *
@@ -88,8 +139,12 @@ bool Compiler::compile() {
   createParser();
 
   try {
+    // The code is kept until the compilation ends, so it's only written to
+    // the output if it succeeds.
     parser.parse();
-    writeOutput(codeGenerator->getWritableCode());
+    codeGenerator->endOutput();
+    writeOutput();
+    saveCache();
   } catch (CompilerException &c) {
     debugMessage(c.getMessage());
     wcerr << L"Error: " << c.getMessage() << endl;
@@ -103,6 +158,40 @@ bool Compiler::compile() {
   return true;
 }
 
+/**
+ * Write the code generated to the output file, or to stdout if there isn't one.
+ */
+void Compiler::writeOutput() const {
+  if (outputFileName != NULL) {
+    wofstream file(outputFileName);
+    codeGenerator->writeOutput(file);
+  } else {
+    codeGenerator->writeOutput(wcout);
+  }
+}
+
+/**
+ * Save the cache file, if one is used, and show the rules and macros whose code
+ * had to be generated.
+ */
+void Compiler::saveCache() {
+  if (cacheFileName == NULL) {
+    return;
+  }
+
+  const vector<wstring> &rebuiltUnits = parser.getRebuiltUnits();
+  for (unsigned int i = 0; i < rebuiltUnits.size(); i++) {
+    wcerr << L"Rebuilt " << rebuiltUnits[i] << endl;
+  }
+  wcerr << L"Rebuilt " << cache.getNumRebuilt() << L" of "
+      << cache.getNumUnits() << L" units" << endl;
+
+  if (!cache.save()) {
+    wcerr << L"Warning: Can't save the cache file '"
+        << WstringUtils::stows(cacheFileName) << L"'" << endl;
+  }
+}
+
 /*
  * If debugging is active, print a debug message on the file specified.
  *
@@ -114,20 +203,6 @@ void Compiler::debugMessage(const wstring &msg) {
   }
 }
 
-/*
- * Write the output of the compiling process to the file specified.
- *
- * @code the code generated by the generator.
- */
-void Compiler::writeOutput(const wstring &code) const {
-  if (outputFileName != NULL) {
-    wofstream file(outputFileName);
-    file << code;
-  } else {
-    wcout << code;
-  }
-}
-
 /**
  * Create the parser depending on the options set. If there is a input file name
  * use that, in other case, read from stdin directly.
@@ -141,5 +216,15 @@ void Compiler::createParser() {
 
   bool debug = debugFile.is_open();
   codeGenerator->setDebug(debug);
+  codeGenerator->setSwitch(useSwitch);
+  codeGenerator->setSymbols(useSymbols);
   parser.setCodeGenerator(codeGenerator);
+  parser.setJobs(jobs);
+
+  if (cacheFileName != NULL) {
+    wstringstream options;
+    options << L"debug " << debug << L" switch " << useSwitch;
+    cache.load(cacheFileName, options.str());
+    parser.setCache(&cache);
+  }
 }
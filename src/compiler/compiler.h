@@ -24,6 +24,7 @@
 
 #include <xml_parser.h>
 #include <code_generator.h>
+#include <compilation_cache.h>
 
 using namespace std;
 
@@ -41,12 +42,16 @@ public:
   void copy(const Compiler&);
 
   void setDebug(char *);
+  void setSwitch(bool);
+  void setSymbols(bool);
+  void setJobs(unsigned int);
+  void setCacheFile(char *);
   void setInputFile(char *);
   void setOutputFile(char *);
 
   bool compile();
   void debugMessage(const wstring &);
-  void writeOutput(const wstring &) const;
+  void writeOutput() const;
 
 private:
   /// Name of the input file to use.
@@ -58,11 +63,27 @@ private:
   /// The debug file if debug mode is activated.
   wofstream debugFile;
 
+  /// If the chooses testing a clip against literals use switch instructions.
+  bool useSwitch;
+
+  /// If the attributes, lists and variables are defined in a symbol section.
+  bool useSymbols;
+
+  /// Number of threads used to generate the code of the rules and macros.
+  unsigned int jobs;
+
+  /// Name of the cache file with the code of the rules and macros, if any.
+  char *cacheFileName;
+
+  /// The cache with the code of the rules and macros.
+  CompilationCache cache;
+
   // Compiler's components.
   XmlParser parser;
   CodeGenerator *codeGenerator;
 
   void createParser();
+  void saveCache();
 };
 
 #endif /* COMPILER_H_ */
@@ -21,17 +21,51 @@
 
 #include <compiler_exception.h>
 
+const wchar_t *Event::ELEMENT_NAMES[UNKNOWN_ELEM] = {
+  L"action", L"and", L"append", L"attr-item", L"b", L"begins-with",
+  L"begins-with-list", L"call-macro", L"case-of", L"cat-item", L"choose",
+  L"chunk", L"clip", L"concat", L"contains-substring", L"def-attr", L"def-cat",
+  L"def-list", L"def-macro", L"def-var", L"ends-with", L"ends-with-list",
+  L"equal", L"get-case-from", L"in", L"interchunk", L"let", L"list",
+  L"list-item", L"lit", L"lit-tag", L"lu", L"lu-count", L"mlu", L"modify-case",
+  L"not", L"or", L"otherwise", L"out", L"pattern", L"pattern-item",
+  L"postchunk", L"reject-current-rule", L"rule", L"section-def-attrs",
+  L"section-def-cats", L"section-def-lists", L"section-def-macros",
+  L"section-def-vars", L"section-rules", L"tag", L"tags", L"test", L"transfer",
+  L"var", L"when", L"with-param"
+};
+
+const wchar_t *Event::ATTRIBUTE_NAMES[UNKNOWN_ATTR] = {
+  L"c", L"case", L"caseless", L"comment", L"default", L"lemma", L"link-to",
+  L"n", L"name", L"namefrom", L"npar", L"part", L"pos", L"side", L"tags", L"v"
+};
+
 Event::Event() {
   this->lineNumber = 0;
+  element = UNKNOWN_ELEM;
   name = L"";
+  empty = false;
+  attributes = NULL;
+  numAttributes = 0;
   parent = NULL;
+  firstChild = NULL;
+  lastChild = NULL;
+  nextSibling = NULL;
+  numChildren = 0;
 }
 
-Event::Event(int lineNumber, const wstring &name,
-    map<wstring, wstring> attributes) {
+Event::Event(int lineNumber, ELEMENT_NAME element, wstring_view name) {
   this->lineNumber = lineNumber;
+  this->element = element;
   this->name = name;
-  this->attributes = attributes;
+  empty = false;
+  attributes = NULL;
+  numAttributes = 0;
+  parent = NULL;
+  firstChild = NULL;
+  lastChild = NULL;
+  nextSibling = NULL;
+  numChildren = 0;
 }
 
 Event::Event(const Event &e) {
@@ -52,13 +86,102 @@ Event& Event::operator=(const Event &e) {
 
 void Event::copy(const Event &e) {
   lineNumber = e.lineNumber;
+  element = e.element;
   name = e.name;
+  empty = e.empty;
   attributes = e.attributes;
+  numAttributes = e.numAttributes;
   parent = e.parent;
-  children = e.children;
+  firstChild = e.firstChild;
+  lastChild = e.lastChild;
+  nextSibling = e.nextSibling;
+  numChildren = e.numChildren;
   variables = e.variables;
 }
 
+/**
+ * Find the element with a given name.
+ *
+ * @param name the name of the element, as read by the xml parser
+ *
+ * @return the element or UNKNOWN_ELEM if it isn't an element of the transfer
+ */
+ELEMENT_NAME Event::findElement(const xmlChar *name) {
+  return (ELEMENT_NAME) findName(ELEMENT_NAMES, UNKNOWN_ELEM, name);
+}
+
+/**
+ * Find the attribute with a given name.
+ *
+ * @param name the name of the attribute, as read by the xml parser
+ *
+ * @return the attribute or UNKNOWN_ATTR if it isn't an attribute of the
+ * transfer
+ */
+ATTRIBUTE_NAME Event::findAttribute(const xmlChar *name) {
+  return (ATTRIBUTE_NAME) findName(ATTRIBUTE_NAMES, UNKNOWN_ATTR, name);
+}
+
+/**
+ * Get the name of an element.
+ *
+ * @param element the element, which can't be UNKNOWN_ELEM
+ *
+ * @return the name of the element
+ */
+wstring_view Event::getElementName(ELEMENT_NAME element) {
+  return ELEMENT_NAMES[element];
+}
+
+/**
+ * Get the name of an attribute.
+ *
+ * @param attribute the attribute, which can't be UNKNOWN_ATTR
+ *
+ * @return the name of the attribute
+ */
+wstring_view Event::getAttributeName(ATTRIBUTE_NAME attribute) {
+  return ATTRIBUTE_NAMES[attribute];
+}
+
+/**
+ * Search a name in a table of names sorted alphabetically. The names of the
+ * table are ascii, so they can be compared directly with the xml name.
+ *
+ * @param names the table of names
+ * @param numNames the number of names of the table
+ * @param name the name to search
+ *
+ * @return the position of the name in the table or numNames if it isn't found
+ */
+int Event::findName(const wchar_t * const names[], int numNames,
+    const xmlChar *name) {
+  int first = 0;
+  int last = numNames - 1;
+
+  while (first <= last) {
+    int middle = (first + last) / 2;
+    const xmlChar *c = name;
+    const wchar_t *w = names[middle];
+
+    while (*c != 0 && (wchar_t) *c == *w) {
+      c++;
+      w++;
+    }
+
+    int cmp = (int) *c - (int) *w;
+    if (cmp == 0) {
+      return middle;
+    } else if (cmp < 0) {
+      last = middle - 1;
+    } else {
+      first = middle + 1;
+    }
+  }
+
+  return numNames;
+}
+
 /**
  * Get the line number (original xml) of the element which generated the event.
  *
@@ -68,13 +191,41 @@ int Event::getLineNumber() const {
   return lineNumber;
 }
 
+/**
+ * Get the element which generated the event.
+ *
+ * @return the element
+ */
+ELEMENT_NAME Event::getElement() const {
+  return element;
+}
+
+/**
+ * Check if the element which generated the event is self-closing, in which case
+ * there is no event for its end.
+ *
+ * @return true if the element is self-closing, false in other case
+ */
+bool Event::isEmpty() const {
+  return empty;
+}
+
+/**
+ * Set if the element which generated the event is self-closing.
+ *
+ * @param empty true if the element is self-closing
+ */
+void Event::setEmpty(bool empty) {
+  this->empty = empty;
+}
+
 /**
  * Get the name of the element which generated the event.
  *
  * @return the name of the element
  */
 wstring Event::getName() const {
-  return name;
+  return wstring(name);
 }
 
 /**
@@ -83,41 +234,57 @@ wstring Event::getName() const {
  * @return the map of key, value pairs.
  */
 map<wstring, wstring> Event::getAttributes() const {
-  return attributes;
+  map<wstring, wstring> attributesMap;
+
+  for (unsigned int i = 0; i < numAttributes; i++) {
+    attributesMap[wstring(attributes[i].name)] = wstring(attributes[i].value);
+  }
+
+  return attributesMap;
+}
+
+/**
+ * Set the attributes of the event.
+ *
+ * @param attributes the attributes, which must live as long as the event
+ * @param numAttributes the number of attributes
+ */
+void Event::setAttributes(const EventAttribute *attributes,
+    unsigned int numAttributes) {
+  this->attributes = attributes;
+  this->numAttributes = numAttributes;
 }
 
 /**
  * Get the value of an attribute, given an attribute name.
  *
- * @param name the name of the attribute
+ * @param id the attribute
  *
  * @return the value if the attribute is found, in other case, an empty string.
  */
-wstring Event::getAttribute(const wstring &name) const {
-  map<wstring, wstring>::const_iterator it;
-  it = attributes.find(name);
-  if (it != attributes.end()) {
-    return it->second;
-  } else {
-    return L"";
+wstring Event::getAttribute(ATTRIBUTE_NAME id) const {
+  for (unsigned int i = 0; i < numAttributes; i++) {
+    if (attributes[i].id == id) {
+      return wstring(attributes[i].value);
+    }
   }
+  return L"";
 }
 
 /**
  * Check if the event has an attribute with the name passed as parameter.
  *
- * @param attrName the name of the attribute
+ * @param id the attribute
  *
  * @return true if the attribute is found, in other case, false.
  */
-bool Event::hasAttribute(const wstring &attrName) const {
-  map<wstring, wstring>::const_iterator it;
-  it = attributes.find(attrName);
-  if (it != attributes.end()) {
-    return true;
-  } else {
-    return false;
+bool Event::hasAttribute(ATTRIBUTE_NAME id) const {
+  for (unsigned int i = 0; i < numAttributes; i++) {
+    if (attributes[i].id == id) {
+      return true;
+    }
   }
+  return false;
 }
 
 /**
@@ -126,7 +293,7 @@ bool Event::hasAttribute(const wstring &attrName) const {
  * @return the number of children
  */
 int Event::getNumChildren() const {
-  return children.size();
+  return numChildren;
 }
 
 /**
@@ -152,8 +319,14 @@ void Event::setParent(const Event *event) {
  *
  * @param event the child of the event
  */
-void Event::addChild(Event event) {
-  children.push_back(event);
+void Event::addChild(Event *event) {
+  if (lastChild == NULL) {
+    firstChild = event;
+  } else {
+    lastChild->nextSibling = event;
+  }
+  lastChild = event;
+  numChildren++;
 }
 
 /**
@@ -163,9 +336,13 @@ void Event::addChild(Event event) {
  *
  * @return the reference to the child Event
  */
-Event Event::getChild(unsigned int pos) const {
-  if (pos < children.size()) {
-    return children[pos];
+const Event &Event::getChild(unsigned int pos) const {
+  if (pos < (unsigned int) numChildren) {
+    const Event *child = firstChild;
+    for (unsigned int i = 0; i < pos; i++) {
+      child = child->nextSibling;
+    }
+    return *child;
   } else {
     wstringstream msg;
     msg << L"Event '" << name << L"' doesn't have a child in pos " << pos;
@@ -173,6 +350,24 @@ Event Event::getChild(unsigned int pos) const {
   }
 }
 
+/**
+ * Get the first child of the event, to go through all of them.
+ *
+ * @return the first child or NULL if the event has no children
+ */
+Event* Event::getFirstChild() const {
+  return firstChild;
+}
+
+/**
+ * Get the next child of the parent of the event.
+ *
+ * @return the next child or NULL if the event is the last one
+ */
+Event* Event::getNextSibling() const {
+  return nextSibling;
+}
+
 /**
  * Get the value of an event's variable.
  *
@@ -19,56 +19,122 @@
 #define EVENT_H_
 
 #include <string>
+#include <string_view>
 #include <map>
-#include <vector>
+
+#include <libxml/xmlreader.h>
 
 using namespace std;
 
-/// A class which encapsulates an event generated by the XML parser.
+/// The elements of the transfer files, sorted by name.
+enum ELEMENT_NAME {
+  ACTION_ELEM, AND_ELEM, APPEND_ELEM, ATTR_ITEM_ELEM, B_ELEM, BEGINS_WITH_ELEM,
+  BEGINS_WITH_LIST_ELEM, CALL_MACRO_ELEM, CASE_OF_ELEM, CAT_ITEM_ELEM,
+  CHOOSE_ELEM, CHUNK_ELEM, CLIP_ELEM, CONCAT_ELEM, CONTAINS_SUBSTRING_ELEM,
+  DEF_ATTR_ELEM, DEF_CAT_ELEM, DEF_LIST_ELEM, DEF_MACRO_ELEM, DEF_VAR_ELEM,
+  ENDS_WITH_ELEM, ENDS_WITH_LIST_ELEM, EQUAL_ELEM, GET_CASE_FROM_ELEM, IN_ELEM,
+  INTERCHUNK_ELEM, LET_ELEM, LIST_ELEM, LIST_ITEM_ELEM, LIT_ELEM, LIT_TAG_ELEM,
+  LU_ELEM, LU_COUNT_ELEM, MLU_ELEM, MODIFY_CASE_ELEM, NOT_ELEM, OR_ELEM,
+  OTHERWISE_ELEM, OUT_ELEM, PATTERN_ELEM, PATTERN_ITEM_ELEM, POSTCHUNK_ELEM,
+  REJECT_CURRENT_RULE_ELEM, RULE_ELEM, SECTION_DEF_ATTRS_ELEM,
+  SECTION_DEF_CATS_ELEM, SECTION_DEF_LISTS_ELEM, SECTION_DEF_MACROS_ELEM,
+  SECTION_DEF_VARS_ELEM, SECTION_RULES_ELEM, TAG_ELEM, TAGS_ELEM, TEST_ELEM,
+  TRANSFER_ELEM, VAR_ELEM, WHEN_ELEM, WITH_PARAM_ELEM,
+  UNKNOWN_ELEM
+};
+
+/// The attributes of the elements of the transfer files, sorted by name.
+enum ATTRIBUTE_NAME {
+  C_ATTR, CASE_ATTR, CASELESS_ATTR, COMMENT_ATTR, DEFAULT_ATTR, LEMMA_ATTR,
+  LINK_TO_ATTR, N_ATTR, NAME_ATTR, NAMEFROM_ATTR, NPAR_ATTR, PART_ATTR,
+  POS_ATTR, SIDE_ATTR, TAGS_ATTR, V_ATTR,
+  UNKNOWN_ATTR
+};
+
+/// An attribute of an element, its name and value stored by the parser.
+struct EventAttribute {
+  ATTRIBUTE_NAME id;
+  wstring_view name;
+  wstring_view value;
+};
+
+/**
+ * A class which encapsulates an event generated by the XML parser. Events are
+ * created by an event arena, which owns them and the text of their attributes,
+ * so they are linked to their parent and children through pointers.
+ */
 class Event {
 
 public:
 
   Event();
-  Event(int, const wstring &, map<wstring, wstring>);
+  Event(int, ELEMENT_NAME, wstring_view);
   Event(const Event&);
   ~Event();
   Event& operator=(const Event&);
   void copy(const Event&);
 
+  static ELEMENT_NAME findElement(const xmlChar *);
+  static ATTRIBUTE_NAME findAttribute(const xmlChar *);
+  static wstring_view getElementName(ELEMENT_NAME);
+  static wstring_view getAttributeName(ATTRIBUTE_NAME);
+
   int getLineNumber() const;
+  ELEMENT_NAME getElement() const;
+  bool isEmpty() const;
+  void setEmpty(bool);
   wstring getName() const;
   map<wstring, wstring> getAttributes() const;
-  wstring getAttribute(const wstring&) const;
-  bool hasAttribute(const wstring &) const;
+  void setAttributes(const EventAttribute *, unsigned int);
+  wstring getAttribute(ATTRIBUTE_NAME) const;
+  bool hasAttribute(ATTRIBUTE_NAME) const;
   int getNumChildren() const;
 
   const Event *getParent() const;
   void setParent(const Event *);
-  void addChild(Event);
-  Event getChild(unsigned int) const;
+  void addChild(Event *);
+  const Event &getChild(unsigned int) const;
+  Event *getFirstChild() const;
+  Event *getNextSibling() const;
   wstring getVariable(const wstring &) const;
   void setVariable(const wstring &, const wstring &);
 
 private:
+  /// The names of the elements, in the order of ELEMENT_NAME.
+  static const wchar_t *ELEMENT_NAMES[UNKNOWN_ELEM];
+
+  /// The names of the attributes, in the order of ATTRIBUTE_NAME.
+  static const wchar_t *ATTRIBUTE_NAMES[UNKNOWN_ATTR];
+
   /// The line number of the event in the XML original file.
   int lineNumber;
 
-  /// The name of the element originator of the event.
-  wstring name;
+  /// The element originator of the event.
+  ELEMENT_NAME element;
+
+  /// The name of the element, needed for the elements which aren't known.
+  wstring_view name;
+
+  /// If the element is self-closing, so it doesn't have an end.
+  bool empty;
 
   /// The attributes of the element.
-  map<wstring, wstring> attributes;
+  const EventAttribute *attributes;
+  unsigned int numAttributes;
 
   /// Store a reference to the parent of the event.
   const Event *parent;
 
-  /// Storing references to the event's children gives us a lot of flexibility.
-  vector<Event> children;
+  /// The children of the event, each one linked to the next one.
+  Event *firstChild;
+  Event *lastChild;
+  Event *nextSibling;
+  int numChildren;
 
   // Variables map is used to pass information between events.
   map<wstring, wstring> variables;
 
+  static int findName(const wchar_t * const [], int, const xmlChar *);
 };
 
 #endif /* EVENT_H_ */
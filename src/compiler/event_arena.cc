@@ -0,0 +1,150 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <event_arena.h>
+
+#include <new>
+
+#include <wstring_utils.h>
+
+EventArena::EventArena() {
+  freeSpace = NULL;
+  freeSize = 0;
+}
+
+EventArena::EventArena(const EventArena &a) {
+  freeSpace = NULL;
+  freeSize = 0;
+  copy(a);
+}
+
+EventArena::~EventArena() {
+  clear();
+}
+
+EventArena& EventArena::operator=(const EventArena &a) {
+  if (this != &a) {
+    clear();
+    this->copy(a);
+  }
+  return *this;
+}
+
+void EventArena::copy(const EventArena &a) {
+  // The events point to the memory of their own arena, so a copy starts empty.
+  freeSpace = NULL;
+  freeSize = 0;
+}
+
+/**
+ * Create a new event without attributes.
+ *
+ * @param lineNumber the line number of the event
+ * @param element the element originator of the event
+ * @param name the name of the element, which must live as long as the arena
+ *
+ * @return the new event
+ */
+Event* EventArena::newEvent(int lineNumber, ELEMENT_NAME element,
+    wstring_view name) {
+  void *space = allocate(sizeof(Event), alignof(Event));
+  Event *event = new (space) Event(lineNumber, element, name);
+  events.push_back(event);
+  return event;
+}
+
+/**
+ * Allocate space for the attributes of an event.
+ *
+ * @param numAttributes the number of attributes
+ *
+ * @return the first attribute
+ */
+EventAttribute* EventArena::newAttributes(unsigned int numAttributes) {
+  void *space = allocate(numAttributes * sizeof(EventAttribute),
+      alignof(EventAttribute));
+  return new (space) EventAttribute[numAttributes];
+}
+
+/**
+ * Store a character sequence of the xml parser as a wide string.
+ *
+ * @param input the character sequence to store, can be NULL
+ *
+ * @return a view of the wide string stored
+ */
+wstring_view EventArena::newString(const xmlChar *input) {
+  if (input == NULL) {
+    return wstring_view();
+  }
+
+  // A wide string never needs more characters than its utf-8 sequence.
+  size_t maxLength = xmlStrlen(input);
+  wchar_t *wstr = (wchar_t *) allocate(maxLength * sizeof(wchar_t),
+      alignof(wchar_t));
+  size_t length = WstringUtils::towstring(input, wstr);
+
+  // Give back the space which wasn't used.
+  freeSpace -= (maxLength - length) * sizeof(wchar_t);
+  freeSize += (maxLength - length) * sizeof(wchar_t);
+
+  return wstring_view(wstr, length);
+}
+
+/**
+ * Free all the events and their attributes.
+ */
+void EventArena::clear() {
+  for (unsigned int i = 0; i < events.size(); i++) {
+    events[i]->~Event();
+  }
+  vector<Event *>().swap(events);
+
+  for (unsigned int i = 0; i < blocks.size(); i++) {
+    delete[] blocks[i];
+  }
+  vector<char *>().swap(blocks);
+
+  freeSpace = NULL;
+  freeSize = 0;
+}
+
+/**
+ * Allocate memory from the last block, or from a new one if it's full.
+ *
+ * @param size the number of bytes
+ * @param alignment the alignment needed
+ *
+ * @return the memory allocated
+ */
+void* EventArena::allocate(size_t size, size_t alignment) {
+  size_t padding = (alignment - (size_t) freeSpace % alignment) % alignment;
+
+  if (freeSpace == NULL || padding + size > freeSize) {
+    // Memory returned by new is aligned for any type.
+    size_t blockSize = (size > BLOCK_SIZE) ? size : BLOCK_SIZE;
+    freeSpace = new char[blockSize];
+    freeSize = blockSize;
+    blocks.push_back(freeSpace);
+    padding = 0;
+  }
+
+  void *space = freeSpace + padding;
+  freeSpace += padding + size;
+  freeSize -= padding + size;
+
+  return space;
+}
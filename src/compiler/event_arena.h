@@ -0,0 +1,63 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef EVENT_ARENA_H_
+#define EVENT_ARENA_H_
+
+#include <vector>
+
+#include <event.h>
+
+using namespace std;
+
+/**
+ * Owns the events of a transfer file and their attributes. All of them are
+ * stored in big blocks of memory, so the events can be created without
+ * allocating memory for each of them and all of them are freed at once.
+ */
+class EventArena {
+
+public:
+
+  /// Size in bytes of each block of memory.
+  static const size_t BLOCK_SIZE = 65536;
+
+  EventArena();
+  EventArena(const EventArena&);
+  ~EventArena();
+  EventArena& operator=(const EventArena&);
+  void copy(const EventArena&);
+
+  Event *newEvent(int, ELEMENT_NAME, wstring_view);
+  EventAttribute *newAttributes(unsigned int);
+  wstring_view newString(const xmlChar *);
+  void clear();
+
+private:
+  /// The events created, which need to be destroyed before freeing them.
+  vector<Event *> events;
+
+  /// The blocks of memory allocated.
+  vector<char *> blocks;
+
+  /// The free space left in the last block.
+  char *freeSpace;
+  size_t freeSize;
+
+  void *allocate(size_t, size_t);
+};
+
+#endif /* EVENT_ARENA_H_ */
@@ -24,7 +24,10 @@
 #include <wstring_utils.h>
 
 EventHandler::EventHandler() {
+  transferStage = TRANSFER;
+  transferDefault = LU;
   codeGenerator = NULL;
+  macrosDeclared = false;
 }
 
 EventHandler::EventHandler(const EventHandler &e) {
@@ -47,6 +50,9 @@ void EventHandler::copy(const EventHandler &e) {
   transferStage = e.transferStage;
   transferDefault = e.transferDefault;
   codeGenerator = e.codeGenerator;
+  symbolTable = e.symbolTable;
+  uncheckedMacros = e.uncheckedMacros;
+  macrosDeclared = e.macrosDeclared;
   defCats = e.defCats;
   currentDefCat = e.currentDefCat;
   defAttrs = e.defAttrs;
@@ -88,10 +94,11 @@ void EventHandler::throwError(const Event &event, const wstring &msg) const {
  * @param attr the attribute to find
  */
 void EventHandler::checkAttributeExists(const Event &event,
-    wstring attr) const {
+    ATTRIBUTE_NAME attr) const {
   if (!event.hasAttribute(attr)) {
     wstringstream msg;
-    msg << event.getName() << L" needs attribute " << attr << L".";
+    msg << event.getName() << L" needs attribute "
+        << Event::getAttributeName(attr) << L".";
     throwError(event, msg.str());
   }
 }
@@ -103,7 +110,7 @@ void EventHandler::checkAttributeExists(const Event &event,
  * @param event the event containing the macro
  */
 void EventHandler::checkMacro(const Event &event) const {
-  wstring name = event.getAttribute(L"n");
+  wstring name = event.getAttribute(N_ATTR);
 
   if (!symbolTable.macroExists(name)) {
     wstringstream msg;
@@ -133,9 +140,10 @@ void EventHandler::checkMacro(const Event &event) const {
 bool EventHandler::isContainer(const Event &event) const {
   const Event *parent = event.getParent();
 
-  if (parent->getName() == L"let" || parent->getName() == L"modify-case") {
+  if (parent->getElement() == LET_ELEM
+      || parent->getElement() == MODIFY_CASE_ELEM) {
     // If it's the first child, it's on the left, so it's a container.
-    if (parent->getNumChildren() == 1) {
+    if (parent->getFirstChild() == &event) {
       return true;
     }
   }
@@ -154,7 +162,7 @@ bool EventHandler::isContainer(const Event &event) const {
  */
 vector<wstring> EventHandler::getPartAttribute(const Event &event) {
   vector<wstring> partAttrs;
-  wstring part = event.getAttribute(L"part");
+  wstring part = event.getAttribute(PART_ATTR);
 
   if (part == L"lem" || part == L"lemh" || part == L"lemq" || part == L"whole"
       || part == L"tags" || part == L"chcontent" || part == L"content") {
@@ -190,14 +198,159 @@ wstring EventHandler::unEscape(wstring &wstr) const {
  */
 void EventHandler::handleEndOfParsing() {
   for (unsigned int i = 0; i < uncheckedMacros.size(); i++) {
-    checkMacro(uncheckedMacros[i]);
+    checkMacro(*uncheckedMacros[i]);
+  }
+}
+
+/**
+ * Move the calls to macros not checked yet to a vector, so they can be checked
+ * by another event handler.
+ *
+ * @param macros the vector where the calls are moved to
+ */
+void EventHandler::moveUncheckedMacros(vector<const Event *> &macros) {
+  macros = uncheckedMacros;
+  uncheckedMacros.clear();
+}
+
+/**
+ * Add some calls to macros to check at the end of parsing.
+ *
+ * @param macros the calls to the macros
+ */
+void EventHandler::addUncheckedMacros(const vector<const Event *> &macros) {
+  uncheckedMacros.insert(uncheckedMacros.end(), macros.begin(), macros.end());
+}
+
+/**
+ * Declare a macro, so the calls to it can be checked even before its code is
+ * generated.
+ *
+ * @param event the event of the macro definition
+ */
+void EventHandler::declareMacro(const Event &event) {
+  checkAttributeExists(event, N_ATTR);
+  wstring name = event.getAttribute(N_ATTR);
+
+  checkAttributeExists(event, NPAR_ATTR);
+  int npar;
+  wstringstream ws(event.getAttribute(NPAR_ATTR));
+  ws >> npar;
+
+  symbolTable.addMacro(name, npar);
+}
+
+/**
+ * Set if the macros are declared with declareMacro when they are parsed,
+ * instead of when their code is generated.
+ *
+ * @param declared true if the macros are already declared
+ */
+void EventHandler::setMacrosDeclared(bool declared) {
+  macrosDeclared = declared;
+}
+
+/**
+ * Get a key which identifies the code of a unit, a rule or a macro. It's made
+ * of its elements and attributes, whatever their format in the file, and the
+ * definitions they use, so two units with the same key get the same code.
+ *
+ * @param unit the event of the rule or macro, with all its children
+ *
+ * @return the key of the unit
+ */
+wstring EventHandler::getUnitKey(const Event &unit) const {
+  wstringstream key;
+  key << transferStage << L' ' << transferDefault << L'\n';
+  addUnitKey(unit, key);
+  return key.str();
+}
+
+/**
+ * Add an event and its children to the key of a unit. Every name and value is
+ * preceded by its size so no two different units share a key.
+ *
+ * @param event the event to add
+ * @param key the key being built
+ */
+void EventHandler::addUnitKey(const Event &event, wostream &key) const {
+  key << L'<' << event.getName();
+
+  map<wstring, wstring> attributes = event.getAttributes();
+  map<wstring, wstring>::const_iterator it;
+  for (it = attributes.begin(); it != attributes.end(); it++) {
+    key << L' ' << it->first << L'=' << it->second.size() << L':'
+        << it->second;
+  }
+
+  switch (event.getElement()) {
+  case PATTERN_ITEM_ELEM:
+    addDefinitionKey(defCats, event.getAttribute(N_ATTR), key);
+    break;
+  case CLIP_ELEM:
+  case CASE_OF_ELEM:
+    addDefinitionKey(defAttrs, event.getAttribute(PART_ATTR), key);
+    break;
+  case LIST_ELEM:
+    addDefinitionKey(defLists, event.getAttribute(N_ATTR), key);
+    break;
+  case VAR_ELEM:
+    key << (defVars.find(event.getAttribute(N_ATTR)) != defVars.end() ?
+        L" [var]" : L" [no var]");
+    break;
+  case CALL_MACRO_ELEM:
+    if (symbolTable.macroExists(event.getAttribute(N_ATTR))) {
+      key << L" [macro "
+          << symbolTable.getMacro(event.getAttribute(N_ATTR)).getNumParameters()
+          << L']';
+    } else {
+      key << L" [no macro]";
+    }
+    break;
+  default:
+    break;
+  }
+
+  key << (event.isEmpty() ? L"/>" : L">");
+
+  for (const Event *child = event.getFirstChild(); child != NULL;
+      child = child->getNextSibling()) {
+    addUnitKey(*child, key);
+  }
+
+  if (!event.isEmpty()) {
+    key << L"</" << event.getName() << L'>';
   }
 }
 
+/**
+ * Add a definition used by an event to the key of a unit.
+ *
+ * @param definitions the definitions of the same type, e.g. the categories
+ * @param name the name of the definition used
+ * @param key the key being built
+ */
+void EventHandler::addDefinitionKey(
+    const map<wstring, vector<wstring> > &definitions, const wstring &name,
+    wostream &key) const {
+  map<wstring, vector<wstring> >::const_iterator it = definitions.find(name);
+
+  if (it == definitions.end()) {
+    key << L" [none]";
+    return;
+  }
+
+  key << L" [" << it->second.size();
+  for (unsigned int i = 0; i < it->second.size(); i++) {
+    key << L' ' << it->second[i].size() << L':' << it->second[i];
+  }
+  key << L']';
+}
+
 void EventHandler::handleTransferStart(const Event &event) {
   transferStage = TRANSFER;
 
-  wstring value = event.getAttribute(L"default");
+  wstring value = event.getAttribute(DEFAULT_ATTR);
   if (value == L"chunk")
     transferDefault = CHUNK;
   else
@@ -229,8 +382,8 @@ void EventHandler::handlePostchunkEnd(const Event &event) {
 }
 
 void EventHandler::handleDefCatStart(const Event & event) {
-  checkAttributeExists(event, L"n");
-  wstring defCatId = event.getAttribute(L"n");
+  checkAttributeExists(event, N_ATTR);
+  wstring defCatId = event.getAttribute(N_ATTR);
   currentDefCat = &(defCats[defCatId]);
 }
 
@@ -242,16 +395,16 @@ void EventHandler::handleCatItemStart(const Event & event) {
   wstring catItem = L"";
 
   if (transferStage == POSTCHUNK) {
-    checkAttributeExists(event, L"name");
-    catItem = event.getAttribute(L"name");
+    checkAttributeExists(event, NAME_ATTR);
+    catItem = event.getAttribute(NAME_ATTR);
   } else {
     // lemma attribute is optional.
-    if (event.hasAttribute(L"lemma")) {
-      catItem = event.getAttribute(L"lemma");
+    if (event.hasAttribute(LEMMA_ATTR)) {
+      catItem = event.getAttribute(LEMMA_ATTR);
     }
 
-    if (event.hasAttribute(L"tags")) {
-      wstring tagsAttr = event.getAttribute(L"tags");
+    if (event.hasAttribute(TAGS_ATTR)) {
+      wstring tagsAttr = event.getAttribute(TAGS_ATTR);
       vector<wstring> tags = WstringUtils::wsplit(tagsAttr, L'.');
       for (unsigned int i = 0; i < tags.size(); i++) {
         catItem += L'<';
@@ -265,20 +418,21 @@ void EventHandler::handleCatItemStart(const Event & event) {
 }
 
 void EventHandler::handleDefAttrStart(const Event &event) {
-  checkAttributeExists(event, L"n");
-  wstring defAttrId = event.getAttribute(L"n");
+  checkAttributeExists(event, N_ATTR);
+  wstring defAttrId = event.getAttribute(N_ATTR);
   currentDefAttr = &(defAttrs[defAttrId]);
 }
 
 void EventHandler::handleDefAttrEnd(const Event &event) {
+  codeGenerator->genDefAttrEnd(event, *currentDefAttr);
   currentDefAttr = NULL;
 }
 
 void EventHandler::handleAttrItemStart(const Event &event) {
-  checkAttributeExists(event, L"tags");
+  checkAttributeExists(event, TAGS_ATTR);
   wstring attrItem = L"";
 
-  wstring tagsAttr = event.getAttribute(L"tags");
+  wstring tagsAttr = event.getAttribute(TAGS_ATTR);
   vector<wstring> tags = WstringUtils::wsplit(tagsAttr, L'.');
   for (unsigned int i = 0; i < tags.size(); i++) {
     attrItem += L'<';
@@ -290,12 +444,12 @@ void EventHandler::handleAttrItemStart(const Event &event) {
 }
 
 void EventHandler::handleDefVarStart(const Event &event) {
-  checkAttributeExists(event, L"n");
-  wstring varName = event.getAttribute(L"n");
+  checkAttributeExists(event, N_ATTR);
+  wstring varName = event.getAttribute(N_ATTR);
 
   wstring defaultValue = L"";
-  if (event.hasAttribute(L"v")) {
-    defaultValue = event.getAttribute(L"v");
+  if (event.hasAttribute(V_ATTR)) {
+    defaultValue = event.getAttribute(V_ATTR);
     if (defaultValue.find(L';') != string::npos) {
       defaultValue = unEscape(defaultValue);
     }
@@ -306,19 +460,20 @@ void EventHandler::handleDefVarStart(const Event &event) {
 }
 
 void EventHandler::handleDefListStart(const Event &event) {
-  checkAttributeExists(event, L"n");
-  wstring defListId = event.getAttribute(L"n");
+  checkAttributeExists(event, N_ATTR);
+  wstring defListId = event.getAttribute(N_ATTR);
   currentDefList = &(defLists[defListId]);
 }
 
 void EventHandler::handleDefListEnd(const Event &event) {
+  codeGenerator->genDefListEnd(event, *currentDefList);
   currentDefList = NULL;
 }
 
 void EventHandler::handleDefListItemStart(const Event &event) {
-  checkAttributeExists(event, L"v");
+  checkAttributeExists(event, V_ATTR);
 
-  wstring listItem = event.getAttribute(L"v");
+  wstring listItem = event.getAttribute(V_ATTR);
   currentDefList->push_back(listItem);
 }
 
@@ -327,15 +482,9 @@ void EventHandler::handleSectionDefMacrosStart(const Event &event) {
 }
 
 void EventHandler::handleDefMacroStart(const Event &event) {
-  checkAttributeExists(event, L"n");
-  wstring name = event.getAttribute(L"n");
-
-  checkAttributeExists(event, L"npar");
-  int npar;
-  wstringstream ws(event.getAttribute(L"npar"));
-  ws >> npar;
-
-  symbolTable.addMacro(name, npar);
+  if (!macrosDeclared) {
+    declareMacro(event);
+  }
 
   codeGenerator->genDefMacroStart(event);
 }
@@ -364,8 +513,8 @@ void EventHandler::handlePatternEnd(const Event &event) {
 }
 
 void EventHandler::handlePatternItemStart(const Event &event) {
-  checkAttributeExists(event, L"n");
-  wstring catName = event.getAttribute(L"n");
+  checkAttributeExists(event, N_ATTR);
+  wstring catName = event.getAttribute(N_ATTR);
 
   if (defCats.find(catName) == defCats.end()) {
     wstringstream msg;
@@ -387,20 +536,19 @@ void EventHandler::handleActionEnd(const Event &event) {
 }
 
 void EventHandler::handleCallMacroStart(const Event &event) {
-  checkAttributeExists(event, L"n");
+  checkAttributeExists(event, N_ATTR);
   codeGenerator->genCallMacroStart(event);
 }
 
 void EventHandler::handleCallMacroEnd(const Event &event) {
-  wstring macroName = event.getAttribute(L"n");
+  wstring macroName = event.getAttribute(N_ATTR);
 
   // In one pass we can only check for the macros already parsed, so we add
   // the other ones to check an the end.
   if (symbolTable.macroExists(macroName)) {
     checkMacro(event);
   } else {
-    Event e = event;
-    uncheckedMacros.push_back(e);
+    uncheckedMacros.push_back(&event);
   }
 
   codeGenerator->genCallMacroEnd(event);
@@ -495,8 +643,8 @@ void EventHandler::handleOutEnd(const Event &event) {
 }
 
 void EventHandler::handleVarStart(const Event &event) {
-  checkAttributeExists(event, L"n");
-  wstring varName = event.getAttribute(L"n");
+  checkAttributeExists(event, N_ATTR);
+  wstring varName = event.getAttribute(N_ATTR);
 
   if (defVars.find(varName) != defVars.end()) {
     // Check if this var acts as a container.
@@ -514,10 +662,10 @@ void EventHandler::handleInEnd(const Event &event) {
 }
 
 void EventHandler::handleClipStart(const Event &event) {
-  bool linkTo = event.hasAttribute(L"link-to");
+  bool linkTo = event.hasAttribute(LINK_TO_ATTR);
 
-  checkAttributeExists(event, L"part");
-  wstring part = event.getAttribute(L"part");
+  checkAttributeExists(event, PART_ATTR);
+  wstring part = event.getAttribute(PART_ATTR);
   vector<wstring> partAttrs = getPartAttribute(event);
 
   // Check if this clip acts as a container.
@@ -527,8 +675,8 @@ void EventHandler::handleClipStart(const Event &event) {
 }
 
 void EventHandler::handleListStart(const Event &event) {
-  checkAttributeExists(event, L"n");
-  wstring listName = event.getAttribute(L"n");
+  checkAttributeExists(event, N_ATTR);
+  wstring listName = event.getAttribute(N_ATTR);
 
   if (defLists.find(listName) != defAttrs.end()) {
     vector<wstring> list = defLists[listName];
@@ -541,7 +689,7 @@ void EventHandler::handleListStart(const Event &event) {
 }
 
 void EventHandler::handleLetEnd(const Event &event) {
-  Event container = event.getChild(0);
+  const Event &container = event.getChild(0);
   codeGenerator->genLetEnd(event, container);
 }
 
@@ -566,15 +714,15 @@ void EventHandler::handleGetCaseFromEnd(const Event &event) {
 }
 
 void EventHandler::handleCaseOfStart(const Event &event) {
-  checkAttributeExists(event, L"part");
-  wstring part = event.getAttribute(L"part");
+  checkAttributeExists(event, PART_ATTR);
+  wstring part = event.getAttribute(PART_ATTR);
   vector<wstring> partAttrs = getPartAttribute(event);
 
   codeGenerator->genCaseOfStart(event, partAttrs);
 }
 
 void EventHandler::handleModifyCaseEnd(const Event &event) {
-  Event container = event.getChild(0);
+  const Event &container = event.getChild(0);
   codeGenerator->genModifyCaseEnd(event, container);
 }
 
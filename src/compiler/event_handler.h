@@ -51,13 +51,18 @@ public:
   void setCodeGenerator(CodeGenerator *);
 
   void throwError(const Event &, const wstring &) const;
-  void checkAttributeExists(const Event &, wstring) const;
+  void checkAttributeExists(const Event &, ATTRIBUTE_NAME) const;
   void checkMacro(const Event &) const;
   bool isContainer(const Event &) const;
   vector<wstring> getPartAttribute(const Event &);
   wstring unEscape(wstring &) const;
 
   void handleEndOfParsing();
+  void moveUncheckedMacros(vector<const Event *> &);
+  void addUncheckedMacros(const vector<const Event *> &);
+  void declareMacro(const Event &);
+  void setMacrosDeclared(bool);
+  wstring getUnitKey(const Event &) const;
 
   // Handlers for each of the xml elements.
   void handleTransferStart(const Event &);
@@ -141,8 +146,11 @@ private:
   /// The symbol table is used to check information about symbols.
   SymbolTable symbolTable;
 
-  /// Store copies of the macros which aren't already defined, to check later.
-  vector<Event> uncheckedMacros;
+  /// Store the calls to macros which aren't already defined, to check later.
+  vector<const Event *> uncheckedMacros;
+
+  /// If the macros are declared before handling them, when they are parsed.
+  bool macrosDeclared;
 
   /// Store category definitions and a reference to the current one.
   map<wstring, vector<wstring> > defCats;
@@ -158,6 +166,10 @@ private:
   /// Store list definitions and a reference to the current one.
   map<wstring, vector<wstring> > defLists;
   vector<wstring> *currentDefList;
+
+  void addUnitKey(const Event &, wostream &) const;
+  void addDefinitionKey(const map<wstring, vector<wstring> > &,
+      const wstring &, wostream &) const;
 };
 
 #endif /* EVENT_HANDLER_H_ */
@@ -51,6 +51,49 @@ wstring WstringUtils::towstring(const xmlChar *input) {
   return XMLParseUtil::towstring(input);
 }
 
+/**
+ * Convert a character sequence used by xml parser to wide characters, without
+ * creating a wide string.
+ *
+ * @param input the utf-8 character sequence to convert
+ * @param output where to store the wide characters, which needs space for as
+ * many characters as bytes has the input
+ *
+ * @return the number of wide characters stored
+ */
+size_t WstringUtils::towstring(const xmlChar *input, wchar_t *output) {
+  size_t length = 0;
+
+  for (const xmlChar *c = input; *c != 0; c++) {
+    wchar_t ch;
+    int continuationBytes;
+
+    if ((*c & 0x80) == 0x00) {
+      ch = *c;
+      continuationBytes = 0;
+    } else if ((*c & 0xE0) == 0xC0) {
+      ch = *c & 0x1F;
+      continuationBytes = 1;
+    } else if ((*c & 0xF0) == 0xE0) {
+      ch = *c & 0x0F;
+      continuationBytes = 2;
+    } else {
+      ch = *c & 0x07;
+      continuationBytes = 3;
+    }
+
+    // The xml parser has already checked the sequence is valid utf-8.
+    for (int i = 0; i < continuationBytes; i++) {
+      c++;
+      ch = (ch << 6) | (*c & 0x3F);
+    }
+
+    output[length++] = ch;
+  }
+
+  return length;
+}
+
 /**
  * Convert a string to a wide string.
  *
@@ -91,3 +134,37 @@ vector<wstring> WstringUtils::wsplit(const wstring &wstr,
   return tokens;
 }
 
+/**
+ * Join several words in a wide string using a delimiter.
+ *
+ * @param words the words to join
+ * @param delimiter the wide char to put between the words
+ *
+ * @return the words separated by the delimiter
+ */
+wstring WstringUtils::wjoin(const vector<wstring> &words,
+    const wchar_t &delimiter) {
+  wstring wstr = L"";
+
+  for (unsigned int i = 0; i < words.size(); i++) {
+    if (i > 0) {
+      wstr += delimiter;
+    }
+    wstr += words[i];
+  }
+
+  return wstr;
+}
+
+
+/**
+ * Check if a wide string starts with another wide string.
+ *
+ * @param wstr the wide string to check
+ * @param prefix the wide string it should start with
+ *
+ * @return true if wstr starts with prefix, otherwise, false
+ */
+bool WstringUtils::startsWith(const wstring &wstr, const wstring &prefix) {
+  return wstr.compare(0, prefix.size(), prefix) == 0;
+}
@@ -31,8 +31,11 @@ class WstringUtils {
 public:
   static wstring replace(wstring &, const wstring &, const wstring &);
   static wstring towstring(const xmlChar *);
+  static size_t towstring(const xmlChar *, wchar_t *);
   static wstring stows(const string &);
   static vector<wstring> wsplit(const wstring &, const wchar_t&);
+  static wstring wjoin(const vector<wstring> &, const wchar_t&);
+  static bool startsWith(const wstring &, const wstring &);
 };
 
 #endif /* WSTRING_UTILS_H_ */
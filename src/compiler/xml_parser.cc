@@ -17,20 +17,37 @@
 
 #include <xml_parser.h>
 
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
 #include <wstring_utils.h>
 
 XmlParser::XmlParser() {
   reader = NULL;
+  codeGenerator = NULL;
+  jobs = 1;
+  cache = NULL;
+  currentUnit = NULL;
   lastElementWasEmpty = false;
 }
 
 XmlParser::XmlParser(int fd) {
   reader = xmlReaderForFd(fd, NULL, NULL, 0);
+  codeGenerator = NULL;
+  jobs = 1;
+  cache = NULL;
+  currentUnit = NULL;
   lastElementWasEmpty = false;
 }
 
 XmlParser::XmlParser(char *fileName) {
   reader = xmlReaderForFile(fileName, NULL, 0);
+  codeGenerator = NULL;
+  jobs = 1;
+  cache = NULL;
+  currentUnit = NULL;
   lastElementWasEmpty = false;
 }
 
@@ -55,6 +72,13 @@ XmlParser& XmlParser::operator=(const XmlParser &c) {
 void XmlParser::copy(const XmlParser &c) {
   reader = c.reader;
   eventHandler = c.eventHandler;
+  codeGenerator = c.codeGenerator;
+  jobs = c.jobs;
+  cache = c.cache;
+  currentUnit = c.currentUnit;
+  units = c.units;
+  rebuiltUnits = c.rebuiltUnits;
+  arena = c.arena;
   callStack = c.callStack;
   lastElementWasEmpty = c.lastElementWasEmpty;
 }
@@ -77,6 +101,10 @@ void XmlParser::parse() {
       ret = xmlTextReaderRead(reader);
     }
     xmlFreeTextReader(reader);
+    callStack.clear();
+    units.clear();
+    currentUnit = NULL;
+    arena.clear();
     if (ret != 0) {
       throw CompilerException(
           L"An error occurred while parsing rules the file");
@@ -90,25 +118,55 @@ void XmlParser::parse() {
  * @param codeGenerator the code generator to use
  */
 void XmlParser::setCodeGenerator(CodeGenerator *codeGenerator) {
+  this->codeGenerator = codeGenerator;
   eventHandler.setCodeGenerator(codeGenerator);
 }
 
+/**
+ * Set the number of threads used to generate the code of the rules and macros.
+ * With more than one, they are kept until the end of their section and their
+ * code is generated in parallel, giving the same code as a single thread.
+ *
+ * @param jobs the number of threads, 0 to use one per core
+ */
+void XmlParser::setJobs(unsigned int jobs) {
+  if (jobs == 0) {
+    jobs = thread::hardware_concurrency();
+  }
+  this->jobs = (jobs == 0 ? 1 : jobs);
+}
+
+/**
+ * Set the cache used to only generate the code of the rules and macros which
+ * changed since the last compilation. They are kept until the end of their
+ * section, like with more than one thread.
+ *
+ * @param cache the cache to use, NULL to generate all the code
+ */
+void XmlParser::setCache(CompilationCache *cache) {
+  this->cache = cache;
+}
+
+/**
+ * Get the rules and macros whose code was generated because it wasn't found in
+ * the cache.
+ *
+ * @return the names of the units rebuilt, e.g. "macro 'f_concord2'"
+ */
+const vector<wstring> &XmlParser::getRebuiltUnits() const {
+  return rebuiltUnits;
+}
+
 /**
  * Process an xml node calling the appropriate method depending on the type.
  */
 void XmlParser::processNode() {
-  xmlChar * xName = xmlTextReaderName(reader);
-  wstring name = WstringUtils::towstring(xName);
-  free(xName);
-  int lineNumber = xmlTextReaderGetParserLineNumber(reader);
-  map<wstring, wstring> attributes = parseAttributes();
-
   switch (xmlTextReaderNodeType(reader)) {
   case XML_READER_TYPE_ELEMENT:
-    handleStartElement(name, lineNumber, attributes);
+    handleStartElement(*createEvent());
     break;
   case XML_READER_TYPE_END_ELEMENT:
-    handleEndElement(name);
+    handleEndElement();
     break;
   default:
     break;
@@ -116,30 +174,71 @@ void XmlParser::processNode() {
 }
 
 /**
- * Parse the atributes of an xml node and convert them to a map of wide strings.
+ * Create the event of the current element, with its attributes.
+ *
+ * @return the event, owned by the arena
+ */
+Event* XmlParser::createEvent() {
+  const xmlChar *xName = xmlTextReaderConstName(reader);
+  int lineNumber = xmlTextReaderGetParserLineNumber(reader);
+
+  ELEMENT_NAME element = Event::findElement(xName);
+  wstring_view name;
+  if (element != UNKNOWN_ELEM) {
+    name = Event::getElementName(element);
+  } else {
+    name = arena.newString(xName);
+  }
+
+  Event *event = arena.newEvent(lineNumber, element, name);
+  event->setEmpty(xmlTextReaderIsEmptyElement(reader) == 1);
+  parseAttributes(*event);
+
+  return event;
+}
+
+/**
+ * Parse the atributes of an xml node and store them in the arena as wide
+ * strings.
  *
- * @return a map containing attributes pairs of key, value
+ * @param event the event of the node
  */
-map<wstring, wstring> XmlParser::parseAttributes() const {
-  map<wstring, wstring> attributes;
+void XmlParser::parseAttributes(Event &event) {
+  if (xmlTextReaderHasAttributes(reader) != 1) {
+    return;
+  }
+
+  xmlNodePtr node = xmlTextReaderCurrentNode(reader);
 
-  if (xmlTextReaderHasAttributes(reader) == 1) {
-    xmlNodePtr node = xmlTextReaderCurrentNode(reader);
+  unsigned int numAttributes = 0;
+  for (xmlAttrPtr attr = node->properties; attr != NULL; attr = attr->next) {
+    numAttributes++;
+  }
 
-    for (xmlAttrPtr attr = node->properties; attr != NULL; attr = attr->next) {
-      // Get the xml attribute name and value.
-      const xmlChar *xName = attr->name;
-      xmlChar *xValue = xmlTextReaderGetAttribute(reader, xName);
+  EventAttribute *attributes = arena.newAttributes(numAttributes);
+  unsigned int i = 0;
+  for (xmlAttrPtr attr = node->properties; attr != NULL; attr = attr->next) {
+    EventAttribute &attribute = attributes[i++];
 
-      // Convert them to wstring and store them in the map.
-      wstring name = WstringUtils::towstring(xName);
-      wstring value = WstringUtils::towstring(xValue);
-      attributes[name] = value;
+    attribute.id = Event::findAttribute(attr->name);
+    if (attribute.id != UNKNOWN_ATTR) {
+      attribute.name = Event::getAttributeName(attribute.id);
+    } else {
+      attribute.name = arena.newString(attr->name);
+    }
 
-      free(xValue);
+    // Usually the value is a single text node, which can be read in place.
+    xmlNodePtr value = attr->children;
+    if (value != NULL && value->type == XML_TEXT_NODE && value->next == NULL) {
+      attribute.value = arena.newString(value->content);
+    } else {
+      xmlChar *xValue = xmlNodeListGetString(node->doc, value, 1);
+      attribute.value = arena.newString(xValue);
+      xmlFree(xValue);
     }
   }
-  return attributes;
+
+  event.setAttributes(attributes, numAttributes);
 }
 
 /**
@@ -150,119 +249,442 @@ map<wstring, wstring> XmlParser::parseAttributes() const {
  */
 void XmlParser::detectSelfClosingElements() {
   if (lastElementWasEmpty) {
-    Event * event = callStack.back();
-    callStack.pop_back();
-    delete event;
+    popEvent();
   }
   lastElementWasEmpty =
       (xmlTextReaderIsEmptyElement(reader) == 1) ? true : false;
 }
 
 /**
- * Create an event object, push it to the stack and call the appropriate
- * eventhandler's method.
+ * Pop the last event from the stack.
  *
- * @param name the name of the element
- * @param lineNumber the line number of the event
- * @param attributes the parsed attributes of the event
+ * @return the event popped
  */
-void XmlParser::handleStartElement(const wstring &name, int lineNumber,
-    map<wstring, wstring> attributes) {
-  Event *event = new Event(lineNumber, name, attributes);
+Event* XmlParser::popEvent() {
+  Event *event = callStack.back();
+  callStack.pop_back();
 
+  if (event == currentUnit) {
+    currentUnit = NULL;
+  }
+
+  return event;
+}
+
+/**
+ * Push an event to the stack and call the appropriate eventhandler's method,
+ * unless it's part of a rule or macro generated at the end of its section.
+ *
+ * @param event the event of the element
+ */
+void XmlParser::handleStartElement(Event &event) {
   // Add the event as a child of the current top.
   if (!callStack.empty()) {
     detectSelfClosingElements();
-    const Event *top = callStack.back();
-    callStack.back()->addChild(*event);
-    event->setParent(top);
+    Event *top = callStack.back();
+    top->addChild(&event);
+    event.setParent(top);
+  }
+
+  if (currentUnit == NULL && isUnit(event)) {
+    // The calls to a macro can be checked before its code is generated.
+    if (event.getElement() == DEF_MACRO_ELEM) {
+      eventHandler.declareMacro(event);
+    }
+    currentUnit = &event;
+    units.push_back(&event);
+  }
+
+  if (currentUnit == NULL) {
+    dispatchStartElement(event, eventHandler);
+  }
+
+  callStack.push_back(&event);
+}
+
+/**
+ * Call the eventhandler's method for the start of an element.
+ *
+ * @param event the event of the element
+ * @param handler the event handler to use
+ */
+void XmlParser::dispatchStartElement(Event &event, EventHandler &handler) {
+  switch (event.getElement()) {
+  case TRANSFER_ELEM:
+    handler.handleTransferStart(event);
+    break;
+  case INTERCHUNK_ELEM:
+    handler.handleInterchunkStart(event);
+    break;
+  case POSTCHUNK_ELEM:
+    handler.handlePostchunkStart(event);
+    break;
+  case DEF_CAT_ELEM:
+    handler.handleDefCatStart(event);
+    break;
+  case CAT_ITEM_ELEM:
+    handler.handleCatItemStart(event);
+    break;
+  case DEF_ATTR_ELEM:
+    handler.handleDefAttrStart(event);
+    break;
+  case ATTR_ITEM_ELEM:
+    handler.handleAttrItemStart(event);
+    break;
+  case DEF_VAR_ELEM:
+    handler.handleDefVarStart(event);
+    break;
+  case DEF_LIST_ELEM:
+    handler.handleDefListStart(event);
+    break;
+  case LIST_ITEM_ELEM:
+    handler.handleDefListItemStart(event);
+    break;
+  case SECTION_DEF_MACROS_ELEM:
+    handler.handleSectionDefMacrosStart(event);
+    break;
+  case DEF_MACRO_ELEM:
+    handler.handleDefMacroStart(event);
+    break;
+  case SECTION_RULES_ELEM:
+    handler.handleSectionRulesStart(event);
+    break;
+  case RULE_ELEM:
+    handler.handleRuleStart(event);
+    break;
+  case PATTERN_ELEM:
+    handler.handlePatternStart(event);
+    break;
+  case PATTERN_ITEM_ELEM:
+    handler.handlePatternItemStart(event);
+    break;
+  case ACTION_ELEM:
+    handler.handleActionStart(event);
+    break;
+  case CALL_MACRO_ELEM:
+    handler.handleCallMacroStart(event);
+    break;
+  case WITH_PARAM_ELEM:
+    handler.handleWithParamStart(event);
+    break;
+  case CHOOSE_ELEM:
+    handler.handleChooseStart(event);
+    break;
+  case WHEN_ELEM:
+    handler.handleWhenStart(event);
+    break;
+  case OTHERWISE_ELEM:
+    handler.handleOtherwiseStart(event);
+    break;
+  case B_ELEM:
+    handler.handleBStart(event);
+    break;
+  case LIT_ELEM:
+    handler.handleLitStart(event);
+    break;
+  case LIT_TAG_ELEM:
+    handler.handleLitTagStart(event);
+    break;
+  case LU_COUNT_ELEM:
+    handler.handleLuCountStart(event);
+    break;
+  case CHUNK_ELEM:
+    handler.handleChunkStart(event);
+    break;
+  case VAR_ELEM:
+    handler.handleVarStart(event);
+    break;
+  case CLIP_ELEM:
+    handler.handleClipStart(event);
+    break;
+  case LIST_ELEM:
+    handler.handleListStart(event);
+    break;
+  case APPEND_ELEM:
+    handler.handleAppendStart(event);
+    break;
+  case GET_CASE_FROM_ELEM:
+    handler.handleGetCaseFromStart(event);
+    break;
+  case CASE_OF_ELEM:
+    handler.handleCaseOfStart(event);
+    break;
+  default:
+    break;
   }
 
-  if (name == L"transfer") eventHandler.handleTransferStart(*event);
-  else if (name == L"interchunk") eventHandler.handleInterchunkStart(*event);
-  else if (name == L"postchunk") eventHandler.handlePostchunkStart(*event);
-  else if (name == L"def-cat") eventHandler.handleDefCatStart(*event);
-  else if (name == L"cat-item") eventHandler.handleCatItemStart(*event);
-  else if (name == L"def-attr") eventHandler.handleDefAttrStart(*event);
-  else if (name == L"attr-item") eventHandler.handleAttrItemStart(*event);
-  else if (name == L"def-var") eventHandler.handleDefVarStart(*event);
-  else if (name == L"def-list") eventHandler.handleDefListStart(*event);
-  else if (name == L"list-item") eventHandler.handleDefListItemStart(*event);
-  else if (name == L"section-def-macros") eventHandler.handleSectionDefMacrosStart(*event);
-  else if (name == L"def-macro") eventHandler.handleDefMacroStart(*event);
-  else if (name == L"section-rules") eventHandler.handleSectionRulesStart(*event);
-  else if (name == L"rule") eventHandler.handleRuleStart(*event);
-  else if (name == L"pattern") eventHandler.handlePatternStart(*event);
-  else if (name == L"pattern-item") eventHandler.handlePatternItemStart(*event);
-  else if (name == L"action") eventHandler.handleActionStart(*event);
-  else if (name == L"call-macro") eventHandler.handleCallMacroStart(*event);
-  else if (name == L"with-param") eventHandler.handleWithParamStart(*event);
-  else if (name == L"choose") eventHandler.handleChooseStart(*event);
-  else if (name == L"when") eventHandler.handleWhenStart(*event);
-  else if (name == L"otherwise") eventHandler.handleOtherwiseStart(*event);
-  else if (name == L"b") eventHandler.handleBStart(*event);
-  else if (name == L"lit") eventHandler.handleLitStart(*event);
-  else if (name == L"lit-tag") eventHandler.handleLitTagStart(*event);
-  else if (name == L"lu-count") eventHandler.handleLuCountStart(*event);
-  else if (name == L"chunk") eventHandler.handleChunkStart(*event);
-  else if (name == L"var") eventHandler.handleVarStart(*event);
-  else if (name == L"clip") eventHandler.handleClipStart(*event);
-  else if (name == L"list") eventHandler.handleListStart(*event);
-  else if (name == L"append") eventHandler.handleAppendStart(*event);
-  else if (name == L"get-case-from") eventHandler.handleGetCaseFromStart(*event);
-  else if (name == L"case-of") eventHandler.handleCaseOfStart(*event);
-
-  callStack.push_back(event);
 }
 
 /**
  * Pop the last event from the stack and call the appropriate eventhandler's
- * method.
+ * method, unless it's part of a rule or macro generated at the end of its
+ * section.
+ */
+void XmlParser::handleEndElement() {
+  if (callStack.empty()) {
+    return;
+  }
+
+  detectSelfClosingElements();
+  bool inUnit = (currentUnit != NULL);
+  Event *event = popEvent();
+
+  if (!inUnit) {
+    if (event->getElement() == SECTION_DEF_MACROS_ELEM
+        || event->getElement() == SECTION_RULES_ELEM) {
+      generateUnits();
+    }
+    dispatchEndElement(*event, eventHandler);
+  }
+}
+
+/**
+ * Call the eventhandler's method for the end of an element.
  *
- * @param name the name of the event
+ * @param event the event of the element
+ * @param handler the event handler to use
  */
-void XmlParser::handleEndElement(const wstring &name) {
-  Event *event;
-  if (!callStack.empty()) {
-    detectSelfClosingElements();
-    event = callStack.back();
-    callStack.pop_back();
+void XmlParser::dispatchEndElement(Event &event, EventHandler &handler) {
+  switch (event.getElement()) {
+  case TRANSFER_ELEM:
+    handler.handleTransferEnd(event);
+    break;
+  case INTERCHUNK_ELEM:
+    handler.handleInterchunkEnd(event);
+    break;
+  case POSTCHUNK_ELEM:
+    handler.handlePostchunkEnd(event);
+    break;
+  case DEF_CAT_ELEM:
+    handler.handleDefCatEnd(event);
+    break;
+  case DEF_ATTR_ELEM:
+    handler.handleDefAttrEnd(event);
+    break;
+  case DEF_LIST_ELEM:
+    handler.handleDefListEnd(event);
+    break;
+  case DEF_MACRO_ELEM:
+    handler.handleDefMacroEnd(event);
+    break;
+  case SECTION_RULES_ELEM:
+    handler.handleSectionRulesEnd(event);
+    break;
+  case PATTERN_ELEM:
+    handler.handlePatternEnd(event);
+    break;
+  case ACTION_ELEM:
+    handler.handleActionEnd(event);
+    break;
+  case CALL_MACRO_ELEM:
+    handler.handleCallMacroEnd(event);
+    break;
+  case CHOOSE_ELEM:
+    handler.handleChooseEnd(event);
+    break;
+  case WHEN_ELEM:
+    handler.handleWhenEnd(event);
+    break;
+  case TEST_ELEM:
+    handler.handleTestEnd(event);
+    break;
+  case TAGS_ELEM:
+    handler.handleTagsEnd(event);
+    break;
+  case LU_ELEM:
+    handler.handleLuEnd(event);
+    break;
+  case MLU_ELEM:
+    handler.handleMluEnd(event);
+    break;
+  case CHUNK_ELEM:
+    handler.handleChunkEnd(event);
+    break;
+  case EQUAL_ELEM:
+    handler.handleEqualEnd(event);
+    break;
+  case AND_ELEM:
+    handler.handleAndEnd(event);
+    break;
+  case OR_ELEM:
+    handler.handleOrEnd(event);
+    break;
+  case NOT_ELEM:
+    handler.handleNotEnd(event);
+    break;
+  case OUT_ELEM:
+    handler.handleOutEnd(event);
+    break;
+  case IN_ELEM:
+    handler.handleInEnd(event);
+    break;
+  case LET_ELEM:
+    handler.handleLetEnd(event);
+    break;
+  case CONCAT_ELEM:
+    handler.handleConcatEnd(event);
+    break;
+  case APPEND_ELEM:
+    handler.handleAppendEnd(event);
+    break;
+  case GET_CASE_FROM_ELEM:
+    handler.handleGetCaseFromEnd(event);
+    break;
+  case MODIFY_CASE_ELEM:
+    handler.handleModifyCaseEnd(event);
+    break;
+  case BEGINS_WITH_ELEM:
+    handler.handleBeginsWithEnd(event);
+    break;
+  case BEGINS_WITH_LIST_ELEM:
+    handler.handleBeginsWithListEnd(event);
+    break;
+  case ENDS_WITH_ELEM:
+    handler.handleEndsWithEnd(event);
+    break;
+  case ENDS_WITH_LIST_ELEM:
+    handler.handleEndsWithListEnd(event);
+    break;
+  case CONTAINS_SUBSTRING_ELEM:
+    handler.handleContainsSubstringEnd(event);
+    break;
+  default:
+    break;
   }
+}
 
-  if (name == L"transfer") eventHandler.handleTransferEnd(*event);
-  else if (name == L"interchunk") eventHandler.handleInterchunkEnd(*event);
-  else if (name == L"postchunk") eventHandler.handlePostchunkEnd(*event);
-  else if (name == L"def-cat") eventHandler.handleDefCatEnd(*event);
-  else if (name == L"def-attr") eventHandler.handleDefAttrEnd(*event);
-  else if (name == L"def-list") eventHandler.handleDefListEnd(*event);
-  else if (name == L"def-macro") eventHandler.handleDefMacroEnd(*event);
-  else if (name == L"section-rules") eventHandler.handleSectionRulesEnd(*event);
-  else if (name == L"pattern") eventHandler.handlePatternEnd(*event);
-  else if (name == L"action") eventHandler.handleActionEnd(*event);
-  else if (name == L"call-macro") eventHandler.handleCallMacroEnd(*event);
-  else if (name == L"choose") eventHandler.handleChooseEnd(*event);
-  else if (name == L"when") eventHandler.handleWhenEnd(*event);
-  else if (name == L"test") eventHandler.handleTestEnd(*event);
-  else if (name == L"tags") eventHandler.handleTagsEnd(*event);
-  else if (name == L"lu") eventHandler.handleLuEnd(*event);
-  else if (name == L"mlu") eventHandler.handleMluEnd(*event);
-  else if (name == L"chunk") eventHandler.handleChunkEnd(*event);
-  else if (name == L"equal") eventHandler.handleEqualEnd(*event);
-  else if (name == L"and") eventHandler.handleAndEnd(*event);
-  else if (name == L"or") eventHandler.handleOrEnd(*event);
-  else if (name == L"not") eventHandler.handleNotEnd(*event);
-  else if (name == L"out") eventHandler.handleOutEnd(*event);
-  else if (name == L"in") eventHandler.handleInEnd(*event);
-  else if (name == L"let") eventHandler.handleLetEnd(*event);
-  else if (name == L"concat") eventHandler.handleConcatEnd(*event);
-  else if (name == L"append") eventHandler.handleAppendEnd(*event);
-  else if (name == L"get-case-from") eventHandler.handleGetCaseFromEnd(*event);
-  else if (name == L"modify-case") eventHandler.handleModifyCaseEnd(*event);
-  else if (name == L"begins-with") eventHandler.handleBeginsWithEnd(*event);
-  else if (name == L"begins-with-list") eventHandler.handleBeginsWithListEnd(*event);
-  else if (name == L"ends-with") eventHandler.handleEndsWithEnd(*event);
-  else if (name == L"ends-with-list") eventHandler.handleEndsWithListEnd(*event);
-  else if (name == L"contains-substring") eventHandler.handleContainsSubstringEnd(*event);
-
-  delete event;
+/**
+ * Call the eventhandler's methods for an element and all its children, in the
+ * same order as if they were being parsed.
+ *
+ * @param event the event of the element
+ * @param handler the event handler to use
+ */
+void XmlParser::replayEvents(Event &event, EventHandler &handler) {
+  dispatchStartElement(event, handler);
+
+  for (Event *child = event.getFirstChild(); child != NULL;
+      child = child->getNextSibling()) {
+    replayEvents(*child, handler);
+  }
+
+  if (!event.isEmpty()) {
+    dispatchEndElement(event, handler);
+  }
+}
+
+/**
+ * Check if the code of an event is generated apart from the parsing, at the
+ * end of its section, which is done for the rules and macros when they are
+ * generated with some threads or looked for in the cache.
+ *
+ * @param event the event to check
+ *
+ * @return true if the event is a rule or macro generated apart
+ */
+bool XmlParser::isUnit(const Event &event) const {
+  return (jobs > 1 || cache != NULL) && (event.getElement() == RULE_ELEM
+      || event.getElement() == DEF_MACRO_ELEM);
+}
+
+/**
+ * Get a name to show a rule or macro to the user.
+ *
+ * @param unit the event of the rule or macro
+ *
+ * @return the name of the macro or the line of the rule
+ */
+wstring XmlParser::getUnitName(const Event &unit) const {
+  wstringstream name;
+
+  if (unit.getElement() == DEF_MACRO_ELEM) {
+    name << L"macro '" << unit.getAttribute(N_ATTR) << L"'";
+  } else {
+    name << L"rule at line " << unit.getLineNumber();
+  }
+
+  return name.str();
+}
+
+/**
+ * Generate the code of the rules or macros kept, dividing them between some
+ * threads. Each unit gets its own forked code generator, and they are joined
+ * in order, so the code is the same as with a single thread. The units found
+ * in the cache only need to be joined, and the other ones are added to it.
+ */
+void XmlParser::generateUnits() {
+  vector<wstring> keys(units.size());
+  vector<CodeGenerator *> generators(units.size(), NULL);
+  vector<unsigned int> pending;
+
+  for (unsigned int i = 0; i < units.size(); i++) {
+    vector<wstring> unitCode;
+    if (cache != NULL) {
+      keys[i] = eventHandler.getUnitKey(*units[i]);
+      if (cache->find(keys[i], unitCode)) {
+        generators[i] = codeGenerator->forkUnit(*units[i], unitCode);
+      }
+    }
+    if (generators[i] == NULL) {
+      generators[i] = codeGenerator->forkUnit(*units[i]);
+      pending.push_back(i);
+    }
+  }
+
+  // Each thread takes the next unit not taken yet, with its own copy of the
+  // event handler. The errors are kept to throw the one of the first unit.
+  vector<vector<const Event *> > uncheckedMacros(units.size());
+  vector<exception_ptr> errors(units.size());
+  atomic<unsigned int> nextUnit(0);
+
+  auto generate = [&]() {
+    EventHandler handler = eventHandler;
+    handler.setMacrosDeclared(true);
+    for (unsigned int p = nextUnit++; p < pending.size(); p = nextUnit++) {
+      unsigned int i = pending[p];
+      handler.setCodeGenerator(generators[i]);
+      try {
+        replayEvents(*units[i], handler);
+      } catch (...) {
+        errors[i] = current_exception();
+      }
+      handler.moveUncheckedMacros(uncheckedMacros[i]);
+    }
+  };
+
+  unsigned int numThreads = min(jobs, (unsigned int) pending.size());
+  vector<thread> threads;
+  for (unsigned int i = 1; i < numThreads; i++) {
+    threads.push_back(thread(generate));
+  }
+  generate();
+  for (unsigned int i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+
+  exception_ptr error = NULL;
+  for (unsigned int p = 0; p < pending.size(); p++) {
+    unsigned int i = pending[p];
+    if (error == NULL && errors[i] != NULL) {
+      error = errors[i];
+    }
+    if (error == NULL && cache != NULL) {
+      cache->add(keys[i], codeGenerator->getUnitCode(generators[i]));
+      rebuiltUnits.push_back(getUnitName(*units[i]));
+    }
+  }
+
+  for (unsigned int i = 0; i < units.size(); i++) {
+    if (error == NULL) {
+      codeGenerator->joinUnit(generators[i]);
+      eventHandler.addUncheckedMacros(uncheckedMacros[i]);
+    } else {
+      delete generators[i];
+    }
+  }
+  units.clear();
+
+  if (error) {
+    rethrow_exception(error);
+  }
 }
@@ -19,13 +19,16 @@
 #define XMLPARSER_H_
 
 #include <iostream>
-#include <list>
+#include <vector>
+#include <exception>
 #include <libxml/xmlreader.h>
 
 #include <compiler_exception.h>
 #include <code_generator.h>
 #include <event_handler.h>
 #include <event.h>
+#include <event_arena.h>
+#include <compilation_cache.h>
 
 using namespace std;
 
@@ -44,6 +47,9 @@ public:
 
   void parse();
   void setCodeGenerator(CodeGenerator*);
+  void setJobs(unsigned int);
+  void setCache(CompilationCache *);
+  const vector<wstring> &getRebuiltUnits() const;
 
 private:
   /// The libxml2's XML reader
@@ -52,17 +58,46 @@ private:
   /// The event handler used to handle the xml elements.
   EventHandler eventHandler;
 
+  /// The code generator used by the event handler.
+  CodeGenerator *codeGenerator;
+
+  /// Number of threads used to generate the code of the rules and macros.
+  unsigned int jobs;
+
+  /// The cache with the code of the rules and macros, if one is used.
+  CompilationCache *cache;
+
+  /// The rule or macro being parsed, if its code is generated apart.
+  Event *currentUnit;
+
+  /// The rules or macros parsed whose code hasn't been generated yet.
+  vector<Event*> units;
+
+  /// The rules and macros whose code wasn't found in the cache.
+  vector<wstring> rebuiltUnits;
+
+  /// The events of the file, freed all at once when the parsing ends.
+  EventArena arena;
+
   /// The call stack with the parsed events.
-  list<Event*> callStack;
+  vector<Event*> callStack;
 
   /// Store if the last element was empty (self-closing) to pop it from stack.
   bool lastElementWasEmpty;
 
   void detectSelfClosingElements();
   void processNode();
-  map<wstring, wstring> parseAttributes() const;
-  void handleStartElement(const wstring &, int, map<wstring, wstring>);
-  void handleEndElement(const wstring &);
+  Event *createEvent();
+  void parseAttributes(Event &);
+  Event *popEvent();
+  void handleStartElement(Event &);
+  void handleEndElement();
+  void dispatchStartElement(Event &, EventHandler &);
+  void dispatchEndElement(Event &, EventHandler &);
+  void replayEvents(Event &, EventHandler &);
+  bool isUnit(const Event &) const;
+  wstring getUnitName(const Event &) const;
+  void generateUnits();
 };
 
 #endif /* XMLPARSER_H_ */
@@ -30,13 +30,27 @@ using namespace std;
 AssemblyLoader::AssemblyLoader() {
   currentLineNumber = 0;
   nextMacroNumber = 0;
+  optimizer = NULL;
+  hasSymbols = false;
 }
 
 AssemblyLoader::AssemblyLoader(char *fileName) {
   currentLineNumber = 0;
   nextMacroNumber = 0;
+  optimizer = NULL;
+  hasSymbols = false;
   codeFileName = fileName;
 
+  fillOpCodes(opCodes);
+}
+
+/**
+ * Fill a map with the assembly representation of every instruction as key and
+ * its vm opcode as value.
+ *
+ * @param opCodes the map to fill
+ */
+void AssemblyLoader::fillOpCodes(map<wstring, OP_CODE> &opCodes) {
   opCodes[L"addtrie"] = ADDTRIE;      opCodes[L"and"] = AND;
   opCodes[L"append"] = APPEND;        opCodes[L"begins-with"] = BEGINS_WITH;
   opCodes[L"call"] = CALL;            opCodes[L"case-of"] = CASE_OF;
@@ -53,7 +67,7 @@ AssemblyLoader::AssemblyLoader(char *fileName) {
   opCodes[L"out"] = OUT;              opCodes[L"or"] = OR;
   opCodes[L"ret"] = RET;              opCodes[L"storecl"] = STORECL;
   opCodes[L"storesl"] = STORESL;      opCodes[L"storetl"] = STORETL;
-  opCodes[L"storev"] = STOREV;
+  opCodes[L"storev"] = STOREV;        opCodes[L"switch"] = SWITCH;
 
   opCodes[L"begins-with-ig"] = BEGINS_WITH_IG;
   opCodes[L"cmp-substr"] = CMP_SUBSTR;
@@ -88,6 +102,11 @@ void AssemblyLoader::copy(const AssemblyLoader &c) {
   macroNumber = c.macroNumber;
   reversedMacroNumber = c.reversedMacroNumber;
   nextMacroNumber = c.nextMacroNumber;
+  optimizer = c.optimizer;
+  hasSymbols = c.hasSymbols;
+  attrSymbols = c.attrSymbols;
+  listSymbols = c.listSymbols;
+  varSymbols = c.varSymbols;
 }
 
 /**
@@ -200,8 +219,9 @@ void AssemblyLoader::load(CodeUnit &preprocessCode, CodeUnit &code,
         // instr, just keep the line as the first operand to later process it.
         instr.op1 = line;
         codeUnit.code.push_back(instr);
-      } else if (getInternalRepresentation(line, codeUnit, instr)) {
-        addInstructionToCodeUnit(instr, codeUnit);
+      } else if (getInternalRepresentation(line, codeUnit, instr,
+          *currentScope)) {
+        addInstructionToCodeUnit(instr, codeUnit, *currentScope);
       }
     }
   }
@@ -231,12 +251,15 @@ void AssemblyLoader::loadCodeSection(wfstream &file, CodeUnit &code) {
     // Ignore comments.
     if (line[0] == L'#') {
       continue;
+    } else if (line[0] == L'.') {
+      loadSymbol(line, code);
+      continue;
     }
 
     Instruction instr;
     instr.lineNumber = currentLineNumber;
-    if (getInternalRepresentation(line, code, instr)) {
-      addInstructionToCodeUnit(instr, code);
+    if (getInternalRepresentation(line, code, instr, *currentScope)) {
+      addInstructionToCodeUnit(instr, code, *currentScope);
     }
     if (line == L"jmp section_rules_start") {
       return;
@@ -245,6 +268,99 @@ void AssemblyLoader::loadCodeSection(wfstream &file, CodeUnit &code) {
   code.loaded = true;
 }
 
+/**
+ * Load a definition of the symbol section, e.g. .attr 3 "<sg>|<pl>". The
+ * variables also get their default value, as if the code section stored it.
+ *
+ * @param line the line with the definition
+ * @param code the main code unit of the vm
+ */
+void AssemblyLoader::loadSymbol(const wstring &line, CodeUnit &code) {
+  wstringstream ws(line);
+  wstring type;
+  unsigned int index;
+  ws >> type >> index;
+
+  size_t start = line.find(L'"');
+  size_t end = line.find(L'"', start + 1);
+  if (ws.fail() || start == wstring::npos || end == wstring::npos) {
+    throwError(L"Wrong symbol definition: " + line);
+  }
+  wstring value = line.substr(start + 1, end - start - 1);
+
+  vector<wstring> *symbols = NULL;
+  if (type == L".attr") {
+    symbols = &attrSymbols;
+  } else if (type == L".list") {
+    symbols = &listSymbols;
+  } else if (type == L".var") {
+    symbols = &varSymbols;
+  } else {
+    throwError(L"Unrecognized symbol type: " + line);
+  }
+
+  if (index != symbols->size()) {
+    throwError(L"Symbols have to be defined in order: " + line);
+  }
+  symbols->push_back(value);
+  hasSymbols = true;
+
+  if (type == L".var") {
+    size_t defaultStart = line.find(L'"', end + 1);
+    if (defaultStart == wstring::npos || line[line.size() - 1] != L'"') {
+      throwError(L"Variable without default value: " + line);
+    }
+
+    Instruction instr;
+    instr.lineNumber = currentLineNumber;
+    instr.opCode = PUSH;
+    instr.op1 = L"\"" + value + L"\"";
+    addInstructionToCodeUnit(instr, code, *currentScope);
+    instr.op1 = line.substr(defaultStart);
+    addInstructionToCodeUnit(instr, code, *currentScope);
+    instr.opCode = STOREV;
+    instr.op1 = L"";
+    addInstructionToCodeUnit(instr, code, *currentScope);
+  }
+}
+
+/**
+ * Get the operand referenced by a push instruction to the symbol section. The
+ * attributes and lists, e.g. @attr_3, are pushed as literals, the variables
+ * as their value, @var_3, or their name, &var_3.
+ *
+ * @param ref the reference to the symbol
+ * @param lineNumber the line of the instruction, for the error messages
+ *
+ * @return the operand as if the symbol was written in the instruction
+ */
+wstring AssemblyLoader::getSymbolOperand(const wstring &ref,
+    unsigned int lineNumber) const {
+  size_t separator = ref.rfind(L'_');
+  wstring type = ref.substr(1, separator == wstring::npos ? 0 : separator - 1);
+  wstringstream ws(separator == wstring::npos ? L"" : ref.substr(separator + 1));
+  unsigned int index;
+
+  const vector<wstring> *symbols = NULL;
+  if (type == L"attr" && ref[0] == L'@') {
+    symbols = &attrSymbols;
+  } else if (type == L"list" && ref[0] == L'@') {
+    symbols = &listSymbols;
+  } else if (type == L"var") {
+    symbols = &varSymbols;
+  }
+
+  if (symbols == NULL || !(ws >> index) || !ws.eof()
+      || index >= symbols->size()) {
+    throwError(L"Unknown symbol: " + ref, lineNumber);
+  }
+
+  if (type == L"var" && ref[0] == L'@') {
+    return (*symbols)[index];
+  }
+  return L"\"" + (*symbols)[index] + L"\"";
+}
+
 /**
  * Process a code unit already preloaded converting all instructions to the
  * internal vm representation and translating labels into addresses etc.
@@ -252,33 +368,61 @@ void AssemblyLoader::loadCodeSection(wfstream &file, CodeUnit &code) {
  * @param unit the code unit containing the code (a rule or macro)
  */
 void AssemblyLoader::loadCodeUnit(CodeUnit &unit) {
-  CodeUnit preloadedUnit = unit;
-  unit.code.clear();
-  createNewScope();
+  vector<Instruction> preloadedCode;
+  preloadedCode.swap(unit.code);
+  unit.code.reserve(preloadedCode.size());
 
-  for (unsigned int i = 0; i < preloadedUnit.code.size(); i++) {
+  // Each code unit has its own scope, which isn't shared with other units
+  // which could be loaded at the same time.
+  Scope scope;
+
+  for (unsigned int i = 0; i < preloadedCode.size(); i++) {
     Instruction instr;
-    instr.lineNumber = preloadedUnit.code[i].lineNumber;
-    if (getInternalRepresentation(preloadedUnit.code[i].op1, unit, instr)) {
-      addInstructionToCodeUnit(instr, unit);
+    instr.lineNumber = preloadedCode[i].lineNumber;
+    if (getInternalRepresentation(preloadedCode[i].op1, unit, instr, scope)) {
+      addInstructionToCodeUnit(instr, unit, scope);
     }
   }
 
-  currentScope->backPatchLabels(unit);
-  deleteCurrentScope();
+  scope.backPatchLabels(unit);
+  if (optimizer != NULL) {
+    optimizer->optimize(unit);
+  }
   unit.loaded = true;
 }
 
+/**
+ * Set an optimizer to apply to every rule and macro once their labels are
+ * converted to addresses.
+ *
+ * @param optimizer the optimizer to use or NULL to not optimize the code
+ */
+void AssemblyLoader::setOptimizer(Optimizer *optimizer) {
+  this->optimizer = optimizer;
+}
+
+/**
+ * Get the name of a macro, as written in the code file, from its number.
+ *
+ * @param number the number of the macro
+ *
+ * @return the name of the macro or "" if there isn't any with that number
+ */
+wstring AssemblyLoader::getMacroNameFromNumber(unsigned int number) {
+  return getMacroNameFromNumber(to_wstring(number));
+}
+
 /**
  * Add a instruction to a code unit, incrementing the appropriate address.
  *
  * @param instruction the instruction to add
  * @param codeUnit the code unit to add the instruction to
+ * @param scope the scope of the code unit
  */
 void AssemblyLoader::addInstructionToCodeUnit(Instruction instruction,
-    CodeUnit &codeUnit) {
+    CodeUnit &codeUnit, Scope &scope) {
   codeUnit.code.push_back(instruction);
-  currentScope->nextAddress++;
+  scope.nextAddress++;
 }
 
 /**
@@ -361,12 +505,13 @@ wstring AssemblyLoader::getMacroName(const wstring &macroLabel) const {
  * @param line the line as read from the code file
  * @param codeUnit the current code unit where the instruction belongs
  * @param instr the instruction structure to fill in with the vm representation
+ * @param scope the scope of the code unit, with its labels
  *
  * @return true if the instruction was filled, false if the instruction
  * structure can be ignored, for example if it's a label
  */
 bool AssemblyLoader::getInternalRepresentation(const wstring &line,
-    CodeUnit &codeUnit, Instruction &instr) {
+    CodeUnit &codeUnit, Instruction &instr, Scope &scope) const {
   // First, we get the name of the instruction or process it if it's a label.
   wstring instrName = L"";
   unsigned int pos;
@@ -377,7 +522,7 @@ bool AssemblyLoader::getInternalRepresentation(const wstring &line,
       break;
     } else if (ch == L':') {
       // If it's a label, just create a new address for it and end.
-      currentScope->createNewLabelAddress(instrName);
+      scope.createNewLabelAddress(instrName);
       return false;
     } else {
       instrName += ch;
@@ -390,7 +535,7 @@ bool AssemblyLoader::getInternalRepresentation(const wstring &line,
   if (it != opCodes.end()) {
     instr.opCode = it->second;
   } else {
-    throwError(L"Unrecognized instruction: " + line);
+    throwError(L"Unrecognized instruction: " + line, instr.lineNumber);
   }
 
   // Finally, we handle the operand.
@@ -418,7 +563,14 @@ bool AssemblyLoader::getInternalRepresentation(const wstring &line,
     case JMP: /* falls through */
     case JZ: /* falls through */
     case JNZ:
-      instr.op1 = currentScope->getReferenceToLabel(operand, codeUnit);
+      instr.op1 = scope.getReferenceToLabel(operand, codeUnit);
+      break;
+    case PUSH:
+      if (hasSymbols && (operand[0] == L'@' || operand[0] == L'&')) {
+        instr.op1 = getSymbolOperand(operand, instr.lineNumber);
+      } else {
+        instr.op1 = operand;
+      }
       break;
     default:
       instr.op1 = operand;
@@ -435,8 +587,20 @@ bool AssemblyLoader::getInternalRepresentation(const wstring &line,
  * @param msg the message describing the problem
  */
 void AssemblyLoader::throwError(const wstring &msg) const {
+  throwError(msg, currentLineNumber);
+}
+
+/**
+ * Throw a loader specific error with the line of the code file where it was
+ * found.
+ *
+ * @param msg the message describing the problem
+ * @param lineNumber the line of the code file
+ */
+void AssemblyLoader::throwError(const wstring &msg,
+    unsigned int lineNumber) const {
   wstringstream ws;
-  ws << L"line " << currentLineNumber << L", " << msg;
+  ws << L"line " << lineNumber << L", " << msg;
   throw LoaderException(ws.str());
 }
 
@@ -33,7 +33,8 @@ using namespace std;
  * and preprocess sections but rules and macros are only preloaded. This means
  * that the first time, and not until then, a rule or a macro is called, the
  * loader will convert them to the internal vm representation and process them
- * properly.
+ * properly. Once load has finished, different code units can be processed at
+ * the same time from different threads.
  */
 class AssemblyLoader: public Loader {
 
@@ -49,6 +50,10 @@ public:
   void load(CodeUnit &, CodeUnit &, CodeSection &, CodeSection &,
       unsigned int &);
   void loadCodeUnit(CodeUnit &);
+  void setOptimizer(Optimizer *);
+  wstring getMacroNameFromNumber(unsigned int);
+
+  static void fillOpCodes(map<wstring, OP_CODE> &);
 
   void printCodeSection(const CodeSection &, const wstring &, const wstring &);
   void printCodeUnit(const CodeUnit &, const wstring &);
@@ -82,15 +87,34 @@ private:
   /// Each macro name needs a unique number.
   unsigned int nextMacroNumber;
 
+  /// Optimizer applied to the rules and macros once loaded, if any.
+  Optimizer *optimizer;
+
+  /// If the code file has a symbol section, so its references are resolved.
+  bool hasSymbols;
+
+  /// The attributes of the symbol section, as their tags separated by '|'.
+  vector<wstring> attrSymbols;
+
+  /// The lists of the symbol section, as their items separated by '|'.
+  vector<wstring> listSymbols;
+
+  /// The names of the variables of the symbol section.
+  vector<wstring> varSymbols;
+
   void loadCodeSection(wfstream &, CodeUnit &);
-  void addInstructionToCodeUnit(Instruction, CodeUnit&);
+  void loadSymbol(const wstring &, CodeUnit &);
+  wstring getSymbolOperand(const wstring &, unsigned int) const;
+  void addInstructionToCodeUnit(Instruction, CodeUnit&, Scope &);
   void createNewScope();
   void deleteCurrentScope();
   wstring getRuleNumber(const wstring &) const;
   wstring getNextMacroNumber();
   wstring getMacroName(const wstring &) const;
-  bool getInternalRepresentation(const wstring &, CodeUnit &, Instruction &);
+  bool getInternalRepresentation(const wstring &, CodeUnit &, Instruction &,
+      Scope &) const;
   void throwError(const wstring &) const;
+  void throwError(const wstring &, unsigned int) const;
 
   bool startsWith(const wstring &, const wstring &) const;
   bool endsWith(const wstring &, const wstring &) const;
@@ -17,23 +17,31 @@
 
 #include "bilingual_lexical_unit.h"
 
+#include <stdexcept>
+
 BilingualLexicalUnit::BilingualLexicalUnit() {
   whole = L"";
   lem = L"";
-  lemh = L"";
-  lemq = L"";
-  tags = L"";
+  lemhSize = 0;
+  lemqSize = 0;
+  tagsSize = 0;
+  isLemStored = false;
   isParsed = false;
   lemqBeforeTags = false;
+  isTagSequenceSynced = false;
+  isTagSequenceValid = false;
 }
 
 BilingualLexicalUnit::BilingualLexicalUnit(const wstring &whole) {
   lem = L"";
-  lemh = L"";
-  lemq = L"";
-  tags = L"";
+  lemhSize = 0;
+  lemqSize = 0;
+  tagsSize = 0;
+  isLemStored = false;
   isParsed = false;
   lemqBeforeTags = false;
+  isTagSequenceSynced = false;
+  isTagSequenceValid = false;
 
   this->whole = whole;
 }
@@ -57,16 +65,20 @@ BilingualLexicalUnit& BilingualLexicalUnit::operator=(const BilingualLexicalUnit
 void BilingualLexicalUnit::copy(const BilingualLexicalUnit &lu) {
   whole = lu.whole;
   lem = lu.lem;
-  lemh = lu.lemh;
-  lemq = lu.lemq;
-  tags = lu.tags;
+  lemhSize = lu.lemhSize;
+  lemqSize = lu.lemqSize;
+  tagsSize = lu.tagsSize;
+  isLemStored = lu.isLemStored;
   isParsed = lu.isParsed;
   lemqBeforeTags = lu.lemqBeforeTags;
+  tagSequence = lu.tagSequence;
+  isTagSequenceSynced = lu.isTagSequenceSynced;
+  isTagSequenceValid = lu.isTagSequenceValid;
 }
 
 /**
- * Parse the content of the whole attribute and fill all the individual
- * components.
+ * Parse the content of the whole attribute and compute the size of all the
+ * individual components. No component is copied out of whole.
  */
 void BilingualLexicalUnit::parse() {
   // Get the positions of the key characters.
@@ -78,83 +90,76 @@ void BilingualLexicalUnit::parse() {
     // Set tags depending on if the '#' is before or after tags.
     if (head == wstring::npos || head < tag) {
       lemqBeforeTags = true;
-      lem = whole.substr(0, tag);
-      tags = whole.substr(tag, size);
+      tagsSize = size - tag;
     } else {
       lemqBeforeTags = false;
-      lem = whole.substr(0, tag) + whole.substr(head, size);
-      tags = whole.substr(tag, head - tag);
+      tagsSize = head - tag;
     }
   } else {
     // If there isn't any tag, the lemma is everything.
-    lem = whole;
-    tags = L"";
+    tagsSize = 0;
   }
 
   if (head != wstring::npos) {
     // Set lemh, lemq depending on if the '#' is before or after tags.
     if (tag == wstring::npos || head < tag) {
-      lemh = whole.substr(0, head);
-      lemq = whole.substr(head, tag - head);
+      lemhSize = head;
+      lemqSize = (tag == wstring::npos ? size : tag) - head;
     } else {
-      lemh = whole.substr(0, tag);
-      lemq = whole.substr(head, size);
-
+      lemhSize = tag;
+      lemqSize = size - head;
     }
   } else {
     // If it isn't a multiword, then the lemh is the lemma.
-    lemh = lem;
-    lemq = L"";
+    lemhSize = (tag == wstring::npos ? size : tag);
+    lemqSize = 0;
   }
 
+  lem = L"";
+  isLemStored = false;
   isParsed = true;
+  isTagSequenceSynced = false;
 }
 
 /**
- * Get the whole attribute of the lexical unit. If the lexical unit is not
- * parsed, just return the unparsed whole to save processing time. If the
- * unit is parsed, return the combination of the individual components.
+ * Get the whole attribute of the lexical unit. The whole buffer is always kept
+ * up to date with the individual components, so no combination is needed.
  *
  * @return the whole lexical unit
  */
-wstring BilingualLexicalUnit::getWhole() const {
-  if (!isParsed) {
-    return whole;
-  } else {
-    if (lemqBeforeTags) {
-      return lemh + lemq + tags;
-    } else {
-      return lemh + tags + lemq;
-    }
-  }
+const wstring& BilingualLexicalUnit::getWhole() {
+  return whole;
 }
 
 /**
- * Get an attribute of the lexical unit.
+ * Get an attribute of the lexical unit. The view returned is only valid until
+ * the lexical unit is modified.
  *
  * @param part the part to get
  *
  * @return the part
  */
-wstring BilingualLexicalUnit::getPart(LU_PART part) {
+wstring_view BilingualLexicalUnit::getPart(LU_PART part) {
   // If we want a part but the lu is not parsed, we need to parse it.
   if (part != WHOLE && !isParsed) {
     parse();
   }
 
+  wstring_view wholeView = whole;
+
   switch (part) {
   case WHOLE:
-    return getWhole();
+    return wholeView;
   case LEM:
-    return lem;
+    return getLem();
   case LEMH:
-    return lemh;
+    return wholeView.substr(0, lemhSize);
   case LEMQ:
-    return lemq;
+    return wholeView.substr(getLemqStart(), lemqSize);
   case TAGS:
-    return tags;
+    return wholeView.substr(getTagsStart(), tagsSize);
   default:
-    return whole;
+    return wholeView;
   }
 }
 
@@ -177,19 +182,23 @@ void BilingualLexicalUnit::changePart(LU_PART part, const wstring &value) {
     isParsed = false;
     break;
   case LEM:
-    if (lem == lemh) {
-      lemh = value;
+    if (getLem() == getPart(LEMH)) {
+      replacePart(0, lemhSize, value);
     }
     lem = value;
+    isLemStored = true;
     break;
   case LEMH:
-    lemh = value;
+    storeLem();
+    replacePart(0, lemhSize, value);
     break;
   case LEMQ:
-    lemq = value;
+    storeLem();
+    replacePart(getLemqStart(), lemqSize, value);
     break;
   case TAGS:
-    tags = value;
+    replacePart(getTagsStart(), tagsSize, value);
+    isTagSequenceSynced = false;
     break;
   default:
     break;
@@ -197,7 +206,8 @@ void BilingualLexicalUnit::changePart(LU_PART part, const wstring &value) {
 }
 
 /**
- * Replace an existing tag or combination of tags with a new value
+ * Replace an existing tag or combination of tags with a new value. A tag
+ * which isn't in the tags throws an out_of_range exception.
  *
  * @param tag the tag or combination of tags to replace
  * @param value the new value to store in its place
@@ -208,11 +218,141 @@ void BilingualLexicalUnit::modifyTag(const wstring &tag, const wstring &value) {
     parse();
   }
 
-  tags.replace(tags.find(tag), tag.size(), value);
+  // If both the tags and the tag to replace are whole tags, find it comparing
+  // identifiers and replace them in the sequence too.
+  TagSequence tagIds, valueIds;
+  if (getTagSequence(TAGS) != NULL && tagIds.assign(tag)) {
+    int pos = tagSequence.find(tagIds);
+    if (pos != -1) {
+      whole.replace(getTagsStart() + tagSequence.getTextPosition(pos),
+          tag.size(), value);
+      tagsSize = tagsSize - tag.size() + value.size();
+
+      if (valueIds.assign(value)) {
+        tagSequence.replace(pos, tagIds.size(), valueIds);
+      } else {
+        isTagSequenceSynced = false;
+      }
+      return;
+    }
+  }
+
+  size_t pos = getPart(TAGS).find(tag);
+  if (pos == wstring_view::npos) {
+    throw out_of_range("The tag to modify isn't in the lexical unit.");
+  }
+
+  whole.replace(getTagsStart() + pos, tag.size(), value);
+  tagsSize = tagsSize - tag.size() + value.size();
+  isTagSequenceSynced = false;
+}
+
+/**
+ * Get the tags of the lexical unit as a sequence of interned tags. Searching
+ * a tag in the sequence gives the same result as searching its text, in the
+ * lemma and tags or in the whole lexical unit, only if no '<' appears outside
+ * the tags.
+ *
+ * @param context the text the search is done on, LEM for the lemma and the
+ * tags, WHOLE for the whole lexical unit or TAGS for only the tags
+ *
+ * @return the sequence of tags or NULL if it isn't equivalent to the text
+ */
+const TagSequence* BilingualLexicalUnit::getTagSequence(LU_PART context) {
+  if (!isParsed) {
+    parse();
+  }
+
+  if (!isTagSequenceSynced) {
+    isTagSequenceValid = tagSequence.assign(getPart(TAGS));
+    isTagSequenceSynced = true;
+  }
+
+  if (!isTagSequenceValid) {
+    return NULL;
+  }
+
+  if (context == LEM && getLem().find(L'<') != wstring_view::npos) {
+    return NULL;
+  } else if (context == WHOLE
+      && (getPart(LEMH).find(L'<') != wstring_view::npos
+          || getPart(LEMQ).find(L'<') != wstring_view::npos)) {
+    return NULL;
+  }
+
+  return &tagSequence;
+}
+
+/**
+ * Get the position of the lemma's queue inside whole.
+ *
+ * @return the position of the first character of the queue
+ */
+size_t BilingualLexicalUnit::getLemqStart() const {
+  return lemqBeforeTags ? lemhSize : lemhSize + tagsSize;
+}
+
+/**
+ * Get the position of the tags inside whole.
+ *
+ * @return the position of the first character of the tags
+ */
+size_t BilingualLexicalUnit::getTagsStart() const {
+  return lemqBeforeTags ? lemhSize + lemqSize : lemhSize;
+}
+
+/**
+ * Get the lemma, which is lemh + lemq unless it was changed on its own. It's
+ * only copied to the lem buffer if the queue is after the tags.
+ *
+ * @return the lemma of the lexical unit
+ */
+wstring_view BilingualLexicalUnit::getLem() {
+  if (!isLemStored && !lemqBeforeTags && lemqSize != 0 && tagsSize != 0) {
+    storeLem();
+  }
+
+  if (isLemStored) {
+    return lem;
+  } else {
+    return wstring_view(whole).substr(0, lemhSize + lemqSize);
+  }
+}
+
+/**
+ * Replace a component of whole with a new value, updating its size.
+ *
+ * @param start the position of the component inside whole
+ * @param size the size of the component, which will be updated
+ * @param value the new value of the component
+ */
+void BilingualLexicalUnit::replacePart(size_t start, size_t &size,
+    const wstring &value) {
+  whole.replace(start, size, value);
+  size = value.size();
+}
+
+/**
+ * Store a copy of the current lemma, so changes in lemh or lemq don't modify
+ * it, as the lemma is only changed explicitly.
+ */
+void BilingualLexicalUnit::storeLem() {
+  if (!isLemStored) {
+    wstring_view wholeView = whole;
+    lem = wstring(wholeView.substr(0, lemhSize));
+    lem += wholeView.substr(getLemqStart(), lemqSize);
+    isLemStored = true;
+  }
 }
 
 wostream& operator<<(wostream &wos, const BilingualLexicalUnit &lu) {
-  wos << L"[" << L"'lem': '" << lu.lem << L"', 'lemh': '" << lu.lemh;
-  wos << L"', 'lemq': '" << lu.lemq << L"', 'tags': '" << lu.tags << L"'}";
+  BilingualLexicalUnit parsed = lu;
+  if (!parsed.isParsed) {
+    parsed.parse();
+  }
+
+  wos << L"[" << L"'lem': '" << parsed.getPart(LEM) << L"', 'lemh': '"
+      << parsed.getPart(LEMH) << L"', 'lemq': '" << parsed.getPart(LEMQ)
+      << L"', 'tags': '" << parsed.getPart(TAGS) << L"'}";
   return wos;
 }
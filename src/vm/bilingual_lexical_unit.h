@@ -19,9 +19,11 @@
 #define BILINGUAL_LEXICAL_UNIT_H_
 
 #include <string>
+#include <string_view>
 #include <iostream>
 
 #include "lexical_unit.h"
+#include "tag_sequence.h"
 
 using namespace std;
 
@@ -30,7 +32,10 @@ using namespace std;
  *  The attributes will be parsed on demand, that is, when the lexical unit
  *  is created, only the attribute whole, with the entire content of the
  *  lexical unit, will be stored. Only if one of the other attributes its
- *  needed the whole content will be parsed and split between components.
+ *  needed the whole content will be parsed, which only computes the size of
+ *  each component inside whole. Parts are returned as views of that buffer and
+ *  the buffer is only rewritten when a part is changed. The tags are also
+ *  kept as a sequence of interned tags, built the first time it's needed.
  */
 class BilingualLexicalUnit: public LexicalUnit {
 
@@ -46,34 +51,55 @@ public:
   void copy(const BilingualLexicalUnit &);
 
   void parse();
-  wstring getWhole() const;
-  wstring getPart(LU_PART);
+  const wstring& getWhole();
+  wstring_view getPart(LU_PART);
   void changePart(LU_PART, const wstring &);
   void modifyTag(const wstring &, const wstring &);
+  const TagSequence* getTagSequence(LU_PART);
 
 private:
 
-  /// The whole content of the lexical unit.
+  /** The whole content of the lexical unit. Once parsed, it's laid out as
+   * lemh + lemq + tags or lemh + tags + lemq, see lemqBeforeTags. */
   wstring whole;
 
-  /// The lemma of the lexical unit.
-  wstring lem;
+  /// Size of the lemma's head, which always starts at the beginning of whole.
+  size_t lemhSize;
+
+  /// Size of the lemma's queue inside whole.
+  size_t lemqSize;
 
-  /// The lemma's head of the lexical unit.
-  wstring lemh;
+  /// Size of the tags inside whole.
+  size_t tagsSize;
 
-  /// The lemma's queue of the lexical unit.
-  wstring lemq;
+  /** The lemma, only used when it can't be a view of whole: the queue is after
+   * the tags or the lemma was changed independently of lemh and lemq. */
+  wstring lem;
 
-  /// The tags of the lexical unit.
-  wstring tags;
+  /// If lem holds the current lemma instead of lemh + lemq.
+  bool isLemStored;
 
-  /// If the lexical unit is parsed, its individual components are filled.
+  /// If the lexical unit is parsed, the sizes of its components are set.
   bool isParsed;
 
   /// Store if the queue is stored before or after the tags.
   bool lemqBeforeTags;
 
+  /// The tags as interned identifiers, only valid if isTagSequenceSynced.
+  TagSequence tagSequence;
+
+  /// If tagSequence represents the current tags.
+  bool isTagSequenceSynced;
+
+  /// If the current tags could be represented as a sequence of whole tags.
+  bool isTagSequenceValid;
+
+  size_t getLemqStart() const;
+  size_t getTagsStart() const;
+  wstring_view getLem();
+  void replacePart(size_t, size_t &, const wstring &);
+  void storeLem();
+
 };
 
 #endif /* LEXICAL_UNIT_H_ */
@@ -0,0 +1,710 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "binary_loader.h"
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+#include <set>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "assembly_loader.h"
+#include "vm_exceptions.h"
+#include "vm_wstring_utils.h"
+
+using namespace std;
+
+const wstring BinaryLoader::HEADER = L"#<binary>";
+
+const wstring BinaryLoader::SNAPSHOT_HEADER = L"#<snapshot>";
+
+BinaryLoader::BinaryLoader() {
+  codeFileName = NULL;
+  mappedFile = NULL;
+  mappedSize = 0;
+  data = NULL;
+  header = NULL;
+}
+
+BinaryLoader::BinaryLoader(char *fileName) {
+  codeFileName = fileName;
+  mappedFile = NULL;
+  mappedSize = 0;
+  data = NULL;
+  header = NULL;
+}
+
+BinaryLoader::BinaryLoader(const BinaryLoader &c) {
+  copy(c);
+}
+
+BinaryLoader::~BinaryLoader() {
+  unmapFile();
+}
+
+BinaryLoader& BinaryLoader::operator=(const BinaryLoader &c) {
+  if (this != &c) {
+    this->~BinaryLoader();
+    this->copy(c);
+  }
+  return *this;
+}
+
+void BinaryLoader::copy(const BinaryLoader &c) {
+  codeFileName = c.codeFileName;
+  mappedFile = NULL;
+  mappedSize = 0;
+  data = NULL;
+  header = NULL;
+  reversedOpCodes = c.reversedOpCodes;
+
+  // Each loader needs its own mapping of the file.
+  if (c.mappedFile != NULL) {
+    mapFile();
+  }
+}
+
+/**
+ * Map the code file and decode the preprocess and code sections. The rules and
+ * macros code units are created empty and decoded when they are called.
+ *
+ * @param preprocessCode the preprocess code section
+ * @param code the main code section
+ * @param rulesCode the code section containing rules
+ * @param macrosCode the code section containing macros
+ * @param finalAddress the final address of the main code section of the vm
+ */
+void BinaryLoader::load(CodeUnit &preprocessCode, CodeUnit &code,
+    CodeSection &rulesCode, CodeSection &macrosCode,
+    unsigned int &finalAddress) {
+  mapFile();
+
+  decodeUnit(0, preprocessCode);
+  decodeUnit(1, code);
+
+  rulesCode.units.resize(header->numRules);
+  for (unsigned int i = 0; i < header->numRules; i++) {
+    rulesCode.units[i].loaded = false;
+    rulesCode.units[i].code.clear();
+  }
+
+  macrosCode.units.resize(header->numMacros);
+  for (unsigned int i = 0; i < header->numMacros; i++) {
+    macrosCode.units[i].loaded = false;
+    macrosCode.units[i].code.clear();
+  }
+
+  // The sections won't be resized anymore, so their units can be identified
+  // by their address.
+  pendingUnits.clear();
+  for (unsigned int i = 0; i < header->numRules; i++) {
+    pendingUnits[&rulesCode.units[i]] = 2 + i;
+  }
+  for (unsigned int i = 0; i < header->numMacros; i++) {
+    pendingUnits[&macrosCode.units[i]] = 2 + header->numRules + i;
+  }
+
+  finalAddress = code.code.size();
+}
+
+/**
+ * Decode a rule or macro the first time it's called. Different code units can
+ * be decoded at the same time from different threads.
+ *
+ * @param unit the code unit to decode, as created by load
+ */
+void BinaryLoader::loadCodeUnit(CodeUnit &unit) {
+  unordered_map<const CodeUnit *, unsigned int>::const_iterator it =
+      pendingUnits.find(&unit);
+
+  if (it == pendingUnits.end()) {
+    throwError(L"Code unit not found in the binary file.");
+  }
+
+  decodeUnit(it->second, unit);
+}
+
+/**
+ * Create every variable used by the code, so the variables map doesn't change
+ * its structure while the rules are executed. They are empty unless the file
+ * is a snapshot, which has their initial values.
+ *
+ * @param variables the variables of the vm
+ */
+void BinaryLoader::loadVariables(map<wstring, wstring> &variables) {
+  const BinaryVariable *entries =
+      (const BinaryVariable *) (data + header->variablesOffset);
+
+  for (unsigned int i = 0; i < header->numVariables; i++) {
+    variables[getString(entries[i].name)] = getString(entries[i].value);
+  }
+}
+
+/**
+ * Restore the patterns trie stored in a snapshot.
+ *
+ * @param trie the trie of the vm, replaced by the one of the snapshot
+ *
+ * @return true if the file is a snapshot and the trie was restored, false if
+ * there isn't any trie so the preprocess section has to be executed
+ */
+bool BinaryLoader::loadTrie(SystemTrie &trie) {
+  if (header->numTrieNodes == 0) {
+    return false;
+  }
+
+  const BinaryTrieNode *nodes =
+      (const BinaryTrieNode *) (data + header->trieNodesOffset);
+  const BinaryTrieLink *links =
+      (const BinaryTrieLink *) (data + header->trieLinksOffset);
+
+  // Check the transitions first, as a trie can't be restored half way.
+  for (unsigned int i = 0; i < header->numTrieNodes; i++) {
+    if ((nodes[i].starTransition != NONE
+        && nodes[i].starTransition >= header->numTrieNodes)
+        || (nodes[i].starTagTransition != NONE
+        && nodes[i].starTagTransition >= header->numTrieNodes)
+        || (uint64_t) nodes[i].firstLink + nodes[i].numLinks
+        > header->numTrieLinks) {
+      throwError(L"The binary file has a corrupt patterns trie.");
+    }
+
+    for (unsigned int j = 0; j < nodes[i].numLinks; j++) {
+      if (links[nodes[i].firstLink + j].node >= header->numTrieNodes) {
+        throwError(L"The binary file has a corrupt patterns trie.");
+      }
+    }
+  }
+
+  trie.resize(header->numTrieNodes);
+  for (unsigned int i = 0; i < header->numTrieNodes; i++) {
+    TrieNode *node = trie.getNode(i);
+    node->ruleNumber = nodes[i].ruleNumber;
+    if (nodes[i].starTransition != NONE) {
+      node->starTransition = trie.getNode(nodes[i].starTransition);
+    }
+    if (nodes[i].starTagTransition != NONE) {
+      node->starTagTransition = trie.getNode(nodes[i].starTagTransition);
+    }
+
+    node->links.reserve(nodes[i].numLinks);
+    for (unsigned int j = 0; j < nodes[i].numLinks; j++) {
+      const BinaryTrieLink &link = links[nodes[i].firstLink + j];
+      node->links.emplace(getString(link.key), trie.getNode(link.node));
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Map the code file in memory and check its header.
+ */
+void BinaryLoader::mapFile() {
+  int fd = open(codeFileName, O_RDONLY);
+  if (fd == -1) {
+    throwError(L"Can't open the code file.");
+  }
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) == -1) {
+    close(fd);
+    throwError(L"Can't read the code file.");
+  }
+
+  mappedSize = fileStat.st_size;
+  void *mapping = mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    mappedSize = 0;
+    throwError(L"Can't map the code file in memory.");
+  }
+  mappedFile = (const char *) mapping;
+
+  // Skip the two header lines and the padding until the binary data.
+  const char *end = mappedFile + mappedSize;
+  const char *pos = (const char *) memchr(mappedFile, '\n', mappedSize);
+  if (pos != NULL) {
+    pos = (const char *) memchr(pos + 1, '\n', end - pos - 1);
+  }
+  if (pos == NULL) {
+    throwError(L"The binary file has no transfer header.");
+  }
+
+  size_t offset = pos + 1 - mappedFile;
+  offset = (offset + 3) & ~((size_t) 3);
+  data = mappedFile + offset;
+
+  if (offset + sizeof(BinaryHeader) > mappedSize) {
+    throwError(L"The binary file is truncated.");
+  }
+
+  header = (const BinaryHeader *) data;
+  if (memcmp(header->magic, "VMB", 4) != 0) {
+    throwError(L"The binary file is corrupt.");
+  }
+  if (header->version != VERSION) {
+    wstringstream ws;
+    ws << L"The binary file has version " << header->version
+       << L" but version " << VERSION << L" is needed, compile it again.";
+    throwError(ws.str());
+  }
+
+  checkFile();
+}
+
+/**
+ * Check that the tables of the header, the instructions of every unit and the
+ * characters of every string are inside the mapped file, so a truncated or
+ * corrupt file is reported instead of read out of the mapping.
+ */
+void BinaryLoader::checkFile() const {
+  uint64_t numUnits = 2 + (uint64_t) header->numRules + header->numMacros;
+
+  checkRange(header->stringsOffset, header->numStrings, sizeof(BinaryString));
+  checkRange(header->variablesOffset, header->numVariables,
+      sizeof(BinaryVariable));
+  checkRange(header->unitsOffset, numUnits, sizeof(BinaryUnit));
+  checkRange(header->trieNodesOffset, header->numTrieNodes,
+      sizeof(BinaryTrieNode));
+  checkRange(header->trieLinksOffset, header->numTrieLinks,
+      sizeof(BinaryTrieLink));
+
+  const BinaryString *strings =
+      (const BinaryString *) (data + header->stringsOffset);
+  for (unsigned int i = 0; i < header->numStrings; i++) {
+    checkRange(strings[i].offset, strings[i].length, sizeof(uint32_t));
+  }
+
+  const BinaryUnit *units = (const BinaryUnit *) (data + header->unitsOffset);
+  for (unsigned int i = 0; i < numUnits; i++) {
+    checkRange(units[i].offset, units[i].numInstructions,
+        sizeof(BinaryInstruction));
+  }
+}
+
+/**
+ * Check that a table of the binary data is inside the mapped file.
+ *
+ * @param offset the offset of the table from the start of the binary data
+ * @param count the number of elements of the table
+ * @param size the size of each element
+ */
+void BinaryLoader::checkRange(uint64_t offset, uint64_t count,
+    size_t size) const {
+  uint64_t dataSize = mappedSize - (data - mappedFile);
+
+  if (offset % 4 != 0 || offset > dataSize
+      || count > (dataSize - offset) / size) {
+    throwError(L"The binary file is truncated or corrupt.");
+  }
+}
+
+/**
+ * Unmap the code file if it's mapped.
+ */
+void BinaryLoader::unmapFile() {
+  if (mappedFile != NULL) {
+    munmap((void *) mappedFile, mappedSize);
+    mappedFile = NULL;
+    mappedSize = 0;
+    data = NULL;
+    header = NULL;
+  }
+}
+
+/**
+ * Get an entry of the code units index.
+ *
+ * @param index the index of the unit: preprocess, code, rules and macros
+ *
+ * @return the entry of the unit
+ */
+const BinaryUnit* BinaryLoader::getUnit(unsigned int index) const {
+  if (index >= 2 + (uint64_t) header->numRules + header->numMacros) {
+    throwError(L"The binary file has no code unit " + to_wstring(index) + L".");
+  }
+
+  return ((const BinaryUnit *) (data + header->unitsOffset)) + index;
+}
+
+/**
+ * Get a string of the string pool.
+ *
+ * @param index the index of the string
+ *
+ * @return the string, empty if the index is NONE
+ */
+wstring BinaryLoader::getString(uint32_t index) const {
+  if (index == NONE) {
+    return L"";
+  } else if (index >= header->numStrings) {
+    throwError(L"The binary file has no string " + to_wstring(index) + L".");
+  }
+
+  const BinaryString *entry =
+      ((const BinaryString *) (data + header->stringsOffset)) + index;
+  const uint32_t *chars = (const uint32_t *) (data + entry->offset);
+
+  wstring str;
+  str.resize(entry->length);
+  for (unsigned int i = 0; i < entry->length; i++) {
+    str[i] = (wchar_t) chars[i];
+  }
+
+  return str;
+}
+
+/**
+ * Convert the instructions of a code unit to the vm representation.
+ *
+ * @param index the index of the unit in the units index
+ * @param unit the code unit to fill
+ */
+void BinaryLoader::decodeUnit(unsigned int index, CodeUnit &unit) const {
+  const BinaryUnit *binaryUnit = getUnit(index);
+  const BinaryInstruction *instrs =
+      (const BinaryInstruction *) (data + binaryUnit->offset);
+
+  unit.code.resize(binaryUnit->numInstructions);
+  for (unsigned int i = 0; i < binaryUnit->numInstructions; i++) {
+    if (instrs[i].opCode > SWITCH) {
+      throwError(L"The binary file has an unknown opcode.");
+    }
+    unit.code[i].opCode = (OP_CODE) instrs[i].opCode;
+    unit.code[i].op1 = getString(instrs[i].operand);
+    unit.code[i].lineNumber = instrs[i].lineNumber;
+  }
+
+  unit.loaded = true;
+}
+
+/**
+ * Throw a loader specific error with the name of the code file.
+ *
+ * @param msg the message describing the problem
+ */
+void BinaryLoader::throwError(const wstring &msg) const {
+  wstringstream ws;
+  ws << codeFileName << L": " << msg;
+  throw LoaderException(ws.str());
+}
+
+/**
+ * Print every code unit of a code section translation all instruction to their
+ * assembly representation.
+ *
+ * @param section the section with the code units to print
+ * @param header a header to show, usually the name of the section
+ * @param unitHeader a header for each of the code units, e.g. "Rule" or "Macro"
+ */
+void BinaryLoader::printCodeSection(const CodeSection &section,
+    const wstring &header, const wstring &unitHeader) {
+  unsigned int maxW = 60;
+  unsigned int w = maxW - 20 - header.size();
+
+  wcout << setfill(L'=') << setw(20) << L"=";
+  wcout << header;
+  wcout << setfill(L'=') << setw(w) << L"=" << endl;
+
+  for (unsigned int i = 0; i < section.units.size(); i++) {
+    const CodeUnit &unit = section.units[i];
+    if (unit.loaded) {
+      wcout << endl << unitHeader << L" " << i << L":" << endl;
+      for (unsigned int j = 0; j < unit.code.size(); j++) {
+        printInstruction(unit.code[j], j);
+      }
+    } else {
+      wcout << endl << unitHeader << L" " << i << L" (not loaded)" << endl;
+    }
+  }
+
+  wcout << setfill(L'=') << setw(maxW) << L"=" << endl;
+  wcout << endl;
+}
+
+/**
+ * Print a code unit translating every instruction to its assembly
+ * representation.
+ *
+ * @param codeUnit the unit with the instructions to print
+ * @param header a header to show, usually the name of the code unit
+ */
+void BinaryLoader::printCodeUnit(const CodeUnit &codeUnit,
+    const wstring &header) {
+  unsigned int maxW = 60;
+  unsigned int w = maxW - 20 - header.size();
+
+  wcout << setfill(L'=') << setw(20) << L"=";
+  wcout << header;
+  wcout << setfill(L'=') << setw(w) << L"=" << endl;
+
+  if (codeUnit.loaded) {
+    for (unsigned int i = 0; i < codeUnit.code.size(); i++) {
+      printInstruction(codeUnit.code[i], i);
+    }
+  } else {
+    wcout << L"(not loaded)" << endl;
+  }
+
+  wcout << setfill(L'=') << setw(maxW) << L"=" << endl;
+  wcout << endl;
+}
+
+/**
+ * Convert an internal representation of an instruction to an assembly one
+ * and print it for debugging purposes. Calls are printed with the macro number.
+ *
+ * @param instr the instruction to print
+ * @param PC the program counter
+ */
+void BinaryLoader::printInstruction(const Instruction &instr,
+    unsigned int PC) {
+  if (reversedOpCodes.size() == 0) {
+    map<wstring, OP_CODE> opCodes;
+    AssemblyLoader::fillOpCodes(opCodes);
+
+    map<wstring, OP_CODE>::const_iterator it;
+    for (it = opCodes.begin(); it != opCodes.end(); ++it) {
+      reversedOpCodes[it->second] = it->first;
+    }
+  }
+
+  wstring opCode = reversedOpCodes.find(instr.opCode)->second;
+
+  if (instr.op1 != L"") {
+    wcout << PC << L"\t" << opCode << L" " << instr.op1 << endl;
+  } else {
+    wcout << PC << L"\t" << opCode << endl;
+  }
+}
+
+/**
+ * Write code already loaded to a binary code file. Every rule and macro must be
+ * loaded, so their labels are resolved. If a trie is given, the file is a
+ * snapshot which also stores it and the values of the variables.
+ *
+ * @param fileName the name of the binary file to create
+ * @param transferHeader the transfer stage header of the code
+ * @param preprocessCode the preprocess code section
+ * @param code the main code section
+ * @param rulesCode the code section containing rules
+ * @param macrosCode the code section containing macros
+ * @param variableValues the variables already initialized, or NULL
+ * @param trie the patterns trie already built, or NULL
+ */
+void BinaryLoader::write(const char *fileName, const wstring &transferHeader,
+    const CodeUnit &preprocessCode, const CodeUnit &code,
+    const CodeSection &rulesCode, const CodeSection &macrosCode,
+    const map<wstring, wstring> *variableValues, const SystemTrie *trie) {
+  vector<const CodeUnit *> units;
+  units.push_back(&preprocessCode);
+  units.push_back(&code);
+  for (unsigned int i = 0; i < rulesCode.units.size(); i++) {
+    units.push_back(&rulesCode.units[i]);
+  }
+  for (unsigned int i = 0; i < macrosCode.units.size(); i++) {
+    units.push_back(&macrosCode.units[i]);
+  }
+
+  // Build the string pool, storing each different string only once, and the
+  // table of variables: the variables read by push and the ones initialized.
+  vector<wstring> strings;
+  map<wstring, uint32_t> stringIndex;
+  set<wstring> variableNames;
+  vector<vector<BinaryInstruction> > instructions(units.size());
+
+  auto addString = [&](const wstring &str) {
+    map<wstring, uint32_t>::iterator it = stringIndex.find(str);
+    if (it != stringIndex.end()) {
+      return it->second;
+    }
+    uint32_t index = strings.size();
+    stringIndex[str] = index;
+    strings.push_back(str);
+    return index;
+  };
+
+  for (unsigned int i = 0; i < units.size(); i++) {
+    const vector<Instruction> &unitCode = units[i]->code;
+
+    for (unsigned int j = 0; j < unitCode.size(); j++) {
+      const Instruction &instr = unitCode[j];
+      BinaryInstruction binaryInstr;
+      binaryInstr.opCode = instr.opCode;
+      binaryInstr.lineNumber = instr.lineNumber;
+      binaryInstr.operand = NONE;
+
+      if (instr.op1 != L"") {
+        binaryInstr.operand = addString(instr.op1);
+      }
+
+      if (instr.opCode == PUSH && instr.op1 != L"" && instr.op1[0] != L'"'
+          && !VMWstringUtils::iswnumeric(instr.op1)) {
+        variableNames.insert(instr.op1);
+      } else if (instr.opCode == STOREV && j >= 2
+          && unitCode[j - 2].opCode == PUSH && unitCode[j - 2].op1.size() >= 2
+          && unitCode[j - 2].op1[0] == L'"') {
+        const wstring &name = unitCode[j - 2].op1;
+        variableNames.insert(name.substr(1, name.size() - 2));
+      }
+
+      instructions[i].push_back(binaryInstr);
+    }
+  }
+
+  if (variableValues != NULL) {
+    for (map<wstring, wstring>::const_iterator it = variableValues->begin();
+        it != variableValues->end(); ++it) {
+      variableNames.insert(it->first);
+    }
+  }
+
+  vector<BinaryVariable> variables;
+  for (set<wstring>::iterator it = variableNames.begin();
+      it != variableNames.end(); ++it) {
+    BinaryVariable variable;
+    variable.name = addString(*it);
+    variable.value = NONE;
+
+    if (variableValues != NULL) {
+      map<wstring, wstring>::const_iterator value = variableValues->find(*it);
+      if (value != variableValues->end()) {
+        variable.value = addString(value->second);
+      }
+    }
+
+    variables.push_back(variable);
+  }
+
+  // Number the nodes of the trie and convert their transitions to indexes.
+  vector<BinaryTrieNode> trieNodes;
+  vector<BinaryTrieLink> trieLinks;
+  if (trie != NULL) {
+    vector<TrieNode *> nodes = trie->getNodes();
+    unordered_map<const TrieNode *, uint32_t> nodeIndex;
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+      nodeIndex[nodes[i]] = i;
+    }
+
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+      const TrieNode *node = nodes[i];
+      BinaryTrieNode trieNode;
+      trieNode.ruleNumber = node->ruleNumber;
+      trieNode.starTransition = (node->starTransition == NULL ?
+          NONE : nodeIndex[node->starTransition]);
+      trieNode.starTagTransition = (node->starTagTransition == NULL ?
+          NONE : nodeIndex[node->starTagTransition]);
+      trieNode.firstLink = trieLinks.size();
+      trieNode.numLinks = node->links.size();
+
+      for (const auto &link : node->links) {
+        BinaryTrieLink trieLink;
+        trieLink.key = addString(link.first);
+        trieLink.node = nodeIndex[link.second];
+        trieLinks.push_back(trieLink);
+      }
+
+      trieNodes.push_back(trieNode);
+    }
+  }
+
+  // Compute the offsets of every part of the binary data.
+  BinaryHeader binaryHeader;
+  memcpy(binaryHeader.magic, "VMB", 4);
+  binaryHeader.version = VERSION;
+  binaryHeader.numStrings = strings.size();
+  binaryHeader.numVariables = variables.size();
+  binaryHeader.numRules = rulesCode.units.size();
+  binaryHeader.numMacros = macrosCode.units.size();
+  binaryHeader.numTrieNodes = trieNodes.size();
+  binaryHeader.numTrieLinks = trieLinks.size();
+
+  uint32_t offset = sizeof(BinaryHeader);
+  binaryHeader.stringsOffset = offset;
+  offset += strings.size() * sizeof(BinaryString);
+
+  vector<BinaryString> stringEntries(strings.size());
+  for (unsigned int i = 0; i < strings.size(); i++) {
+    stringEntries[i].offset = offset;
+    stringEntries[i].length = strings[i].size();
+    offset += strings[i].size() * sizeof(uint32_t);
+  }
+
+  binaryHeader.variablesOffset = offset;
+  offset += variables.size() * sizeof(BinaryVariable);
+
+  binaryHeader.unitsOffset = offset;
+  offset += units.size() * sizeof(BinaryUnit);
+
+  vector<BinaryUnit> unitEntries(units.size());
+  for (unsigned int i = 0; i < units.size(); i++) {
+    unitEntries[i].numInstructions = instructions[i].size();
+    unitEntries[i].offset = offset;
+    offset += instructions[i].size() * sizeof(BinaryInstruction);
+  }
+
+  binaryHeader.trieNodesOffset = offset;
+  offset += trieNodes.size() * sizeof(BinaryTrieNode);
+
+  binaryHeader.trieLinksOffset = offset;
+  offset += trieLinks.size() * sizeof(BinaryTrieLink);
+
+  // Write the text headers, the padding and the binary data.
+  ofstream file(fileName, ios::out | ios::binary);
+  if (!file.is_open()) {
+    throw LoaderException(L"Can't open the binary file for writing.");
+  }
+
+  const wstring &fileHeader = (trie != NULL ? SNAPSHOT_HEADER : HEADER);
+  string textHeader = string(fileHeader.begin(), fileHeader.end()) + "\n"
+      + string(transferHeader.begin(), transferHeader.end()) + "\n";
+  while (textHeader.size() % 4 != 0) {
+    textHeader += '\0';
+  }
+  file.write(textHeader.data(), textHeader.size());
+
+  file.write((const char *) &binaryHeader, sizeof(BinaryHeader));
+  file.write((const char *) stringEntries.data(),
+      stringEntries.size() * sizeof(BinaryString));
+  for (unsigned int i = 0; i < strings.size(); i++) {
+    vector<uint32_t> chars(strings[i].begin(), strings[i].end());
+    file.write((const char *) chars.data(), chars.size() * sizeof(uint32_t));
+  }
+  file.write((const char *) variables.data(),
+      variables.size() * sizeof(BinaryVariable));
+  file.write((const char *) unitEntries.data(),
+      unitEntries.size() * sizeof(BinaryUnit));
+  for (unsigned int i = 0; i < instructions.size(); i++) {
+    file.write((const char *) instructions[i].data(),
+        instructions[i].size() * sizeof(BinaryInstruction));
+  }
+  file.write((const char *) trieNodes.data(),
+      trieNodes.size() * sizeof(BinaryTrieNode));
+  file.write((const char *) trieLinks.data(),
+      trieLinks.size() * sizeof(BinaryTrieLink));
+
+  file.close();
+}
@@ -0,0 +1,188 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef BINARY_LOADER_H_
+#define BINARY_LOADER_H_
+
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+
+#include "loader.h"
+#include "instructions.h"
+
+using namespace std;
+
+/**
+ * Layout of a binary code file (.vmb). The file starts with two text lines,
+ * the "#<binary>" header and the transfer stage header of the assembly, so the
+ * vm can detect both without knowing the format. The binary data starts at
+ * the next multiple of 4 bytes and every field is a 32 bits integer, with the
+ * offsets relative to the start of the binary data:
+ *
+ * \verbatim
+   BinaryHeader
+   strings:      numStrings  x {offset, length}, then the characters
+   variables:    numVariables x {name, value} as string indexes
+   units:        {numInstructions, offset} per unit, in order the
+                 preprocess section, the code section, the rules and the macros
+   instructions: numInstructions x {opCode, operand, lineNumber} per unit
+   trie nodes:   numTrieNodes x {ruleNumber, starTransition, starTagTransition,
+                 firstLink, numLinks}, the root first
+   trie links:   numTrieLinks x {key, node}
+   \endverbatim
+ *
+ * Labels are already resolved, so the operands of the jumps, calls and
+ * addtries are addresses, and every operand is an index of the string pool.
+ *
+ * A snapshot has the same layout with the "#<snapshot>" header instead. It
+ * stores the vm already initialized: the patterns trie built by the preprocess
+ * section and the values given to the variables by the code section, so both
+ * sections don't need to be executed again. Other binary files have no trie.
+ */
+struct BinaryHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t numStrings;
+  uint32_t stringsOffset;
+  uint32_t numVariables;
+  uint32_t variablesOffset;
+  uint32_t numRules;
+  uint32_t numMacros;
+  uint32_t unitsOffset;
+  uint32_t numTrieNodes;
+  uint32_t trieNodesOffset;
+  uint32_t numTrieLinks;
+  uint32_t trieLinksOffset;
+};
+
+/// An entry of the string pool.
+struct BinaryString {
+  uint32_t offset;
+  uint32_t length;
+};
+
+/// A variable and its value, NONE if it has no value yet.
+struct BinaryVariable {
+  uint32_t name;
+  uint32_t value;
+};
+
+/// An entry of the code units index.
+struct BinaryUnit {
+  uint32_t numInstructions;
+  uint32_t offset;
+};
+
+/// An instruction with its operand as an index of the string pool.
+struct BinaryInstruction {
+  uint32_t opCode;
+  uint32_t operand;
+  int32_t lineNumber;
+};
+
+/// A node of the patterns trie, its transitions as node indexes or NONE.
+struct BinaryTrieNode {
+  int32_t ruleNumber;
+  uint32_t starTransition;
+  uint32_t starTagTransition;
+  uint32_t firstLink;
+  uint32_t numLinks;
+};
+
+/// A transition of the patterns trie by a lemma or a tag.
+struct BinaryTrieLink {
+  uint32_t key;
+  uint32_t node;
+};
+
+/**
+ * Loads code from a binary code file, mapping it in memory. The preprocess and
+ * code sections are decoded directly but, like the assembly loader, rules and
+ * macros are only decoded the first time they are called.
+ */
+class BinaryLoader: public Loader {
+
+public:
+
+  /// First line of a binary code file.
+  static const wstring HEADER;
+
+  /// First line of a snapshot of an initialized vm.
+  static const wstring SNAPSHOT_HEADER;
+
+  /// Version of the binary format, changed on every incompatible change.
+  static const uint32_t VERSION = 2;
+
+  /// Value of an operand which isn't present.
+  static const uint32_t NONE = 0xFFFFFFFF;
+
+  BinaryLoader();
+  BinaryLoader(char *);
+  BinaryLoader(const BinaryLoader&);
+  virtual ~BinaryLoader();
+  BinaryLoader& operator=(const BinaryLoader&);
+  void copy(const BinaryLoader&);
+
+  void load(CodeUnit &, CodeUnit &, CodeSection &, CodeSection &,
+      unsigned int &);
+  void loadCodeUnit(CodeUnit &);
+  void loadVariables(map<wstring, wstring> &);
+  bool loadTrie(SystemTrie &);
+
+  void printCodeSection(const CodeSection &, const wstring &, const wstring &);
+  void printCodeUnit(const CodeUnit &, const wstring &);
+  void printInstruction(const Instruction &, unsigned int);
+
+  static void write(const char *, const wstring &, const CodeUnit &,
+      const CodeUnit &, const CodeSection &, const CodeSection &,
+      const map<wstring, wstring> *, const SystemTrie *);
+
+private:
+  /// Name of the code file to use.
+  char *codeFileName;
+
+  /// The code file mapped in memory.
+  const char *mappedFile;
+
+  /// Size of the mapped code file.
+  size_t mappedSize;
+
+  /// Start of the binary data inside the mapped file.
+  const char *data;
+
+  /// The header of the binary data.
+  const BinaryHeader *header;
+
+  /// The rules and macros of the code file, with their index in the units.
+  unordered_map<const CodeUnit *, unsigned int> pendingUnits;
+
+  /// Reversed opcodes map, only used when debugging is activated.
+  map<OP_CODE, wstring> reversedOpCodes;
+
+  void mapFile();
+  void checkFile() const;
+  void checkRange(uint64_t, uint64_t, size_t) const;
+  void unmapFile();
+  const BinaryUnit* getUnit(unsigned int) const;
+  wstring getString(uint32_t) const;
+  void decodeUnit(unsigned int, CodeUnit &) const;
+  void throwError(const wstring &) const;
+};
+
+#endif /* BINARY_LOADER_H_ */
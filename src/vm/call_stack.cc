@@ -18,13 +18,21 @@
 #include "call_stack.h"
 
 #include "vm.h"
+#include "vm_exceptions.h"
+#include "profiler.h"
 
 CallStack::CallStack() {
   vm = NULL;
+  profiler = NULL;
+  depth = 0;
+  frames.resize(INITIAL_FRAMES);
 }
 
 CallStack::CallStack(VM *vm) {
   this->vm = vm;
+  profiler = NULL;
+  depth = 0;
+  frames.resize(INITIAL_FRAMES);
 }
 
 CallStack::CallStack(const CallStack &c) {
@@ -44,20 +52,86 @@ CallStack& CallStack::operator=(const CallStack &c) {
 }
 
 void CallStack::copy(const CallStack &c) {
-  stack = c.stack;
+  frames = c.frames;
+  depth = c.depth;
   vm = c.vm;
+  profiler = c.profiler;
 }
 
 /**
- * Push a code unit call to the stack. This is needed because a rule can call
+ * Get the frame for a new call to a code unit, above the current one, to add
+ * the words of the call before pushing it. A frame is only allocated the first
+ * time the stack reaches its depth.
+ *
+ * @param section the code section of the code unit called
+ * @param number the number of the code unit in its section
+ *
+ * @return the frame of the call
+ */
+TCALL& CallStack::prepareCall(CODE_SECTION section, int number) {
+  if (depth == frames.size()) {
+    frames.emplace_back();
+  }
+
+  TCALL &call = frames[depth];
+  call.section = section;
+  call.number = number;
+  call.numWords = 0;
+  call.heapWords.clear();
+  call.PC = 0;
+
+  return call;
+}
+
+/**
+ * Add the index of a word to a call being prepared. The words of a call with
+ * more than CALL_INLINE_WORDS are stored in heapWords, whose memory is kept
+ * with the frame for the next calls.
+ *
+ * @param call the call returned by prepareCall
+ * @param word the index of the word
+ */
+void CallStack::addWord(TCALL &call, int word) {
+  if (call.numWords < CALL_INLINE_WORDS) {
+    call.inlineWords[call.numWords] = word;
+  } else {
+    if (call.numWords == CALL_INLINE_WORDS) {
+      call.heapWords.assign(call.inlineWords,
+          call.inlineWords + CALL_INLINE_WORDS);
+    }
+    call.heapWords.push_back(word);
+  }
+
+  call.numWords++;
+}
+
+/**
+ * Get the indexes of the words of a call.
+ *
+ * @param call the call
+ *
+ * @return the indexes of its numWords words
+ */
+const int* CallStack::getWords(const TCALL &call) {
+  if (call.numWords > CALL_INLINE_WORDS) {
+    return call.heapWords.data();
+  } else {
+    return call.inlineWords;
+  }
+}
+
+/**
+ * Push the call prepared to the stack. This is needed because a rule can call
  * a macro and a macro can also call a macro, so storing the last PC isn't
  * enough, we also need the code section.
- *
- * @param call the call to push to the stack
  */
-void CallStack::pushCall(const TCALL &call) {
-  stack.push_back(call);
-  vm->setCurrentCodeUnit(call);
+void CallStack::pushCall() {
+  if (profiler != NULL) {
+    profiler->enterUnit(frames[depth].section, frames[depth].number);
+  }
+
+  depth++;
+  vm->setCurrentCodeUnit(frames[depth - 1]);
 }
 
 /**
@@ -65,8 +139,34 @@ void CallStack::pushCall(const TCALL &call) {
  * done when a macro ends, it restores its caller and its PC.
  */
 void CallStack::popCall() {
-  stack.pop_back();
-  vm->setCurrentCodeUnit(stack.back());
+  // Only a macro returns, the rule in the first frame just ends.
+  if (depth <= 1) {
+    throw InterpreterException(L"A return can only be executed by a macro.");
+  }
+
+  if (profiler != NULL) {
+    profiler->leaveUnit();
+  }
+
+  depth--;
+  vm->setCurrentCodeUnit(frames[depth - 1]);
+}
+
+/**
+ * Remove every call from the stack, keeping their frames to reuse them. This
+ * is done before a rule starts, as it's always the first call.
+ */
+void CallStack::clear() {
+  depth = 0;
+}
+
+/**
+ * Get the number of calls in the stack.
+ *
+ * @return the depth of the stack
+ */
+unsigned int CallStack::getDepth() const {
+  return depth;
 }
 
 /**
@@ -75,6 +175,14 @@ void CallStack::popCall() {
  * @param PC the current PC to save
  */
 void CallStack::saveCurrentPC(int PC) {
-  stack.back().PC = PC;
+  frames[depth - 1].PC = PC;
 }
 
+/**
+ * Set the profiler to tell about every call and return.
+ *
+ * @param profiler the profiler or NULL to not profile the calls
+ */
+void CallStack::setProfiler(Profiler *profiler) {
+  this->profiler = profiler;
+}
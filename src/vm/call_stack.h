@@ -18,22 +18,33 @@
 #ifndef CALL_STACK_H_
 #define CALL_STACK_H_
 
+#include <deque>
 #include <vector>
 
 using namespace std;
 
 class VM;
+class Profiler;
 
 enum CODE_SECTION {
   MACROS_SECTION,
   RULES_SECTION
 };
 
-/// This stuct represents a call to a code unit.
+/// Number of words of a rule or passed to a macro stored inline in a call.
+const unsigned int CALL_INLINE_WORDS = 32;
+
+/**
+ * This stuct represents a call to a code unit. The indexes of its words are
+ * stored inline, so a call doesn't need to allocate memory, unless it has more
+ * than CALL_INLINE_WORDS words, when all of them are moved to heapWords.
+ */
 struct TCALL {
   CODE_SECTION section;
   int number;
-  vector<int> words;
+  unsigned int numWords;
+  int inlineWords[CALL_INLINE_WORDS];
+  vector<int> heapWords;
   int PC;
 };
 
@@ -49,18 +60,34 @@ public:
   CallStack& operator=(const CallStack &);
   void copy(const CallStack &);
 
-  void pushCall(const TCALL &);
+  TCALL& prepareCall(CODE_SECTION, int);
+  void addWord(TCALL &, int);
+  static const int* getWords(const TCALL &);
+  void pushCall();
   void popCall();
+  void clear();
+  unsigned int getDepth() const;
   void saveCurrentPC(int);
+  void setProfiler(Profiler *);
 
 private:
 
-  /// The actual stack used to track the calls and returns.
-  vector<TCALL> stack;
+  /// Number of frames preallocated when the stack is created.
+  static const unsigned int INITIAL_FRAMES = 16;
+
+  /** The frames used to track the calls and returns. They are kept once
+   * allocated and a deque doesn't move them, so the vm can point to them. */
+  deque<TCALL> frames;
+
+  /// Number of frames of the calls in the stack.
+  unsigned int depth;
 
   /// Access to the data structures of the vm is needed.
   VM *vm;
 
+  /// Profiler told about every call and return, NULL if not profiling.
+  Profiler *profiler;
+
 };
 
 #endif /* CALL_STACK_H_ */
@@ -17,12 +17,17 @@
 
 #include "chunk_lexical_unit.h"
 
+#include <stdexcept>
+
 ChunkLexicalUnit::ChunkLexicalUnit() {
   whole = L"";
   pseudolemma = L"";
   chcontent = L"";
   tags = L"";
   isParsed = false;
+  isWholeDirty = false;
+  isTagSequenceSynced = false;
+  isTagSequenceValid = false;
 }
 
 ChunkLexicalUnit::ChunkLexicalUnit(const wstring &whole) {
@@ -30,6 +35,9 @@ ChunkLexicalUnit::ChunkLexicalUnit(const wstring &whole) {
   chcontent = L"";
   tags = L"";
   isParsed = false;
+  isWholeDirty = false;
+  isTagSequenceSynced = false;
+  isTagSequenceValid = false;
 
   this->whole = whole;
 }
@@ -56,6 +64,10 @@ void ChunkLexicalUnit::copy(const ChunkLexicalUnit &c) {
   tags = c.tags;
   chcontent = c.chcontent;
   isParsed = c.isParsed;
+  isWholeDirty = c.isWholeDirty;
+  tagSequence = c.tagSequence;
+  isTagSequenceSynced = c.isTagSequenceSynced;
+  isTagSequenceValid = c.isTagSequenceValid;
 }
 
 /**
@@ -81,31 +93,53 @@ void ChunkLexicalUnit::parse() {
   chcontent = whole.substr(contentStart, whole.size());
 
   isParsed = true;
+  isWholeDirty = false;
+  isTagSequenceSynced = false;
 }
 
 /**
- * Get the whole attribute of the lexical unit. If the lexical unit is not
- * parsed, just return the unparsed whole to save processing time. If the
- * unit is parsed, return the combination of the individual components.
+ * Get the whole attribute of the lexical unit. It's only rebuilt from the
+ * individual components if one of them changed since the last time.
  *
  * @return the whole lexical unit
  */
-wstring ChunkLexicalUnit::getWhole() const {
-  if (!isParsed) {
-    return whole;
+const wstring& ChunkLexicalUnit::getWhole() {
+  if (isWholeDirty) {
+    whole.clear();
+    whole.reserve(pseudolemma.size() + tags.size() + chcontent.size());
+    whole += pseudolemma;
+    whole += tags;
+    whole += chcontent;
+    isWholeDirty = false;
+  }
+
+  return whole;
+}
+
+/**
+ * Write the whole attribute of the lexical unit to a stream, writing the
+ * components one by one if the whole isn't up to date, so it doesn't need to be
+ * rebuilt.
+ *
+ * @param wos the stream to write to
+ */
+void ChunkLexicalUnit::writeWhole(wostream &wos) const {
+  if (isWholeDirty) {
+    wos << pseudolemma << tags << chcontent;
   } else {
-    return pseudolemma + tags + chcontent;
+    wos << whole;
   }
 }
 
 /**
- * Get an attribute of the lexical unit.
+ * Get an attribute of the lexical unit. The view returned is only valid until
+ * the lexical unit is modified.
  *
  * @param part the part to get
  *
  * @return the part
  */
-wstring ChunkLexicalUnit::getPart(LU_PART part) {
+wstring_view ChunkLexicalUnit::getPart(LU_PART part) {
   // If we want a part but the lu is not parsed, we need to parse it.
   if (part != WHOLE && !isParsed) {
     parse();
@@ -115,11 +149,11 @@ wstring ChunkLexicalUnit::getPart(LU_PART part) {
   case WHOLE: return getWhole();
   case LEM: /*FALL THROUGH*/
   case LEMH: return pseudolemma;
-  case LEMQ: return L"";
+  case LEMQ: return wstring_view();
   case TAGS: return tags;
   case CHCONTENT: return chcontent;
   /*jacob's new 'part' (from apertium's interchunk.cc:248) */
-  case CONTENT: return chcontent.substr(1, chcontent.size() - 2);
+  case CONTENT: return wstring_view(chcontent).substr(1, chcontent.size() - 2);
   default: return whole;
   }
 }
@@ -141,16 +175,21 @@ void ChunkLexicalUnit::changePart(LU_PART part, const wstring &value) {
     // If we change the whole we set the lexical unit as unparsed.
     whole = value;
     isParsed = false;
+    isWholeDirty = false;
     break;
   case LEM: /*FALL THROUGH*/
   case LEMH:
     pseudolemma = value;
+    isWholeDirty = true;
     break;
   case TAGS:
     tags = value;
+    isTagSequenceSynced = false;
+    isWholeDirty = true;
     break;
   case CHCONTENT:
     chcontent = value;
+    isWholeDirty = true;
     break;
   default:
     break;
@@ -158,7 +197,8 @@ void ChunkLexicalUnit::changePart(LU_PART part, const wstring &value) {
 }
 
 /**
- * Replace an existing tag or combination of tags with a new value
+ * Replace an existing tag or combination of tags with a new value. A tag
+ * which isn't in the tags throws an out_of_range exception.
  *
  * @param tag the tag or combination of tags to replace
  * @param value the new value to store in its place
@@ -169,7 +209,65 @@ void ChunkLexicalUnit::modifyTag(const wstring &tag, const wstring &value) {
     parse();
   }
 
-  tags.replace(tags.find(tag), tag.size(), value);
+  // If both the tags and the tag to replace are whole tags, find it comparing
+  // identifiers and replace them in the sequence too.
+  TagSequence tagIds, valueIds;
+  if (getTagSequence(TAGS) != NULL && tagIds.assign(tag)) {
+    int pos = tagSequence.find(tagIds);
+    if (pos != -1) {
+      tags.replace(tagSequence.getTextPosition(pos), tag.size(), value);
+      isWholeDirty = true;
+
+      if (valueIds.assign(value)) {
+        tagSequence.replace(pos, tagIds.size(), valueIds);
+      } else {
+        isTagSequenceSynced = false;
+      }
+      return;
+    }
+  }
+
+  size_t pos = tags.find(tag);
+  if (pos == wstring::npos) {
+    throw out_of_range("The tag to modify isn't in the lexical unit.");
+  }
+
+  tags.replace(pos, tag.size(), value);
+  isTagSequenceSynced = false;
+  isWholeDirty = true;
+}
+
+/**
+ * Get the tags of the chunk as a sequence of interned tags. Searching a tag in
+ * the sequence gives the same result as searching its text, in the lemma and
+ * tags or in the whole chunk, only if no '<' appears outside the tags.
+ *
+ * @param context the text the search is done on, LEM for the lemma and the
+ * tags, WHOLE for the whole chunk or TAGS for only the tags
+ *
+ * @return the sequence of tags or NULL if it isn't equivalent to the text
+ */
+const TagSequence* ChunkLexicalUnit::getTagSequence(LU_PART context) {
+  if (!isParsed) {
+    parse();
+  }
+
+  if (!isTagSequenceSynced) {
+    isTagSequenceValid = tagSequence.assign(tags);
+    isTagSequenceSynced = true;
+  }
+
+  if (!isTagSequenceValid) {
+    return NULL;
+  }
+
+  if (context != TAGS && pseudolemma.find(L'<') != wstring::npos) {
+    return NULL;
+  } else if (context == WHOLE && chcontent.find(L'<') != wstring::npos) {
+    return NULL;
+  }
+
+  return &tagSequence;
 }
 
 wostream& operator<<(wostream &wos, const ChunkLexicalUnit &clu) {
@@ -21,8 +21,10 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 
 #include "lexical_unit.h"
+#include "tag_sequence.h"
 
 using namespace std;
 
@@ -32,6 +34,8 @@ using namespace std;
  *  is created, only the attribute whole, with the entire content of the
  *  lexical unit, will be stored. Only if one of the other attributes its
  *  needed the whole content will be parsed and split between components.
+ *  The whole is kept as well and only rebuilt from the components when it's
+ *  needed after one of them changes.
  */
 class ChunkLexicalUnit: public LexicalUnit {
 
@@ -47,13 +51,15 @@ public:
   void copy(const ChunkLexicalUnit &);
 
   void parse();
-  wstring getWhole() const;
-  wstring getPart(LU_PART);
+  const wstring& getWhole();
+  wstring_view getPart(LU_PART);
   void changePart(LU_PART, const wstring &);
   void modifyTag(const wstring &, const wstring &);
+  const TagSequence* getTagSequence(LU_PART);
+  void writeWhole(wostream &) const;
 
 private:
-  /// The whole content of the lexical unit.
+  /// The whole content of the lexical unit, outdated if isWholeDirty is set.
   wstring whole;
 
   /// The pseudolemma of the chunk.
@@ -67,6 +73,18 @@ private:
 
   /// If the lexical unit is parsed, its individual components are filled.
   bool isParsed;
+
+  /// If a component changed after whole was last built.
+  bool isWholeDirty;
+
+  /// The tags as interned identifiers, only valid if isTagSequenceSynced.
+  TagSequence tagSequence;
+
+  /// If tagSequence represents the current tags.
+  bool isTagSequenceSynced;
+
+  /// If the current tags could be represented as a sequence of whole tags.
+  bool isTagSequenceValid;
 };
 
 #endif /* CHUNK_LEXICAL_UNIT_H_ */
@@ -17,13 +17,15 @@
 
 #include "chunk_word.h"
 
-#include <locale>
-#include <sstream>
+#include <algorithm>
 
 #include "vm_wstring_utils.h"
 
 ChunkWord::ChunkWord() {
   chunk = NULL;
+  isContentModified = false;
+  hasPendingReferences = false;
+  isContentPending = false;
 }
 
 ChunkWord::ChunkWord(const ChunkWord &c) {
@@ -31,10 +33,7 @@ ChunkWord::ChunkWord(const ChunkWord &c) {
 }
 
 ChunkWord::~ChunkWord() {
-  for (unsigned int i = 0; i < content.size(); i++) {
-    delete content[i];
-    content[i] = NULL;
-  }
+  clearContent();
 
   if (chunk != NULL) {
     delete chunk;
@@ -54,98 +53,146 @@ void ChunkWord::copy(const ChunkWord &c) {
   chunk = new ChunkLexicalUnit(*c.chunk);
   content = c.content;
   blanks = c.blanks;
+  separators = c.separators;
+  isContentModified = c.isContentModified;
+  hasPendingReferences = c.hasPendingReferences;
+  isContentPending = c.isContentPending;
 }
 
 /**
- * Get the chunk lexical unit of the word.
+ * Get the chunk lexical unit of the word, with its chcontent updated if a
+ * lexical unit of the content changed.
  *
  * @return the lexical unit
  */
 ChunkLexicalUnit* ChunkWord::getChunk() {
+  if (isContentModified) {
+    updateChunkContent();
+  }
+
   return chunk;
 }
 
 /**
- * Solve the references, inside the chcontent, to the chunk tags.
+ * Check if a lexical unit is the chunk of the word, without updating its
+ * chcontent.
+ *
+ * @param lu the lexical unit to check
+ *
+ * @return true if it's the chunk lexical unit, false if it's another one, like
+ * a lexical unit of the content
+ */
+bool ChunkWord::isChunk(const LexicalUnit *lu) const {
+  return lu == chunk;
+}
+
+/**
+ * Solve the references, inside the chcontent, to the chunk tags. A reference
+ * is the position of a tag between '<' and '>', e.g. <1> or <12>, and the
+ * chcontent is decoded in a single pass, writing the tags in a new buffer.
  */
 void ChunkWord::solveReferences() {
-  vector<wstring> tagsValues;
+  vector<wstring_view> tagsValues = getTagsValues();
+  wstring_view chcontent = chunk->getPart(CHCONTENT);
+  wstring newChcontent;
+  newChcontent.reserve(chcontent.size() + chunk->getPart(TAGS).size());
+  bool hasReferences = false;
+
+  for (size_t i = 0; i < chcontent.size(); i++) {
+    wchar_t ch = chcontent[i];
+
+    if (ch == L'\\' && i + 1 < chcontent.size()) {
+      // Escaped characters are never part of a reference.
+      newChcontent += ch;
+      newChcontent += chcontent[++i];
+      continue;
+    }
 
-  wstring tags = chunk->getPart(TAGS);
-  wstring token = L"";
-  wchar_t ch;
-  for (unsigned int i = 0; i < tags.size(); i++) {
-    ch = tags[i];
-    if (ch == L'>') {
-      token += ch;
-      tagsValues.push_back(token);
-      token = L"";
+    size_t end = i;
+    if (ch == L'<') {
+      end = solveReference(chcontent, i, tagsValues, newChcontent);
+    }
+
+    if (end == i) {
+      newChcontent += ch;
     } else {
-      token += ch;
+      hasReferences = true;
+      i = end;
     }
   }
 
-  locale loc;
-  wstring chcontent = chunk->getPart(CHCONTENT);
-  wstring newChcontent = chcontent;
-  wstring newWhole = chunk->getPart(WHOLE);
-
-  for (unsigned int i = 0; i < chcontent.size(); i++) {
-    ch = chcontent[i];
-    if (isdigit(ch, loc)) {
-      if (chcontent[i - 1] == L'<' && chcontent[i + 1] == L'>') {
-        unsigned int pos;
-        wstringstream ws;
-        ws << ch;
-        ws >> pos;
-        wstring tag;
-        if(pos - 1 < tagsValues.size()) {
-          tag = tagsValues[pos - 1];
-        } else {
-          wcerr << "WARNING: tag linked from position " << pos
-                << " not found in tag string " <<  tags << "." << endl;
-          tag = L"";
-        }
-        newWhole = replaceReference(newWhole, ch, tag);
-        newChcontent = replaceReference(newChcontent, ch, tag);
-      }
+  if (hasReferences) {
+    chunk->changePart(CHCONTENT, newChcontent);
+  }
+}
+
+/**
+ * Get each tag of the chunk, in order, to solve the references to them.
+ *
+ * @return views of the tags, inside the tags of the chunk
+ */
+vector<wstring_view> ChunkWord::getTagsValues() {
+  wstring_view tags = chunk->getPart(TAGS);
+  vector<wstring_view> tagsValues;
+  size_t tagStart = 0;
+
+  for (size_t i = 0; i < tags.size(); i++) {
+    if (tags[i] == L'>') {
+      tagsValues.push_back(tags.substr(tagStart, i + 1 - tagStart));
+      tagStart = i + 1;
     }
   }
 
-  chunk->changePart(WHOLE, newWhole);
-  chunk->changePart(CHCONTENT, newChcontent);
+  return tagsValues;
 }
 
 /**
- * Replace references to a tag with the actual tag.
+ * Solve the reference to a chunk tag starting at a position of the chcontent,
+ * if there is one, writing the tag it links to.
  *
- * @param container the wide string containing the references
- * @param pos position of the reference to replace, as found in the container
- * @param tag the actual tag to put in place
+ * @param chcontent the chcontent of the chunk
+ * @param start the position of the '<' which could start the reference
+ * @param tagsValues the tags of the chunk
+ * @param solved the text to write the tag to
  *
- * @return the container with the references replaced
+ * @return the position of the '>' ending the reference, or start if there
+ * isn't a reference there
  */
-wstring ChunkWord::replaceReference(const wstring &container, wchar_t pos,
-    const wstring &tag) {
-  wstring newContainer = container;
-  wstring reference;
-  reference += L'<';
-  reference += pos;
-  reference += L'>';
+size_t ChunkWord::solveReference(wstring_view chcontent, size_t start,
+    const vector<wstring_view> &tagsValues, wstring &solved) {
+  // Read the digits of the reference, if it's one.
+  size_t end = start + 1;
+  unsigned int pos = 0;
+  while (end < chcontent.size() && chcontent[end] >= L'0'
+      && chcontent[end] <= L'9') {
+    pos = pos * 10 + (chcontent[end] - L'0');
+    end++;
+  }
+
+  if (end == start + 1 || end == chcontent.size() || chcontent[end] != L'>') {
+    return start;
+  }
 
-  newContainer = VMWstringUtils::replace(newContainer, reference, tag);
+  if (pos >= 1 && pos <= tagsValues.size()) {
+    solved += tagsValues[pos - 1];
+  } else {
+    wcerr << "WARNING: tag linked from position " << pos
+          << " not found in tag string " << chunk->getPart(TAGS) << "."
+          << endl;
+  }
 
-  return newContainer;
+  return end;
 }
 
 /**
  * Set the content of the chunk word as a list of lexical units and apply the
  * postchunk rule of setting the case of the lexical units as the one of the
- * chunk pseudolemma.
+ * chunk pseudolemma. If the references to the chunk tags are pending, they
+ * are solved in the same pass over the chcontent.
  */
 void ChunkWord::parseChunkContent() {
   // Depending on the case, change all cases or just the first lexical unit.
-  CASE pseudoLemmaCase = VMWstringUtils::getCase(chunk->getPart(LEM));
+  CASE pseudoLemmaCase = VMWstringUtils::getCase(wstring(chunk->getPart(LEM)));
   bool upperCaseAll = false;
   bool firstUpper = false;
   if (pseudoLemmaCase == AA) {
@@ -154,67 +201,223 @@ void ChunkWord::parseChunkContent() {
     firstUpper = true;
   }
 
-  // The first blank is the one before the chunk name.
-  blanks.push_back(L"");
-  bool firstLu = true;
+  // Parsing the content again replaces the lexical units parsed before.
+  clearContent();
+  isContentPending = false;
+
+  // With pending references, the chcontent is written with them solved and
+  // the positions below are the ones of the solved text.
+  bool solve = hasPendingReferences;
+  hasPendingReferences = false;
+  vector<wstring_view> tagsValues;
+  wstring_view chcontent = chunk->getPart(CHCONTENT);
+  wstring solved;
+  bool hasReferences = false;
+  if (solve) {
+    tagsValues = getTagsValues();
+    solved.reserve(chcontent.size() + chunk->getPart(TAGS).size());
+  }
 
-  wstring token = L"";
-  wstring chcontent = chunk->getPart(CHCONTENT);
-  wchar_t ch;
-  BilingualLexicalUnit *lu;
+  // The bounds of the lexical units, blanks and separators, taken from the
+  // chcontent once all the references are solved.
+  vector<pair<size_t, size_t> > luBounds, blankBounds, separatorBounds;
+  size_t separatorStart = 1, luStart = 1;
+  bool firstLu = true;
   bool escapeNextChar = false;
 
-  // Ignore first and last chars '{' and '}'.
-  for (unsigned int i = 1; i < chcontent.size() - 1; i++) {
-    ch = chcontent[i];
+  for (size_t i = 0; i < chcontent.size(); i++) {
+    wchar_t ch = chcontent[i];
+    size_t pos = solve ? solved.size() : i;
+
+    if (solve) {
+      if (ch == L'<' && !escapeNextChar) {
+        size_t end = solveReference(chcontent, i, tagsValues, solved);
+        if (end != i) {
+          hasReferences = true;
+          i = end;
+          continue;
+        }
+      }
+      solved += ch;
+    }
+
+    // Ignore first and last chars '{' and '}'.
+    if (i == 0 || i + 1 == chcontent.size()) {
+      continue;
+    }
+
     if (escapeNextChar) {
-      token += ch;
       escapeNextChar = false;
     } else if (ch == L'\\') {
-      token += ch;
       escapeNextChar = true;
     } else if (ch == L'^') {
-      // After the first blank, append the blanks between lexical units.
+      // The first blank is the one before the chunk name.
       if (firstLu) {
         firstLu = false;
       } else {
-        blanks.push_back(token);
+        blankBounds.push_back(make_pair(luStart, pos));
       }
-      token = L"";
+      luStart = pos + 1;
     } else if (ch == L'$') {
-      lu = new BilingualLexicalUnit(token);
+      luBounds.push_back(make_pair(luStart, pos));
 
-      if (upperCaseAll) {
-        changeLemmaCase(*lu, pseudoLemmaCase);
-      } else if (firstUpper) {
-        changeLemmaCase(*lu, pseudoLemmaCase);
-        firstUpper = false;
-      }
+      // The separator ends at the '^' of the lexical unit, if there is one.
+      size_t separatorEnd = max(luStart - 1, separatorStart);
+      separatorBounds.push_back(make_pair(separatorStart, separatorEnd));
+      separatorStart = pos + 1;
+      luStart = pos + 1;
+    }
+  }
 
-      content.push_back(lu);
+  if (hasReferences) {
+    chunk->changePart(CHCONTENT, solved);
+    chcontent = chunk->getPart(CHCONTENT);
+  }
 
-      token = L"";
-    } else {
-      token += ch;
+  blanks.push_back(L"");
+  for (unsigned int i = 0; i < blankBounds.size(); i++) {
+    blanks.emplace_back(chcontent.substr(blankBounds[i].first,
+        blankBounds[i].second - blankBounds[i].first));
+  }
+
+  bool caseChanged = false;
+  for (unsigned int i = 0; i < luBounds.size(); i++) {
+    BilingualLexicalUnit *lu = new BilingualLexicalUnit(
+        wstring(chcontent.substr(luBounds[i].first,
+            luBounds[i].second - luBounds[i].first)));
+
+    if (upperCaseAll || firstUpper) {
+      caseChanged = changeLemmaCase(*lu, pseudoLemmaCase) || caseChanged;
+      firstUpper = false;
     }
+
+    content.push_back(lu);
+    separators.emplace_back(chcontent.substr(separatorBounds[i].first,
+        separatorBounds[i].second - separatorBounds[i].first));
+  }
+
+  if (chcontent.size() > separatorStart) {
+    separators.emplace_back(chcontent.substr(separatorStart,
+        chcontent.size() - 1 - separatorStart));
+  } else {
+    separators.push_back(L"");
   }
+
+  // The chcontent is only rebuilt if the case of a lemma changed.
+  isContentModified = caseChanged;
 }
 
 /**
- * Update the chcontent when a lu inside the chunk changes.
+ * Solve the references and parse the chunk content if it wasn't done yet. It's
+ * done the first time a rule needs the content of the chunk.
+ */
+void ChunkWord::parsePendingContent() {
+  if (isContentPending) {
+    parseChunkContent();
+  } else if (hasPendingReferences) {
+    solveReferences();
+    hasPendingReferences = false;
+  }
+}
+
+/**
+ * Write the chunk content, without the '{' and '}', with the case of the
+ * chunk pseudolemma applied to the lexical units. If the content wasn't
+ * parsed, it's written from the text without creating the lexical units.
  *
- * @param oldLu the lexical unit being replaced
- * @param newLu the new lexical unit
+ * @param wos the stream to write to
  */
-void ChunkWord::updateChunkContent(const wstring & oldLu,
-    const wstring & newLu) {
-  wstring chcontent = chunk->getPart(CHCONTENT);
-
-  size_t pos = chcontent.find(oldLu);
-  if (pos != wstring::npos) {
-    wstring ch = chcontent.replace(pos, oldLu.size(), newLu);
-    chunk->changePart(CHCONTENT, ch);
+void ChunkWord::writeContent(wostream &wos) {
+  if (hasPendingReferences) {
+    solveReferences();
+    hasPendingReferences = false;
+  }
+
+  wstring_view chcontent = getChunk()->getPart(CHCONTENT);
+  CASE pseudoLemmaCase = VMWstringUtils::getCase(wstring(chunk->getPart(LEM)));
+
+  if (!isContentPending || pseudoLemmaCase == aa) {
+    wos << chcontent.substr(1, chcontent.size() - 2);
+    return;
+  }
+
+  // Change the case of the lemmas like parseChunkContent, where the lemma is
+  // the text until '<', with the queue of a multiword if it's before the tags.
+  bool firstUpper = (pseudoLemmaCase == Aa);
+  bool escapeNextChar = false;
+  size_t written = 1, luStart = 1;
+
+  for (size_t i = 1; i + 1 < chcontent.size(); i++) {
+    wchar_t ch = chcontent[i];
+    if (escapeNextChar) {
+      escapeNextChar = false;
+    } else if (ch == L'\\') {
+      escapeNextChar = true;
+    } else if (ch == L'^') {
+      luStart = i + 1;
+    } else if (ch == L'$') {
+      wstring_view lu = chcontent.substr(luStart, i - luStart);
+
+      size_t tag = lu.find(L'<');
+      size_t head = lu.find(L'#');
+      bool isLemmaFirst = (head == wstring_view::npos
+          || tag == wstring_view::npos || head < tag);
+
+      if (isLemmaFirst && (pseudoLemmaCase == AA || firstUpper)) {
+        wstring lem(lu.substr(0, tag));
+        wos << chcontent.substr(written, luStart - written)
+            << VMWstringUtils::changeCase(lem, pseudoLemmaCase);
+        written = luStart + lem.size();
+      }
+      firstUpper = false;
+      luStart = i + 1;
+    }
   }
+
+  wos << chcontent.substr(written, chcontent.size() - 1 - written);
+}
+
+/**
+ * Mark the chunk content as modified after one of its lexical units changed,
+ * so the chcontent of the chunk is rebuilt the next time it's used.
+ */
+void ChunkWord::setContentModified() {
+  isContentModified = true;
+}
+
+/**
+ * Delete the lexical units of the chunk content and the blanks between them.
+ */
+void ChunkWord::clearContent() {
+  for (unsigned int i = 0; i < content.size(); i++) {
+    delete content[i];
+    content[i] = NULL;
+  }
+
+  content.clear();
+  blanks.clear();
+  separators.clear();
+  isContentModified = false;
+}
+
+/**
+ * Rebuild the chcontent of the chunk from its lexical units and the text
+ * around them.
+ */
+void ChunkWord::updateChunkContent() {
+  wstring chcontent = L"{";
+
+  for (unsigned int i = 0; i < content.size(); i++) {
+    chcontent += separators[i];
+    chcontent += L'^';
+    chcontent += content[i]->getWhole();
+    chcontent += L'$';
+  }
+  chcontent += separators[content.size()];
+  chcontent += L'}';
+
+  chunk->changePart(CHCONTENT, chcontent);
+  isContentModified = false;
 }
 
 /**
@@ -222,14 +425,17 @@ void ChunkWord::updateChunkContent(const wstring & oldLu,
  *
  * @param pos the position of the lexical unit
  *
- * @return the reference to the lexical unit inside the chunk content.
+ * @return the reference to the lexical unit inside the chunk content, or NULL
+ * if there isn't a lexical unit in that position
  */
 BilingualLexicalUnit* ChunkWord::getContentLexicalUnit(int pos) {
-  if (content.size() == 0) {
-    parseChunkContent();
-  }
+  parsePendingContent();
 
-  return content[pos];
+  if (pos >= 0 && pos < (int) content.size()) {
+    return content[pos];
+  } else {
+    return NULL;
+  }
 }
 
 /**
@@ -238,6 +444,7 @@ BilingualLexicalUnit* ChunkWord::getContentLexicalUnit(int pos) {
  * @return the number of lexical units inside the chunk.
  */
 int ChunkWord::getLuCount() {
+  parsePendingContent();
   return content.size();
 }
 
@@ -250,6 +457,8 @@ int ChunkWord::getLuCount() {
  * @return the blank in position pos or "" if the position is past the end
  */
 wstring ChunkWord::getBlank(unsigned int pos) {
+  parsePendingContent();
+
   if (pos < blanks.size()) {
     return blanks[pos];
   } else {
@@ -264,8 +473,10 @@ wstring ChunkWord::getBlank(unsigned int pos) {
  * @param input the input stream to parse
  * @param words a collection of words to be filled.
  * @param blanks a collection of blanks to be filled.
- * @param solveRefs if references to chunk tags should be solved or not
- * @param parseContent if chunk content should be parsed and lus created or not
+ * @param solveRefs if references to chunk tags should be solved or not, when
+ * the chunk content is first needed
+ * @param parseContent if chunk content should be parsed and lus created or not,
+ * when it's first needed
  */
 void ChunkWord::tokenizeInput(wistream &input, vector<TransferWord*> &words,
     vector<wstring> &blanks, bool solveRefs, bool parseContent) {
@@ -301,12 +512,8 @@ void ChunkWord::tokenizeInput(wistream &input, vector<TransferWord*> &words,
       token += ch;
       word->chunk = new ChunkLexicalUnit(token);
 
-      if (solveRefs) {
-        word->solveReferences();
-      }
-      if (parseContent) {
-        word->parseChunkContent();
-      }
+      word->hasPendingReferences = solveRefs;
+      word->isContentPending = parseContent;
 
       words.push_back(word);
 
@@ -331,15 +538,27 @@ void ChunkWord::tokenizeInput(wistream &input, vector<TransferWord*> &words,
  *
  * @param lu the lexical unit to change the case from
  * @param luCase the new case to apply.
+ *
+ * @return true if the lemma changed, false if it already had that case
  */
-void ChunkWord::changeLemmaCase(BilingualLexicalUnit &lu, CASE luCase) {
-  wstring oldLem = lu.getPart(LEM);
+bool ChunkWord::changeLemmaCase(BilingualLexicalUnit &lu, CASE luCase) {
+  wstring oldLem(lu.getPart(LEM));
   wstring newLem = VMWstringUtils::changeCase(oldLem, luCase);
+  if (newLem == oldLem) {
+    return false;
+  }
 
+  // The chcontent is rebuilt from the whole of the lexical unit, so the head
+  // and queue of a multiword are changed too if the queue is before the tags,
+  // when the lemma is the start of whole.
+  size_t lemhSize = lu.getPart(LEMH).size();
+  if (lemhSize < oldLem.size()
+      && lu.getWhole().compare(0, oldLem.size(), oldLem) == 0) {
+    lu.changePart(LEMH, newLem.substr(0, lemhSize));
+    lu.changePart(LEMQ, newLem.substr(lemhSize));
+  }
   lu.changePart(LEM, newLem);
-
-  // Also, update the chcontent attribute of the chunk.
-  updateChunkContent(oldLem, newLem);
+  return true;
 }
 
 wostream& operator<<(wostream &wos, const ChunkWord &cw) {
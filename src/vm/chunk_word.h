@@ -20,6 +20,7 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <iostream>
 
@@ -28,7 +29,14 @@
 #include "chunk_lexical_unit.h"
 #include "vm_wstring_utils.h"
 
-/// Represent a word as a chunk for the interchunk and postchunk stages.
+/**
+ * Represent a word as a chunk for the interchunk and postchunk stages. In the
+ * postchunk stage, the chunk content is also kept as a list of lexical units
+ * and the text between them. Changes to those lexical units only mark the
+ * chcontent of the chunk as outdated, it's rebuilt when the chunk is used.
+ * The references to the chunk tags and the content are only processed when a
+ * rule needs them, unmatched chunks are written from the text.
+ */
 class ChunkWord: TransferWord {
 
   friend wostream& operator<<(wostream &, const ChunkWord &);
@@ -42,14 +50,16 @@ public:
   void copy(const ChunkWord &);
 
   ChunkLexicalUnit* getChunk();
+  bool isChunk(const LexicalUnit *) const;
   BilingualLexicalUnit* getContentLexicalUnit(int);
   int getLuCount();
   wstring getBlank(unsigned int);
 
   void solveReferences();
-  wstring replaceReference(const wstring &, wchar_t, const wstring &);
   void parseChunkContent();
-  void updateChunkContent(const wstring &, const wstring &);
+  void parsePendingContent();
+  void setContentModified();
+  void writeContent(wostream &);
 
   static void tokenizeInput(wistream &, vector<TransferWord *> &,
       vector<wstring> &, bool, bool);
@@ -65,7 +75,26 @@ private:
   /// Blanks inside the chunk content (between lexical units) have to be stored.
   vector<wstring> blanks;
 
-  void changeLemmaCase(BilingualLexicalUnit &, CASE);
+  /** The exact text around the lexical units of the chunk content, from the
+   * '{' to the first '^', between each '$' and the next '^' and from the last
+   * '$' to the '}'. It has one more element than content. */
+  vector<wstring> separators;
+
+  /// If a lexical unit of content changed and chcontent needs to be rebuilt.
+  bool isContentModified;
+
+  /// If the references to the chunk tags still have to be solved.
+  bool hasPendingReferences;
+
+  /// If the chunk content still has to be parsed as lexical units.
+  bool isContentPending;
+
+  void clearContent();
+  void updateChunkContent();
+  bool changeLemmaCase(BilingualLexicalUnit &, CASE);
+  vector<wstring_view> getTagsValues();
+  size_t solveReference(wstring_view, size_t, const vector<wstring_view> &,
+      wstring &);
 };
 
 #endif /* CHUNK_WORD_H_ */
@@ -0,0 +1,405 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "inliner.h"
+
+#include <cwchar>
+
+#include "optimizer.h"
+#include "vm_wstring_utils.h"
+
+using namespace std;
+
+/**
+ * Check if an instruction pushes a number, like the positions of the words.
+ *
+ * @param instr the instruction
+ *
+ * @return true if it's the push of a number
+ */
+static bool isNumberPush(const Instruction &instr) {
+  return instr.opCode == PUSH && instr.op1 != L""
+      && VMWstringUtils::iswnumeric(instr.op1);
+}
+
+/**
+ * Get the number of an instruction operand, e.g. an address or a position.
+ *
+ * @param operand the operand
+ *
+ * @return the number
+ */
+static unsigned int getNumber(const wstring &operand) {
+  return wcstoul(operand.c_str(), NULL, 10);
+}
+
+Inliner::Inliner() {
+  maxMacroSize = 0;
+  isPostchunk = false;
+  numInlinedCalls = 0;
+}
+
+/**
+ * Create an inliner for the code of a transfer stage.
+ *
+ * @param maxMacroSize the maximum number of instructions of the macros inlined
+ * @param isPostchunk if the code belongs to the postchunk
+ */
+Inliner::Inliner(unsigned int maxMacroSize, bool isPostchunk) {
+  this->maxMacroSize = maxMacroSize;
+  this->isPostchunk = isPostchunk;
+  numInlinedCalls = 0;
+}
+
+Inliner::Inliner(const Inliner &i) {
+  copy(i);
+}
+
+Inliner::~Inliner() {
+
+}
+
+Inliner& Inliner::operator=(const Inliner &i) {
+  if (this != &i) {
+    this->~Inliner();
+    this->copy(i);
+  }
+  return *this;
+}
+
+void Inliner::copy(const Inliner &i) {
+  maxMacroSize = i.maxMacroSize;
+  isPostchunk = i.isPostchunk;
+  numInlinedCalls = i.numInlinedCalls;
+}
+
+/**
+ * Inline the calls of every rule to the macros which can be inlined. All the
+ * rules and macros must be already loaded.
+ *
+ * @param rulesCode the code section containing rules
+ * @param macrosCode the code section containing macros
+ */
+void Inliner::inlineMacros(CodeSection &rulesCode,
+    const CodeSection &macrosCode) {
+  vector<InlinableMacro> macros;
+  for (unsigned int i = 0; i < macrosCode.units.size(); i++) {
+    macros.push_back(analyzeMacro(macrosCode.units[i]));
+  }
+
+  for (unsigned int i = 0; i < rulesCode.units.size(); i++) {
+    inlineCalls(rulesCode.units[i], macrosCode, macros);
+  }
+}
+
+/**
+ * Get the number of calls replaced by the code of their macros.
+ *
+ * @return the number of calls inlined
+ */
+unsigned int Inliner::getNumInlinedCalls() const {
+  return numInlinedCalls;
+}
+
+/**
+ * Check if a macro can be inlined and find the instructions using the words
+ * it receives. A macro is inlined if it's small, doesn't call other macros
+ * and every word position it uses is a number pushed just for it.
+ *
+ * @param macro the code unit of the macro
+ *
+ * @return the information needed to inline the macro
+ */
+InlinableMacro Inliner::analyzeMacro(const CodeUnit &macro) const {
+  InlinableMacro info;
+  info.isInlinable = false;
+
+  const vector<Instruction> &code = macro.code;
+  if (!macro.loaded || code.size() > maxMacroSize) {
+    return info;
+  }
+
+  vector<bool> targets = Optimizer::getJumpTargets(code);
+  vector<bool> removed(code.size(), false);
+
+  for (unsigned int i = 0; i < code.size(); i++) {
+    // The position of the word is the first operand of these instructions.
+    unsigned int numOperands = 0;
+
+    switch (code[i].opCode) {
+    case CALL: /* falls through */
+    case ADDTRIE:
+      return info;
+    case GET_CASE_FROM:
+      numOperands = 1;
+      break;
+    case CLIP: /* falls through */
+    case CLIPSL: /* falls through */
+    case CLIPTL:
+      numOperands = 2;
+      break;
+    case STORECL: /* falls through */
+    case STORESL: /* falls through */
+    case STORETL:
+      numOperands = 3;
+      break;
+    case PUSHSB:
+      // The blanks of the postchunk are always the ones of the chunk.
+      if (!isPostchunk) {
+        info.blanks.push_back(i);
+      }
+      break;
+    default:
+      break;
+    }
+
+    if (numOperands == 0) {
+      continue;
+    }
+
+    vector<unsigned int> starts = Optimizer::getOperandStarts(code, i,
+        numOperands, targets, removed);
+    if (starts.size() < numOperands) {
+      return info;
+    }
+
+    unsigned int start = starts[numOperands - 1];
+    unsigned int end = (numOperands == 1 ? i - 1 : starts[numOperands - 2] - 1);
+    if (start != end || !isNumberPush(code[start])) {
+      return info;
+    }
+    info.positions.push_back(start);
+  }
+
+  info.isInlinable = true;
+  return info;
+}
+
+/**
+ * Get the positions of the words passed to a macro, when all of them are
+ * numbers pushed just before the call.
+ *
+ * @param code the code of the caller
+ * @param callPos the position of the call
+ * @param targets the instructions of the caller reached by a jump
+ * @param arguments the positions passed to the macro, in order
+ *
+ * @return true if every argument is a number pushed for the call
+ */
+bool Inliner::getArguments(const vector<Instruction> &code,
+    unsigned int callPos, const vector<bool> &targets,
+    vector<unsigned int> &arguments) const {
+  if (callPos == 0 || targets[callPos] || targets[callPos - 1]
+      || !isNumberPush(code[callPos - 1])) {
+    return false;
+  }
+
+  unsigned int numArguments = getNumber(code[callPos - 1].op1);
+  vector<bool> removed(code.size(), false);
+  vector<unsigned int> starts = Optimizer::getOperandStarts(code, callPos - 1,
+      numArguments, targets, removed);
+  if (starts.size() < numArguments) {
+    return false;
+  }
+
+  for (int j = numArguments - 1; j >= 0; j--) {
+    unsigned int end = (j == 0 ? callPos - 2 : starts[j - 1] - 1);
+    if (starts[j] != end || !isNumberPush(code[starts[j]])) {
+      return false;
+    }
+    arguments.push_back(getNumber(code[starts[j]].op1));
+  }
+
+  return true;
+}
+
+/**
+ * Check if every position used by a macro can be changed to the position of a
+ * word of the caller.
+ *
+ * @param macro the code unit of the macro
+ * @param info the information of the macro
+ * @param arguments the positions passed to the macro
+ *
+ * @return true if the macro can be inlined with these arguments
+ */
+bool Inliner::canRemapPositions(const CodeUnit &macro,
+    const InlinableMacro &info, const vector<unsigned int> &arguments) const {
+  unsigned int numArguments = arguments.size();
+
+  for (unsigned int i = 0; i < info.positions.size(); i++) {
+    unsigned int pos = getNumber(macro.code[info.positions[i]].op1);
+
+    // In the postchunk 0 is the chunk and without arguments the positions
+    // are the ones of the caller.
+    if (isPostchunk) {
+      if (numArguments > 0 && pos > numArguments) {
+        return false;
+      }
+    } else if (pos < 1 || pos > numArguments) {
+      return false;
+    }
+  }
+
+  // The blanks are relative to the first word passed.
+  if (!info.blanks.empty() && numArguments == 0) {
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Replace the calls of a rule to the macros which can be inlined.
+ *
+ * @param rule the code unit of the rule
+ * @param macrosCode the code section containing macros
+ * @param macros the information of every macro
+ */
+void Inliner::inlineCalls(CodeUnit &rule, const CodeSection &macrosCode,
+    const vector<InlinableMacro> &macros) {
+  // The native code refers to the instructions by their address.
+  if (rule.native != NULL) {
+    return;
+  }
+
+  vector<Instruction> &ruleCode = rule.code;
+  vector<bool> targets = Optimizer::getJumpTargets(ruleCode);
+
+  vector<Instruction> code;
+  vector<unsigned int> newAddress(ruleCode.size() + 1, 0);
+  vector<unsigned int> ruleJumps;
+  unsigned int next = 0;
+  bool changed = false;
+
+  // Copy the instructions of the rule until a position, keeping their new
+  // address and which ones are jumps to update them at the end.
+  auto copyUntil = [&](unsigned int end) {
+    for (; next < end; next++) {
+      newAddress[next] = code.size();
+      if (Optimizer::isJump(ruleCode[next])) {
+        ruleJumps.push_back(code.size());
+      }
+      code.push_back(ruleCode[next]);
+    }
+  };
+
+  for (unsigned int i = 0; i < ruleCode.size(); i++) {
+    if (ruleCode[i].opCode != CALL) {
+      continue;
+    }
+
+    unsigned int macroNumber = getNumber(ruleCode[i].op1);
+    if (macroNumber >= macros.size() || !macros[macroNumber].isInlinable) {
+      continue;
+    }
+
+    const CodeUnit &macro = macrosCode.units[macroNumber];
+    vector<unsigned int> arguments;
+    if (!getArguments(ruleCode, i, targets, arguments)
+        || !canRemapPositions(macro, macros[macroNumber], arguments)) {
+      continue;
+    }
+
+    // The arguments, their number and the call are replaced by the macro.
+    unsigned int callStart = i - 1 - arguments.size();
+    copyUntil(callStart);
+    for (; next <= i; next++) {
+      newAddress[next] = code.size();
+    }
+    appendMacroCode(code, macro, macros[macroNumber], arguments);
+
+    numInlinedCalls++;
+    changed = true;
+  }
+
+  if (!changed) {
+    return;
+  }
+
+  copyUntil(ruleCode.size());
+  newAddress[ruleCode.size()] = code.size();
+
+  for (unsigned int i = 0; i < ruleJumps.size(); i++) {
+    Instruction &jump = code[ruleJumps[i]];
+    vector<unsigned int> addresses = Optimizer::getJumpAddresses(jump);
+    for (unsigned int j = 0; j < addresses.size(); j++) {
+      if (addresses[j] < newAddress.size()) {
+        addresses[j] = newAddress[addresses[j]];
+      }
+    }
+    Optimizer::setJumpAddresses(jump, addresses);
+  }
+
+  ruleCode.swap(code);
+}
+
+/**
+ * Append the code of a macro to the code of a rule, changing the positions of
+ * the words it uses and its addresses. Its final ret is removed and any other
+ * one jumps to the end of the macro.
+ *
+ * @param code the code of the rule
+ * @param macro the code unit of the macro
+ * @param info the information of the macro
+ * @param arguments the positions passed to the macro
+ */
+void Inliner::appendMacroCode(vector<Instruction> &code, const CodeUnit &macro,
+    const InlinableMacro &info, const vector<unsigned int> &arguments) const {
+  const vector<Instruction> &macroCode = macro.code;
+  unsigned int size = macroCode.size();
+  if (size > 0 && macroCode[size - 1].opCode == RET) {
+    size--;
+  }
+
+  unsigned int base = code.size();
+  unsigned int end = base + size;
+
+  vector<bool> isPosition(macroCode.size(), false);
+  for (unsigned int i = 0; i < info.positions.size(); i++) {
+    isPosition[info.positions[i]] = true;
+  }
+  vector<bool> isBlank(macroCode.size(), false);
+  for (unsigned int i = 0; i < info.blanks.size(); i++) {
+    isBlank[info.blanks[i]] = true;
+  }
+
+  for (unsigned int i = 0; i < size; i++) {
+    Instruction instr = macroCode[i];
+
+    if (instr.opCode == RET) {
+      instr.opCode = JMP;
+      instr.op1 = to_wstring(end);
+    } else if (Optimizer::isJump(instr)) {
+      vector<unsigned int> addresses = Optimizer::getJumpAddresses(instr);
+      for (unsigned int j = 0; j < addresses.size(); j++) {
+        addresses[j] = base + (addresses[j] < size ? addresses[j] : size);
+      }
+      Optimizer::setJumpAddresses(instr, addresses);
+    } else if (isPosition[i]) {
+      unsigned int pos = getNumber(instr.op1);
+      if (!arguments.empty() && (pos > 0 || !isPostchunk)) {
+        instr.op1 = to_wstring(arguments[pos - 1]);
+      }
+    } else if (isBlank[i]) {
+      unsigned int pos = getNumber(instr.op1);
+      instr.op1 = to_wstring(pos + arguments[0] - 1);
+    }
+
+    code.push_back(instr);
+  }
+}
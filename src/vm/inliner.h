@@ -0,0 +1,79 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef INLINER_H_
+#define INLINER_H_
+
+#include <vector>
+
+#include "instructions.h"
+
+using namespace std;
+
+/**
+ * Information about a macro needed to inline it: if it can be inlined and the
+ * instructions which refer to the words it receives as parameters.
+ */
+struct InlinableMacro {
+  bool isInlinable;
+  vector<unsigned int> positions;
+  vector<unsigned int> blanks;
+};
+
+/**
+ * Replaces the calls of the rules to small macros with the code of the macros,
+ * avoiding the work of the call stack. Only macros which don't call other
+ * macros are inlined and the positions of the words they use are changed to
+ * the positions of the words passed by the rule.
+ */
+class Inliner {
+
+public:
+
+  Inliner();
+  Inliner(unsigned int, bool);
+  Inliner(const Inliner &);
+  ~Inliner();
+  Inliner& operator=(const Inliner &);
+  void copy(const Inliner &);
+
+  void inlineMacros(CodeSection &, const CodeSection &);
+  unsigned int getNumInlinedCalls() const;
+
+private:
+
+  /// Maximum number of instructions of the macros to inline.
+  unsigned int maxMacroSize;
+
+  /// If the code belongs to the postchunk, which handles the words differently.
+  bool isPostchunk;
+
+  /// Number of calls replaced by the code of the macro.
+  unsigned int numInlinedCalls;
+
+  InlinableMacro analyzeMacro(const CodeUnit &) const;
+  bool getArguments(const vector<Instruction> &, unsigned int,
+      const vector<bool> &, vector<unsigned int> &) const;
+  bool canRemapPositions(const CodeUnit &, const InlinableMacro &,
+      const vector<unsigned int> &) const;
+  void inlineCalls(CodeUnit &, const CodeSection &,
+      const vector<InlinableMacro> &);
+  void appendMacroCode(vector<Instruction> &, const CodeUnit &,
+      const InlinableMacro &, const vector<unsigned int> &) const;
+};
+
+#endif /* INLINER_H_ */
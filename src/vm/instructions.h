@@ -33,7 +33,7 @@ enum OP_CODE {
   CLIPTL, CMP_SUBSTR, CMPI_SUBSTR, CMP, CMPI, CONCAT, CHUNK, ENDS_WITH,
   ENDS_WITH_IG, GET_CASE_FROM, IN, INIG, JMP, JZ, JNZ, MLU, MODIFY_CASE, PUSH,
   PUSHBL, PUSHSB, LU, LU_COUNT, NOT, OUT, RET, STORECL, STORESL, STORETL,
-  STOREV, CASE_OF
+  STOREV, CASE_OF, SWITCH
 };
 
 /// A struct representing a instruction as an opcode and an operand.
@@ -43,10 +43,15 @@ struct Instruction {
   int lineNumber = -1;
 };
 
+struct VmNativeRuntime;
+
 /// A code unit is a collection of instructions like the instructions of a rule.
 struct CodeUnit {
   bool loaded;
   vector<Instruction> code;
+
+  /// The code unit compiled to native code, NULL if it's interpreted.
+  void (*native)(const VmNativeRuntime *) = NULL;
 };
 
 /// A code section is a collection of code units like all rules of a file.
@@ -22,6 +22,7 @@
 
 #include "vm.h"
 #include "vm_wstring_utils.h"
+#include "switch_table.h"
 
 const wstring Interpreter::FALSE_WSTR = L"0";
 
@@ -29,11 +30,15 @@ const wstring Interpreter::TRUE_WSTR = L"1";
 
 Interpreter::Interpreter() {
   modifiedPC = false;
+  isCodeVerified = false;
+  initNativeRuntime();
 }
 
 Interpreter::Interpreter(VM *vm) {
   modifiedPC = false;
+  isCodeVerified = false;
   this->vm = vm;
+  initNativeRuntime();
 }
 
 Interpreter::Interpreter(const Interpreter &c) {
@@ -53,7 +58,263 @@ Interpreter& Interpreter::operator=(const Interpreter &c) {
 }
 
 void Interpreter::copy(const Interpreter &c) {
+  opcodeStats = c.opcodeStats;
+}
 
+/**
+ * Set if the code has been verified, so the interpreter can trust it and skip
+ * the checks of every instruction.
+ *
+ * @param verified true if the code has been verified
+ */
+void Interpreter::setCodeVerified(bool verified) {
+  isCodeVerified = verified;
+}
+
+/**
+ * Get the statistics of the instructions executed, which are only gathered if
+ * the vm is built with OPCODE_STATS defined.
+ *
+ * @return the statistics
+ */
+const OpcodeStats& Interpreter::getOpcodeStats() const {
+  return opcodeStats;
+}
+
+/**
+ * Run the native code of the current code unit, a rule compiled ahead of time.
+ */
+void Interpreter::executeNative() {
+  vm->currentCodeUnit->native(&nativeRuntime);
+}
+
+/**
+ * Set the functions used by the native code, with this interpreter as their
+ * context.
+ */
+void Interpreter::initNativeRuntime() {
+  static_assert(NUM_OP_CODES <= VM_NATIVE_MAX_OP_CODES,
+      "The native handlers table is too small for the opcodes.");
+
+  nativeRuntime.context = this;
+
+  // The jumps, calls and returns are native code, so they and any unknown
+  // opcode go through execute.
+  for (unsigned int i = 0; i < VM_NATIVE_MAX_OP_CODES; i++) {
+    nativeRuntime.handlers[i] = &Interpreter::nativeExecute;
+  }
+  nativeRuntime.handlers[ADDTRIE] = &nativeHandler<&Interpreter::executeAddtrie>;
+  nativeRuntime.handlers[AND] = &nativeHandler<&Interpreter::executeAnd>;
+  nativeRuntime.handlers[APPEND] = &nativeHandler<&Interpreter::executeAppend>;
+  nativeRuntime.handlers[BEGINS_WITH] =
+      &nativeHandler<&Interpreter::executeBeginsWith>;
+  nativeRuntime.handlers[BEGINS_WITH_IG] =
+      &nativeHandler<&Interpreter::executeBeginsWithIg>;
+  nativeRuntime.handlers[OR] = &nativeHandler<&Interpreter::executeOr>;
+  nativeRuntime.handlers[CLIP] = &nativeHandler<&Interpreter::executeClip>;
+  nativeRuntime.handlers[CLIPSL] = &nativeHandler<&Interpreter::executeClipsl>;
+  nativeRuntime.handlers[CLIPTL] = &nativeHandler<&Interpreter::executeCliptl>;
+  nativeRuntime.handlers[CMP_SUBSTR] =
+      &nativeHandler<&Interpreter::executeCmpSubstr>;
+  nativeRuntime.handlers[CMPI_SUBSTR] =
+      &nativeHandler<&Interpreter::executeCmpiSubstr>;
+  nativeRuntime.handlers[CMP] = &nativeHandler<&Interpreter::executeCmp>;
+  nativeRuntime.handlers[CMPI] = &nativeHandler<&Interpreter::executeCmpi>;
+  nativeRuntime.handlers[CONCAT] = &nativeHandler<&Interpreter::executeConcat>;
+  nativeRuntime.handlers[CHUNK] = &nativeHandler<&Interpreter::executeChunk>;
+  nativeRuntime.handlers[ENDS_WITH] =
+      &nativeHandler<&Interpreter::executeEndsWith>;
+  nativeRuntime.handlers[ENDS_WITH_IG] =
+      &nativeHandler<&Interpreter::executeEndsWithIg>;
+  nativeRuntime.handlers[GET_CASE_FROM] =
+      &nativeHandler<&Interpreter::executeGetCaseFrom>;
+  nativeRuntime.handlers[IN] = &nativeHandler<&Interpreter::executeIn>;
+  nativeRuntime.handlers[INIG] = &nativeHandler<&Interpreter::executeInig>;
+  nativeRuntime.handlers[MLU] = &nativeHandler<&Interpreter::executeMlu>;
+  nativeRuntime.handlers[MODIFY_CASE] =
+      &nativeHandler<&Interpreter::executeModifyCase>;
+  nativeRuntime.handlers[PUSH] = &nativeHandler<&Interpreter::executePush>;
+  nativeRuntime.handlers[PUSHBL] = &nativeHandler<&Interpreter::executePushbl>;
+  nativeRuntime.handlers[PUSHSB] = &nativeHandler<&Interpreter::executePushsb>;
+  nativeRuntime.handlers[LU] = &nativeHandler<&Interpreter::executeLu>;
+  nativeRuntime.handlers[LU_COUNT] =
+      &nativeHandler<&Interpreter::executeLuCount>;
+  nativeRuntime.handlers[NOT] = &nativeHandler<&Interpreter::executeNot>;
+  nativeRuntime.handlers[OUT] = &nativeHandler<&Interpreter::executeOut>;
+  nativeRuntime.handlers[STORECL] =
+      &nativeHandler<&Interpreter::executeStorecl>;
+  nativeRuntime.handlers[STORESL] =
+      &nativeHandler<&Interpreter::executeStoresl>;
+  nativeRuntime.handlers[STORETL] =
+      &nativeHandler<&Interpreter::executeStoretl>;
+  nativeRuntime.handlers[STOREV] = &nativeHandler<&Interpreter::executeStorev>;
+  nativeRuntime.handlers[CASE_OF] = &nativeHandler<&Interpreter::executeCaseOf>;
+
+  nativeRuntime.push = &Interpreter::nativePush;
+  nativeRuntime.popCondition = &Interpreter::nativePopCondition;
+  nativeRuntime.call = &Interpreter::nativeCall;
+  nativeRuntime.switchAddress = &Interpreter::nativeSwitchAddress;
+  nativeRuntime.clip = &Interpreter::nativeClip;
+  nativeRuntime.compare = &Interpreter::nativeCompare;
+}
+
+/**
+ * Execute an instruction of the current code unit for the native code, with
+ * the dispatch of the interpreter.
+ *
+ * @param context the interpreter
+ * @param address the address of the instruction
+ */
+void Interpreter::nativeExecute(void *context, unsigned int address) {
+  Interpreter *interpreter = (Interpreter *) context;
+  interpreter->execute(interpreter->vm->currentCodeUnit->code[address]);
+}
+
+/**
+ * Execute an instruction of the current code unit for the native code, with
+ * the handler of its opcode. The PC is only set for the errors, as the native
+ * code doesn't use it.
+ *
+ * @param context the interpreter
+ * @param address the address of the instruction
+ */
+template <void (Interpreter::*handler)(const Instruction &)>
+void Interpreter::nativeHandler(void *context, unsigned int address) {
+  Interpreter *interpreter = (Interpreter *) context;
+  interpreter->vm->PC = address;
+  (interpreter->*handler)(interpreter->vm->currentCodeUnit->code[address]);
+}
+
+/**
+ * Execute a clip instruction of the current code unit for the native code,
+ * with its position and parts passed as literals instead of pushed.
+ *
+ * @param context the interpreter
+ * @param address the address of the clip, clipsl or cliptl instruction
+ * @param pos the position of the word
+ * @param parts the characters of the parts to clip
+ * @param length the number of characters of the parts
+ */
+void Interpreter::nativeClip(void *context, unsigned int address, int pos,
+    const wchar_t *parts, unsigned int length) {
+  Interpreter *interpreter = (Interpreter *) context;
+  interpreter->vm->PC = address;
+  interpreter->clip(interpreter->vm->currentCodeUnit->code[address], pos,
+      wstring(parts, length));
+}
+
+/**
+ * Execute a cmp or cmpi instruction of the current code unit for the native
+ * code, returning its result instead of pushing it.
+ *
+ * @param context the interpreter
+ * @param address the address of the cmp or cmpi instruction
+ * @param literal the characters of the first operand, or NULL to pop it
+ * @param length the number of characters of the literal
+ *
+ * @return 1 if the operands are equal, 0 otherwise
+ */
+int Interpreter::nativeCompare(void *context, unsigned int address,
+    const wchar_t *literal, unsigned int length) {
+  Interpreter *interpreter = (Interpreter *) context;
+  interpreter->vm->PC = address;
+
+  wstring op1 = (literal != NULL ? wstring(literal, length)
+      : interpreter->popSystemStack());
+  wstring op2 = interpreter->popSystemStack();
+
+  if (interpreter->vm->currentCodeUnit->code[address].opCode == CMPI) {
+    return VMWstringUtils::wtolower(op1) == VMWstringUtils::wtolower(op2);
+  } else {
+    return op1 == op2;
+  }
+}
+
+/**
+ * Push a string to the system stack for the native code.
+ *
+ * @param context the interpreter
+ * @param str the characters of the string
+ * @param length the number of characters
+ */
+void Interpreter::nativePush(void *context, const wchar_t *str,
+    unsigned int length) {
+  Interpreter *interpreter = (Interpreter *) context;
+  interpreter->vm->systemStack.emplace_back(str, length);
+}
+
+/**
+ * Pop the condition of a jump from the system stack for the native code.
+ *
+ * @param context the interpreter
+ *
+ * @return 0 if the condition is false, 1 otherwise
+ */
+int Interpreter::nativePopCondition(void *context) {
+  Interpreter *interpreter = (Interpreter *) context;
+  vector<wstring> &systemStack = interpreter->vm->systemStack;
+
+  if (!interpreter->isCodeVerified && systemStack.empty()) {
+    interpreter->throwError(L"The system stack is empty.");
+  }
+
+  int condition = (systemStack.back() != FALSE_WSTR);
+  systemStack.pop_back();
+  return condition;
+}
+
+/**
+ * Pop the value of a switch instruction of the current code unit for the
+ * native code, finding the address it jumps to.
+ *
+ * @param context the interpreter
+ * @param address the address of the switch instruction
+ *
+ * @return the address to jump to
+ */
+int Interpreter::nativeSwitchAddress(void *context, unsigned int address) {
+  Interpreter *interpreter = (Interpreter *) context;
+  return interpreter->popSwitchAddress(
+      interpreter->vm->currentCodeUnit->code[address]);
+}
+
+/**
+ * Execute a call of the current code unit for the native code, running the
+ * macro called until it returns.
+ *
+ * @param context the interpreter
+ * @param address the address of the call instruction
+ */
+void Interpreter::nativeCall(void *context, unsigned int address) {
+  Interpreter *interpreter = (Interpreter *) context;
+  unsigned int depth = interpreter->vm->callStack->getDepth();
+
+  interpreter->executeCall(interpreter->vm->currentCodeUnit->code[address]);
+  interpreter->modifiedPC = false;
+  interpreter->runCalledUnit(depth);
+}
+
+/**
+ * Run the code unit just called until it returns, natively if it has native
+ * code or with the interpreter otherwise.
+ *
+ * @param depth the depth of the call stack before the call
+ */
+void Interpreter::runCalledUnit(unsigned int depth) {
+  const CodeUnit *unit = vm->currentCodeUnit;
+
+  if (unit->native != NULL) {
+    unit->native(&nativeRuntime);
+    vm->callStack->popCall();
+  } else {
+    while (vm->status == RUNNING && vm->callStack->getDepth() > depth
+        && vm->PC < vm->endAddress) {
+      if (vm->profiler != NULL) {
+        vm->profiler->countInstruction();
+      }
+      execute(vm->currentCodeUnit->code[vm->PC]);
+    }
+  }
 }
 
 /**
@@ -85,18 +346,27 @@ void Interpreter::modifyPC(int newPC) {
  */
 LexicalUnit* Interpreter::getSourceLexicalUnit(int relativePos) {
   if (vm->transferStage == TRANSFER) {
+    checkWordPosition(relativePos);
     int realPos = vm->currentWords[relativePos - 1];
     return ((BilingualWord *) vm->words[realPos])->getSource();
   } else if (vm->transferStage == INTERCHUNK) {
+    checkWordPosition(relativePos);
     int realPos = vm->currentWords[relativePos - 1];
     return ((ChunkWord *) vm->words[realPos])->getChunk();
   } else {
-    // Get the only word available in the postchunk.
+    // Get the only word available in the postchunk, with its content ready.
     ChunkWord *word = (ChunkWord *) vm->words[vm->currentWords[0]];
+    word->parsePendingContent();
 
+    // The verifier doesn't check the positions in the postchunk, where the
+    // number of lexical units depends on the chunk, so they're always checked.
     int realPos;
     // If it's a macro, get the position passed as a parameter.
-    if (vm->currentWords.size() > 1) {
+    if (vm->numCurrentWords > 1) {
+      if (relativePos < 0 || relativePos >= (int) vm->numCurrentWords) {
+        throwError(L"The position " + to_wstring(relativePos)
+            + L" isn't one of the parameters of the macro.");
+      }
       realPos = vm->currentWords[relativePos];
     } else {
       realPos = relativePos;
@@ -104,9 +374,14 @@ LexicalUnit* Interpreter::getSourceLexicalUnit(int relativePos) {
 
     if (realPos == 0) {
       return word->getChunk();
-    } else {
-      return word->getContentLexicalUnit(realPos - 1);
     }
+
+    LexicalUnit *lu = word->getContentLexicalUnit(realPos - 1);
+    if (lu == NULL) {
+      throwError(L"The position " + to_wstring(realPos)
+          + L" isn't one of the lexical units of the chunk.");
+    }
+    return lu;
   }
 }
 
@@ -118,11 +393,25 @@ LexicalUnit* Interpreter::getSourceLexicalUnit(int relativePos) {
  * @return a reference to the lexical unit
  */
 LexicalUnit* Interpreter::getTargetLexicalUnit(int relativePos) {
-  // TODO(asfrent): check relativePos, this makes a memcheck test fail.
+  checkWordPosition(relativePos);
   int realPos = vm->currentWords[relativePos - 1];
   return ((BilingualWord *) vm->words[realPos])->getTarget();
 }
 
+/**
+ * Check that a position refers to one of the current words, unless the code
+ * has been verified.
+ *
+ * @param relativePos the position of the word in the current context
+ */
+void Interpreter::checkWordPosition(int relativePos) {
+  if (!isCodeVerified && (relativePos < 1
+      || relativePos > (int) vm->numCurrentWords)) {
+    throwError(L"The position " + to_wstring(relativePos)
+        + L" isn't one of the current words.");
+  }
+}
+
 /**
  * Execute all the code inside the preprocessing code section.
  */
@@ -137,10 +426,14 @@ void Interpreter::preprocess() {
  * Execute a instruction, modifying the vm accordingly.
  */
 void Interpreter::execute(const Instruction &instr) {
+#ifdef OPCODE_STATS
+  uint64_t startCycles = Profiler::readCycles();
+#endif
 
   // Execute the appropriate instruction depending on the opcode.
   // Cases are ordered by frequency (calculated using the en-ca pair) just
-  // in case the compiler doesn't optimize it.
+  // in case the compiler doesn't optimize it. A vm built with OPCODE_STATS
+  // measures it with --opcode-stats.
   switch (instr.opCode) {
   case PUSH: executePush(instr); break;
   case CLIPTL: executeCliptl(instr); break;
@@ -181,8 +474,14 @@ void Interpreter::execute(const Instruction &instr) {
   case ENDS_WITH_IG: executeEndsWithIg(instr); break;
   case CMP_SUBSTR: executeCmpSubstr(instr); break;
   case CMPI_SUBSTR: executeCmpiSubstr(instr); break;
+  case SWITCH: executeSwitch(instr); break;
   }
 
+#ifdef OPCODE_STATS
+  opcodeStats.count(instr, Profiler::readCycles() - startCycles,
+      vm->systemStack.size(), vm->callStack->getDepth());
+#endif
+
   // If the last instruction didn't modify the PC, point it to the next
   // instruction. Otherwise, keep the modified PC.
   if (!modifiedPC) {
@@ -211,34 +510,16 @@ vector<wstring> Interpreter::getOperands(const Instruction &instr) {
   return operands;
 }
 
-/**
- * Get n operands from the stack and return them reversed.
- *
- * @param instr the instruction to get the operands for
- * @param n the number of operands
- *
- * @return the operands in reversed stack order
- */
-vector<int> Interpreter::getNOperands(const Instruction &instr,
-    const wstring &n) {
-  vector<int> operands;
-
-  int numOperands = VMWstringUtils::stringTo<int>(n);
-  while (numOperands > 0) {
-    int operand = popSystemStackInteger();
-    operands.insert(operands.begin(), operand);
-    numOperands--;
-  }
-
-  return operands;
-}
-
 /**
  * Pop the top of the stack and return its value.
  *
  * @return the top of the stack
  */
 wstring Interpreter::popSystemStack() {
+  if (!isCodeVerified && vm->systemStack.empty()) {
+    throwError(L"The system stack is empty.");
+  }
+
   wstring top = vm->systemStack.back();
   vm->systemStack.pop_back();
 
@@ -251,6 +532,10 @@ wstring Interpreter::popSystemStack() {
  * @return the top of the stack
  */
 int Interpreter::popSystemStackInteger() {
+  if (!isCodeVerified && vm->systemStack.empty()) {
+    throwError(L"The system stack is empty.");
+  }
+
   int intValue = VMWstringUtils::stringTo<int>(vm->systemStack.back());
   vm->systemStack.pop_back();
   return intValue;
@@ -399,32 +684,37 @@ void Interpreter::executeCall(const Instruction &instr) {
   // Save current PC to return later when the macro ends.
   vm->callStack->saveCurrentPC(vm->PC);
 
-  // Get the words passed as argument to the macro.
-  vector<int> operands = getNOperands(instr, popSystemStack());
+  // Create an entry in the call stack with the macro called.
+  int macroNumber = VMWstringUtils::stringTo<int>(instr.op1);
+  TCALL &call = vm->callStack->prepareCall(MACROS_SECTION, macroNumber);
 
-  vector<int> words;
+  // Get the words passed as argument to the macro, which are in the stack in
+  // the same order as the parameters.
+  unsigned int numOperands = popSystemStackInteger();
+  if (!isCodeVerified && numOperands > vm->systemStack.size()) {
+    throwError(L"The stack doesn't have the words passed to the macro.");
+  }
+  unsigned int firstOperand = vm->systemStack.size() - numOperands;
 
   if (vm->transferStage == POSTCHUNK) {
     // For the postchunk append the index of the only current word and then
     // append all the parameters.
-    words.push_back(vm->currentWords[0]);
-    words.insert(words.end(), operands.begin(), operands.end());
+    vm->callStack->addWord(call, vm->currentWords[0]);
+    for (unsigned int i = firstOperand; i < vm->systemStack.size(); i++) {
+      vm->callStack->addWord(call, VMWstringUtils::stringTo<int>(
+          vm->systemStack[i]));
+    }
   } else {
     // For the rest, just append the index of the current words.
-    for (unsigned int i = 0; i < operands.size(); i++) {
-      words.push_back(vm->currentWords[operands[i] - 1]);
+    for (unsigned int i = firstOperand; i < vm->systemStack.size(); i++) {
+      int pos = VMWstringUtils::stringTo<int>(vm->systemStack[i]);
+      checkWordPosition(pos);
+      vm->callStack->addWord(call, vm->currentWords[pos - 1]);
     }
   }
+  vm->systemStack.resize(firstOperand);
 
-  // Create an entry in the call stack with the macro called.
-  int macroNumber = VMWstringUtils::stringTo<int>(instr.op1);
-
-  TCALL call;
-  call.PC = 0;
-  call.number = macroNumber;
-  call.section = MACROS_SECTION;
-  call.words = words;
-  vm->callStack->pushCall(call);
+  vm->callStack->pushCall();
 
   // Tell the interpreter that the PC has been modified, so it does not.
   modifyPC(vm->PC);
@@ -438,104 +728,231 @@ void Interpreter::executeRet(const Instruction &instr) {
 void Interpreter::executeClip(const Instruction &instr) {
   wstring parts = popSystemStack();
   int pos = popSystemStackInteger();
-  LexicalUnit *lu = getSourceLexicalUnit(pos);
-
-  wstring linkTo = instr.op1;
-  if (linkTo != L"") {
-    VMWstringUtils::replace(linkTo, L"\"", L"");
-  }
-
-  wstring lemmaAndTags = lu->getPart(LEM) + lu->getPart(TAGS);
-  handleClipInstruction(parts, lu, lemmaAndTags, linkTo);
+  clip(instr, pos, parts);
 }
 
 void Interpreter::executeClipsl(const Instruction &instr) {
   wstring parts = popSystemStack();
   int pos = popSystemStackInteger();
-  LexicalUnit *lu = getSourceLexicalUnit(pos);
-
-  wstring linkTo = instr.op1;
-  if (linkTo != L"") {
-    VMWstringUtils::replace(linkTo, L"\"", L"");
-  }
-
-  handleClipInstruction(parts, lu, lu->getWhole(), linkTo);
+  clip(instr, pos, parts);
 }
 
 void Interpreter::executeCliptl(const Instruction &instr) {
   wstring parts = popSystemStack();
   int pos = popSystemStackInteger();
-  LexicalUnit *lu = getTargetLexicalUnit(pos);
+  clip(instr, pos, parts);
+}
+
+/**
+ * Clip the parts of a word, from the source language for a clip or clipsl
+ * instruction and from the target language for a cliptl.
+ *
+ * @param instr the clip, clipsl or cliptl instruction
+ * @param pos the position of the word
+ * @param parts the parts to clip
+ */
+void Interpreter::clip(const Instruction &instr, int pos,
+    const wstring &parts) {
+  LexicalUnit *lu;
+  if (instr.opCode == CLIPTL) {
+    lu = getTargetLexicalUnit(pos);
+  } else {
+    lu = getSourceLexicalUnit(pos);
+  }
 
   wstring linkTo = instr.op1;
   if (linkTo != L"") {
     VMWstringUtils::replace(linkTo, L"\"", L"");
   }
 
-  handleClipInstruction(parts, lu, lu->getWhole(), linkTo);
+  handleClipInstruction(parts, lu, (instr.opCode == CLIP ? LEM : WHOLE),
+      linkTo);
 }
 
 void Interpreter::handleClipInstruction(const wstring &parts, LexicalUnit *lu,
-    const wstring &lemmaAndTags, const wstring &linkTo) {
+    LU_PART context, const wstring &linkTo) {
   bool notLinkTo = (linkTo == L"");
 
   if (notLinkTo && parts == L"whole") {
     vm->systemStack.push_back(lu->getWhole());
     return;
   } else if (notLinkTo && parts == L"lem") {
-    vm->systemStack.push_back(lu->getPart(LEM));
+    vm->systemStack.emplace_back(lu->getPart(LEM));
     return;
   } else if (notLinkTo && parts == L"lemh") {
-    vm->systemStack.push_back(lu->getPart(LEMH));
+    vm->systemStack.emplace_back(lu->getPart(LEMH));
     return;
   } else if (notLinkTo && parts == L"lemq") {
-    vm->systemStack.push_back(lu->getPart(LEMQ));
+    vm->systemStack.emplace_back(lu->getPart(LEMQ));
     return;
   } else if (notLinkTo && parts == L"tags") {
-    vm->systemStack.push_back(lu->getPart(TAGS));
+    vm->systemStack.emplace_back(lu->getPart(TAGS));
     return;
   } else if (notLinkTo && parts == L"chcontent") {
-    vm->systemStack.push_back(lu->getPart(CHCONTENT));
+    vm->systemStack.emplace_back(lu->getPart(CHCONTENT));
     return;
   } else if (notLinkTo && parts == L"content") {
-    vm->systemStack.push_back(lu->getPart(CONTENT));
+    vm->systemStack.emplace_back(lu->getPart(CONTENT));
     return;
   } else {
     // Check if one of the parts divided by | matches the lemma or tags.
-    wstring longestMatch = L"";
-    wstring part = L"";
-
-    size_t pipePos = 0, prevPipePos = -1;
-    while(true) {
-      pipePos = parts.find(L'|', prevPipePos + 1);
-      part = parts.substr(prevPipePos + 1, pipePos - prevPipePos - 1);
-
-      if (lemmaAndTags.find(part) != wstring::npos) {
-        if (notLinkTo) {
-          if (part.size() > longestMatch.size()) {
-            longestMatch = part;
-          }
-        } else {
-          vm->systemStack.push_back(linkTo);
+    int match = matchAttribute(parts, lu, context, notLinkTo);
+
+    if (match != -1) {
+      if (notLinkTo) {
+        const wstring &longestMatch = getAttributeAlternatives(parts)
+            .values[match];
+        if (longestMatch != L"") {
+          vm->systemStack.push_back(longestMatch);
           return;
         }
+      } else {
+        vm->systemStack.push_back(linkTo);
+        return;
+      }
+    }
+  }
+
+  // If the lu doesn't have the part needed, return "".
+  vm->systemStack.push_back(L"");
+}
+
+/**
+ * Get the alternatives of an attribute, splitting and parsing them the first
+ * time the attribute is used.
+ *
+ * @param parts the alternatives divided by |
+ *
+ * @return the alternatives of the attribute
+ */
+const AttributeAlternatives& Interpreter::getAttributeAlternatives(
+    const wstring &parts) {
+  unordered_map<wstring, AttributeAlternatives>::iterator it =
+      attributes.find(parts);
+
+  if (it != attributes.end()) {
+    return it->second;
+  }
+
+  AttributeAlternatives &alternatives = attributes[parts];
+
+  size_t pipePos = 0, prevPipePos = -1;
+  while(true) {
+    pipePos = parts.find(L'|', prevPipePos + 1);
+    wstring part = parts.substr(prevPipePos + 1, pipePos - prevPipePos - 1);
+
+    unsigned int index = alternatives.values.size();
+    TagSequence sequence;
+    bool isSequence = sequence.assign(part);
+
+    alternatives.values.push_back(part);
+    alternatives.sequences.push_back(sequence);
+    alternatives.isSequence.push_back(isSequence);
+
+    if (isSequence && sequence.size() == 1) {
+      // Only the first alternative with a tag can be chosen, keep that one.
+      alternatives.singleTags.insert(make_pair(sequence[0], index));
+    } else {
+      alternatives.others.push_back(index);
+    }
+
+    if(pipePos == wstring::npos) {
+      break;
+    }
+
+    prevPipePos = pipePos;
+  }
+
+  return alternatives;
+}
+
+/**
+ * Find which alternative of an attribute matches a lexical unit. The tags of
+ * the lexical unit are intersected with the alternatives by identifier and the
+ * text is only used if some alternative or the lexical unit can't be compared
+ * that way.
+ *
+ * @param parts the alternatives divided by |
+ * @param lu the lexical unit to match
+ * @param context LEM to search in the lemma and tags, WHOLE to search in
+ * the whole lexical unit
+ * @param longest true to get the longest alternative matched, false to get the
+ * first one
+ *
+ * @return the index of the alternative matched or -1 if none matched
+ */
+int Interpreter::matchAttribute(const wstring &parts, LexicalUnit *lu,
+    LU_PART context, bool longest) {
+  const AttributeAlternatives &alternatives = getAttributeAlternatives(parts);
+  const TagSequence *tags = lu->getTagSequence(context);
+  int match = -1;
+
+  // Choose the longest alternative or, on a tie or if longest is false, the
+  // first one defined.
+  auto choose = [&](unsigned int index) {
+    if (match == -1) {
+      match = index;
+    } else if (longest) {
+      size_t size = alternatives.values[index].size();
+      size_t matchSize = alternatives.values[match].size();
+      if (size > matchSize || (size == matchSize && (int) index < match)) {
+        match = index;
       }
+    } else if ((int) index < match) {
+      match = index;
+    }
+  };
 
-      if(pipePos == wstring::npos) {
-        break;
+  if (tags == NULL) {
+    // The lexical unit can only be searched as text.
+    wstring text;
+    if (context == LEM) {
+      text = wstring(lu->getPart(LEM)).append(lu->getPart(TAGS));
+    } else {
+      text = lu->getWhole();
+    }
+
+    for (unsigned int i = 0; i < alternatives.values.size(); i++) {
+      if (text.find(alternatives.values[i]) != wstring::npos) {
+        choose(i);
       }
+    }
+    return match;
+  }
 
-      prevPipePos = pipePos;
+  for (unsigned int i = 0; i < tags->size(); i++) {
+    unordered_map<unsigned int, unsigned int>::const_iterator it =
+        alternatives.singleTags.find((*tags)[i]);
+    if (it != alternatives.singleTags.end()) {
+      choose(it->second);
     }
+  }
 
-    if (longestMatch != L"") {
-      vm->systemStack.push_back(longestMatch);
-      return;
+  wstring text;
+  bool isTextBuilt = false;
+  for (unsigned int i = 0; i < alternatives.others.size(); i++) {
+    unsigned int index = alternatives.others[i];
+
+    if (alternatives.isSequence[index]) {
+      if (tags->find(alternatives.sequences[index]) != -1) {
+        choose(index);
+      }
+    } else {
+      if (!isTextBuilt) {
+        if (context == LEM) {
+          text = wstring(lu->getPart(LEM)).append(lu->getPart(TAGS));
+        } else {
+          text = lu->getWhole();
+        }
+        isTextBuilt = true;
+      }
+      if (text.find(alternatives.values[index]) != wstring::npos) {
+        choose(index);
+      }
     }
   }
 
-  // If the lu doesn't have the part needed, return "".
-  vm->systemStack.push_back(L"");
+  return match;
 }
 
 void Interpreter::executeCmp(const Instruction &instr) {
@@ -743,6 +1160,59 @@ void Interpreter::executeJnz(const Instruction &instr) {
   }
 }
 
+void Interpreter::executeSwitch(const Instruction &instr) {
+  modifyPC(popSwitchAddress(instr));
+}
+
+/**
+ * Pop the value of a switch instruction and find the address it jumps to.
+ *
+ * @param instr the switch instruction
+ *
+ * @return the address of the case of the value, or the default one
+ */
+int Interpreter::popSwitchAddress(const Instruction &instr) {
+  const SwitchJumps &jumps = getSwitchJumps(instr.op1);
+  wstring value = popSystemStack();
+
+  unordered_map<wstring, int>::const_iterator it =
+      jumps.addresses.find(value);
+  if (it != jumps.addresses.end()) {
+    return it->second;
+  }
+
+  return jumps.defaultAddress;
+}
+
+/**
+ * Get the jump table of a switch instruction, parsing it the first time the
+ * instruction is executed.
+ *
+ * @param operand the operand of the switch instruction
+ *
+ * @return the jump table
+ */
+const SwitchJumps& Interpreter::getSwitchJumps(const wstring &operand) {
+  unordered_map<wstring, SwitchJumps>::iterator it = switches.find(operand);
+
+  if (it != switches.end()) {
+    return it->second;
+  }
+
+  SwitchTable table(operand);
+  SwitchJumps &jumps = switches[operand];
+  jumps.defaultAddress = VMWstringUtils::stringTo<int>(
+      table.getDefaultTarget());
+
+  // The first case with a value is the one chosen.
+  for (unsigned int i = 0; i < table.getNumCases(); i++) {
+    jumps.addresses.insert(make_pair(table.getValue(i),
+        VMWstringUtils::stringTo<int>(table.getTarget(i))));
+  }
+
+  return jumps;
+}
+
 void Interpreter::executeLu(const Instruction &instr) {
   vector<wstring> operands = getOperands(instr);
 
@@ -799,7 +1269,7 @@ void Interpreter::executeCaseOf(const Instruction &instr) {
 void Interpreter::executeGetCaseFrom(const Instruction &instr) {
   int pos = popSystemStackInteger();
   LexicalUnit *lu = getSourceLexicalUnit(pos);
-  wstring lem = lu->getPart(LEM);
+  wstring lem(lu->getPart(LEM));
 
   pushCaseToStack(VMWstringUtils::getCase(lem));
 }
@@ -815,11 +1285,9 @@ void Interpreter::executeModifyCase(const Instruction &instr) {
 
 void Interpreter::executeOut(const Instruction &instr) {
   vector<wstring> operands = getOperands(instr);
-  wstring out = L"";
   for (unsigned int i = 0; i < operands.size(); i++) {
-    out += operands[i];
+    vm->writeOutput(operands[i]);
   }
-  vm->writeOutput(out);
 }
 
 void Interpreter::executePush(const Instruction &instr) {
@@ -872,8 +1340,7 @@ void Interpreter::executeStorecl(const Instruction &instr) {
   int pos = popSystemStackInteger();
   LexicalUnit *lu = getSourceLexicalUnit(pos);
 
-  wstring lemmaAndTags = lu->getPart(LEM) + lu->getPart(TAGS);
-  handleStoreClipInstruction(parts, lu, lemmaAndTags, value);
+  handleStoreClipInstruction(parts, lu, LEM, value);
 }
 
 void Interpreter::executeStoresl(const Instruction &instr) {
@@ -882,7 +1349,7 @@ void Interpreter::executeStoresl(const Instruction &instr) {
   int pos = popSystemStackInteger();
   LexicalUnit *lu = getSourceLexicalUnit(pos);
 
-  handleStoreClipInstruction(parts, lu, lu->getWhole(), value);
+  handleStoreClipInstruction(parts, lu, WHOLE, value);
 }
 
 void Interpreter::executeStoretl(const Instruction &instr) {
@@ -891,12 +1358,11 @@ void Interpreter::executeStoretl(const Instruction &instr) {
   int pos = popSystemStackInteger();
   LexicalUnit *lu = getTargetLexicalUnit(pos);
 
-  handleStoreClipInstruction(parts, lu, lu->getWhole(), value);
+  handleStoreClipInstruction(parts, lu, WHOLE, value);
 }
 
 void Interpreter::handleStoreClipInstruction(const wstring &parts,
-    LexicalUnit *lu, const wstring &lemmaAndTags, const wstring &value) {
-  wstring oldWhole = lu->getWhole();
+    LexicalUnit *lu, LU_PART context, const wstring &value) {
   bool change = false;
 
   if (parts == L"whole") {
@@ -924,39 +1390,24 @@ void Interpreter::handleStoreClipInstruction(const wstring &parts,
     }
   } else {
     // Check if one of the parts divided by | matches the lemma or tags.
-    wstring longestMatch = L"";
-    wstring part = L"";
-    wchar_t ch;
-
-    for (unsigned int i = 0; i < parts.size(); i++) {
-      ch = parts[i];
-
-      if (i == parts.size() - 1) {
-        part += ch;
-      }
-
-      if (ch == L'|' || i == parts.size() - 1) {
-        if (lemmaAndTags.find(part) != wstring::npos) {
-          if (part.size() > longestMatch.size()) {
-            longestMatch = part;
-          }
-        }
-        part = L"";
-      } else {
-        part += ch;
+    int match = matchAttribute(parts, lu, context, true);
+
+    if (match != -1) {
+      const wstring &longestMatch = getAttributeAlternatives(parts)
+          .values[match];
+      if (longestMatch != L"") {
+        lu->modifyTag(longestMatch, value);
+        change = true;
       }
     }
-
-    if (longestMatch != L"") {
-      lu->modifyTag(longestMatch, value);
-      change = true;
-    }
   }
 
   if (change && vm->transferStage == POSTCHUNK) {
-    // Update the chunk content when changing a lu inside the chunk.
+    // The chunk content is rebuilt when needed if a lu inside it changed.
     ChunkWord *word = (ChunkWord *) vm->words[vm->currentWords[0]];
-    word->updateChunkContent(oldWhole, lu->getWhole());
+    if (!word->isChunk(lu)) {
+      word->setContentModified();
+    }
   }
 }
 
@@ -19,17 +19,53 @@
 #define INTERPRETER_H_
 
 #include <string>
+#include <vector>
+#include <unordered_map>
 
 #include "vm_exceptions.h"
 #include "instructions.h"
 #include "lexical_unit.h"
 #include "chunk_lexical_unit.h"
+#include "tag_sequence.h"
 #include "vm_wstring_utils.h"
+#include "native_code.h"
+#include "opcode_stats.h"
 
 using namespace std;
 
 class VM;
 
+/**
+ * The alternatives of an attribute used by the clip instructions, e.g.
+ * <sg>|<pl>|<sp>, parsed once so they can be matched against the tags of a
+ * lexical unit by identifier.
+ */
+struct AttributeAlternatives {
+  /// The text of each alternative, in the order they were defined.
+  vector<wstring> values;
+
+  /// Each alternative as a sequence of tags, if isSequence is set for it.
+  vector<TagSequence> sequences;
+
+  /// If an alternative is only made of whole tags.
+  vector<bool> isSequence;
+
+  /// The first alternative made of only one tag, indexed by that tag.
+  unordered_map<unsigned int, unsigned int> singleTags;
+
+  /// The alternatives which aren't a single tag, checked one by one.
+  vector<unsigned int> others;
+};
+
+/// The jump table of a switch instruction, with its addresses already parsed.
+struct SwitchJumps {
+  /// The address to jump to for each value.
+  unordered_map<wstring, int> addresses;
+
+  /// The address to jump to if the value isn't in the table.
+  int defaultAddress;
+};
+
 /// Interprets an op code and executes the appropriate instruction.
 class Interpreter {
 
@@ -50,6 +86,9 @@ public:
 
   void preprocess();
   void execute(const Instruction&);
+  void setCodeVerified(bool);
+  void executeNative();
+  const OpcodeStats& getOpcodeStats() const;
 
 private:
 
@@ -59,15 +98,45 @@ private:
   /// Track if the last executed instruction modified the PC.
   bool modifiedPC;
 
+  /// The functions used by the native code of the rules and macros.
+  VmNativeRuntime nativeRuntime;
+
+  /** If the code has been verified when loaded, so the checks of the stack and
+   * the positions of the words can be skipped. */
+  bool isCodeVerified;
+
+  /// The attributes used by clip instructions, already split and parsed.
+  unordered_map<wstring, AttributeAlternatives> attributes;
+
+  /// The jump tables of the switch instructions, indexed by their operand.
+  unordered_map<wstring, SwitchJumps> switches;
+
+  /// Statistics of the instructions executed, only if built with OPCODE_STATS.
+  OpcodeStats opcodeStats;
+
   void throwError(const wstring &);
   void modifyPC(int);
   LexicalUnit* getSourceLexicalUnit(int);
   LexicalUnit* getTargetLexicalUnit(int);
+  void checkWordPosition(int);
+  void runCalledUnit(unsigned int);
+  void initNativeRuntime();
+  static void nativeExecute(void *, unsigned int);
+  template <void (Interpreter::*)(const Instruction &)>
+  static void nativeHandler(void *, unsigned int);
+  static void nativeClip(void *, unsigned int, int, const wchar_t *,
+      unsigned int);
+  static int nativeCompare(void *, unsigned int, const wchar_t *,
+      unsigned int);
+  static void nativePush(void *, const wchar_t *, unsigned int);
+  static int nativePopCondition(void *);
+  static void nativeCall(void *, unsigned int);
+  static int nativeSwitchAddress(void *, unsigned int);
   vector<wstring> getOperands(const Instruction &);
-  vector<int> getNOperands(const Instruction &, const wstring &);
   wstring popSystemStack();
   int popSystemStackInteger();
   void pushCaseToStack(CASE);
+  void clip(const Instruction &, int, const wstring &);
 
   void executeAddtrie(const Instruction&);
   void executeAnd(const Instruction&);
@@ -82,8 +151,10 @@ private:
   void executeClip(const Instruction&);
   void executeClipsl(const Instruction&);
   void executeCliptl(const Instruction&);
-  void handleClipInstruction(const wstring &, LexicalUnit*, const wstring &,
+  void handleClipInstruction(const wstring &, LexicalUnit*, LU_PART,
       const wstring &);
+  const AttributeAlternatives& getAttributeAlternatives(const wstring &);
+  int matchAttribute(const wstring &, LexicalUnit*, LU_PART, bool);
   void executeCmp(const Instruction&);
   void executeCmpi(const Instruction&);
   void executeCmpSubstr(const Instruction&);
@@ -99,6 +170,9 @@ private:
   void executeJmp(const Instruction&);
   void executeJz(const Instruction&);
   void executeJnz(const Instruction&);
+  void executeSwitch(const Instruction&);
+  int popSwitchAddress(const Instruction&);
+  const SwitchJumps& getSwitchJumps(const wstring &);
   void executeLu(const Instruction&);
   void executeLuCount(const Instruction&);
   void executeMlu(const Instruction&);
@@ -112,8 +186,8 @@ private:
   void executeStorecl(const Instruction&);
   void executeStoresl(const Instruction&);
   void executeStoretl(const Instruction&);
-  void handleStoreClipInstruction(const wstring &, LexicalUnit*,
-      const wstring &, const wstring &);
+  void handleStoreClipInstruction(const wstring &, LexicalUnit*, LU_PART,
+      const wstring &);
   void executeStorev(const Instruction&);
 
 };
@@ -19,6 +19,9 @@
 #define LEXICAL_UNIT_H_
 
 #include <string>
+#include <string_view>
+
+#include "tag_sequence.h"
 
 using namespace std;
 
@@ -34,10 +37,11 @@ public:
 //  virtual ~LexicalUnit() { };
 
   virtual void parse() = 0;
-  virtual wstring getWhole() const = 0;
-  virtual wstring getPart(LU_PART) = 0;
+  virtual const wstring& getWhole() = 0;
+  virtual wstring_view getPart(LU_PART) = 0;
   virtual void changePart(LU_PART, const wstring &) = 0;
   virtual void modifyTag(const wstring &, const wstring &) = 0;
+  virtual const TagSequence* getTagSequence(LU_PART) = 0;
 
 private:
 
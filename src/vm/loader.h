@@ -19,8 +19,12 @@
 #define LOADER_H_
 
 #include <vector>
+#include <map>
+#include <string>
 
 #include "instructions.h"
+#include "system_trie.h"
+#include "optimizer.h"
 
 /// Interface for a code loader.
 class Loader {
@@ -32,6 +36,10 @@ public:
   virtual void load(CodeUnit &, CodeUnit &, CodeSection &, CodeSection &,
       unsigned int &) = 0;
   virtual void loadCodeUnit(CodeUnit &) = 0;
+  virtual void loadVariables(map<wstring, wstring> &) { }
+  virtual bool loadTrie(SystemTrie &) { return false; }
+  virtual void setOptimizer(Optimizer *) { }
+  virtual wstring getMacroNameFromNumber(unsigned int) { return L""; }
   virtual void printCodeSection(const CodeSection &, const wstring &,
       const wstring &) = 0;
   virtual void printCodeUnit(const CodeUnit &, const wstring &) = 0;
@@ -0,0 +1,97 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef NATIVE_CODE_H_
+#define NATIVE_CODE_H_
+
+/**
+ * Interface between the vm and the native code of a code file, translated to
+ * C++ and compiled ahead of time into a shared object. It only uses C types,
+ * so the shared object doesn't depend on the classes of the vm. Every
+ * generated source starts with the same declarations (see
+ * NativeCodeGenerator), so any change here must be done there too and
+ * increase VM_NATIVE_VERSION.
+ */
+#define VM_NATIVE_VERSION 3
+
+/// Size of the table of instruction handlers, above the number of opcodes.
+#define VM_NATIVE_MAX_OP_CODES 64
+
+extern "C" {
+
+/**
+ * The functions of the vm used by the native code, which execute instructions
+ * of the current code unit by their address.
+ */
+struct VmNativeRuntime {
+  /// The interpreter, passed to every function.
+  void *context;
+
+  /** Execute an instruction with the handler of its opcode, indexed by the
+   * opcode, without the dispatch of the interpreter. */
+  void (*handlers[VM_NATIVE_MAX_OP_CODES])(void *, unsigned int);
+
+  /// Push a string to the system stack.
+  void (*push)(void *, const wchar_t *, unsigned int);
+
+  /// Pop a condition from the system stack, returning 0 if it's false.
+  int (*popCondition)(void *);
+
+  /// Execute a call instruction, running the macro until it returns.
+  void (*call)(void *, unsigned int);
+
+  /// Pop the value of a switch instruction, returning the address to jump to.
+  int (*switchAddress)(void *, unsigned int);
+
+  /// Execute a clip instruction with its position and parts as literals.
+  void (*clip)(void *, unsigned int, int, const wchar_t *, unsigned int);
+
+  /** Execute a cmp or cmpi instruction without pushing its result, returning
+   * 0 if it's false. The first operand is a literal or, if NULL, popped. */
+  int (*compare)(void *, unsigned int, const wchar_t *, unsigned int);
+};
+
+/// An instruction of a code unit, with the operand already resolved.
+struct VmNativeInstruction {
+  int opCode;
+  const wchar_t *operand;
+  int lineNumber;
+};
+
+/// A code unit with its instructions and its native code, if it has any.
+struct VmNativeUnit {
+  unsigned int numInstructions;
+  const VmNativeInstruction *code;
+  void (*run)(const VmNativeRuntime *);
+};
+
+/**
+ * A code file compiled to native code, exported by the shared object as
+ * vm_native_program. The units are the preprocess section, the code section,
+ * the rules and the macros, in this order.
+ */
+struct VmNativeProgram {
+  unsigned int version;
+  const wchar_t *transferHeader;
+  unsigned int numRules;
+  unsigned int numMacros;
+  const VmNativeUnit *units;
+};
+
+}
+
+#endif /* NATIVE_CODE_H_ */
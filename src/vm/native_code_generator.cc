@@ -0,0 +1,399 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "native_code_generator.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <set>
+
+#include "native_code.h"
+#include "vm_exceptions.h"
+#include "vm_wstring_utils.h"
+#include "optimizer.h"
+
+using namespace std;
+
+const char *NativeCodeGenerator::PRELUDE =
+    "#define VM_NATIVE_VERSION 3\n"
+    "#define VM_NATIVE_MAX_OP_CODES 64\n"
+    "\n"
+    "extern \"C\" {\n"
+    "\n"
+    "struct VmNativeRuntime {\n"
+    "  void *context;\n"
+    "  void (*handlers[VM_NATIVE_MAX_OP_CODES])(void *, unsigned int);\n"
+    "  void (*push)(void *, const wchar_t *, unsigned int);\n"
+    "  int (*popCondition)(void *);\n"
+    "  void (*call)(void *, unsigned int);\n"
+    "  int (*switchAddress)(void *, unsigned int);\n"
+    "  void (*clip)(void *, unsigned int, int, const wchar_t *, unsigned int);\n"
+    "  int (*compare)(void *, unsigned int, const wchar_t *, unsigned int);\n"
+    "};\n"
+    "\n"
+    "struct VmNativeInstruction {\n"
+    "  int opCode;\n"
+    "  const wchar_t *operand;\n"
+    "  int lineNumber;\n"
+    "};\n"
+    "\n"
+    "struct VmNativeUnit {\n"
+    "  unsigned int numInstructions;\n"
+    "  const VmNativeInstruction *code;\n"
+    "  void (*run)(const VmNativeRuntime *);\n"
+    "};\n"
+    "\n"
+    "struct VmNativeProgram {\n"
+    "  unsigned int version;\n"
+    "  const wchar_t *transferHeader;\n"
+    "  unsigned int numRules;\n"
+    "  unsigned int numMacros;\n"
+    "  const VmNativeUnit *units;\n"
+    "};\n"
+    "\n"
+    "}\n";
+
+/**
+ * Write the C++ source of a code file, which must be completely loaded. Its
+ * instructions are written as they are, so every address of the native code
+ * is the same as in the interpreted code.
+ *
+ * @param fileName the name of the source file to create
+ * @param transferHeader the transfer stage header of the code
+ * @param preprocessCode the preprocess code section
+ * @param code the main code section
+ * @param rulesCode the code section containing rules
+ * @param macrosCode the code section containing macros
+ */
+void NativeCodeGenerator::write(const char *fileName,
+    const wstring &transferHeader, const CodeUnit &preprocessCode,
+    const CodeUnit &code, const CodeSection &rulesCode,
+    const CodeSection &macrosCode) {
+  ofstream file(fileName, ios::out);
+  if (!file.is_open()) {
+    throw LoaderException(L"Can't open the native source file for writing.");
+  }
+
+  file << "// Generated by apertium-xfervm, don't edit it.\n\n" << PRELUDE;
+
+  vector<const CodeUnit *> units;
+  vector<string> names;
+  units.push_back(&preprocessCode);
+  names.push_back("preprocess");
+  units.push_back(&code);
+  names.push_back("code");
+  for (unsigned int i = 0; i < rulesCode.units.size(); i++) {
+    units.push_back(&rulesCode.units[i]);
+    names.push_back("rule_" + to_string(i));
+  }
+  for (unsigned int i = 0; i < macrosCode.units.size(); i++) {
+    units.push_back(&macrosCode.units[i]);
+    names.push_back("macro_" + to_string(i));
+  }
+
+  // The preprocess and code sections are only executed once, so they are
+  // left to the interpreter.
+  for (unsigned int i = 0; i < units.size(); i++) {
+    writeInstructions(file, names[i], *units[i]);
+    if (i >= 2) {
+      writeFunction(file, names[i], *units[i]);
+    }
+  }
+
+  file << "\nstatic const VmNativeUnit units[] = {\n";
+  for (unsigned int i = 0; i < units.size(); i++) {
+    file << "  {" << units[i]->code.size() << ", "
+         << (units[i]->code.empty() ? "0" : names[i] + "_code") << ", "
+         << (i >= 2 ? names[i] : "0") << "},\n";
+  }
+  file << "};\n\n";
+
+  file << "extern \"C\" const VmNativeProgram vm_native_program = {\n"
+       << "  VM_NATIVE_VERSION, " << getLiteral(transferHeader) << ", "
+       << rulesCode.units.size() << ", " << macrosCode.units.size()
+       << ", units\n};\n";
+
+  file.close();
+  if (file.fail()) {
+    throw LoaderException(L"Can't write the native source file.");
+  }
+}
+
+/**
+ * Compile a source written by write into a shared object, with the compiler
+ * of the CXX environment variable or g++ by default.
+ *
+ * @param sourceFileName the name of the source file
+ * @param libraryFileName the name of the shared object to create
+ *
+ * @return true if it was compiled, false otherwise
+ */
+bool NativeCodeGenerator::compile(const char *sourceFileName,
+    const char *libraryFileName) {
+  // Quote the file names for the shell.
+  auto quote = [](const string &str) {
+    string quoted = "'";
+    for (unsigned int i = 0; i < str.size(); i++) {
+      if (str[i] == '\'') {
+        quoted += "'\\''";
+      } else {
+        quoted += str[i];
+      }
+    }
+    return quoted + "'";
+  };
+
+  const char *compiler = getenv("CXX");
+  string command = string(compiler != NULL ? compiler : "g++")
+      + " -shared -fPIC -O1 -w -o " + quote(libraryFileName) + " "
+      + quote(sourceFileName);
+
+  return system(command.c_str()) == 0;
+}
+
+/**
+ * Get a string as a C++ wide string literal. Every character which isn't
+ * printable ASCII is written as a hexadecimal escape, ending the literal after
+ * it so the next character isn't taken as part of the escape.
+ *
+ * @param str the string
+ *
+ * @return the literal
+ */
+string NativeCodeGenerator::getLiteral(const wstring &str) {
+  string literal = "L\"";
+
+  for (unsigned int i = 0; i < str.size(); i++) {
+    wchar_t c = str[i];
+    if (c == L'\\' || c == L'"') {
+      literal += '\\';
+      literal += (char) c;
+    } else if (c >= 0x20 && c < 0x7F) {
+      literal += (char) c;
+    } else {
+      char escape[16];
+      snprintf(escape, sizeof(escape), "\\x%x\" L\"", (unsigned int) c);
+      literal += escape;
+    }
+  }
+
+  return literal + "\"";
+}
+
+/**
+ * Write the instructions of a code unit as an array.
+ *
+ * @param out the stream of the source
+ * @param name the name of the code unit
+ * @param unit the code unit
+ */
+void NativeCodeGenerator::writeInstructions(ostream &out, const string &name,
+    const CodeUnit &unit) {
+  if (unit.code.empty()) {
+    return;
+  }
+
+  out << "\nstatic const VmNativeInstruction " << name << "_code[] = {\n";
+  for (unsigned int i = 0; i < unit.code.size(); i++) {
+    const Instruction &instr = unit.code[i];
+    out << "  {" << instr.opCode << ", " << getLiteral(instr.op1) << ", "
+        << instr.lineNumber << "},\n";
+  }
+  out << "};\n";
+}
+
+/**
+ * Write the function which runs a rule or a macro. Each instruction reached by
+ * a jump gets a label and a jump past the end ends the code unit, like the
+ * interpreter does. The instructions which aren't native code are executed by
+ * the handler of their opcode.
+ *
+ * @param out the stream of the source
+ * @param name the name of the code unit
+ * @param unit the code unit
+ */
+void NativeCodeGenerator::writeFunction(ostream &out, const string &name,
+    const CodeUnit &unit) {
+  const vector<Instruction> &code = unit.code;
+
+  // The addresses of each jump, with the default one first for a switch.
+  vector<vector<unsigned int> > addresses(code.size());
+  vector<bool> targets(code.size() + 1, false);
+  for (unsigned int i = 0; i < code.size(); i++) {
+    if (Optimizer::isJump(code[i])) {
+      addresses[i] = Optimizer::getJumpAddresses(code[i]);
+      for (unsigned int j = 0; j < addresses[i].size(); j++) {
+        if (addresses[i][j] > code.size()) {
+          addresses[i][j] = code.size();
+        }
+        targets[addresses[i][j]] = true;
+      }
+    }
+  }
+
+  out << "\nstatic void " << name << "(const VmNativeRuntime *rt) {\n"
+      << "  void *vm = rt->context;\n";
+
+  for (unsigned int i = 0; i < code.size(); i++) {
+    const Instruction &instr = code[i];
+
+    if (targets[i]) {
+      out << "L" << i << ":\n";
+    }
+
+    out << "  ";
+    unsigned int sequenceSize = writeSequence(out, code, i, targets,
+        addresses);
+    if (sequenceSize > 0) {
+      out << "\n";
+      i += sequenceSize - 1;
+      continue;
+    }
+
+    switch (instr.opCode) {
+    case PUSH: {
+      // The same values pushed by the interpreter, except the variables.
+      const wstring &op1 = instr.op1;
+      if (op1.size() >= 2 && op1[0] == L'"') {
+        wstring value = op1.substr(1, op1.size() - 2);
+        out << "rt->push(vm, " << getLiteral(value) << ", " << value.size()
+            << ");";
+      } else if (VMWstringUtils::iswnumeric(op1)) {
+        out << "rt->push(vm, " << getLiteral(op1) << ", " << op1.size()
+            << ");";
+      } else {
+        out << "rt->handlers[" << instr.opCode << "](vm, " << i << ");";
+      }
+      break;
+    }
+    case PUSHBL:
+      out << "rt->push(vm, L\" \", 1);";
+      break;
+    case JMP:
+      out << "goto L" << addresses[i][0] << ";";
+      break;
+    case JZ:
+      out << "if (!rt->popCondition(vm)) goto L" << addresses[i][0] << ";";
+      break;
+    case JNZ:
+      out << "if (rt->popCondition(vm)) goto L" << addresses[i][0] << ";";
+      break;
+    case SWITCH: {
+      // Each address once, as several cases can go to the same one.
+      set<unsigned int> written;
+      written.insert(addresses[i][0]);
+      out << "switch (rt->switchAddress(vm, " << i << ")) {\n";
+      for (unsigned int j = 1; j < addresses[i].size(); j++) {
+        if (written.insert(addresses[i][j]).second) {
+          out << "  case " << addresses[i][j] << ": goto L"
+              << addresses[i][j] << ";\n";
+        }
+      }
+      out << "  default: goto L" << addresses[i][0] << ";\n  }";
+      break;
+    }
+    case RET:
+      out << "return;";
+      break;
+    case CALL:
+      out << "rt->call(vm, " << i << ");";
+      break;
+    default:
+      out << "rt->handlers[" << instr.opCode << "](vm, " << i << ");";
+      break;
+    }
+    out << "\n";
+  }
+
+  out << "L" << code.size() << ":\n  return;\n}\n";
+}
+
+/**
+ * Write the most common sequences of instructions with literal operands as a
+ * single statement, so the literals are passed as they are instead of pushed
+ * to the system stack and popped again: the position and the parts of a clip
+ * and a literal compared by a cmp or cmpi, with the jump on its result. Only
+ * the first instruction of a sequence can be the target of a jump.
+ *
+ * @param out the stream of the source
+ * @param code the instructions of the code unit
+ * @param address the address of the first instruction of the sequence
+ * @param targets the addresses which are the target of a jump
+ * @param addresses the addresses of each jump
+ *
+ * @return the number of instructions written, 0 if there isn't a sequence
+ */
+unsigned int NativeCodeGenerator::writeSequence(ostream &out,
+    const vector<Instruction> &code, unsigned int address,
+    const vector<bool> &targets,
+    const vector<vector<unsigned int> > &addresses) {
+  // Number of instructions from the address which can be in a sequence.
+  unsigned int size = 1;
+  while (size < 3 && address + size < code.size()
+      && !targets[address + size]) {
+    size++;
+  }
+
+  auto isLiteral = [&code](unsigned int i) {
+    return code[i].opCode == PUSH && code[i].op1.size() >= 2
+        && code[i].op1[0] == L'"';
+  };
+  auto isCompare = [&code](unsigned int i) {
+    return code[i].opCode == CMP || code[i].opCode == CMPI;
+  };
+  auto isBranch = [&code](unsigned int i) {
+    return code[i].opCode == JZ || code[i].opCode == JNZ;
+  };
+  auto getValue = [&code](unsigned int i) {
+    return code[i].op1.substr(1, code[i].op1.size() - 2);
+  };
+
+  unsigned int i = address;
+  if (size == 3 && code[i].opCode == PUSH
+      && VMWstringUtils::iswnumeric(code[i].op1) && isLiteral(i + 1)
+      && (code[i + 2].opCode == CLIP || code[i + 2].opCode == CLIPSL
+          || code[i + 2].opCode == CLIPTL)) {
+    wstring parts = getValue(i + 1);
+    out << "rt->clip(vm, " << i + 2 << ", "
+        << VMWstringUtils::stringTo<int>(code[i].op1) << ", "
+        << getLiteral(parts) << ", " << parts.size() << ");";
+    return 3;
+  } else if (size == 3 && isLiteral(i) && isCompare(i + 1)
+      && isBranch(i + 2)) {
+    wstring value = getValue(i);
+    out << "if (" << (code[i + 2].opCode == JZ ? "!" : "")
+        << "rt->compare(vm, " << i + 1 << ", " << getLiteral(value) << ", "
+        << value.size() << ")) goto L" << addresses[i + 2][0] << ";";
+    return 3;
+  } else if (size >= 2 && isCompare(i) && isBranch(i + 1)) {
+    out << "if (" << (code[i + 1].opCode == JZ ? "!" : "")
+        << "rt->compare(vm, " << i << ", 0, 0)) goto L"
+        << addresses[i + 1][0] << ";";
+    return 2;
+  } else if (size >= 2 && isLiteral(i) && isCompare(i + 1)) {
+    wstring value = getValue(i);
+    out << "rt->push(vm, rt->compare(vm, " << i + 1 << ", "
+        << getLiteral(value) << ", " << value.size()
+        << ") ? L\"1\" : L\"0\", 1);";
+    return 2;
+  }
+
+  return 0;
+}
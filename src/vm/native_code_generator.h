@@ -0,0 +1,60 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef NATIVE_CODE_GENERATOR_H_
+#define NATIVE_CODE_GENERATOR_H_
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "instructions.h"
+
+using namespace std;
+
+/**
+ * Translates the code of a code file, already loaded, to C++ and compiles it
+ * with the system compiler into a shared object, loaded by the NativeLoader.
+ * Each rule and macro becomes a function where the jumps, the conditions, the
+ * returns and the literals pushed are native code, the clips and comparisons
+ * of literals take them as arguments and the rest of the instructions are
+ * executed by the handler of their opcode, without the dispatch of the
+ * interpreter. The instructions are also stored in the shared object, so it
+ * can be used instead of the code file.
+ */
+class NativeCodeGenerator {
+
+public:
+
+  static void write(const char *, const wstring &, const CodeUnit &,
+      const CodeUnit &, const CodeSection &, const CodeSection &);
+  static bool compile(const char *, const char *);
+
+private:
+
+  /// The declarations of native_code.h, written at the start of every source.
+  static const char *PRELUDE;
+
+  static string getLiteral(const wstring &);
+  static void writeInstructions(ostream &, const string &, const CodeUnit &);
+  static void writeFunction(ostream &, const string &, const CodeUnit &);
+  static unsigned int writeSequence(ostream &, const vector<Instruction> &,
+      unsigned int, const vector<bool> &,
+      const vector<vector<unsigned int> > &);
+};
+
+#endif /* NATIVE_CODE_GENERATOR_H_ */
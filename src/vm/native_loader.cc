@@ -0,0 +1,255 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "native_loader.h"
+
+#include <sstream>
+#include <cstring>
+#include <dlfcn.h>
+
+#include "vm_exceptions.h"
+
+using namespace std;
+
+const string NativeLoader::ELF_MAGIC = "\x7f" "ELF";
+
+NativeLoader::NativeLoader() {
+  codeFileName = NULL;
+  library = NULL;
+  program = NULL;
+}
+
+NativeLoader::NativeLoader(char *fileName) {
+  codeFileName = fileName;
+  library = NULL;
+  program = NULL;
+}
+
+NativeLoader::NativeLoader(const NativeLoader &c) {
+  copy(c);
+}
+
+NativeLoader::~NativeLoader() {
+  closeLibrary();
+}
+
+NativeLoader& NativeLoader::operator=(const NativeLoader &c) {
+  if (this != &c) {
+    this->~NativeLoader();
+    this->copy(c);
+  }
+  return *this;
+}
+
+void NativeLoader::copy(const NativeLoader &c) {
+  codeFileName = c.codeFileName;
+  library = NULL;
+  program = NULL;
+  printer = c.printer;
+
+  // Each loader needs its own reference to the shared object.
+  if (c.library != NULL) {
+    openLibrary();
+  }
+}
+
+/**
+ * Get the transfer stage header of the code file compiled, which isn't stored
+ * as text at the start of the shared object.
+ *
+ * @return the transfer stage header
+ */
+wstring NativeLoader::getTransferHeader() {
+  if (library == NULL) {
+    openLibrary();
+  }
+
+  return program->transferHeader;
+}
+
+/**
+ * Open the shared object and decode the preprocess and code sections. The
+ * rules and macros code units are created empty and decoded when they are
+ * called.
+ *
+ * @param preprocessCode the preprocess code section
+ * @param code the main code section
+ * @param rulesCode the code section containing rules
+ * @param macrosCode the code section containing macros
+ * @param finalAddress the final address of the main code section of the vm
+ */
+void NativeLoader::load(CodeUnit &preprocessCode, CodeUnit &code,
+    CodeSection &rulesCode, CodeSection &macrosCode,
+    unsigned int &finalAddress) {
+  if (library == NULL) {
+    openLibrary();
+  }
+
+  decodeUnit(0, preprocessCode);
+  decodeUnit(1, code);
+
+  rulesCode.units.resize(program->numRules);
+  for (unsigned int i = 0; i < program->numRules; i++) {
+    rulesCode.units[i].loaded = false;
+    rulesCode.units[i].code.clear();
+  }
+
+  macrosCode.units.resize(program->numMacros);
+  for (unsigned int i = 0; i < program->numMacros; i++) {
+    macrosCode.units[i].loaded = false;
+    macrosCode.units[i].code.clear();
+  }
+
+  pendingUnits.clear();
+  for (unsigned int i = 0; i < program->numRules; i++) {
+    pendingUnits[&rulesCode.units[i]] = 2 + i;
+  }
+  for (unsigned int i = 0; i < program->numMacros; i++) {
+    pendingUnits[&macrosCode.units[i]] = 2 + program->numRules + i;
+  }
+
+  finalAddress = code.code.size();
+}
+
+/**
+ * Decode a rule or macro the first time it's called, with its native code.
+ * Different code units can be decoded at the same time from different
+ * threads.
+ *
+ * @param unit the code unit to decode, as created by load
+ */
+void NativeLoader::loadCodeUnit(CodeUnit &unit) {
+  unordered_map<const CodeUnit *, unsigned int>::const_iterator it =
+      pendingUnits.find(&unit);
+
+  if (it == pendingUnits.end()) {
+    throwError(L"Code unit not found in the shared object.");
+  }
+
+  decodeUnit(it->second, unit);
+}
+
+/**
+ * Open the shared object and check its version.
+ */
+void NativeLoader::openLibrary() {
+  // Without a slash, dlopen would search the file in the library paths.
+  string path = codeFileName;
+  if (path.find('/') == string::npos) {
+    path = "./" + path;
+  }
+
+  library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (library == NULL) {
+    const char *error = dlerror();
+    string message = (error != NULL ? error : "");
+    throwError(L"Can't open the shared object: "
+        + wstring(message.begin(), message.end()));
+  }
+
+  program = (const VmNativeProgram *) dlsym(library, "vm_native_program");
+  if (program == NULL) {
+    closeLibrary();
+    throwError(L"The shared object isn't a compiled code file.");
+  }
+
+  if (program->version != VM_NATIVE_VERSION) {
+    wstringstream ws;
+    ws << L"The shared object has version " << program->version
+       << L" but version " << VM_NATIVE_VERSION
+       << L" is needed, compile it again.";
+    closeLibrary();
+    throwError(ws.str());
+  }
+}
+
+/**
+ * Close the shared object if it's open.
+ */
+void NativeLoader::closeLibrary() {
+  if (library != NULL) {
+    dlclose(library);
+    library = NULL;
+    program = NULL;
+  }
+}
+
+/**
+ * Convert the instructions of a code unit to the vm representation and set
+ * its native code.
+ *
+ * @param index the index of the unit in the units of the program
+ * @param unit the code unit to fill
+ */
+void NativeLoader::decodeUnit(unsigned int index, CodeUnit &unit) const {
+  const VmNativeUnit &nativeUnit = program->units[index];
+
+  unit.code.resize(nativeUnit.numInstructions);
+  for (unsigned int i = 0; i < nativeUnit.numInstructions; i++) {
+    unit.code[i].opCode = (OP_CODE) nativeUnit.code[i].opCode;
+    unit.code[i].op1 = nativeUnit.code[i].operand;
+    unit.code[i].lineNumber = nativeUnit.code[i].lineNumber;
+  }
+
+  unit.native = nativeUnit.run;
+  unit.loaded = true;
+}
+
+/**
+ * Throw a loader specific error with the name of the code file.
+ *
+ * @param msg the message describing the problem
+ */
+void NativeLoader::throwError(const wstring &msg) const {
+  wstringstream ws;
+  ws << codeFileName << L": " << msg;
+  throw LoaderException(ws.str());
+}
+
+/**
+ * Print every code unit of a code section.
+ *
+ * @param section the section with the code units to print
+ * @param header a header to show, usually the name of the section
+ * @param unitHeader a header for each of the code units, e.g. "Rule" or "Macro"
+ */
+void NativeLoader::printCodeSection(const CodeSection &section,
+    const wstring &header, const wstring &unitHeader) {
+  printer.printCodeSection(section, header, unitHeader);
+}
+
+/**
+ * Print a code unit.
+ *
+ * @param codeUnit the unit with the instructions to print
+ * @param header a header to show, usually the name of the code unit
+ */
+void NativeLoader::printCodeUnit(const CodeUnit &codeUnit,
+    const wstring &header) {
+  printer.printCodeUnit(codeUnit, header);
+}
+
+/**
+ * Print an instruction.
+ *
+ * @param instr the instruction to print
+ * @param PC the program counter
+ */
+void NativeLoader::printInstruction(const Instruction &instr,
+    unsigned int PC) {
+  printer.printInstruction(instr, PC);
+}
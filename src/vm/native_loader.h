@@ -0,0 +1,84 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef NATIVE_LOADER_H_
+#define NATIVE_LOADER_H_
+
+#include <string>
+#include <unordered_map>
+
+#include "loader.h"
+#include "instructions.h"
+#include "binary_loader.h"
+#include "native_code.h"
+
+using namespace std;
+
+/**
+ * Loads code from a shared object compiled from a code file by the
+ * NativeCodeGenerator, opening it with dlopen. The shared object has the
+ * instructions of every code unit, so it's used instead of the code file, and
+ * the native code of the rules and macros, which the vm runs instead of
+ * interpreting them.
+ */
+class NativeLoader: public Loader {
+
+public:
+
+  /// First bytes of a shared object, an ELF file.
+  static const string ELF_MAGIC;
+
+  NativeLoader();
+  NativeLoader(char *);
+  NativeLoader(const NativeLoader&);
+  virtual ~NativeLoader();
+  NativeLoader& operator=(const NativeLoader&);
+  void copy(const NativeLoader&);
+
+  wstring getTransferHeader();
+
+  void load(CodeUnit &, CodeUnit &, CodeSection &, CodeSection &,
+      unsigned int &);
+  void loadCodeUnit(CodeUnit &);
+
+  void printCodeSection(const CodeSection &, const wstring &, const wstring &);
+  void printCodeUnit(const CodeUnit &, const wstring &);
+  void printInstruction(const Instruction &, unsigned int);
+
+private:
+  /// Name of the shared object to use.
+  char *codeFileName;
+
+  /// Handle of the shared object opened.
+  void *library;
+
+  /// The code file compiled, exported by the shared object.
+  const VmNativeProgram *program;
+
+  /// The rules and macros of the code file, with their index in the units.
+  unordered_map<const CodeUnit *, unsigned int> pendingUnits;
+
+  /// The instructions are printed as the ones of binary code files.
+  BinaryLoader printer;
+
+  void openLibrary();
+  void closeLibrary();
+  void decodeUnit(unsigned int, CodeUnit &) const;
+  void throwError(const wstring &) const;
+};
+
+#endif /* NATIVE_LOADER_H_ */
@@ -0,0 +1,182 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "opcode_stats.h"
+
+#include <fstream>
+#include <map>
+#include <algorithm>
+
+#include "assembly_loader.h"
+
+OpcodeStats::OpcodeStats() {
+  for (unsigned int i = 0; i < NUM_OP_CODES; i++) {
+    executions[i] = 0;
+    cycles[i] = 0;
+  }
+  pairExecutions.assign(NUM_OP_CODES * NUM_OP_CODES, 0);
+  pairCycles.assign(NUM_OP_CODES * NUM_OP_CODES, 0);
+  lastInstruction = NULL;
+  lastCycles = 0;
+  maxStackDepth = 0;
+  maxCallDepth = 0;
+}
+
+OpcodeStats::OpcodeStats(const OpcodeStats &o) {
+  copy(o);
+}
+
+OpcodeStats::~OpcodeStats() {
+
+}
+
+OpcodeStats& OpcodeStats::operator=(const OpcodeStats &o) {
+  if (this != &o) {
+    this->~OpcodeStats();
+    this->copy(o);
+  }
+  return *this;
+}
+
+void OpcodeStats::copy(const OpcodeStats &o) {
+  for (unsigned int i = 0; i < NUM_OP_CODES; i++) {
+    executions[i] = o.executions[i];
+    cycles[i] = o.cycles[i];
+  }
+  pairExecutions = o.pairExecutions;
+  pairCycles = o.pairCycles;
+  lastInstruction = NULL;
+  lastCycles = 0;
+  maxStackDepth = o.maxStackDepth;
+  maxCallDepth = o.maxCallDepth;
+}
+
+/**
+ * Count the execution of an instruction. It makes a pair with the last one
+ * executed if it's the next one in the same code unit, as only those could be
+ * merged into one instruction.
+ *
+ * @param instr the instruction executed
+ * @param instrCycles the cycles its execution took
+ * @param stackDepth the number of elements of the system stack after it
+ * @param callDepth the number of calls in the call stack after it
+ */
+void OpcodeStats::count(const Instruction &instr, uint64_t instrCycles,
+    unsigned int stackDepth, unsigned int callDepth) {
+  executions[instr.opCode]++;
+  cycles[instr.opCode] += instrCycles;
+
+  if (lastInstruction != NULL && &instr == lastInstruction + 1) {
+    unsigned int pair = lastInstruction->opCode * NUM_OP_CODES + instr.opCode;
+    pairExecutions[pair]++;
+    pairCycles[pair] += lastCycles + instrCycles;
+  }
+  lastInstruction = &instr;
+  lastCycles = instrCycles;
+
+  maxStackDepth = max(maxStackDepth, stackDepth);
+  maxCallDepth = max(maxCallDepth, callDepth);
+}
+
+/**
+ * Write the statistics to a JSON file, the opcodes and pairs executed the most
+ * first.
+ *
+ * @param fileName the name of the file to write
+ * @param codeFileName the name of the code file executed
+ *
+ * @return true if the file was written, false otherwise
+ */
+bool OpcodeStats::writeReport(const char *fileName,
+    const string &codeFileName) const {
+  wofstream file(fileName);
+  if (!file.good()) {
+    return false;
+  }
+
+  vector<wstring> names = getOpCodeNames();
+  uint64_t totalExecutions = 0, totalCycles = 0;
+  vector<unsigned int> opCodes, pairs;
+
+  for (unsigned int i = 0; i < NUM_OP_CODES; i++) {
+    totalExecutions += executions[i];
+    totalCycles += cycles[i];
+    if (executions[i] > 0) {
+      opCodes.push_back(i);
+    }
+  }
+  for (unsigned int i = 0; i < pairExecutions.size(); i++) {
+    if (pairExecutions[i] > 0) {
+      pairs.push_back(i);
+    }
+  }
+
+  sort(opCodes.begin(), opCodes.end(), [this](unsigned int a, unsigned int b) {
+    return executions[a] > executions[b];
+  });
+  sort(pairs.begin(), pairs.end(), [this](unsigned int a, unsigned int b) {
+    return pairExecutions[a] > pairExecutions[b];
+  });
+
+  file << L"{" << endl;
+  file << L"  \"code_file\": \"" << codeFileName.c_str() << L"\"," << endl;
+  file << L"  \"instructions\": " << totalExecutions << L"," << endl;
+  file << L"  \"cycles\": " << totalCycles << L"," << endl;
+  file << L"  \"max_stack_depth\": " << maxStackDepth << L"," << endl;
+  file << L"  \"max_call_depth\": " << maxCallDepth << L"," << endl;
+
+  file << L"  \"opcodes\": [";
+  for (unsigned int i = 0; i < opCodes.size(); i++) {
+    unsigned int op = opCodes[i];
+    file << (i > 0 ? L"," : L"") << endl << L"    {\"opcode\": \""
+         << names[op] << L"\", \"executions\": " << executions[op]
+         << L", \"cycles\": " << cycles[op] << L"}";
+  }
+  file << endl << L"  ]," << endl;
+
+  file << L"  \"pairs\": [";
+  for (unsigned int i = 0; i < pairs.size(); i++) {
+    unsigned int pair = pairs[i];
+    file << (i > 0 ? L"," : L"") << endl << L"    {\"first\": \""
+         << names[pair / NUM_OP_CODES] << L"\", \"second\": \""
+         << names[pair % NUM_OP_CODES] << L"\", \"executions\": "
+         << pairExecutions[pair] << L", \"cycles\": " << pairCycles[pair]
+         << L"}";
+  }
+  file << endl << L"  ]" << endl << L"}" << endl;
+  file.close();
+
+  return !file.fail();
+}
+
+/**
+ * Get the assembly representation of every opcode.
+ *
+ * @return the names indexed by opcode
+ */
+vector<wstring> OpcodeStats::getOpCodeNames() {
+  map<wstring, OP_CODE> opCodes;
+  AssemblyLoader::fillOpCodes(opCodes);
+
+  vector<wstring> names(NUM_OP_CODES);
+  for (map<wstring, OP_CODE>::const_iterator it = opCodes.begin();
+      it != opCodes.end(); ++it) {
+    names[it->second] = it->first;
+  }
+
+  return names;
+}
@@ -0,0 +1,76 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef OPCODE_STATS_H_
+#define OPCODE_STATS_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "instructions.h"
+
+using namespace std;
+
+/// Number of opcodes of the vm, the last one being SWITCH.
+const unsigned int NUM_OP_CODES = SWITCH + 1;
+
+/**
+ * Statistics of the instructions executed: the executions and cycles of every
+ * opcode and of every pair of instructions next to each other in the code,
+ * and the deepest the system stack and the call stack have been. They are
+ * only gathered by a vm built with OPCODE_STATS defined, as counting every
+ * instruction slows down the interpreter.
+ */
+class OpcodeStats {
+
+public:
+
+  OpcodeStats();
+  OpcodeStats(const OpcodeStats &);
+  ~OpcodeStats();
+  OpcodeStats& operator=(const OpcodeStats &);
+  void copy(const OpcodeStats &);
+
+  void count(const Instruction &, uint64_t, unsigned int, unsigned int);
+  bool writeReport(const char *, const string &) const;
+
+private:
+
+  /// Executions and cycles of every opcode.
+  uint64_t executions[NUM_OP_CODES];
+  uint64_t cycles[NUM_OP_CODES];
+
+  /** Executions and cycles of the pairs of instructions, indexed by the
+   * opcode of the first one and then by the opcode of the second one. */
+  vector<uint64_t> pairExecutions;
+  vector<uint64_t> pairCycles;
+
+  /// The last instruction executed and its cycles.
+  const Instruction *lastInstruction;
+  uint64_t lastCycles;
+
+  /// Maximum number of elements of the system stack.
+  unsigned int maxStackDepth;
+
+  /// Maximum number of calls in the call stack.
+  unsigned int maxCallDepth;
+
+  static vector<wstring> getOpCodeNames();
+};
+
+#endif /* OPCODE_STATS_H_ */
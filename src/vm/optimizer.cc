@@ -0,0 +1,683 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "optimizer.h"
+
+#include <cwchar>
+
+#include "vm_wstring_utils.h"
+#include "switch_table.h"
+
+using namespace std;
+
+/**
+ * Get the address a jump goes to. The shared string conversion of the vm isn't
+ * used, as code units can be optimized from different threads.
+ *
+ * @param instr the jump instruction
+ *
+ * @return the address of the instruction it jumps to
+ */
+static unsigned int getAddress(const Instruction &instr) {
+  return wcstoul(instr.op1.c_str(), NULL, 10);
+}
+
+/**
+ * Get the number of operands of an instruction which takes them from the stack.
+ *
+ * @param instr the instruction
+ *
+ * @return the number of operands
+ */
+static int getNumOperands(const Instruction &instr) {
+  return wcstol(instr.op1.c_str(), NULL, 10);
+}
+
+Optimizer::Optimizer() {
+  instructionsBefore = 0;
+  instructionsAfter = 0;
+  foldedConstants = 0;
+  threadedJumps = 0;
+  invertedBranches = 0;
+  removedJumps = 0;
+  removedDeadCode = 0;
+}
+
+Optimizer::Optimizer(const Optimizer &o) {
+  copy(o);
+}
+
+Optimizer::~Optimizer() {
+
+}
+
+Optimizer& Optimizer::operator=(const Optimizer &o) {
+  if (this != &o) {
+    this->~Optimizer();
+    this->copy(o);
+  }
+  return *this;
+}
+
+void Optimizer::copy(const Optimizer &o) {
+  instructionsBefore = o.instructionsBefore.load();
+  instructionsAfter = o.instructionsAfter.load();
+  foldedConstants = o.foldedConstants.load();
+  threadedJumps = o.threadedJumps.load();
+  invertedBranches = o.invertedBranches.load();
+  removedJumps = o.removedJumps.load();
+  removedDeadCode = o.removedDeadCode.load();
+}
+
+/**
+ * Optimize a code unit, applying every optimization until none of them changes
+ * the code anymore.
+ *
+ * @param unit the code unit, with its labels already converted to addresses
+ */
+void Optimizer::optimize(CodeUnit &unit) {
+  vector<Instruction> &code = unit.code;
+  instructionsBefore += code.size();
+
+  bool changed = true;
+  while (changed) {
+    changed = invertBranches(code);
+    changed = threadJumps(code) || changed;
+    changed = foldConstants(code) || changed;
+    changed = removeDeadCode(code) || changed;
+  }
+
+  instructionsAfter += code.size();
+}
+
+/**
+ * Get the stats of all the code units optimized until now.
+ *
+ * @return the stats
+ */
+OptimizerStats Optimizer::getStats() const {
+  OptimizerStats stats;
+  stats.instructionsBefore = instructionsBefore;
+  stats.instructionsAfter = instructionsAfter;
+  stats.foldedConstants = foldedConstants;
+  stats.threadedJumps = threadedJumps;
+  stats.invertedBranches = invertedBranches;
+  stats.removedJumps = removedJumps;
+  stats.removedDeadCode = removedDeadCode;
+
+  return stats;
+}
+
+/**
+ * Get the number of values an instruction takes from the system stack and the
+ * number of values it leaves there.
+ *
+ * @param instr the instruction
+ * @param pops the number of values taken
+ * @param pushes the number of values left
+ *
+ * @return false if they depend on the values of the stack, e.g. for a call
+ */
+bool Optimizer::getStackEffect(const Instruction &instr, int &pops,
+    int &pushes) {
+  pops = 0;
+  pushes = 0;
+
+  switch (instr.opCode) {
+  case PUSH: /* falls through */
+  case PUSHBL: /* falls through */
+  case PUSHSB: /* falls through */
+  case LU_COUNT:
+    pushes = 1;
+    break;
+  case NOT: /* falls through */
+  case CASE_OF: /* falls through */
+  case GET_CASE_FROM:
+    pops = 1;
+    pushes = 1;
+    break;
+  case BEGINS_WITH: /* falls through */
+  case BEGINS_WITH_IG: /* falls through */
+  case ENDS_WITH: /* falls through */
+  case ENDS_WITH_IG: /* falls through */
+  case CMP: /* falls through */
+  case CMPI: /* falls through */
+  case CMP_SUBSTR: /* falls through */
+  case CMPI_SUBSTR: /* falls through */
+  case IN: /* falls through */
+  case INIG: /* falls through */
+  case CLIP: /* falls through */
+  case CLIPSL: /* falls through */
+  case CLIPTL: /* falls through */
+  case MODIFY_CASE:
+    pops = 2;
+    pushes = 1;
+    break;
+  case AND: /* falls through */
+  case OR: /* falls through */
+  case CONCAT: /* falls through */
+  case CHUNK: /* falls through */
+  case LU: /* falls through */
+  case MLU:
+    pops = getNumOperands(instr);
+    pushes = 1;
+    break;
+  case OUT:
+    pops = getNumOperands(instr);
+    break;
+  case APPEND:
+    pops = getNumOperands(instr) + 1;
+    break;
+  case STOREV:
+    pops = 2;
+    break;
+  case STORECL: /* falls through */
+  case STORESL: /* falls through */
+  case STORETL:
+    pops = 3;
+    break;
+  case JZ: /* falls through */
+  case JNZ: /* falls through */
+  case SWITCH:
+    pops = 1;
+    break;
+  case JMP: /* falls through */
+  case RET:
+    break;
+  case ADDTRIE: /* falls through */
+  case CALL:
+    // The number of operands is on the stack.
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Check if an instruction changes the flow of the code unit.
+ *
+ * @param instr the instruction
+ *
+ * @return true for the jumps and switches, false otherwise
+ */
+bool Optimizer::isJump(const Instruction &instr) {
+  return instr.opCode == JMP || instr.opCode == JZ || instr.opCode == JNZ
+      || instr.opCode == SWITCH;
+}
+
+/**
+ * Get the addresses a jump can go to, which for a switch are its default
+ * address followed by the address of each case.
+ *
+ * @param instr the jump instruction
+ *
+ * @return the addresses of the instructions it can jump to
+ */
+vector<unsigned int> Optimizer::getJumpAddresses(const Instruction &instr) {
+  vector<unsigned int> addresses;
+
+  if (instr.opCode == SWITCH) {
+    SwitchTable table(instr.op1);
+    addresses.push_back(wcstoul(table.getDefaultTarget().c_str(), NULL, 10));
+    for (unsigned int i = 0; i < table.getNumCases(); i++) {
+      addresses.push_back(wcstoul(table.getTarget(i).c_str(), NULL, 10));
+    }
+  } else {
+    addresses.push_back(getAddress(instr));
+  }
+
+  return addresses;
+}
+
+/**
+ * Change the addresses a jump can go to.
+ *
+ * @param instr the jump instruction
+ * @param addresses the new addresses, in the order given by getJumpAddresses
+ */
+void Optimizer::setJumpAddresses(Instruction &instr,
+    const vector<unsigned int> &addresses) {
+  if (instr.opCode == SWITCH) {
+    SwitchTable table(instr.op1);
+    table.setDefaultTarget(to_wstring(addresses[0]));
+    for (unsigned int i = 0; i < table.getNumCases(); i++) {
+      table.setTarget(i, to_wstring(addresses[i + 1]));
+    }
+    instr.op1 = table.getOperand();
+  } else {
+    instr.op1 = to_wstring(addresses[0]);
+  }
+}
+
+/**
+ * Check if an instruction pushes a value known before executing the code.
+ *
+ * @param instr the instruction
+ *
+ * @return true for the push of a string or number and for pushbl
+ */
+bool Optimizer::isLiteral(const Instruction &instr) {
+  if (instr.opCode == PUSHBL) {
+    return true;
+  } else if (instr.opCode == PUSH && instr.op1 != L"") {
+    if (instr.op1[0] == L'"') {
+      return instr.op1.size() >= 2;
+    }
+    return VMWstringUtils::iswnumeric(instr.op1);
+  }
+
+  return false;
+}
+
+/**
+ * Get the value pushed by a literal instruction, as the interpreter does.
+ *
+ * @param instr the instruction, which must be a literal
+ *
+ * @return the value pushed
+ */
+wstring Optimizer::getLiteral(const Instruction &instr) {
+  if (instr.opCode == PUSHBL) {
+    return L" ";
+  } else if (instr.op1[0] == L'"') {
+    return instr.op1.substr(1, instr.op1.size() - 2);
+  }
+
+  return instr.op1;
+}
+
+/**
+ * Get the instructions which can be reached by a jump.
+ *
+ * @param code the code of the unit
+ *
+ * @return for each instruction, and the end of the code, if some jump goes there
+ */
+vector<bool> Optimizer::getJumpTargets(const vector<Instruction> &code) {
+  vector<bool> targets(code.size() + 1, false);
+
+  for (unsigned int i = 0; i < code.size(); i++) {
+    if (isJump(code[i])) {
+      vector<unsigned int> addresses = getJumpAddresses(code[i]);
+      for (unsigned int j = 0; j < addresses.size(); j++) {
+        if (addresses[j] < targets.size()) {
+          targets[addresses[j]] = true;
+        }
+      }
+    }
+  }
+
+  return targets;
+}
+
+/**
+ * Find where the code computing each operand of an instruction starts. Only
+ * the operands computed in the same block of code are found: every operand
+ * must be computed by instructions with a known stack effect and none of
+ * them, except the first one, can be reached by a jump.
+ *
+ * @param code the code of the unit
+ * @param pos the position of the instruction
+ * @param numOperands the number of operands of the instruction
+ * @param targets the instructions reached by a jump
+ * @param removed the instructions already removed, which can't be used
+ *
+ * @return the first instruction of each operand found, from the last operand
+ */
+vector<unsigned int> Optimizer::getOperandStarts(
+    const vector<Instruction> &code, unsigned int pos, unsigned int numOperands,
+    const vector<bool> &targets, const vector<bool> &removed) {
+  vector<unsigned int> starts;
+  int end = (int) pos - 1;
+
+  while (starts.size() < numOperands && end >= 0) {
+    int needed = 1;
+    int i = end;
+    for (; i >= 0; i--) {
+      int pops, pushes;
+      if (removed[i] || isJump(code[i]) || code[i].opCode == RET
+          || !getStackEffect(code[i], pops, pushes)) {
+        break;
+      }
+
+      needed += pops - pushes;
+      if (needed == 0 || targets[i]) {
+        break;
+      }
+    }
+
+    if (i < 0 || needed != 0) {
+      break;
+    }
+
+    starts.push_back(i);
+    end = i - 1;
+    if (targets[i]) {
+      break;
+    }
+  }
+
+  return starts;
+}
+
+/**
+ * Replace a not followed by a conditional jump with the opposite jump, e.g.
+ * "not, jz" with "jnz".
+ *
+ * @param code the code of the unit
+ *
+ * @return true if the code changed
+ */
+bool Optimizer::invertBranches(vector<Instruction> &code) {
+  vector<bool> targets = getJumpTargets(code);
+  vector<bool> removed(code.size(), false);
+  bool changed = false;
+
+  for (unsigned int i = 0; i + 1 < code.size(); i++) {
+    Instruction &next = code[i + 1];
+
+    if (code[i].opCode == NOT && !targets[i + 1] && !removed[i]
+        && (next.opCode == JZ || next.opCode == JNZ)) {
+      next.opCode = (next.opCode == JZ ? JNZ : JZ);
+      removed[i] = true;
+      invertedBranches++;
+      changed = true;
+    }
+  }
+
+  if (changed) {
+    removeInstructions(code, removed);
+  }
+
+  return changed;
+}
+
+/**
+ * Make the jumps to an unconditional jump go directly to its destination,
+ * replace the jumps to a ret with the ret and remove the jumps to the next
+ * instruction. The jumps leading to a cycle of unconditional jumps are kept,
+ * so every pass leaves them the same.
+ *
+ * @param code the code of the unit
+ *
+ * @return true if the code changed
+ */
+bool Optimizer::threadJumps(vector<Instruction> &code) {
+  vector<bool> removed(code.size(), false);
+  bool changed = false;
+
+  // The jumps visited following a chain, cleared after each one.
+  vector<bool> visited(code.size(), false);
+  vector<unsigned int> visitedAddresses;
+
+  for (unsigned int i = 0; i < code.size(); i++) {
+    Instruction &instr = code[i];
+    if (!isJump(instr)) {
+      continue;
+    }
+
+    // Follow the chain of jumps of each address. A jump into a cycle of
+    // jumps, or a jump which is part of one, is left as it is.
+    vector<unsigned int> addresses = getJumpAddresses(instr);
+    bool threaded = false;
+    for (unsigned int j = 0; j < addresses.size(); j++) {
+      unsigned int address = addresses[j];
+      visited[i] = true;
+      visitedAddresses.assign(1, i);
+      bool isCycle = false;
+      while (address < code.size() && code[address].opCode == JMP) {
+        if (visited[address]) {
+          isCycle = true;
+          break;
+        }
+        visited[address] = true;
+        visitedAddresses.push_back(address);
+        address = getAddress(code[address]);
+      }
+
+      for (unsigned int k = 0; k < visitedAddresses.size(); k++) {
+        visited[visitedAddresses[k]] = false;
+      }
+
+      if (!isCycle && address != addresses[j]) {
+        addresses[j] = address;
+        threaded = true;
+      }
+    }
+
+    if (threaded) {
+      setJumpAddresses(instr, addresses);
+      threadedJumps++;
+      changed = true;
+    }
+
+    unsigned int address = addresses[0];
+    if (instr.opCode == JMP && address == i + 1) {
+      removed[i] = true;
+      removedJumps++;
+      changed = true;
+    } else if (instr.opCode == JMP && address < code.size()
+        && code[address].opCode == RET) {
+      instr.opCode = RET;
+      instr.op1 = L"";
+      threadedJumps++;
+      changed = true;
+    }
+  }
+
+  if (changed) {
+    removeInstructions(code, removed);
+  }
+
+  return changed;
+}
+
+/**
+ * Join the adjacent literal operands of the instructions which concatenate
+ * their operands, e.g. "push "a", push "b", concat 2" becomes "push "ab"".
+ *
+ * @param code the code of the unit
+ *
+ * @return true if the code changed
+ */
+bool Optimizer::foldConstants(vector<Instruction> &code) {
+  vector<bool> targets = getJumpTargets(code);
+  vector<bool> removed(code.size(), false);
+  bool changed = false;
+
+  for (unsigned int i = 0; i < code.size(); i++) {
+    OP_CODE opCode = code[i].opCode;
+    if (opCode == CONCAT || opCode == OUT || opCode == LU
+        || opCode == APPEND || opCode == CHUNK) {
+      changed = foldOperands(code, i, targets, removed) || changed;
+    }
+  }
+
+  if (changed) {
+    removeInstructions(code, removed);
+  }
+
+  return changed;
+}
+
+/**
+ * Join the adjacent literal operands of an instruction, of the ones computed
+ * in the same block of code.
+ *
+ * @param code the code of the unit
+ * @param pos the position of the instruction which concatenates its operands
+ * @param targets the instructions reached by a jump
+ * @param removed the instructions to remove, updated with the ones folded
+ *
+ * @return true if the code changed
+ */
+bool Optimizer::foldOperands(vector<Instruction> &code, unsigned int pos,
+    const vector<bool> &targets, vector<bool> &removed) {
+  Instruction &instr = code[pos];
+  int numOperands = getNumOperands(instr);
+
+  if (targets[pos] || numOperands < 2) {
+    return false;
+  }
+
+  vector<unsigned int> starts = getOperandStarts(code, pos, numOperands,
+      targets, removed);
+
+  // The chunk doesn't concatenate its name and tags, the first two operands.
+  int firstFoldable = (instr.opCode == CHUNK ? 2 : 0);
+
+  // Join each group of operands which are single literal instructions.
+  bool changed = false;
+  int folded = 0;
+  unsigned int first = 0;
+  bool inGroup = false;
+  for (int j = starts.size() - 1; j >= -1; j--) {
+    bool literal = false;
+    if (j >= 0) {
+      unsigned int operandEnd = (j == 0 ? pos - 1 : starts[j - 1] - 1);
+      int operand = numOperands - 1 - j;
+      literal = (starts[j] == operandEnd && operand >= firstFoldable
+          && isLiteral(code[starts[j]]));
+    }
+
+    if (literal && !inGroup) {
+      first = starts[j];
+      inGroup = true;
+    } else if (!literal && inGroup) {
+      unsigned int last = (j >= 0 ? starts[j] : pos);
+      if (last - first >= 2) {
+        wstring value = L"";
+        for (unsigned int k = first; k < last; k++) {
+          value += getLiteral(code[k]);
+          if (k > first) {
+            removed[k] = true;
+          }
+        }
+        code[first].opCode = PUSH;
+        code[first].op1 = L"\"" + value + L"\"";
+        folded += last - first - 1;
+        foldedConstants += last - first - 1;
+        changed = true;
+      }
+      inGroup = false;
+    }
+  }
+
+  if (changed) {
+    numOperands -= folded;
+    instr.op1 = to_wstring(numOperands);
+
+    // A concat of a single value is the value itself.
+    if (instr.opCode == CONCAT && numOperands == 1) {
+      removed[pos] = true;
+      foldedConstants++;
+    }
+  }
+
+  return changed;
+}
+
+/**
+ * Remove the instructions which can't be reached from the start of the code.
+ *
+ * @param code the code of the unit
+ *
+ * @return true if the code changed
+ */
+bool Optimizer::removeDeadCode(vector<Instruction> &code) {
+  vector<bool> reached(code.size(), false);
+  vector<unsigned int> pending;
+
+  if (code.size() > 0) {
+    pending.push_back(0);
+  }
+
+  while (!pending.empty()) {
+    unsigned int i = pending.back();
+    pending.pop_back();
+    if (i >= code.size() || reached[i]) {
+      continue;
+    }
+    reached[i] = true;
+
+    if (isJump(code[i])) {
+      vector<unsigned int> addresses = getJumpAddresses(code[i]);
+      pending.insert(pending.end(), addresses.begin(), addresses.end());
+    }
+    if (code[i].opCode != JMP && code[i].opCode != RET
+        && code[i].opCode != SWITCH) {
+      pending.push_back(i + 1);
+    }
+  }
+
+  vector<bool> removed(code.size(), false);
+  bool changed = false;
+  for (unsigned int i = 0; i < code.size(); i++) {
+    if (!reached[i]) {
+      removed[i] = true;
+      removedDeadCode++;
+      changed = true;
+    }
+  }
+
+  if (changed) {
+    removeInstructions(code, removed);
+  }
+
+  return changed;
+}
+
+/**
+ * Remove some instructions of the code, updating the addresses of the jumps.
+ * A jump to a removed instruction goes to the next one which isn't removed.
+ *
+ * @param code the code of the unit
+ * @param removed the instructions to remove
+ */
+void Optimizer::removeInstructions(vector<Instruction> &code,
+    const vector<bool> &removed) const {
+  vector<unsigned int> newAddress(code.size() + 1);
+  unsigned int next = 0;
+  for (unsigned int i = 0; i < code.size(); i++) {
+    newAddress[i] = next;
+    if (!removed[i]) {
+      next++;
+    }
+  }
+  newAddress[code.size()] = next;
+
+  vector<Instruction> optimized;
+  optimized.reserve(next);
+  for (unsigned int i = 0; i < code.size(); i++) {
+    if (removed[i]) {
+      continue;
+    }
+
+    optimized.push_back(code[i]);
+    if (isJump(code[i])) {
+      vector<unsigned int> addresses = getJumpAddresses(code[i]);
+      for (unsigned int j = 0; j < addresses.size(); j++) {
+        if (addresses[j] < newAddress.size()) {
+          addresses[j] = newAddress[addresses[j]];
+        }
+      }
+      setJumpAddresses(optimized.back(), addresses);
+    }
+  }
+
+  code.swap(optimized);
+}
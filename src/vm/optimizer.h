@@ -0,0 +1,90 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef OPTIMIZER_H_
+#define OPTIMIZER_H_
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "instructions.h"
+
+using namespace std;
+
+/// Number of instructions changed by each optimization of the optimizer.
+struct OptimizerStats {
+  unsigned int instructionsBefore;
+  unsigned int instructionsAfter;
+  unsigned int foldedConstants;
+  unsigned int threadedJumps;
+  unsigned int invertedBranches;
+  unsigned int removedJumps;
+  unsigned int removedDeadCode;
+};
+
+/**
+ * Peephole optimizer of the code units, applied after their labels have been
+ * converted to addresses. It folds adjacent literal operands of the
+ * instructions which concatenate them, threads jumps to jumps, inverts
+ * branches after a not and removes jumps to the next instruction and the code
+ * which can't be reached. Code units can be optimized from different threads.
+ */
+class Optimizer {
+
+public:
+
+  Optimizer();
+  Optimizer(const Optimizer &);
+  ~Optimizer();
+  Optimizer& operator=(const Optimizer &);
+  void copy(const Optimizer &);
+
+  void optimize(CodeUnit &);
+  OptimizerStats getStats() const;
+
+  static bool getStackEffect(const Instruction &, int &, int &);
+  static bool isJump(const Instruction &);
+  static vector<unsigned int> getJumpAddresses(const Instruction &);
+  static void setJumpAddresses(Instruction &, const vector<unsigned int> &);
+  static bool isLiteral(const Instruction &);
+  static wstring getLiteral(const Instruction &);
+  static vector<bool> getJumpTargets(const vector<Instruction> &);
+  static vector<unsigned int> getOperandStarts(const vector<Instruction> &,
+      unsigned int, unsigned int, const vector<bool> &, const vector<bool> &);
+
+private:
+
+  /// Counters of the stats, updated by every code unit optimized.
+  atomic<unsigned int> instructionsBefore;
+  atomic<unsigned int> instructionsAfter;
+  atomic<unsigned int> foldedConstants;
+  atomic<unsigned int> threadedJumps;
+  atomic<unsigned int> invertedBranches;
+  atomic<unsigned int> removedJumps;
+  atomic<unsigned int> removedDeadCode;
+
+  bool invertBranches(vector<Instruction> &);
+  bool threadJumps(vector<Instruction> &);
+  bool foldConstants(vector<Instruction> &);
+  bool foldOperands(vector<Instruction> &, unsigned int, const vector<bool> &,
+      vector<bool> &);
+  bool removeDeadCode(vector<Instruction> &);
+  void removeInstructions(vector<Instruction> &, const vector<bool> &) const;
+};
+
+#endif /* OPTIMIZER_H_ */
@@ -0,0 +1,482 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "profiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "vm_wstring_utils.h"
+
+Profiler::Profiler() {
+  numInstructions = 0;
+  numBytes = 0;
+  startCycles = readCycles();
+  startTime = chrono::steady_clock::now();
+}
+
+Profiler::Profiler(const Profiler &p) {
+  copy(p);
+}
+
+Profiler::~Profiler() {
+
+}
+
+Profiler& Profiler::operator=(const Profiler &p) {
+  if (this != &p) {
+    this->~Profiler();
+    this->copy(p);
+  }
+  return *this;
+}
+
+void Profiler::copy(const Profiler &p) {
+  rules = p.rules;
+  macros = p.macros;
+  frames = p.frames;
+  numInstructions = p.numInstructions;
+  numBytes = p.numBytes;
+  startCycles = p.startCycles;
+  startTime = p.startTime;
+  rulePatterns = p.rulePatterns;
+  ruleShortPatterns = p.ruleShortPatterns;
+}
+
+/**
+ * Take the patterns of the rules from the preprocess code, where every addtrie
+ * is preceded by the items of its pattern and their number.
+ *
+ * @param preprocessCode the preprocess code, already loaded
+ */
+void Profiler::setPatterns(const CodeUnit &preprocessCode) {
+  const vector<Instruction> &code = preprocessCode.code;
+
+  for (unsigned int i = 1; i < code.size(); i++) {
+    if (code[i].opCode != ADDTRIE || code[i - 1].opCode != PUSH) {
+      continue;
+    }
+
+    unsigned int numItems = VMWstringUtils::stringTo<unsigned int>(
+        code[i - 1].op1);
+    if (numItems > i - 1) {
+      continue;
+    }
+
+    wstring pattern, shortPattern;
+    for (unsigned int j = i - 1 - numItems; j < i - 1; j++) {
+      wstring item = code[j].op1;
+      item = VMWstringUtils::replace(item, L"\"", L"");
+      wstring shortItem = item.substr(0, item.find(L'|'));
+      if (shortItem.size() < item.size()) {
+        shortItem += L"|...";
+      }
+
+      if (j > i - 1 - numItems) {
+        pattern += L' ';
+        shortPattern += L' ';
+      }
+      pattern += item;
+      shortPattern += shortItem;
+    }
+
+    unsigned int ruleNumber = VMWstringUtils::stringTo<unsigned int>(
+        code[i].op1);
+    if (ruleNumber >= rulePatterns.size()) {
+      rulePatterns.resize(ruleNumber + 1);
+      ruleShortPatterns.resize(ruleNumber + 1);
+    }
+    if (rulePatterns[ruleNumber].empty()) {
+      ruleShortPatterns[ruleNumber] = shortPattern;
+    }
+    rulePatterns[ruleNumber].push_back(pattern);
+  }
+}
+
+/**
+ * Start the profile of a call to a rule or macro.
+ *
+ * @param section the code section of the unit called
+ * @param number the number of the unit in its section
+ */
+void Profiler::enterUnit(CODE_SECTION section, int number) {
+  Frame frame;
+  frame.section = section;
+  frame.number = number;
+  frame.start = getCounters();
+  frame.callees = {0, 0, 0};
+
+  frames.push_back(frame);
+}
+
+/**
+ * End the profile of the last call, adding its cost to the unit called and to
+ * the callees of its caller.
+ */
+void Profiler::leaveUnit() {
+  if (frames.empty()) {
+    return;
+  }
+
+  ProfileCounters now = getCounters();
+  Frame &frame = frames.back();
+
+  ProfileCounters total;
+  total.instructions = now.instructions - frame.start.instructions;
+  total.cycles = now.cycles - frame.start.cycles;
+  total.bytes = now.bytes - frame.start.bytes;
+
+  ProfileEntry &entry = getEntry(frame.section, frame.number);
+  entry.calls++;
+  entry.total.instructions += total.instructions;
+  entry.total.cycles += total.cycles;
+  entry.total.bytes += total.bytes;
+  entry.self.instructions += total.instructions - frame.callees.instructions;
+  entry.self.cycles += total.cycles - frame.callees.cycles;
+  entry.self.bytes += total.bytes - frame.callees.bytes;
+
+  frames.pop_back();
+
+  if (!frames.empty()) {
+    ProfileCounters &callees = frames.back().callees;
+    callees.instructions += total.instructions;
+    callees.cycles += total.cycles;
+    callees.bytes += total.bytes;
+  }
+}
+
+/**
+ * End the profile of the current rule and of the macros which didn't return,
+ * because the rule ended without a return instruction.
+ */
+void Profiler::leaveRule() {
+  while (!frames.empty()) {
+    leaveUnit();
+  }
+}
+
+/**
+ * Count an instruction executed by the current unit.
+ */
+void Profiler::countInstruction() {
+  numInstructions++;
+}
+
+/**
+ * Count the bytes output by the current unit, once encoded as UTF-8.
+ *
+ * @param output the text output
+ */
+void Profiler::countOutput(wstring_view output) {
+  for (unsigned int i = 0; i < output.size(); i++) {
+    wchar_t c = output[i];
+    if (c < 0x80) {
+      numBytes += 1;
+    } else if (c < 0x800) {
+      numBytes += 2;
+    } else if (c < 0x10000) {
+      numBytes += 3;
+    } else {
+      numBytes += 4;
+    }
+  }
+}
+
+/**
+ * Get the profile of the rules and macros called at least once, the most
+ * expensive first.
+ *
+ * @param rulesCode the rules, to get where their code starts
+ * @param macrosCode the macros, to get where their code starts
+ * @param loader the loader of the code, to get the names of the macros
+ *
+ * @return the profile of each unit called, sorted by the cycles of their code
+ */
+vector<ProfileEntry> Profiler::getEntries(const CodeSection &rulesCode,
+    const CodeSection &macrosCode, Loader *loader) const {
+  vector<ProfileEntry> entries;
+
+  for (unsigned int i = 0; i < rules.size(); i++) {
+    if (rules[i].calls == 0) {
+      continue;
+    }
+    ProfileEntry entry = rules[i];
+    if (i < rulePatterns.size()) {
+      entry.patterns = rulePatterns[i];
+    }
+    if (i < rulesCode.units.size() && !rulesCode.units[i].code.empty()) {
+      entry.lineNumber = rulesCode.units[i].code[0].lineNumber;
+    }
+    entries.push_back(entry);
+  }
+
+  for (unsigned int i = 0; i < macros.size(); i++) {
+    if (macros[i].calls == 0) {
+      continue;
+    }
+    ProfileEntry entry = macros[i];
+    entry.name = loader->getMacroNameFromNumber(i);
+    if (i < macrosCode.units.size() && !macrosCode.units[i].code.empty()) {
+      entry.lineNumber = macrosCode.units[i].code[0].lineNumber;
+    }
+    entries.push_back(entry);
+  }
+
+  sort(entries.begin(), entries.end(),
+      [](const ProfileEntry &a, const ProfileEntry &b) {
+        if (a.self.cycles != b.self.cycles) {
+          return a.self.cycles > b.self.cycles;
+        }
+        return a.total.cycles > b.total.cycles;
+      });
+
+  return entries;
+}
+
+/**
+ * Show the profile of the rules and macros called, one per line.
+ *
+ * @param codeFileName the name of the code file profiled
+ * @param entries the profile of the units, as returned by getEntries
+ */
+void Profiler::printReport(const string &codeFileName,
+    const vector<ProfileEntry> &entries) const {
+  double msPerCycle = getNanosecondsPerCycle() / 1e6;
+  unsigned long ruleCalls = 0, macroCalls = 0;
+
+  for (unsigned int i = 0; i < entries.size(); i++) {
+    if (entries[i].section == RULES_SECTION) {
+      ruleCalls += entries[i].calls;
+    } else {
+      macroCalls += entries[i].calls;
+    }
+  }
+
+  double ms = chrono::duration<double, milli>(
+      chrono::steady_clock::now() - startTime).count();
+  wcerr << codeFileName.c_str() << L": " << ruleCalls << L" rule calls and "
+        << macroCalls << L" macro calls in " << fixed << setprecision(3) << ms
+        << L" ms" << endl;
+  wcerr << L"   self ms   total ms      calls  instructions       bytes  unit"
+        << endl;
+
+  for (unsigned int i = 0; i < entries.size(); i++) {
+    const ProfileEntry &entry = entries[i];
+    wcerr << setw(10) << entry.self.cycles * msPerCycle << L" "
+          << setw(10) << entry.total.cycles * msPerCycle << L" "
+          << setw(10) << entry.calls << L" "
+          << setw(13) << entry.self.instructions << L" "
+          << setw(11) << entry.total.bytes << L"  "
+          << getUnitDescription(entry) << endl;
+  }
+}
+
+/**
+ * Write the profile of the rules and macros called to a JSON file.
+ *
+ * @param fileName the name of the file to write
+ * @param codeFileName the name of the code file profiled
+ * @param entries the profile of the units, as returned by getEntries
+ *
+ * @return true if the file was written, false otherwise
+ */
+bool Profiler::writeReport(const char *fileName, const string &codeFileName,
+    const vector<ProfileEntry> &entries) const {
+  wofstream file(fileName);
+  if (!file.good()) {
+    return false;
+  }
+
+  double msPerCycle = getNanosecondsPerCycle() / 1e6;
+  double ms = chrono::duration<double, milli>(
+      chrono::steady_clock::now() - startTime).count();
+
+  file << fixed << setprecision(6);
+  file << L"{" << endl;
+  file << L"  \"code_file\": \"" << escapeJson(
+      wstring(codeFileName.begin(), codeFileName.end())) << L"\"," << endl;
+  file << L"  \"milliseconds\": " << ms << L"," << endl;
+  file << L"  \"units\": [";
+
+  for (unsigned int i = 0; i < entries.size(); i++) {
+    const ProfileEntry &entry = entries[i];
+    const ProfileCounters *counters[] = { &entry.self, &entry.total };
+    const wchar_t *countersNames[] = { L"self", L"total" };
+
+    file << (i > 0 ? L"," : L"") << endl << L"    {\"type\": \""
+         << (entry.section == RULES_SECTION ? L"rule" : L"macro")
+         << L"\", \"number\": " << entry.number
+         << L", \"name\": \"" << escapeJson(entry.name)
+         << L"\", \"line\": " << entry.lineNumber << L", \"patterns\": [";
+    for (unsigned int j = 0; j < entry.patterns.size(); j++) {
+      file << (j > 0 ? L", " : L"") << L"\"" << escapeJson(entry.patterns[j])
+           << L"\"";
+    }
+    file << L"], \"calls\": " << entry.calls;
+
+    for (unsigned int j = 0; j < 2; j++) {
+      file << L", \"" << countersNames[j] << L"\": {\"instructions\": "
+           << counters[j]->instructions << L", \"cycles\": "
+           << counters[j]->cycles << L", \"milliseconds\": "
+           << counters[j]->cycles * msPerCycle << L", \"bytes\": "
+           << counters[j]->bytes << L"}";
+    }
+    file << L"}";
+  }
+
+  file << endl << L"  ]" << endl << L"}" << endl;
+  file.close();
+
+  return !file.fail();
+}
+
+/**
+ * Read the cycle counter of the processor, or a clock in nanoseconds if the
+ * processor doesn't have one.
+ *
+ * @return the number of cycles
+ */
+uint64_t Profiler::readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * Get the counters of the whole run until now.
+ *
+ * @return the instructions, cycles and bytes since the start
+ */
+ProfileCounters Profiler::getCounters() const {
+  ProfileCounters counters;
+  counters.instructions = numInstructions;
+  counters.cycles = readCycles();
+  counters.bytes = numBytes;
+
+  return counters;
+}
+
+/**
+ * Get the profile of a unit, creating it the first time the unit is called.
+ *
+ * @param section the code section of the unit
+ * @param number the number of the unit in its section
+ *
+ * @return the profile of the unit
+ */
+ProfileEntry& Profiler::getEntry(CODE_SECTION section, int number) {
+  vector<ProfileEntry> &entries = (section == RULES_SECTION ? rules : macros);
+
+  while ((int) entries.size() <= number) {
+    ProfileEntry entry;
+    entry.section = section;
+    entry.number = entries.size();
+    entry.calls = 0;
+    entry.self = {0, 0, 0};
+    entry.total = {0, 0, 0};
+    entry.lineNumber = -1;
+    entries.push_back(entry);
+  }
+
+  return entries[number];
+}
+
+/**
+ * Get the duration of a cycle, comparing the cycles and the time elapsed
+ * since the profiler was created.
+ *
+ * @return the nanoseconds per cycle
+ */
+double Profiler::getNanosecondsPerCycle() const {
+  uint64_t cycles = readCycles() - startCycles;
+  double ns = chrono::duration<double, nano>(
+      chrono::steady_clock::now() - startTime).count();
+
+  return cycles > 0 ? ns / cycles : 0;
+}
+
+/**
+ * Get a short description of a unit for the text report, with its line in the
+ * code file and its name or first pattern.
+ *
+ * @param entry the profile of the unit
+ *
+ * @return the description
+ */
+wstring Profiler::getUnitDescription(const ProfileEntry &entry) const {
+  wstringstream ws;
+
+  if (entry.section == RULES_SECTION) {
+    ws << L"rule " << entry.number;
+  } else {
+    ws << L"macro " << (entry.name != L"" ? entry.name
+        : to_wstring(entry.number));
+  }
+
+  if (entry.lineNumber >= 0) {
+    ws << L" (line " << entry.lineNumber << L")";
+  }
+
+  if (entry.section == RULES_SECTION
+      && (unsigned int) entry.number < ruleShortPatterns.size()) {
+    ws << L": " << ruleShortPatterns[entry.number];
+    if (rulePatterns[entry.number].size() > 1) {
+      ws << L" (+" << rulePatterns[entry.number].size() - 1 << L" patterns)";
+    }
+  }
+
+  return ws.str();
+}
+
+/**
+ * Escape a string to write it inside the quotes of a JSON string.
+ *
+ * @param str the string to escape
+ *
+ * @return the string escaped
+ */
+wstring Profiler::escapeJson(const wstring &str) {
+  wstringstream ws;
+
+  for (unsigned int i = 0; i < str.size(); i++) {
+    wchar_t c = str[i];
+    if (c == L'"' || c == L'\\') {
+      ws << L'\\' << c;
+    } else if (c == L'\n') {
+      ws << L"\\n";
+    } else if (c == L'\t') {
+      ws << L"\\t";
+    } else if (c < 0x20) {
+      ws << L"\\u" << hex << setw(4) << setfill(L'0') << (int) c << dec
+         << setfill(L' ');
+    } else {
+      ws << c;
+    }
+  }
+
+  return ws.str();
+}
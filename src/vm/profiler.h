@@ -0,0 +1,131 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "instructions.h"
+#include "call_stack.h"
+#include "loader.h"
+
+using namespace std;
+
+/// The cost of a code unit: instructions executed, cycles and bytes output.
+struct ProfileCounters {
+  uint64_t instructions;
+  uint64_t cycles;
+  uint64_t bytes;
+};
+
+/**
+ * The profile of a rule or macro. The self counters only include the code of
+ * the unit, the total ones also include the macros it calls.
+ */
+struct ProfileEntry {
+  CODE_SECTION section;
+  int number;
+  unsigned long calls;
+  ProfileCounters self;
+  ProfileCounters total;
+
+  /// Name of the macro, empty if it's unknown or the entry is a rule.
+  wstring name;
+
+  /// Line of the first instruction in the code file, -1 if it's unknown.
+  int lineNumber;
+
+  /// Patterns of the rule, as the items of each one separated by spaces.
+  vector<wstring> patterns;
+};
+
+/**
+ * Profiler of the rules and macros executed. Every call to a code unit opens
+ * a frame which takes note of the counters when it starts, so the cost of a
+ * call is known when it returns and is added to the unit and its caller. The
+ * time is measured in cycles of the processor, which are much cheaper to read
+ * than the clock, and converted to time comparing both over the whole run.
+ */
+class Profiler {
+
+public:
+
+  Profiler();
+  Profiler(const Profiler &);
+  ~Profiler();
+  Profiler& operator=(const Profiler &);
+  void copy(const Profiler &);
+
+  void setPatterns(const CodeUnit &);
+  void enterUnit(CODE_SECTION, int);
+  void leaveUnit();
+  void leaveRule();
+  void countInstruction();
+  void countOutput(wstring_view);
+
+  vector<ProfileEntry> getEntries(const CodeSection &, const CodeSection &,
+      Loader *) const;
+  void printReport(const string &, const vector<ProfileEntry> &) const;
+  bool writeReport(const char *, const string &,
+      const vector<ProfileEntry> &) const;
+
+  static uint64_t readCycles();
+
+private:
+
+  /// A call in progress, with the counters when it started.
+  struct Frame {
+    CODE_SECTION section;
+    int number;
+    ProfileCounters start;
+    ProfileCounters callees;
+  };
+
+  /// The cost of every rule and macro, indexed by their number.
+  vector<ProfileEntry> rules;
+  vector<ProfileEntry> macros;
+
+  /// Calls in progress, the rule first.
+  vector<Frame> frames;
+
+  /// Instructions executed and bytes output since the start.
+  uint64_t numInstructions;
+  uint64_t numBytes;
+
+  /// Cycles and time when the profiler was created.
+  uint64_t startCycles;
+  chrono::steady_clock::time_point startTime;
+
+  /// Patterns of each rule, taken from the code which adds them to the trie.
+  vector<vector<wstring> > rulePatterns;
+
+  /// First pattern of each rule, with only the first choice of each item.
+  vector<wstring> ruleShortPatterns;
+
+  ProfileCounters getCounters() const;
+  ProfileEntry& getEntry(CODE_SECTION, int);
+  double getNanosecondsPerCycle() const;
+  wstring getUnitDescription(const ProfileEntry &) const;
+  static wstring escapeJson(const wstring &);
+};
+
+#endif /* PROFILER_H_ */
@@ -0,0 +1,249 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "rule_cache.h"
+
+#include <cwchar>
+
+#include "vm_wstring_utils.h"
+
+using namespace std;
+
+RuleCache::RuleCache() {
+  capacity = 0;
+  isPostchunk = false;
+  lookups = 0;
+  hits = 0;
+}
+
+/**
+ * Create a cache for the rules of a transfer stage.
+ *
+ * @param capacity the maximum number of outputs stored
+ * @param isPostchunk if the code belongs to the postchunk
+ */
+RuleCache::RuleCache(unsigned int capacity, bool isPostchunk) {
+  this->capacity = capacity;
+  this->isPostchunk = isPostchunk;
+  lookups = 0;
+  hits = 0;
+}
+
+RuleCache::RuleCache(const RuleCache &c) {
+  copy(c);
+}
+
+RuleCache::~RuleCache() {
+
+}
+
+RuleCache& RuleCache::operator=(const RuleCache &c) {
+  if (this != &c) {
+    this->~RuleCache();
+    this->copy(c);
+  }
+  return *this;
+}
+
+void RuleCache::copy(const RuleCache &c) {
+  capacity = c.capacity;
+  isPostchunk = c.isPostchunk;
+  cacheableRules = c.cacheableRules;
+  ruleBlanks = c.ruleBlanks;
+  lookups = c.lookups;
+  hits = c.hits;
+
+  // The index points to the entries, so it's built again for the copy.
+  entries = c.entries;
+  index.clear();
+  for (list<pair<wstring, wstring> >::iterator it = entries.begin();
+      it != entries.end(); ++it) {
+    index[it->first] = it;
+  }
+}
+
+/**
+ * Find the rules whose output can be cached. A macro has effects if it uses
+ * variables or calls a macro which has them, and the blanks it reads depend on
+ * the words passed, so only the rules can read blanks. Every rule and macro
+ * must be already loaded.
+ *
+ * @param rulesCode the code section containing rules
+ * @param macrosCode the code section containing macros
+ */
+void RuleCache::analyze(const CodeSection &rulesCode,
+    const CodeSection &macrosCode) {
+  // Every macro is assumed without effects until one is found, which lets
+  // recursive macros without effects be cached.
+  vector<bool> macroEffects(macrosCode.units.size(), false);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (unsigned int i = 0; i < macrosCode.units.size(); i++) {
+      if (!macroEffects[i]
+          && hasEffects(macrosCode.units[i], macroEffects, true)) {
+        macroEffects[i] = true;
+        changed = true;
+      }
+    }
+  }
+
+  cacheableRules.assign(rulesCode.units.size(), false);
+  ruleBlanks.assign(rulesCode.units.size(), vector<int>());
+  for (unsigned int i = 0; i < rulesCode.units.size(); i++) {
+    const CodeUnit &rule = rulesCode.units[i];
+    cacheableRules[i] = !hasEffects(rule, macroEffects, false);
+
+    if (cacheableRules[i] && !isPostchunk) {
+      for (unsigned int j = 0; j < rule.code.size(); j++) {
+        if (rule.code[j].opCode == PUSHSB) {
+          ruleBlanks[i].push_back(wcstol(rule.code[j].op1.c_str(), NULL, 10));
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Check if the output of a rule can be cached.
+ *
+ * @param ruleNumber the number of the rule
+ *
+ * @return true if the rule only depends on its words
+ */
+bool RuleCache::isCacheable(unsigned int ruleNumber) const {
+  return ruleNumber < cacheableRules.size() && cacheableRules[ruleNumber];
+}
+
+/**
+ * Get the blanks read by a rule, which are part of the key of its output.
+ *
+ * @param ruleNumber the number of the rule
+ *
+ * @return the positions of the blanks relative to the first word
+ */
+const vector<int>& RuleCache::getBlanks(unsigned int ruleNumber) const {
+  return ruleBlanks[ruleNumber];
+}
+
+/**
+ * Find the output stored for a key, marking it as the most recently used.
+ *
+ * @param key the key of the rule and its words
+ *
+ * @return the output or NULL if it isn't stored
+ */
+const wstring* RuleCache::find(const wstring &key) {
+  lookups++;
+
+  unordered_map<wstring, list<pair<wstring, wstring> >::iterator>::iterator it =
+      index.find(key);
+  if (it == index.end()) {
+    return NULL;
+  }
+
+  hits++;
+  entries.splice(entries.begin(), entries, it->second);
+  return &it->second->second;
+}
+
+/**
+ * Store the output of a rule, removing the least recently used output if the
+ * cache is full.
+ *
+ * @param key the key of the rule and its words
+ * @param output the output of the rule
+ */
+void RuleCache::insert(const wstring &key, const wstring &output) {
+  if (capacity == 0 || index.find(key) != index.end()) {
+    return;
+  }
+
+  if (entries.size() == capacity) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+
+  entries.emplace_front(key, output);
+  index[key] = entries.begin();
+}
+
+/**
+ * Get the number of rules which can be cached and how many outputs were found.
+ *
+ * @return the stats of the cache
+ */
+RuleCacheStats RuleCache::getStats() const {
+  RuleCacheStats stats;
+  stats.numRules = cacheableRules.size();
+  stats.numCacheableRules = 0;
+  for (unsigned int i = 0; i < cacheableRules.size(); i++) {
+    if (cacheableRules[i]) {
+      stats.numCacheableRules++;
+    }
+  }
+  stats.lookups = lookups;
+  stats.hits = hits;
+
+  return stats;
+}
+
+/**
+ * Check if a code unit has effects besides its output: reading or writing
+ * variables, calling a macro with effects or, for a macro, reading blanks.
+ *
+ * @param unit the code unit
+ * @param macroEffects the macros known to have effects
+ * @param isMacro if the code unit is a macro
+ *
+ * @return true if it has effects
+ */
+bool RuleCache::hasEffects(const CodeUnit &unit,
+    const vector<bool> &macroEffects, bool isMacro) const {
+  for (unsigned int i = 0; i < unit.code.size(); i++) {
+    const Instruction &instr = unit.code[i];
+
+    switch (instr.opCode) {
+    case STOREV: /* falls through */
+    case APPEND:
+      return true;
+    case PUSH:
+      // Anything but a string or a number is a variable.
+      if ((instr.op1.size() == 0 || instr.op1[0] != L'"')
+          && !VMWstringUtils::iswnumeric(instr.op1)) {
+        return true;
+      }
+      break;
+    case PUSHSB:
+      if (isMacro && !isPostchunk) {
+        return true;
+      }
+      break;
+    case CALL: {
+      unsigned long macro = wcstoul(instr.op1.c_str(), NULL, 10);
+      if (macro >= macroEffects.size() || macroEffects[macro]) {
+        return true;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,96 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RULE_CACHE_H_
+#define RULE_CACHE_H_
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+#include "instructions.h"
+
+using namespace std;
+
+/// Number of outputs cached when no size is given.
+const unsigned int DEFAULT_RULE_CACHE_SIZE = 1000;
+
+/// Number of rules which can be cached and use of the cache.
+struct RuleCacheStats {
+  unsigned int numRules;
+  unsigned int numCacheableRules;
+  unsigned long lookups;
+  unsigned long hits;
+};
+
+/**
+ * Cache of the output of the rules which only depend on their words. An
+ * effect analysis of the code finds the rules which don't read or write
+ * variables, directly or through the macros they call, so executing them
+ * again with the same words gives the same output. Their output is stored in
+ * a least recently used cache of limited size, keyed by the rule and the text
+ * of its words and of the blanks it reads.
+ */
+class RuleCache {
+
+public:
+
+  RuleCache();
+  RuleCache(unsigned int, bool);
+  RuleCache(const RuleCache &);
+  ~RuleCache();
+  RuleCache& operator=(const RuleCache &);
+  void copy(const RuleCache &);
+
+  void analyze(const CodeSection &, const CodeSection &);
+  bool isCacheable(unsigned int) const;
+  const vector<int>& getBlanks(unsigned int) const;
+  const wstring* find(const wstring &);
+  void insert(const wstring &, const wstring &);
+  RuleCacheStats getStats() const;
+
+private:
+
+  /// Maximum number of outputs stored.
+  unsigned int capacity;
+
+  /// If the code belongs to the postchunk, whose blanks belong to the chunk.
+  bool isPostchunk;
+
+  /// If the output of each rule can be cached.
+  vector<bool> cacheableRules;
+
+  /// Positions of the blanks read by each rule, relative to its first word.
+  vector<vector<int> > ruleBlanks;
+
+  /// The outputs stored with their key, the most recently used first.
+  list<pair<wstring, wstring> > entries;
+
+  /// Each output stored by its key.
+  unordered_map<wstring, list<pair<wstring, wstring> >::iterator> index;
+
+  /// Number of outputs looked for.
+  unsigned long lookups;
+
+  /// Number of outputs found.
+  unsigned long hits;
+
+  bool hasEffects(const CodeUnit &, const vector<bool> &, bool) const;
+};
+
+#endif /* RULE_CACHE_H_ */
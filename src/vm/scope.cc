@@ -20,6 +20,7 @@
 #include <sstream>
 
 #include "vm_wstring_utils.h"
+#include "switch_table.h"
 
 Scope::Scope() {
   nextAddress = 0;
@@ -48,7 +49,8 @@ void Scope::copy(const Scope &s) {
 }
 
 /**
- * Backpatch all the labels which require it.
+ * Backpatch all the labels which require it, including the labels of the jump
+ * tables of the switch instructions.
  *
  * @param codeUnit code unit which has the labels to patch
  */
@@ -63,6 +65,37 @@ void Scope::backPatchLabels(CodeUnit &codeUnit) const {
       codeUnit.code[positions[pos]].op1 = address;
     }
   }
+
+  for (unsigned int i = 0; i < codeUnit.code.size(); i++) {
+    Instruction &instr = codeUnit.code[i];
+    if (instr.opCode != SWITCH) {
+      continue;
+    }
+
+    SwitchTable table(instr.op1);
+    table.setDefaultTarget(getLabelAddress(table.getDefaultTarget()));
+    for (unsigned int j = 0; j < table.getNumCases(); j++) {
+      table.setTarget(j, getLabelAddress(table.getTarget(j)));
+    }
+    instr.op1 = table.getOperand();
+  }
+}
+
+/**
+ * Get the internal address of a label of the scope.
+ *
+ * @param label the label
+ *
+ * @return its address, or the label itself if it isn't in the scope
+ */
+wstring Scope::getLabelAddress(const wstring &label) const {
+  map<wstring, wstring>::const_iterator it = labelAddress.find(label);
+
+  if (it != labelAddress.end()) {
+    return it->second;
+  }
+
+  return label;
 }
 
 /**
@@ -52,6 +52,7 @@ private:
   map<wstring, vector<unsigned int> > patchNeeded;
 
   void addLabelToPatch(wstring, unsigned int);
+  wstring getLabelAddress(const wstring &) const;
 };
 
 #endif /* SCOPE_H_ */
@@ -0,0 +1,158 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "switch_table.h"
+
+SwitchTable::SwitchTable() {
+
+}
+
+/**
+ * Parse the operand of a switch instruction.
+ *
+ * @param operand the operand, the default target and each case
+ */
+SwitchTable::SwitchTable(const wstring &operand) {
+  unsigned int pos = 0;
+  bool isDefault = true;
+
+  while (pos < operand.size()) {
+    if (operand[pos] == L' ') {
+      pos++;
+    } else if (operand[pos] == L'"') {
+      size_t end = operand.find(L'"', pos + 1);
+      if (end == wstring::npos) {
+        end = operand.size();
+      }
+      values.push_back(operand.substr(pos + 1, end - pos - 1));
+      pos = end + 1;
+    } else {
+      size_t end = operand.find(L' ', pos);
+      if (end == wstring::npos) {
+        end = operand.size();
+      }
+      wstring target = operand.substr(pos, end - pos);
+      if (isDefault) {
+        defaultTarget = target;
+        isDefault = false;
+      } else {
+        targets.push_back(target);
+      }
+      pos = end;
+    }
+  }
+
+  // A value without target isn't a case.
+  values.resize(targets.size());
+}
+
+SwitchTable::SwitchTable(const SwitchTable &t) {
+  copy(t);
+}
+
+SwitchTable::~SwitchTable() {
+
+}
+
+SwitchTable& SwitchTable::operator=(const SwitchTable &t) {
+  if (this != &t) {
+    this->~SwitchTable();
+    this->copy(t);
+  }
+  return *this;
+}
+
+void SwitchTable::copy(const SwitchTable &t) {
+  values = t.values;
+  targets = t.targets;
+  defaultTarget = t.defaultTarget;
+}
+
+/**
+ * Get the number of cases of the table, without the default one.
+ *
+ * @return the number of cases
+ */
+unsigned int SwitchTable::getNumCases() const {
+  return values.size();
+}
+
+/**
+ * Get the value of a case.
+ *
+ * @param i the number of the case
+ *
+ * @return the value which selects the case
+ */
+const wstring& SwitchTable::getValue(unsigned int i) const {
+  return values[i];
+}
+
+/**
+ * Get the target of a case.
+ *
+ * @param i the number of the case
+ *
+ * @return the label or address to jump to
+ */
+const wstring& SwitchTable::getTarget(unsigned int i) const {
+  return targets[i];
+}
+
+/**
+ * Set the target of a case.
+ *
+ * @param i the number of the case
+ * @param target the label or address to jump to
+ */
+void SwitchTable::setTarget(unsigned int i, const wstring &target) {
+  targets[i] = target;
+}
+
+/**
+ * Get the target used if no case has the value popped.
+ *
+ * @return the label or address to jump to
+ */
+const wstring& SwitchTable::getDefaultTarget() const {
+  return defaultTarget;
+}
+
+/**
+ * Set the target used if no case has the value popped.
+ *
+ * @param target the label or address to jump to
+ */
+void SwitchTable::setDefaultTarget(const wstring &target) {
+  defaultTarget = target;
+}
+
+/**
+ * Write the table as the operand of a switch instruction.
+ *
+ * @return the operand
+ */
+wstring SwitchTable::getOperand() const {
+  wstring operand = defaultTarget;
+
+  for (unsigned int i = 0; i < values.size(); i++) {
+    operand += L" \"" + values[i] + L"\" " + targets[i];
+  }
+
+  return operand;
+}
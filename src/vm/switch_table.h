@@ -0,0 +1,66 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef SWITCH_TABLE_H_
+#define SWITCH_TABLE_H_
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * The jump table of a switch instruction, written as its operand, e.g.
+ * switch when_2_end "<m>" when_0_case "<f>" when_1_case: the target used if
+ * the value popped isn't in the table, followed by each value and the target
+ * to jump to if it's the value popped. The targets are labels in the assembly
+ * code and addresses once the code unit is loaded. Values can't contain
+ * quotes.
+ */
+class SwitchTable {
+
+public:
+
+  SwitchTable();
+  SwitchTable(const wstring &);
+  SwitchTable(const SwitchTable &);
+  ~SwitchTable();
+  SwitchTable& operator=(const SwitchTable &);
+  void copy(const SwitchTable &);
+
+  unsigned int getNumCases() const;
+  const wstring& getValue(unsigned int) const;
+  const wstring& getTarget(unsigned int) const;
+  void setTarget(unsigned int, const wstring &);
+  const wstring& getDefaultTarget() const;
+  void setDefaultTarget(const wstring &);
+  wstring getOperand() const;
+
+private:
+
+  /// The value of each case.
+  vector<wstring> values;
+
+  /// The target of each case.
+  vector<wstring> targets;
+
+  /// The target used if no case has the value popped.
+  wstring defaultTarget;
+};
+
+#endif /* SWITCH_TABLE_H_ */
@@ -130,17 +130,30 @@ void TrieNode::pushNextNodes(const wstring& wstr, list<TrieNode*>& nodes) const
 
 SystemTrie::SystemTrie() {
   root = new TrieNode;
+  hasNodesOutsidePool = true;
 }
 
 SystemTrie::~SystemTrie() {
+  deleteNodesOutsidePool();
+}
+
+/**
+ * Get every node of the trie, each one only once although the star transitions
+ * create loops.
+ *
+ * @return the nodes in breadth first order, starting by the root
+ */
+vector<TrieNode*> SystemTrie::getNodes() const {
   queue<TrieNode *> q;
   unordered_set<TrieNode *> allNodes;
+  vector<TrieNode *> nodes;
   q.push(root);
   allNodes.insert(root);
 
   while (!q.empty()) {
     TrieNode *node = q.front();
     q.pop();
+    nodes.push_back(node);
     TrieNode *starTransition = node->starTransition;
     if (starTransition != NULL && allNodes.find(starTransition) == allNodes.end()) {
       q.push(starTransition);
@@ -159,12 +172,67 @@ SystemTrie::~SystemTrie() {
       }
     }
   }
-  for (TrieNode *node : allNodes) {
-    delete node;
+
+  return nodes;
+}
+
+/**
+ * Replace the trie by a number of empty nodes, allocated together, to restore
+ * a trie already built. The first node is the new root.
+ *
+ * @param numNodes the number of nodes of the trie, at least one
+ */
+void SystemTrie::resize(unsigned int numNodes) {
+  deleteNodesOutsidePool();
+
+  nodePool.clear();
+  nodePool.resize(numNodes);
+  root = &nodePool[0];
+  hasNodesOutsidePool = false;
+}
+
+/**
+ * Get a node restored with resize.
+ *
+ * @param index the position of the node, 0 for the root
+ *
+ * @return the node
+ */
+TrieNode* SystemTrie::getNode(unsigned int index) {
+  return &nodePool[index];
+}
+
+/**
+ * Delete the nodes allocated on their own, looking for them only if there can
+ * be any, as a trie restored is usually just read.
+ */
+void SystemTrie::deleteNodesOutsidePool() {
+  if (!hasNodesOutsidePool) {
+    return;
+  }
+
+  for (TrieNode *node : getNodes()) {
+    if (!isPooled(node)) {
+      delete node;
+    }
   }
 }
 
+/**
+ * Check if a node was allocated by resize instead of on its own.
+ *
+ * @param node the node to check
+ *
+ * @return true if the node belongs to the pool
+ */
+bool SystemTrie::isPooled(const TrieNode *node) const {
+  return !nodePool.empty() && node >= &nodePool.front()
+      && node <= &nodePool.back();
+}
+
 void SystemTrie::addPattern(const vector<wstring> &pattern, int ruleNumber) {
+  hasNodesOutsidePool = true;
+
   // Only the last part of the pattern matches to the ruleNumber.
   int rule = NaRuleNumber;
   unsigned int numPatterns = pattern.size();
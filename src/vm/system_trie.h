@@ -49,10 +49,23 @@ class SystemTrie {
  private:
   TrieNode *root;
 
+  /// Nodes restored all at once, e.g. from a snapshot, instead of one by one.
+  std::vector<TrieNode> nodePool;
+
+  /// If patterns were added after restoring the nodes, allocating new ones.
+  bool hasNodesOutsidePool;
+
+  void deleteNodesOutsidePool();
+  bool isPooled(const TrieNode *) const;
+
  public:
   SystemTrie();
   ~SystemTrie();
 
+  std::vector<TrieNode*> getNodes() const;
+  void resize(unsigned int numNodes);
+  TrieNode* getNode(unsigned int);
+
   std::list<TrieNode*> getPatternNodes(const std::wstring& pattern, TrieNode *startNode);
   std::list<TrieNode*> getPatternNodes(const std::wstring& pattern);
   void addPattern(const std::vector<std::wstring> &pattern, int ruleNumber);
@@ -0,0 +1,286 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "tag_sequence.h"
+
+unordered_map<wstring_view, unsigned int> TagTable::ids;
+
+deque<wstring> TagTable::tags;
+
+shared_mutex TagTable::tagsMutex;
+
+/**
+ * Get the identifier of a tag, interning it if it's the first time it's seen.
+ *
+ * @param tag the tag, including the '<' and '>'
+ *
+ * @return the identifier of the tag
+ */
+unsigned int TagTable::getId(wstring_view tag) {
+  {
+    shared_lock<shared_mutex> lock(tagsMutex);
+    unordered_map<wstring_view, unsigned int>::const_iterator it =
+        ids.find(tag);
+
+    if (it != ids.end()) {
+      return it->second;
+    }
+  }
+
+  unique_lock<shared_mutex> lock(tagsMutex);
+
+  // Another thread could have interned it since the shared lock was released.
+  unordered_map<wstring_view, unsigned int>::const_iterator it = ids.find(tag);
+
+  if (it != ids.end()) {
+    return it->second;
+  }
+
+  // The deque doesn't move its elements, so the key can be a view of them.
+  unsigned int id = tags.size();
+  tags.push_back(wstring(tag));
+  ids[tags.back()] = id;
+
+  return id;
+}
+
+/**
+ * Get the text of an interned tag.
+ *
+ * @param id the identifier of the tag
+ *
+ * @return the tag, including the '<' and '>'
+ */
+wstring_view TagTable::getTag(unsigned int id) {
+  // The element doesn't move, but the deque's index can while pushing.
+  shared_lock<shared_mutex> lock(tagsMutex);
+  return tags[id];
+}
+
+TagSequence::TagSequence() {
+  numTags = 0;
+}
+
+TagSequence::TagSequence(const TagSequence &ts) {
+  copy(ts);
+}
+
+TagSequence::~TagSequence() {
+
+}
+
+TagSequence& TagSequence::operator=(const TagSequence &ts) {
+  // The heap storage is reused, so there is nothing to destroy first.
+  if (this != &ts) {
+    this->copy(ts);
+  }
+  return *this;
+}
+
+void TagSequence::copy(const TagSequence &ts) {
+  setIds(ts.getIds(), ts.numTags);
+}
+
+/**
+ * Set the sequence from the textual representation of the tags.
+ *
+ * @param text the tags as text, e.g. <n><pl>
+ *
+ * @return true if the text only contains complete tags, otherwise the sequence
+ * is left empty and false is returned
+ */
+bool TagSequence::assign(wstring_view text) {
+  setIds(NULL, 0);
+
+  size_t pos = 0;
+  while (pos < text.size()) {
+    if (text[pos] != L'<') {
+      setIds(NULL, 0);
+      return false;
+    }
+
+    size_t end = pos + 1;
+    while (end < text.size() && text[end] != L'>') {
+      // Nested or escaped characters can't be matched as whole tags.
+      if (text[end] == L'<' || text[end] == L'\\') {
+        setIds(NULL, 0);
+        return false;
+      }
+      end++;
+    }
+
+    if (end == text.size()) {
+      setIds(NULL, 0);
+      return false;
+    }
+
+    push(TagTable::getId(text.substr(pos, end + 1 - pos)));
+    pos = end + 1;
+  }
+
+  return true;
+}
+
+/**
+ * Get the number of tags of the sequence.
+ *
+ * @return the number of tags
+ */
+unsigned int TagSequence::size() const {
+  return numTags;
+}
+
+/**
+ * Get the tag at a position of the sequence.
+ *
+ * @param pos the position of the tag
+ *
+ * @return the identifier of the tag
+ */
+unsigned int TagSequence::operator[](unsigned int pos) const {
+  return getIds()[pos];
+}
+
+/**
+ * Find the first occurrence of a sequence of tags inside this one.
+ *
+ * @param sequence the sequence to find
+ *
+ * @return the position of the first tag found or -1 if there isn't any
+ */
+int TagSequence::find(const TagSequence &sequence) const {
+  const unsigned int *ids = getIds();
+  const unsigned int *otherIds = sequence.getIds();
+
+  if (sequence.numTags > numTags) {
+    return -1;
+  }
+
+  for (unsigned int i = 0; i + sequence.numTags <= numTags; i++) {
+    unsigned int j = 0;
+    while (j < sequence.numTags && ids[i + j] == otherIds[j]) {
+      j++;
+    }
+    if (j == sequence.numTags) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Get the position inside the textual representation of a tag.
+ *
+ * @param pos the position of the tag in the sequence
+ *
+ * @return the position of its '<' in the text
+ */
+size_t TagSequence::getTextPosition(unsigned int pos) const {
+  return getTextSize(0, pos);
+}
+
+/**
+ * Get the size of the textual representation of some tags of the sequence.
+ *
+ * @param pos the position of the first tag
+ * @param count the number of tags
+ *
+ * @return the number of characters of those tags
+ */
+size_t TagSequence::getTextSize(unsigned int pos, unsigned int count) const {
+  const unsigned int *ids = getIds();
+  size_t size = 0;
+
+  for (unsigned int i = pos; i < pos + count; i++) {
+    size += TagTable::getTag(ids[i]).size();
+  }
+
+  return size;
+}
+
+/**
+ * Replace some tags of the sequence with other tags.
+ *
+ * @param pos the position of the first tag to replace
+ * @param count the number of tags to replace
+ * @param value the tags to put in their place
+ */
+void TagSequence::replace(unsigned int pos, unsigned int count,
+    const TagSequence &value) {
+  const unsigned int *ids = getIds();
+  TagSequence result;
+
+  for (unsigned int i = 0; i < pos; i++) {
+    result.push(ids[i]);
+  }
+  for (unsigned int i = 0; i < value.numTags; i++) {
+    result.push(value[i]);
+  }
+  for (unsigned int i = pos + count; i < numTags; i++) {
+    result.push(ids[i]);
+  }
+
+  copy(result);
+}
+
+/**
+ * Get the tags of the sequence, wherever they are stored.
+ *
+ * @return a pointer to the first tag
+ */
+const unsigned int* TagSequence::getIds() const {
+  return numTags <= INLINE_SIZE ? inlineIds : heapIds.data();
+}
+
+/**
+ * Append a tag to the sequence, moving all of them to the heap if they don't
+ * fit inline anymore.
+ *
+ * @param id the tag to append
+ */
+void TagSequence::push(unsigned int id) {
+  if (numTags < INLINE_SIZE) {
+    inlineIds[numTags] = id;
+  } else {
+    if (numTags == INLINE_SIZE) {
+      heapIds.assign(inlineIds, inlineIds + INLINE_SIZE);
+    }
+    heapIds.push_back(id);
+  }
+
+  numTags++;
+}
+
+/**
+ * Set the tags of the sequence, storing them inline if they fit.
+ *
+ * @param ids the tags to store
+ * @param count the number of tags
+ */
+void TagSequence::setIds(const unsigned int *ids, unsigned int count) {
+  if (count <= INLINE_SIZE) {
+    for (unsigned int i = 0; i < count; i++) {
+      inlineIds[i] = ids[i];
+    }
+    heapIds.clear();
+  } else {
+    heapIds.assign(ids, ids + count);
+  }
+
+  numTags = count;
+}
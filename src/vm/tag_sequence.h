@@ -0,0 +1,97 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef TAG_SEQUENCE_H_
+#define TAG_SEQUENCE_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+
+using namespace std;
+
+/**
+ * Interns tags, e.g. <n>, as small integers shared by every lexical unit. The
+ * table is shared by every VM of the process, so it can be used from different
+ * threads, like the ones loading the code units in eager mode.
+ */
+class TagTable {
+
+public:
+
+  static unsigned int getId(wstring_view);
+  static wstring_view getTag(unsigned int);
+
+private:
+
+  /// Identifier of each tag, keyed by views of the strings stored in tags.
+  static unordered_map<wstring_view, unsigned int> ids;
+
+  /// The text of every tag interned, indexed by its identifier.
+  static deque<wstring> tags;
+
+  /// Guards ids and tags, interning a new tag excludes every other access.
+  static shared_mutex tagsMutex;
+
+};
+
+/**
+ * A sequence of interned tags, like the tags of a lexical unit. The usual short
+ * sequences are stored inline and only longer ones use the heap.
+ */
+class TagSequence {
+
+public:
+
+  /// Number of tags which can be stored without allocating memory.
+  static const unsigned int INLINE_SIZE = 8;
+
+  TagSequence();
+  TagSequence(const TagSequence &);
+  ~TagSequence();
+  TagSequence& operator=(const TagSequence &);
+  void copy(const TagSequence &);
+
+  bool assign(wstring_view);
+  unsigned int size() const;
+  unsigned int operator[](unsigned int) const;
+  int find(const TagSequence &) const;
+  size_t getTextPosition(unsigned int) const;
+  size_t getTextSize(unsigned int, unsigned int) const;
+  void replace(unsigned int, unsigned int, const TagSequence &);
+
+private:
+
+  /// Number of tags of the sequence.
+  unsigned int numTags;
+
+  /// Tags of short sequences.
+  unsigned int inlineIds[INLINE_SIZE];
+
+  /// Tags of the sequences longer than INLINE_SIZE.
+  vector<unsigned int> heapIds;
+
+  const unsigned int* getIds() const;
+  void push(unsigned int);
+  void setIds(const unsigned int *, unsigned int);
+};
+
+#endif /* TAG_SEQUENCE_H_ */
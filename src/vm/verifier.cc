@@ -0,0 +1,443 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "verifier.h"
+
+#include <cwchar>
+
+#include "optimizer.h"
+#include "vm_exceptions.h"
+#include "vm_wstring_utils.h"
+
+using namespace std;
+
+const int Verifier::UNKNOWN;
+
+/**
+ * Get the number pushed by an instruction, like the position of a word.
+ *
+ * @param instr the instruction
+ *
+ * @return the number or -1 if it doesn't push a number
+ */
+static int getPushedNumber(const Instruction &instr) {
+  if (instr.opCode != PUSH || instr.op1 == L""
+      || !VMWstringUtils::iswnumeric(instr.op1)) {
+    return -1;
+  }
+  return wcstol(instr.op1.c_str(), NULL, 10);
+}
+
+/**
+ * Get the number of an instruction operand, e.g. an address.
+ *
+ * @param instr the instruction
+ *
+ * @return the number
+ */
+static unsigned int getNumber(const Instruction &instr) {
+  return wcstoul(instr.op1.c_str(), NULL, 10);
+}
+
+Verifier::Verifier() {
+  isPostchunk = false;
+  numMacros = 0;
+  numRules = 0;
+  maxStackDepth = 0;
+  isDepthBounded = true;
+}
+
+/**
+ * Create a verifier for the code of a transfer stage.
+ *
+ * @param isPostchunk if the code belongs to the postchunk
+ */
+Verifier::Verifier(bool isPostchunk) {
+  this->isPostchunk = isPostchunk;
+  numMacros = 0;
+  numRules = 0;
+  maxStackDepth = 0;
+  isDepthBounded = true;
+}
+
+Verifier::Verifier(const Verifier &v) {
+  copy(v);
+}
+
+Verifier::~Verifier() {
+
+}
+
+Verifier& Verifier::operator=(const Verifier &v) {
+  if (this != &v) {
+    this->~Verifier();
+    this->copy(v);
+  }
+  return *this;
+}
+
+void Verifier::copy(const Verifier &v) {
+  isPostchunk = v.isPostchunk;
+  numMacros = v.numMacros;
+  numRules = v.numRules;
+  maxStackDepth = v.maxStackDepth;
+  isDepthBounded = v.isDepthBounded;
+  ruleWords = v.ruleWords;
+  macroWords = v.macroWords;
+  macroDepths = v.macroDepths;
+  macroCalls = v.macroCalls;
+  macroTotalDepths = v.macroTotalDepths;
+}
+
+/**
+ * Verify all the code of a code file, which must be already loaded, throwing
+ * a loader exception on the first problem found.
+ *
+ * @param preprocessCode the preprocess code section
+ * @param code the code section
+ * @param rulesCode the code section containing rules
+ * @param macrosCode the code section containing macros
+ */
+void Verifier::verify(const CodeUnit &preprocessCode, const CodeUnit &code,
+    const CodeSection &rulesCode, const CodeSection &macrosCode) {
+  numMacros = macrosCode.units.size();
+  numRules = rulesCode.units.size();
+  findNumWords(preprocessCode, macrosCode);
+  for (unsigned int i = 0; i < rulesCode.units.size(); i++) {
+    updateNumWords(macroWords, rulesCode.units[i].code, CALL);
+  }
+
+  macroDepths.assign(numMacros, 0);
+  macroCalls.assign(numMacros, vector<pair<unsigned int, unsigned int> >());
+  for (unsigned int i = 0; i < numMacros; i++) {
+    macroDepths[i] = verifyCodeUnit(macrosCode.units[i], macroWords[i], true,
+        L"macro " + to_wstring(i), macroCalls[i]);
+  }
+
+  // The depth of each macro with its calls is computed once it's needed.
+  macroTotalDepths.assign(numMacros, 0);
+  vector<bool> visited(numMacros, false);
+  isDepthBounded = true;
+  maxStackDepth = 0;
+
+  vector<pair<unsigned int, unsigned int> > calls;
+  for (unsigned int i = 0; i < numRules; i++) {
+    calls.clear();
+    unsigned int depth = verifyCodeUnit(rulesCode.units[i], ruleWords[i],
+        false, L"rule " + to_wstring(i), calls);
+    maxStackDepth = max(maxStackDepth, getTotalDepth(depth, calls, visited));
+  }
+
+  calls.clear();
+  unsigned int depth = verifyCodeUnit(preprocessCode, UNKNOWN, false,
+      L"preprocess section", calls);
+  maxStackDepth = max(maxStackDepth, getTotalDepth(depth, calls, visited));
+
+  calls.clear();
+  depth = verifyCodeUnit(code, UNKNOWN, false, L"code section", calls);
+  maxStackDepth = max(maxStackDepth, getTotalDepth(depth, calls, visited));
+}
+
+/**
+ * Get the maximum depth of the system stack of the code verified.
+ *
+ * @return the number of values of the stack, 0 if it has no limit
+ */
+unsigned int Verifier::getMaxStackDepth() const {
+  return isDepthBounded ? maxStackDepth : 0;
+}
+
+/**
+ * Find the number of words of the pattern of each rule, from the addtries of
+ * the preprocess section, and the number of words passed to the macros by
+ * other macros.
+ *
+ * @param preprocessCode the preprocess code section
+ * @param macrosCode the code section containing macros
+ */
+void Verifier::findNumWords(const CodeUnit &preprocessCode,
+    const CodeSection &macrosCode) {
+  ruleWords.assign(numRules, UNKNOWN);
+  updateNumWords(ruleWords, preprocessCode.code, ADDTRIE);
+
+  macroWords.assign(numMacros, UNKNOWN);
+  for (unsigned int i = 0; i < macrosCode.units.size(); i++) {
+    updateNumWords(macroWords, macrosCode.units[i].code, CALL);
+  }
+}
+
+/**
+ * Update the number of words of the rules or macros with the ones given by
+ * their addtries or calls, keeping the minimum one.
+ *
+ * @param numWords the number of words of each code unit
+ * @param code the code with the addtries or calls
+ * @param opCode ADDTRIE or CALL
+ */
+void Verifier::updateNumWords(vector<int> &numWords,
+    const vector<Instruction> &code, OP_CODE opCode) {
+  for (unsigned int i = 1; i < code.size(); i++) {
+    unsigned int number = getNumber(code[i]);
+    int count = getPushedNumber(code[i - 1]);
+
+    if (code[i].opCode == opCode && number < numWords.size() && count >= 0
+        && (numWords[number] == UNKNOWN || count < numWords[number])) {
+      numWords[number] = count;
+    }
+  }
+}
+
+/**
+ * Verify a code unit following all its paths and get the maximum depth of the
+ * stack reached by its own instructions. The values of the stack are tracked
+ * when they are numbers, which is enough for the positions of the words and
+ * the number of operands.
+ *
+ * @param unit the code unit
+ * @param numWords the number of words of the code unit, UNKNOWN if not known
+ * @param isMacro if the code unit is a macro, which must end with a ret
+ * @param name the name of the code unit, for the errors
+ * @param calls the depth of the stack at each call and the macro called
+ *
+ * @return the maximum depth of the stack
+ */
+unsigned int Verifier::verifyCodeUnit(const CodeUnit &unit, int numWords,
+    bool isMacro, const wstring &name,
+    vector<pair<unsigned int, unsigned int> > &calls) const {
+  const vector<Instruction> &code = unit.code;
+  if (code.empty()) {
+    return 0;
+  }
+
+  // The numbers in the stack before each instruction, once it's reached.
+  vector<vector<int> > states(code.size());
+  vector<bool> reached(code.size(), false);
+  vector<unsigned int> pending;
+  unsigned int maxDepth = 0;
+
+  reached[0] = true;
+  pending.push_back(0);
+
+  // Join the stack after an instruction with the one of the next instruction
+  // executed, which is verified again if a number isn't known anymore.
+  auto flowTo = [&](unsigned int target, const vector<int> &stack,
+      const Instruction &instr) {
+    if (target == code.size() && !isMacro) {
+      return;
+    } else if (target >= code.size()) {
+      throwError(L"Jump or end out of the code unit.", instr, name);
+    }
+
+    if (!reached[target]) {
+      reached[target] = true;
+      states[target] = stack;
+      pending.push_back(target);
+      return;
+    }
+
+    vector<int> &state = states[target];
+    if (state.size() != stack.size()) {
+      throwError(L"The stack depth isn't the same in every path.", instr, name);
+    }
+
+    bool changed = false;
+    for (unsigned int i = 0; i < state.size(); i++) {
+      if (state[i] != stack[i] && state[i] != UNKNOWN) {
+        state[i] = UNKNOWN;
+        changed = true;
+      }
+    }
+    if (changed) {
+      pending.push_back(target);
+    }
+  };
+
+  while (!pending.empty()) {
+    unsigned int pos = pending.back();
+    pending.pop_back();
+
+    const Instruction &instr = code[pos];
+    vector<int> stack = states[pos];
+    unsigned int depth = stack.size();
+
+    int pops, pushes;
+    if (!Optimizer::getStackEffect(instr, pops, pushes)) {
+      if (depth == 0 || stack.back() == UNKNOWN) {
+        throwError(L"The number of operands isn't a number.", instr, name);
+      }
+      pops = stack.back() + 1;
+      pushes = 0;
+    }
+
+    if ((unsigned int) pops > depth) {
+      throwError(L"The stack doesn't have the operands.", instr, name);
+    }
+
+    switch (instr.opCode) {
+    case CALL:
+      if (getNumber(instr) >= numMacros) {
+        throwError(L"Call to a macro which doesn't exist.", instr, name);
+      }
+      for (unsigned int i = depth - pops; i < depth - 1; i++) {
+        checkPosition(stack[i], numWords, instr, name);
+      }
+      calls.push_back(make_pair(depth - pops, getNumber(instr)));
+      break;
+    case ADDTRIE:
+      if (getNumber(instr) >= numRules) {
+        throwError(L"Pattern of a rule which doesn't exist.", instr, name);
+      }
+      break;
+    case GET_CASE_FROM:
+      checkPosition(stack[depth - 1], numWords, instr, name);
+      break;
+    case CLIP: /* falls through */
+    case CLIPSL: /* falls through */
+    case CLIPTL:
+      checkPosition(stack[depth - 2], numWords, instr, name);
+      break;
+    case STORECL: /* falls through */
+    case STORESL: /* falls through */
+    case STORETL:
+      checkPosition(stack[depth - 3], numWords, instr, name);
+      break;
+    case RET:
+      if (!isMacro) {
+        throwError(L"Return outside of a macro.", instr, name);
+      } else if (depth != 0) {
+        throwError(L"The macro doesn't leave the stack empty.", instr, name);
+      }
+      break;
+    default:
+      break;
+    }
+
+    stack.resize(depth - pops);
+    for (int i = 0; i < pushes; i++) {
+      stack.push_back(getPushedNumber(instr));
+    }
+    maxDepth = max(maxDepth, (unsigned int) stack.size());
+
+    switch (instr.opCode) {
+    case RET:
+      break;
+    case JMP:
+      flowTo(getNumber(instr), stack, instr);
+      break;
+    case JZ: /* falls through */
+    case JNZ:
+      flowTo(getNumber(instr), stack, instr);
+      flowTo(pos + 1, stack, instr);
+      break;
+    case SWITCH: {
+      vector<unsigned int> addresses = Optimizer::getJumpAddresses(instr);
+      for (unsigned int i = 0; i < addresses.size(); i++) {
+        flowTo(addresses[i], stack, instr);
+      }
+      break;
+    }
+    default:
+      flowTo(pos + 1, stack, instr);
+      break;
+    }
+  }
+
+  return maxDepth;
+}
+
+/**
+ * Get the maximum depth of the stack of a code unit adding the depth reached
+ * by the macros it calls.
+ *
+ * @param depth the depth reached by the code unit itself
+ * @param calls the depth of the stack at each call and the macro called
+ * @param visited the macros whose depth is being or has been computed
+ *
+ * @return the maximum depth of the stack
+ */
+unsigned int Verifier::getTotalDepth(unsigned int depth,
+    const vector<pair<unsigned int, unsigned int> > &calls,
+    vector<bool> &visited) {
+  for (unsigned int i = 0; i < calls.size(); i++) {
+    depth = max(depth, calls[i].first
+        + getMacroTotalDepth(calls[i].second, visited));
+  }
+  return depth;
+}
+
+/**
+ * Get the maximum depth of the stack of a macro with its calls. The depth of a
+ * macro which calls itself, directly or not, has no limit.
+ *
+ * @param macro the number of the macro
+ * @param visited the macros whose depth is being or has been computed
+ *
+ * @return the maximum depth of the stack
+ */
+unsigned int Verifier::getMacroTotalDepth(unsigned int macro,
+    vector<bool> &visited) {
+  if (visited[macro]) {
+    // A macro still being computed is called again.
+    if (macroTotalDepths[macro] == 0 && macroDepths[macro] > 0) {
+      isDepthBounded = false;
+    }
+    return macroTotalDepths[macro];
+  }
+
+  visited[macro] = true;
+  macroTotalDepths[macro] = getTotalDepth(macroDepths[macro],
+      macroCalls[macro], visited);
+  return macroTotalDepths[macro];
+}
+
+/**
+ * Check that the position of a word is one of the words of the code unit.
+ * The positions of the postchunk refer to the content of the chunk, so they
+ * can't be checked.
+ *
+ * @param pos the position, UNKNOWN if it isn't a number pushed
+ * @param numWords the number of words of the code unit, UNKNOWN if not known
+ * @param instr the instruction using the position
+ * @param name the name of the code unit
+ */
+void Verifier::checkPosition(int pos, int numWords, const Instruction &instr,
+    const wstring &name) const {
+  if (isPostchunk) {
+    return;
+  }
+
+  if (pos == UNKNOWN) {
+    throwError(L"The position of the word isn't a number.", instr, name);
+  } else if (pos < 1 || (numWords != UNKNOWN && pos > numWords)) {
+    throwError(L"The position " + to_wstring(pos) + L" isn't a word of the "
+        + name + L".", instr, name);
+  }
+}
+
+/**
+ * Throw a loader specific error with the line of the code file and the code
+ * unit where it was found.
+ *
+ * @param msg the message describing the problem
+ * @param instr the instruction with the problem
+ * @param name the name of the code unit
+ */
+void Verifier::throwError(const wstring &msg, const Instruction &instr,
+    const wstring &name) const {
+  throw LoaderException(L"line " + to_wstring(instr.lineNumber) + L", "
+      + name + L": " + msg);
+}
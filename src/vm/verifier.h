@@ -0,0 +1,107 @@
+/*Copyright (C) 2011  Gabriel Gregori Manzano
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef VERIFIER_H_
+#define VERIFIER_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "instructions.h"
+
+using namespace std;
+
+/**
+ * Checks the code of a code file before running it, so malformed programs are
+ * rejected when loaded instead of failing in the middle of the input. For
+ * every code unit it follows all the paths of the code, computing the depth of
+ * the system stack at each instruction, and checks that:
+ *
+ *  - The jumps go to an address of their code unit.
+ *  - The depth is the same at every path joining in an instruction and no
+ *    instruction takes more values than the stack has.
+ *  - The number of operands of calls and addtries is a number pushed before.
+ *  - The macros and rules referred exist and the macros leave the stack as
+ *    they found it.
+ *  - Except in the postchunk, the positions of the words clipped, stored or
+ *    passed to a macro are within the words of its rule or macro.
+ *
+ * The maximum depth reached lets the vm allocate the system stack once.
+ */
+class Verifier {
+
+public:
+
+  Verifier();
+  Verifier(bool);
+  Verifier(const Verifier &);
+  ~Verifier();
+  Verifier& operator=(const Verifier &);
+  void copy(const Verifier &);
+
+  void verify(const CodeUnit &, const CodeUnit &, const CodeSection &,
+      const CodeSection &);
+  unsigned int getMaxStackDepth() const;
+
+private:
+
+  /// A position not known, e.g. of a value not pushed as a number.
+  static const int UNKNOWN = -1;
+
+  /// If the code belongs to the postchunk, which handles the words differently.
+  bool isPostchunk;
+
+  /// Number of macros of the code verified.
+  unsigned int numMacros;
+
+  /// Number of rules of the code verified.
+  unsigned int numRules;
+
+  /// Maximum depth of the system stack reached by any code unit and its calls.
+  unsigned int maxStackDepth;
+
+  /// If the depth of the stack has a limit, which recursive macros don't have.
+  bool isDepthBounded;
+
+  /// Number of words of the pattern of each rule, UNKNOWN if it has none.
+  vector<int> ruleWords;
+
+  /// Minimum number of words passed to each macro, UNKNOWN if never called.
+  vector<int> macroWords;
+
+  /// Depth of the stack reached by each macro itself, without its calls.
+  vector<unsigned int> macroDepths;
+
+  /// Depth of the stack at each call of each macro and the macro called.
+  vector<vector<pair<unsigned int, unsigned int> > > macroCalls;
+
+  /// Depth of the stack reached by each macro with its calls, 0 if unknown.
+  vector<unsigned int> macroTotalDepths;
+
+  void findNumWords(const CodeUnit &, const CodeSection &);
+  void updateNumWords(vector<int> &, const vector<Instruction> &, OP_CODE);
+  unsigned int verifyCodeUnit(const CodeUnit &, int, bool, const wstring &,
+      vector<pair<unsigned int, unsigned int> > &) const;
+  unsigned int getTotalDepth(unsigned int,
+      const vector<pair<unsigned int, unsigned int> > &, vector<bool> &);
+  unsigned int getMacroTotalDepth(unsigned int, vector<bool> &);
+  void checkPosition(int, int, const Instruction &, const wstring &) const;
+  void throwError(const wstring &, const Instruction &, const wstring &) const;
+};
+
+#endif /* VERIFIER_H_ */
@@ -20,22 +20,49 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <string>
 #include <list>
 #include <set>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <cstdio>
 
 #include "vm_exceptions.h"
 #include "assembly_loader.h"
+#include "binary_loader.h"
+#include "inliner.h"
+#include "verifier.h"
+#include "native_loader.h"
+#include "native_code_generator.h"
 
 using namespace std;
 
 VM::VM() {
   debugMode = false;
+  eagerLoad = false;
+  eagerLoadThreads = 1;
+  isCodeFrozen = false;
+  optimizer = NULL;
+  showOptimizerStats = false;
+  maxInlinedMacroSize = 0;
+  numInlinedCalls = 0;
+  verifyCode = false;
+  ruleCacheSize = 0;
+  showRuleCacheStats = false;
+  ruleCache = NULL;
+  outputCapture = NULL;
+  profiler = NULL;
+  currentRuleNumber = -1;
   callStack = new CallStack(this);
   interpreter = new Interpreter(this);
   nextPattern = 0;
   lastSuperblank = -1;
   loader = NULL;
+  currentCodeUnit = NULL;
+  currentWords = NULL;
+  numCurrentWords = 0;
 }
 
 VM::VM(const VM &vm) {
@@ -65,6 +92,21 @@ VM::~VM() {
     interpreter = NULL;
   }
 
+  if (optimizer != NULL) {
+    delete optimizer;
+    optimizer = NULL;
+  }
+
+  if (ruleCache != NULL) {
+    delete ruleCache;
+    ruleCache = NULL;
+  }
+
+  if (profiler != NULL) {
+    delete profiler;
+    profiler = NULL;
+  }
+
   if (outputFile.is_open()) {
     outputFile.close();
   }
@@ -81,8 +123,25 @@ VM& VM::operator=(const VM &vm) {
 void VM::copy(const VM &vm) {
   transferStage = vm.transferStage;
   transferDefault = vm.transferDefault;
+  transferHeader = vm.transferHeader;
+  codeFileName = vm.codeFileName;
   inputFileName = vm.inputFileName;
   debugMode = vm.debugMode;
+  eagerLoad = vm.eagerLoad;
+  eagerLoadThreads = vm.eagerLoadThreads;
+  optimizer = (vm.optimizer != NULL ? new Optimizer(*vm.optimizer) : NULL);
+  showOptimizerStats = vm.showOptimizerStats;
+  maxInlinedMacroSize = vm.maxInlinedMacroSize;
+  numInlinedCalls = vm.numInlinedCalls;
+  verifyCode = vm.verifyCode;
+  ruleCacheSize = vm.ruleCacheSize;
+  showRuleCacheStats = vm.showRuleCacheStats;
+  ruleCache = (vm.ruleCache != NULL ? new RuleCache(*vm.ruleCache) : NULL);
+  outputCapture = NULL;
+  profiler = (vm.profiler != NULL ? new Profiler(*vm.profiler) : NULL);
+  profileFileName = vm.profileFileName;
+  opcodeStatsFileName = vm.opcodeStatsFileName;
+  currentRuleNumber = vm.currentRuleNumber;
 }
 
 /**
@@ -92,6 +151,21 @@ void VM::copy(const VM &vm) {
  * @param fileName code file's name
  */
 void VM::setCodeFile(char *fileName) {
+  codeFileName = string(fileName);
+
+  // A compiled code file is a shared object, without text headers.
+  ifstream binaryFile(fileName, ios::in | ios::binary);
+  string magic(NativeLoader::ELF_MAGIC.size(), '\0');
+  binaryFile.read(&magic[0], magic.size());
+  binaryFile.close();
+  if (magic == NativeLoader::ELF_MAGIC) {
+    NativeLoader *nativeLoader = new NativeLoader(fileName);
+    loader = nativeLoader;
+    transferHeader = nativeLoader->getTransferHeader();
+    setTransferStage(transferHeader);
+    return;
+  }
+
   wfstream file;
   file.open(fileName, ios::in);
 
@@ -99,7 +173,6 @@ void VM::setCodeFile(char *fileName) {
   getline(file, header, L'\n');
   setLoader(header, fileName);
 
-  wstring transferHeader;
   getline(file, transferHeader, L'\n');
   setTransferStage(transferHeader);
 
@@ -115,6 +188,9 @@ void VM::setCodeFile(char *fileName) {
 void VM::setLoader(const wstring &header, char *fileName) {
   if (header == L"#<assembly>") {
     loader = new AssemblyLoader(fileName);
+  } else if (header == BinaryLoader::HEADER
+      || header == BinaryLoader::SNAPSHOT_HEADER) {
+    loader = new BinaryLoader(fileName);
   } else {
     wstringstream msg;
     msg << L"The header of the file " << fileName << " is not recognized: "
@@ -176,31 +252,285 @@ void VM::setDebugMode() {
   // TODO: Create the debugger proxy and its components.
 }
 
+/**
+ * Load every rule and macro at startup, instead of the first time they are
+ * called, and freeze the code sections after that.
+ *
+ * @param numThreads the number of threads to use, 0 to use one per core
+ */
+void VM::setEagerLoad(unsigned int numThreads) {
+  eagerLoad = true;
+
+  if (numThreads == 0) {
+    numThreads = thread::hardware_concurrency();
+  }
+  eagerLoadThreads = (numThreads == 0 ? 1 : numThreads);
+}
+
+/**
+ * Optimize every rule and macro when they are loaded.
+ *
+ * @param showStats if the instructions removed are shown once loaded, which
+ * loads every rule and macro at startup
+ */
+void VM::setOptimize(bool showStats) {
+  if (optimizer == NULL) {
+    optimizer = new Optimizer();
+  }
+
+  if (showStats) {
+    showOptimizerStats = true;
+    if (!eagerLoad) {
+      setEagerLoad(1);
+    }
+  }
+}
+
+/**
+ * Inline the calls of the rules to small macros once every rule and macro is
+ * loaded, which loads them at startup.
+ *
+ * @param maxMacroSize the maximum number of instructions of the macros inlined
+ */
+void VM::setInline(unsigned int maxMacroSize) {
+  maxInlinedMacroSize = maxMacroSize;
+
+  if (!eagerLoad) {
+    setEagerLoad(1);
+  }
+}
+
+/**
+ * Verify the code once every rule and macro is loaded, which loads them at
+ * startup, and run it without checking each instruction if it's correct.
+ */
+void VM::setVerify() {
+  verifyCode = true;
+
+  if (!eagerLoad) {
+    setEagerLoad(1);
+  }
+}
+
+/**
+ * Cache the output of the rules which only depend on their words, once every
+ * rule and macro is loaded, which loads them at startup.
+ *
+ * @param size the maximum number of outputs cached, 0 to keep the size already
+ * set or use the default one
+ * @param showStats if the use of the cache is shown at the end
+ */
+void VM::setRuleCache(unsigned int size, bool showStats) {
+  if (size > 0) {
+    ruleCacheSize = size;
+  } else if (ruleCacheSize == 0) {
+    ruleCacheSize = DEFAULT_RULE_CACHE_SIZE;
+  }
+
+  if (showStats) {
+    showRuleCacheStats = true;
+  }
+
+  if (!eagerLoad) {
+    setEagerLoad(1);
+  }
+}
+
+/**
+ * Profile the rules and macros executed: their calls, instructions, time and
+ * bytes output. The profile is shown once the input is processed and written
+ * to a file as JSON.
+ *
+ * @param fileName the name of the file to write the profile to
+ */
+void VM::setProfile(char *fileName) {
+  profileFileName = string(fileName);
+
+  if (profiler == NULL) {
+    profiler = new Profiler();
+    callStack->setProfiler(profiler);
+  }
+}
+
+/**
+ * Write the executions and cycles of every opcode and pair of opcodes, and
+ * the maximum depth of the stacks, to a file as JSON once the input is
+ * processed. The vm must be built with OPCODE_STATS defined to gather them.
+ *
+ * @param fileName the name of the file to write the statistics to
+ *
+ * @return true if the statistics can be gathered, false otherwise
+ */
+bool VM::setOpcodeStats(char *fileName) {
+#ifdef OPCODE_STATS
+  opcodeStatsFileName = string(fileName);
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Show how many instructions of the code file the optimizer has removed.
+ */
+void VM::printOptimizerStats() const {
+  OptimizerStats stats = optimizer->getStats();
+  double reduction = 0;
+  if (stats.instructionsBefore > 0) {
+    reduction = 100.0 * (stats.instructionsBefore - stats.instructionsAfter)
+        / stats.instructionsBefore;
+  }
+
+  wcerr << codeFileName.c_str() << L": " << stats.instructionsBefore
+        << L" instructions in rules and macros, " << stats.instructionsAfter
+        << L" after optimizing (-" << fixed << setprecision(1) << reduction
+        << L"%)" << endl;
+  wcerr << L"  folded constants: " << stats.foldedConstants
+        << L", threaded jumps: " << stats.threadedJumps
+        << L", inverted branches: " << stats.invertedBranches
+        << L", removed jumps: " << stats.removedJumps
+        << L", removed dead code: " << stats.removedDeadCode << endl;
+  if (maxInlinedMacroSize > 0) {
+    wcerr << L"  inlined calls: " << numInlinedCalls << endl;
+  }
+}
+
+/**
+ * Show how many rules can be cached and how many of their outputs were found
+ * in the cache.
+ */
+void VM::printRuleCacheStats() const {
+  RuleCacheStats stats = ruleCache->getStats();
+  double hitRate = 0;
+  if (stats.lookups > 0) {
+    hitRate = 100.0 * stats.hits / stats.lookups;
+  }
+
+  wcerr << codeFileName.c_str() << L": " << stats.numCacheableRules << L" of "
+        << stats.numRules << L" rules cached, " << stats.hits << L" hits in "
+        << stats.lookups << L" lookups (" << fixed << setprecision(1)
+        << hitRate << L"%)" << endl;
+}
+
+/**
+ * Show the profile of the rules and macros executed, the most expensive first,
+ * and write it to the profile file.
+ */
+void VM::printProfile() {
+  vector<ProfileEntry> entries = profiler->getEntries(rulesCode, macrosCode,
+      loader);
+
+  profiler->printReport(codeFileName, entries);
+  if (!profiler->writeReport(profileFileName.c_str(), codeFileName, entries)) {
+    wcerr << L"Error: Can't write the profile to '"
+          << profileFileName.c_str() << L"'" << endl;
+  }
+}
+
+/**
+ * Load every rule and macro not loaded yet, dividing them between some
+ * threads, and freeze the code sections as they won't change anymore.
+ *
+ * @param numThreads the number of threads to use
+ */
+void VM::loadAllCodeUnits(unsigned int numThreads) {
+  vector<CodeUnit *> units;
+  for (unsigned int i = 0; i < rulesCode.units.size(); i++) {
+    if (!rulesCode.units[i].loaded) {
+      units.push_back(&rulesCode.units[i]);
+    }
+  }
+  for (unsigned int i = 0; i < macrosCode.units.size(); i++) {
+    if (!macrosCode.units[i].loaded) {
+      units.push_back(&macrosCode.units[i]);
+    }
+  }
+
+  // Each thread takes the next unit not taken yet, until there are none left.
+  // The first error found is thrown again after every thread has finished.
+  atomic<unsigned int> nextUnit(0);
+  exception_ptr error = NULL;
+  atomic_flag errorSet = ATOMIC_FLAG_INIT;
+
+  auto loadUnits = [&]() {
+    try {
+      for (unsigned int i = nextUnit++; i < units.size(); i = nextUnit++) {
+        loader->loadCodeUnit(*units[i]);
+      }
+    } catch (...) {
+      if (!errorSet.test_and_set()) {
+        error = current_exception();
+      }
+      nextUnit = units.size();
+    }
+  };
+
+  numThreads = min(numThreads, (unsigned int) units.size());
+  vector<thread> threads;
+  for (unsigned int i = 1; i < numThreads; i++) {
+    threads.push_back(thread(loadUnits));
+  }
+  loadUnits();
+  for (unsigned int i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+
+  if (error) {
+    rethrow_exception(error);
+  }
+
+  if (maxInlinedMacroSize > 0) {
+    Inliner inliner(maxInlinedMacroSize, transferStage == POSTCHUNK);
+    inliner.inlineMacros(rulesCode, macrosCode);
+    numInlinedCalls = inliner.getNumInlinedCalls();
+  }
+
+  if (ruleCacheSize > 0 && ruleCache == NULL) {
+    ruleCache = new RuleCache(ruleCacheSize, transferStage == POSTCHUNK);
+    ruleCache->analyze(rulesCode, macrosCode);
+  }
+
+  // The stack is allocated once for the deepest code unit, if it's bounded.
+  if (verifyCode) {
+    Verifier verifier(transferStage == POSTCHUNK);
+    verifier.verify(preproprocessCode, code, rulesCode, macrosCode);
+    systemStack.reserve(verifier.getMaxStackDepth());
+    interpreter->setCodeVerified(true);
+  }
+
+  isCodeFrozen = true;
+}
+
 /**
  * Set the current code unit as the one passed as parameter.
  *
  * @param call the call containing the code unit to set as the current one
  */
 void VM::setCurrentCodeUnit(const TCALL &call) {
-  currentWords = call.words;
+  currentWords = CallStack::getWords(call);
+  numCurrentWords = call.numWords;
   setPC(call.PC);
 
   int numCodeUnit = call.number;
+  CodeUnit *unit = NULL;
 
   switch (call.section) {
   case RULES_SECTION:
-    currentCodeUnit = &(rulesCode.units[numCodeUnit]);
+    unit = &(rulesCode.units[numCodeUnit]);
     break;
   case MACROS_SECTION:
-    currentCodeUnit = &(macrosCode.units[numCodeUnit]);
+    unit = &(macrosCode.units[numCodeUnit]);
     break;
   }
 
   // If the code unit hasn't been fully loaded, we need to process it now.
-  if (!currentCodeUnit->loaded) {
-    loader->loadCodeUnit(*currentCodeUnit);
+  // Frozen code is always loaded and can't be modified.
+  if (!isCodeFrozen && !unit->loaded) {
+    loader->loadCodeUnit(*unit);
   }
 
+  currentCodeUnit = unit;
+
   endAddress = currentCodeUnit->code.size();
 }
 
@@ -218,11 +548,26 @@ void VM::setPC(int PC) {
  *
  * @param wstr the wide string to output
  */
-void VM::writeOutput(wstring wstr) {
+void VM::writeOutput(wstring_view wstr) {
+  if (outputCapture != NULL) {
+    outputCapture->append(wstr);
+  }
+  if (profiler != NULL) {
+    profiler->countOutput(wstr);
+  }
+  getOutput().write(wstr.data(), wstr.size());
+}
+
+/**
+ * Get the output already set or stdout by default, to write to it directly.
+ *
+ * @return the output stream
+ */
+wostream& VM::getOutput() {
   if (outputFile.is_open()) {
-    outputFile << wstr;
+    return outputFile;
   } else {
-    wcout << wstr;
+    return wcout;
   }
 }
 
@@ -231,9 +576,7 @@ void VM::writeOutput(wstring wstr) {
  */
 bool VM::run() {
   try {
-    loader->load(preproprocessCode, code, rulesCode, macrosCode, endAddress);
-    interpreter->preprocess();
-    initializeVM();
+    initialize();
     tokenizeInput();
 
     // Select the first rule. If there isn't one, the vm work has ended.
@@ -242,9 +585,9 @@ bool VM::run() {
     }
 
     while(status == RUNNING) {
-      // Execute the rule selected until it ends.
-      while (status == RUNNING and PC < endAddress) {
-        interpreter->execute(currentCodeUnit->code[PC]);
+      executeRule();
+      if (profiler != NULL) {
+        profiler->leaveRule();
       }
 
       // Process rule ending and select the next one to execute.
@@ -254,6 +597,182 @@ bool VM::run() {
       }
 
     }
+
+    if (showRuleCacheStats) {
+      printRuleCacheStats();
+    }
+    if (profiler != NULL) {
+      printProfile();
+    }
+    if (!opcodeStatsFileName.empty() && !interpreter->getOpcodeStats()
+        .writeReport(opcodeStatsFileName.c_str(), codeFileName)) {
+      wcerr << L"Error: Can't write the opcode statistics to '"
+            << opcodeStatsFileName.c_str() << L"'" << endl;
+    }
+  } catch (LoaderException &le) {
+    wcerr << L"Loader error: " << le.getMessage() << endl;
+    return false;
+  } catch (InterpreterException &ie) {
+    wcerr << L"Interpreter error: " << ie.getMessage() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Execute the rule selected until it ends, with its native code if it has
+ * any. If the rule can be cached and its words have been seen before, its
+ * output is written from the cache instead.
+ */
+void VM::executeRule() {
+  bool isCacheable = (ruleCache != NULL
+      && ruleCache->isCacheable(currentRuleNumber));
+  wstring key;
+
+  if (isCacheable) {
+    key = getRuleCacheKey();
+    const wstring *output = ruleCache->find(key);
+    if (output != NULL) {
+      writeOutput(*output);
+      return;
+    }
+
+    capturedOutput.clear();
+    outputCapture = &capturedOutput;
+  }
+
+  if (currentCodeUnit->native != NULL) {
+    interpreter->executeNative();
+  } else {
+    while (status == RUNNING and PC < endAddress) {
+      if (profiler != NULL) {
+        profiler->countInstruction();
+      }
+      interpreter->execute(currentCodeUnit->code[PC]);
+    }
+  }
+
+  if (isCacheable) {
+    outputCapture = NULL;
+    if (status == RUNNING) {
+      ruleCache->insert(key, capturedOutput);
+    }
+  }
+}
+
+/**
+ * Get the key of the output of the current rule in the rule cache: the number
+ * of the rule, the text of its words and the text of the blanks it reads.
+ *
+ * @return the key
+ */
+wstring VM::getRuleCacheKey() const {
+  wstring key = to_wstring(currentRuleNumber);
+
+  for (unsigned int i = 0; i < numCurrentWords; i++) {
+    key += L'\0';
+    if (transferStage == TRANSFER) {
+      BilingualWord *word = (BilingualWord *) words[currentWords[i]];
+      key += word->getSource()->getWhole();
+      key += L'\0';
+      key += word->getTarget()->getWhole();
+    } else {
+      key += ((ChunkWord *) words[currentWords[i]])->getChunk()->getWhole();
+    }
+  }
+
+  const vector<int> &blanks = ruleCache->getBlanks(currentRuleNumber);
+  for (unsigned int i = 0; i < blanks.size(); i++) {
+    key += L'\0';
+    unsigned int pos = blanks[i] + currentWords[0];
+    if (pos < superblanks.size()) {
+      key += superblanks[pos];
+    }
+  }
+
+  return key;
+}
+
+/**
+ * Load all the code, including every rule and macro, and write it to a binary
+ * code file which can be loaded without processing the assembly again.
+ *
+ * @param fileName the name of the binary file to create
+ *
+ * @return true if the binary file was written, false otherwise
+ */
+bool VM::emitBinary(char *fileName) {
+  try {
+    loader->setOptimizer(optimizer);
+    loader->load(preproprocessCode, code, rulesCode, macrosCode, endAddress);
+    loadAllCodeUnits(eagerLoad ? eagerLoadThreads : 1);
+    if (showOptimizerStats) {
+      printOptimizerStats();
+    }
+
+    BinaryLoader::write(fileName, transferHeader, preproprocessCode, code,
+        rulesCode, macrosCode, NULL, NULL);
+  } catch (LoaderException &le) {
+    wcerr << L"Loader error: " << le.getMessage() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Load all the code, including every rule and macro, and compile it to native
+ * code in a shared object which can be used as code file. The C++ source is
+ * written next to it and removed once compiled.
+ *
+ * @param fileName the name of the shared object to create
+ *
+ * @return true if the shared object was compiled, false otherwise
+ */
+bool VM::emitNative(char *fileName) {
+  try {
+    loader->setOptimizer(optimizer);
+    loader->load(preproprocessCode, code, rulesCode, macrosCode, endAddress);
+    loadAllCodeUnits(eagerLoad ? eagerLoadThreads : 1);
+    if (showOptimizerStats) {
+      printOptimizerStats();
+    }
+
+    string sourceFileName = string(fileName) + ".cc";
+    NativeCodeGenerator::write(sourceFileName.c_str(), transferHeader,
+        preproprocessCode, code, rulesCode, macrosCode);
+
+    if (!NativeCodeGenerator::compile(sourceFileName.c_str(), fileName)) {
+      wcerr << L"Error: Can't compile " << sourceFileName.c_str() << endl;
+      return false;
+    }
+    remove(sourceFileName.c_str());
+  } catch (LoaderException &le) {
+    wcerr << L"Loader error: " << le.getMessage() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Initialize the vm and write a snapshot of it, with all the code already
+ * loaded, which can be used as code file to start without initializing again.
+ *
+ * @param fileName the name of the snapshot file to create
+ *
+ * @return true if the snapshot was written, false otherwise
+ */
+bool VM::saveSnapshot(char *fileName) {
+  try {
+    if (!eagerLoad) {
+      setEagerLoad(1);
+    }
+    initialize();
+
+    BinaryLoader::write(fileName, transferHeader, preproprocessCode, code,
+        rulesCode, macrosCode, &variables, &systemTrie);
   } catch (LoaderException &le) {
     wcerr << L"Loader error: " << le.getMessage() << endl;
     return false;
@@ -304,6 +823,33 @@ void VM::tokenizeInput() {
   input.close();
 }
 
+/**
+ * Load the code and get the vm ready to process the input: build the patterns
+ * trie and initialize the variables, unless they come from a snapshot.
+ */
+void VM::initialize() {
+  loader->setOptimizer(optimizer);
+  loader->load(preproprocessCode, code, rulesCode, macrosCode, endAddress);
+  loader->loadVariables(variables);
+  if (profiler != NULL) {
+    profiler->setPatterns(preproprocessCode);
+  }
+  if (eagerLoad) {
+    loadAllCodeUnits(eagerLoadThreads);
+  }
+  if (showOptimizerStats) {
+    printOptimizerStats();
+  }
+
+  if (loader->loadTrie(systemTrie)) {
+    PC = 0;
+    status = RUNNING;
+  } else {
+    interpreter->preprocess();
+    initializeVM();
+  }
+}
+
 /**
  * Execute code to initialize the VM, e.g. default values for vars.
  */
@@ -336,9 +882,9 @@ wstring VM::getSourceWord(unsigned int pos) {
     return ((BilingualWord *) words[pos])->getSource()->getWhole();
   } else if (transferStage == INTERCHUNK) {
     ChunkLexicalUnit *chunk = ((ChunkWord *) words[pos])->getChunk();
-    return chunk->getPart(LEM) + chunk->getPart(TAGS);
+    return wstring(chunk->getPart(LEM)).append(chunk->getPart(TAGS));
   } else {
-    return ((ChunkWord *) words[pos])->getChunk()->getPart(LEM);
+    return wstring(((ChunkWord *) words[pos])->getChunk()->getPart(LEM));
   }
 }
 
@@ -486,17 +1032,20 @@ void VM::setRuleSelected(int ruleNumber, unsigned int startPos, const wstring &p
   // Output the leading superblank of the matched pattern.
   writeOutput(getUniqueSuperblank(startPos));
 
+  currentRuleNumber = ruleNumber;
+
+  // Create an entry in the call stack with the rule to execute, the first one
+  // as the previous rule has already ended.
+  callStack->clear();
+  TCALL &rule = callStack->prepareCall(RULES_SECTION, ruleNumber);
+
   // Add only a reference to the index pos of words, to avoid copying them.
-  vector<int> wordsIndex;
   while (startPos != nextPattern) {
-    wordsIndex.push_back(startPos);
+    callStack->addWord(rule, startPos);
     startPos++;
   }
 
-  // Create an entry in the call stack with the rule to execute.
-  TCALL rule = {RULES_SECTION, ruleNumber, wordsIndex, 0};
-
-  callStack->pushCall(rule);
+  callStack->pushCall();
 }
 
 /**
@@ -512,50 +1061,49 @@ void VM::processRuleEnd() {
  * stage.
  */
 void VM::processUnmatchedPattern(TransferWord *word) {
-  wstring defaultOutput = L"";
-
   // Output the leading superblank of the unmatched pattern.
   writeOutput(getUniqueSuperblank(nextPattern - 1));
 
+  // The parts are written one by one, without building the default output.
   switch(transferStage) {
   //For the chunker, output the default version of the unmatched pattern.
   case TRANSFER: {
-    wstring whole = ((BilingualWord *) word)->getTarget()->getWhole();
+    const wstring &whole = ((BilingualWord *) word)->getTarget()->getWhole();
 
     // If the target word is empty, we don't need to output anything.
     if (whole != L"") {
-      wstring wordTL = L"^" + whole + L"$";
-
       if (transferDefault == TD_CHUNK) {
-        if (wordTL[1] == L'*') {
-          defaultOutput += L"^unknown<unknown>{" + wordTL + L"}$";
+        if (whole[0] == L'*') {
+          writeOutput(L"^unknown<unknown>{^");
         } else {
-          defaultOutput += L"^default<default>{" + wordTL + L"}$";
+          writeOutput(L"^default<default>{^");
         }
+        writeOutput(whole);
+        writeOutput(L"$}$");
       } else {
-        defaultOutput += wordTL;
+        writeOutput(L"^");
+        writeOutput(whole);
+        writeOutput(L"$");
       }
     }
     break;
   }
   // For the interchunk stage only need to output the complete chunk.
   case INTERCHUNK: {
-    wstring whole = ((ChunkWord *) word)->getChunk()->getWhole();
-    defaultOutput += L"^" + whole + L"$";
+    writeOutput(L"^");
+    ((ChunkWord *) word)->getChunk()->writeWhole(getOutput());
+    writeOutput(L"$");
     break;
   }
   // Lastly, for the postchunk stage output the lexical units inside chunks
   // with the case of the chunk pseudolemma, without the { and }.
   case POSTCHUNK: {
-    wstring chcontent = ((ChunkWord *) word)->getChunk()->getPart(CHCONTENT);
-    defaultOutput += chcontent.substr(1, chcontent.size() - 2);
+    ((ChunkWord *) word)->writeContent(getOutput());
     break;
   }
   }
 
   // Output the trailing superblank of the matched pattern.
-  defaultOutput += getUniqueSuperblank(nextPattern);
-
-  writeOutput(defaultOutput);
+  writeOutput(getUniqueSuperblank(nextPattern));
 }
 
@@ -19,7 +19,9 @@
 #define VM_H_
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <iostream>
 
 #include "loader.h"
 #include "transfer_word.h"
@@ -28,6 +30,8 @@
 #include "call_stack.h"
 #include "system_trie.h"
 #include "interpreter.h"
+#include "rule_cache.h"
+#include "profiler.h"
 
 using namespace std;
 
@@ -62,13 +66,24 @@ public:
   void setInputFile(char *);
   void setOutputFile(char *);
   void setDebugMode();
+  void setEagerLoad(unsigned int);
+  void setOptimize(bool);
+  void setInline(unsigned int);
+  void setVerify();
+  void setRuleCache(unsigned int, bool);
+  void setProfile(char *);
+  bool setOpcodeStats(char *);
 
   void setCurrentCodeUnit(const TCALL &);
   void setPC(int);
 
-  void writeOutput(wstring);
+  void writeOutput(wstring_view);
+  wostream& getOutput();
 
   bool run();
+  bool emitBinary(char *);
+  bool saveSnapshot(char *);
+  bool emitNative(char *);
 
   void printCodeSection() const;
 
@@ -79,6 +94,12 @@ private:
   /// Store the default unit in the transfer.
   TRANSFER_DEFAULT transferDefault;
 
+  /// The header of the code file with the transfer stage and its options.
+  wstring transferHeader;
+
+  /// Name of the code file to use.
+  string codeFileName;
+
   /// Name of the input file to use.
   string inputFileName;
 
@@ -88,6 +109,58 @@ private:
   /// Store if the debug mode is active or not.
   bool debugMode;
 
+  /// If every rule and macro is loaded at startup instead of when called.
+  bool eagerLoad;
+
+  /// Number of threads used to load the code units in eager mode.
+  unsigned int eagerLoadThreads;
+
+  /** Once every code unit is loaded the code sections are frozen: they are
+   * only read, so they can be shared between threads. */
+  bool isCodeFrozen;
+
+  /// Optimizer of the rules and macros loaded, NULL if they aren't optimized.
+  Optimizer *optimizer;
+
+  /// If the instructions removed by the optimizer are shown after loading.
+  bool showOptimizerStats;
+
+  /// Maximum number of instructions of the macros inlined, 0 to not inline.
+  unsigned int maxInlinedMacroSize;
+
+  /// Number of calls to macros replaced by their code.
+  unsigned int numInlinedCalls;
+
+  /// If the code is verified once loaded, to run it without further checks.
+  bool verifyCode;
+
+  /// Maximum number of rule outputs cached, 0 to not cache them.
+  unsigned int ruleCacheSize;
+
+  /// If the use of the rule cache is shown once the input is processed.
+  bool showRuleCacheStats;
+
+  /// Cache of the output of the rules without effects, NULL if not used.
+  RuleCache *ruleCache;
+
+  /// The output of the current rule, while it's being stored for the cache.
+  wstring *outputCapture;
+
+  /// The output written by a rule whose output will be cached.
+  wstring capturedOutput;
+
+  /// Profiler of the rules and macros executed, NULL if they aren't profiled.
+  Profiler *profiler;
+
+  /// Name of the file where the profile is written as JSON.
+  string profileFileName;
+
+  /// Name of the file where the statistics of the opcodes are written.
+  string opcodeStatsFileName;
+
+  /// Number of the rule being executed.
+  int currentRuleNumber;
+
   /// Program counter: position of the next instruction to execute.
   unsigned int PC;
 
@@ -120,7 +193,7 @@ private:
   CodeSection macrosCode;
 
   /// Current code unit in execution (preprocessCode, a macro, a rule...).
-  CodeUnit *currentCodeUnit;
+  const CodeUnit *currentCodeUnit;
 
   /// The loader is set dynamically, depending on the code file's type.
   Loader *loader;
@@ -137,14 +210,18 @@ private:
   /// Store the index of the last superblank used to avoid outputting duplicates.
   int lastSuperblank;
 
-  /** The current words is a vector of indices of the words vector ordered by
-   * position in the current code unit.
+  /** The current words are the indices of the words vector ordered by
+   * position in the current code unit, pointing to the frame of the current
+   * call.
    * \code
    {Position in this vector and codeUnit: index of the word in the words vector}
    {0: Word2, 1: Word1, 2: Word5}
    * \endcode
    */
-  vector<int> currentWords;
+  const int *currentWords;
+
+  /// Number of current words.
+  unsigned int numCurrentWords;
 
   /// The index of the next input pattern to process.
   unsigned int nextPattern;
@@ -153,8 +230,15 @@ private:
   map<wstring, wstring> variables;
 
   void setLoader(const wstring &, char*);
+  void loadAllCodeUnits(unsigned int);
+  void printOptimizerStats() const;
+  void printRuleCacheStats() const;
+  void printProfile();
+  void executeRule();
+  wstring getRuleCacheKey() const;
   void setTransferStage(const wstring &);
   void tokenizeInput();
+  void initialize();
   void initializeVM();
   wstring getSourceWord(unsigned int);
   wstring getNextInputPattern();